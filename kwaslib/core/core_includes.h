@@ -6,6 +6,7 @@
 #include <kwaslib/core/crypto/crc32.h>
 #include <kwaslib/core/crypto/crc16.h>
 #include <kwaslib/core/crypto/crc8.h>
+#include <kwaslib/core/crypto/cri_key.h>
 
 #include <kwaslib/core/io/arg_parser.h>
 #include <kwaslib/core/io/date_utils.h>
@@ -19,6 +20,7 @@
 #include <kwaslib/core/math/boundary.h>
 #include <kwaslib/core/math/half.h>
 #include <kwaslib/core/math/vec.h>
+#include <kwaslib/core/math/audio_meter.h>
 
 #include <kwaslib/core/data/dbl_link_list.h>
 #include <kwaslib/core/data/cvector.h>
@@ -36,13 +36,15 @@ uint16_t crc16_calc_hash_bit_by_bit(const uint8_t* data, const uint64_t size,
                                     const uint16_t init, const uint16_t xorout,
                                     const uint8_t refin, const uint8_t refout);
 
+/*
+    CRC-16-UMTS with a lookup table, a byte at a time.
+*/
+uint16_t crc16_calc_hash_umts_table(const uint8_t* data, const uint64_t size);
+
 /*
     Quick way for calculating CRC-16-UMTS
 */
 static inline uint16_t crc16_encode_umts(const uint8_t* data, const uint64_t size)
 {
-    return crc16_calc_hash_bit_by_bit(data, size,
-                                      CRC16_UMTS_POLY,
-                                      CRC16_UMTS_INIT, CRC16_UMTS_XOROUT,
-                                      CRC16_UMTS_REFIN, CRC16_UMTS_REFOUT);
+    return crc16_calc_hash_umts_table(data, size);
 }
\ No newline at end of file
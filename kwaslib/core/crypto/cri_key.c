@@ -0,0 +1,78 @@
+#include "cri_key.h"
+
+#include <stdlib.h>
+
+uint64_t cri_key_scramble(const uint64_t keycode, const uint16_t subkey)
+{
+    const uint16_t inverted = (uint16_t)(~subkey + 2);
+    return keycode * (((uint64_t)subkey << 16) | inverted);
+}
+
+CRI_ADX_KEY cri_key_adx_type9(const uint64_t keycode, const uint16_t subkey)
+{
+    CRI_ADX_KEY key = {0};
+
+    /* 0 is never used by the encoder */
+    if(keycode == 0)
+    {
+        return key;
+    }
+
+    const uint64_t code = cri_key_scramble(keycode, subkey) - 1;
+    key.start = (code >> 27) & CRI_ADX_KEY_MASK;
+    key.mult = ((code >> 12) & 0x7FFC) | 1;
+    key.add = ((code << 1) & 0x7FFE) | 1;
+
+    return key;
+}
+
+uint8_t cri_key_adx_from_str(const char* str, CRI_ADX_KEY* key)
+{
+    char* end = NULL;
+    const uint64_t first = strtoull(str, &end, 0);
+
+    if(end == str)
+    {
+        return 0xFF;
+    }
+
+    /* Plain keycode */
+    if(*end == '\0')
+    {
+        *key = cri_key_adx_type9(first, 0);
+        return first ? 9 : 0;
+    }
+
+    if(*end != ':')
+    {
+        return 0xFF;
+    }
+
+    /* start:mult:add */
+    uint64_t parts[3] = {first, 0, 0};
+
+    for(uint32_t i = 1; i != 3; ++i)
+    {
+        const char* part = end + 1;
+        parts[i] = strtoull(part, &end, 0);
+
+        if((end == part) || (*end != ((i == 2) ? '\0' : ':')))
+        {
+            return 0xFF;
+        }
+    }
+
+    for(uint32_t i = 0; i != 3; ++i)
+    {
+        if(parts[i] > CRI_ADX_KEY_MASK)
+        {
+            return 0xFF;
+        }
+    }
+
+    key->start = parts[0];
+    key->mult = parts[1];
+    key->add = parts[2];
+
+    return (parts[0] | parts[1] | parts[2]) ? 8 : 0;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+    CRIWARE key handling, shared by HCA and ADX.
+
+    https://github.com/hozuki/libcgss/issues/4#issuecomment-429415659
+    https://blog.mottomo.moe/categories/Tech/RE/en/2018-10-12-New-HCA-Encryption/
+    https://github.com/vgmstream/vgmstream/blob/master/src/meta/adx.c
+*/
+
+/*
+    ADX encryption is a XOR stream over the frame scales.
+    Every frame takes the current value, which then steps to
+    (value*mult + add) & 0x7FFF. Values are always 15 bit.
+*/
+typedef struct
+{
+    uint16_t start;
+    uint16_t mult;
+    uint16_t add;
+} CRI_ADX_KEY;
+
+#define CRI_ADX_KEY_MASK        (uint16_t)(0x7FFF)
+
+/*
+    Implementation
+*/
+
+/*
+    Mixes a keycode with the subkey (AWB key) stored in an AWB header.
+    A subkey of 0 leaves the keycode as it is.
+
+    Returns the key to use for the files inside the AWB.
+*/
+uint64_t cri_key_scramble(const uint64_t keycode, const uint16_t subkey);
+
+/*
+    Derives the ADX type 9 XOR stream from a keycode, mixed with `subkey` first.
+    Keycode 0 means no encryption and gives an all-zero key.
+
+    Returns the XOR stream parameters.
+*/
+CRI_ADX_KEY cri_key_adx_type9(const uint64_t keycode, const uint16_t subkey);
+
+/*
+    Parses an ADX key written as a type 9 keycode (decimal or 0x hex)
+    or as type 8 `start:mult:add` triple, each part decimal or 0x hex.
+
+    Returns 9 or 8 on success, 0 if the key is zero and 0xFF if it can't be parsed.
+*/
+uint8_t cri_key_adx_from_str(const char* str, CRI_ADX_KEY* key);
+
+/*
+    Returns the XOR value of the next frame.
+*/
+static inline uint16_t cri_key_adx_next(const uint16_t value, const CRI_ADX_KEY* key)
+{
+    return (value*key->mult + key->add) & CRI_ADX_KEY_MASK;
+}
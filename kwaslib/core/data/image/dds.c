@@ -5,6 +5,8 @@
 #include <string.h>
 
 #include <kwaslib/core/io/type_readers.h>
+#include <kwaslib/core/io/type_writers.h>
+#include <kwaslib/core/data/image/s3tc.h>
 
 DDS_FILE* dds_header_from_data(const char* data)
 {
@@ -30,6 +32,129 @@ void dds_read_header(DDS_FILE* dds, const char* data)
     }
 }
 
+void dds_init_bcn(DDS_FILE* dds,
+                  const uint32_t width, const uint32_t height,
+                  const uint32_t mipmap_count,
+                  const char* fourcc, const uint32_t block_size)
+{
+    memset(dds, 0, sizeof(DDS_FILE));
+    memcpy(&dds->magic[0], "DDS ", 4);
+    
+    dds->header.size = 124;
+    dds->header.flags.data.caps = 1;
+    dds->header.flags.data.height = 1;
+    dds->header.flags.data.width = 1;
+    dds->header.flags.data.pixelformat = 1;
+    dds->header.flags.data.linearsize = 1;
+    dds->header.height = height;
+    dds->header.width = width;
+    dds->header.pitch_or_linear_size = dds_bcn_level_size(width, height, block_size);
+    
+    dds->header.pf.size = 32;
+    dds->header.pf.flags.data.fourcc = 1;
+    memcpy(&dds->header.pf.fourcc[0], fourcc, 4);
+    
+    dds->header.caps.data.texture = 1;
+    
+    if(mipmap_count > 1)
+    {
+        dds->header.flags.data.mipmapcount = 1;
+        dds->header.mipmap_count = mipmap_count;
+        dds->header.caps.data.complex = 1;
+        dds->header.caps.data.mipmap = 1;
+    }
+}
+
+void dds_write_header(const DDS_FILE* dds, uint8_t* out)
+{
+    const uint32_t* dds_int = (const uint32_t*)dds;
+    
+    for(uint32_t i = 0; i != DDS_FILE_HEADER_SIZE; i+=4)
+    {
+        tw_write_u32le(*dds_int, &out[i]);
+        dds_int += 1;
+    }
+}
+
+uint32_t dds_bcn_level_size(const uint32_t width, const uint32_t height, const uint32_t block_size)
+{
+    const uint32_t blocks_w = width ? (width+3)/4 : 1;
+    const uint32_t blocks_h = height ? (height+3)/4 : 1;
+    return blocks_w*blocks_h*block_size;
+}
+
+uint32_t dds_full_mip_count(const uint32_t width, const uint32_t height)
+{
+    uint32_t size = width > height ? width : height;
+    uint32_t count = 1;
+    
+    while(size > 1)
+    {
+        size >>= 1;
+        count += 1;
+    }
+    
+    return count;
+}
+
+DDS_FORMAT dds_get_format(const DDS_FILE* dds)
+{
+    const DDS_PIXELFORMAT* pf = &dds->header.pf;
+    
+    if(pf->flags.data.fourcc)
+    {
+        if(strncmp((const char*)&pf->fourcc[0], "DXT1", 4) == 0) return DDS_FORMAT_DXT1;
+        if(strncmp((const char*)&pf->fourcc[0], "DXT2", 4) == 0) return DDS_FORMAT_DXT3;
+        if(strncmp((const char*)&pf->fourcc[0], "DXT3", 4) == 0) return DDS_FORMAT_DXT3;
+        if(strncmp((const char*)&pf->fourcc[0], "DXT4", 4) == 0) return DDS_FORMAT_DXT5;
+        if(strncmp((const char*)&pf->fourcc[0], "DXT5", 4) == 0) return DDS_FORMAT_DXT5;
+        return DDS_FORMAT_UNKNOWN;
+    }
+    
+    if(pf->flags.data.rgb
+       && (pf->rgb_bit_count == 32)
+       && (pf->r_bitmask == 0x00FF0000)
+       && (pf->g_bitmask == 0x0000FF00)
+       && (pf->b_bitmask == 0x000000FF))
+    {
+        return DDS_FORMAT_A8R8G8B8;
+    }
+    
+    if((pf->flags.data.luminance || pf->flags.data.alpha)
+       && (pf->rgb_bit_count == 8))
+    {
+        return DDS_FORMAT_L8;
+    }
+    
+    return DDS_FORMAT_UNKNOWN;
+}
+
+uint32_t dds_get_mip_count(const DDS_FILE* dds)
+{
+    if(dds->header.flags.data.mipmapcount && dds->header.mipmap_count)
+    {
+        return dds->header.mipmap_count;
+    }
+    
+    return 1;
+}
+
+uint32_t dds_format_level_size(const DDS_FORMAT format, const uint32_t width, const uint32_t height)
+{
+    const uint32_t w = width ? width : 1;
+    const uint32_t h = height ? height : 1;
+    
+    switch(format)
+    {
+        case DDS_FORMAT_DXT1:       return dds_bcn_level_size(w, h, 8);
+        case DDS_FORMAT_DXT3:
+        case DDS_FORMAT_DXT5:       return dds_bcn_level_size(w, h, 16);
+        case DDS_FORMAT_A8R8G8B8:   return w*h*4;
+        case DDS_FORMAT_L8:         return w*h;
+        default:                    return 0;
+    }
+}
+
 void dds_print_info(DDS_FILE* dds)
 {
     printf("flags.caps:              %u\n", dds->header.flags.data.caps);
@@ -70,4 +195,106 @@ void dds_print_info(DDS_FILE* dds)
                                      dds->header.caps2.data.cubemap_negativey,
                                      dds->header.caps2.data.cubemap_positivez,
                                      dds->header.caps2.data.cubemap_negativez);
-}
\ No newline at end of file
+}
+
+/*
+    Halves the level, odd edges reuse their last row/column.
+*/
+static void dds_downsample_rgba(const uint8_t* src, const uint32_t width, const uint32_t height,
+                                uint8_t* dst, const uint32_t dst_width, const uint32_t dst_height)
+{
+    for(uint32_t y = 0; y != dst_height; ++y)
+    {
+        const uint32_t y0 = y*2;
+        const uint32_t y1 = (y0+1 < height) ? (y0+1) : y0;
+        
+        for(uint32_t x = 0; x != dst_width; ++x)
+        {
+            const uint32_t x0 = x*2;
+            const uint32_t x1 = (x0+1 < width) ? (x0+1) : x0;
+            
+            for(uint32_t c = 0; c != 4; ++c)
+            {
+                const uint32_t sum = src[(y0*width + x0)*4 + c] + src[(y0*width + x1)*4 + c]
+                                   + src[(y1*width + x0)*4 + c] + src[(y1*width + x1)*4 + c];
+                dst[(y*dst_width + x)*4 + c] = (sum + 2)/4;
+            }
+        }
+    }
+}
+
+uint8_t* dds_encode_rgba(const uint8_t* rgba, const uint32_t width, const uint32_t height,
+                         const uint8_t format, const uint8_t quality, const uint8_t mipmaps,
+                         const uint32_t thread_count, uint64_t* dds_size)
+{
+    const char* fourcc = NULL;
+    
+    switch(format)
+    {
+        case S3TC_FORMAT_DXT1: fourcc = "DXT1"; break;
+        case S3TC_FORMAT_DXT3: fourcc = "DXT3"; break;
+        case S3TC_FORMAT_DXT5: fourcc = "DXT5"; break;
+        case S3TC_FORMAT_BC4: fourcc = "ATI1"; break;
+        case S3TC_FORMAT_BC5: fourcc = "ATI2"; break;
+        default: return NULL;
+    }
+    
+    if((rgba == NULL) || (width == 0) || (height == 0)) return NULL;
+    
+    const uint32_t mip_count = mipmaps ? dds_full_mip_count(width, height) : 1;
+    const uint32_t block_size = s3tc_data_size(format, 4, 4);
+    uint64_t size = DDS_FILE_HEADER_SIZE;
+    
+    for(uint32_t i = 0; i != mip_count; ++i)
+    {
+        const uint32_t w = (width>>i) ? (width>>i) : 1;
+        const uint32_t h = (height>>i) ? (height>>i) : 1;
+        size += dds_bcn_level_size(w, h, block_size);
+    }
+    
+    uint8_t* dds_data = (uint8_t*)calloc(1, size);
+    uint8_t* level = NULL;
+    
+    if(dds_data == NULL) return NULL;
+    
+    DDS_FILE dds = {0};
+    dds_init_bcn(&dds, width, height, mip_count, fourcc, block_size);
+    dds_write_header(&dds, dds_data);
+    
+    const uint8_t* src = rgba;
+    uint64_t offset = DDS_FILE_HEADER_SIZE;
+    uint32_t w = width;
+    uint32_t h = height;
+    
+    for(uint32_t i = 0; i != mip_count; ++i)
+    {
+        if(i != 0)
+        {
+            const uint32_t next_w = (w>>1) ? (w>>1) : 1;
+            const uint32_t next_h = (h>>1) ? (h>>1) : 1;
+            uint8_t* next = (uint8_t*)malloc((uint64_t)next_w*next_h*4);
+            
+            if(next == NULL)
+            {
+                free(level);
+                free(dds_data);
+                return NULL;
+            }
+            
+            dds_downsample_rgba(src, w, h, next, next_w, next_h);
+            free(level);
+            level = next;
+            src = level;
+            w = next_w;
+            h = next_h;
+        }
+        
+        s3tc_encode_image(format, quality, src, w, h, w*4, &dds_data[offset], thread_count);
+        offset += dds_bcn_level_size(w, h, block_size);
+    }
+    
+    free(level);
+    
+    *dds_size = size;
+    return dds_data;
+}
@@ -6,6 +6,19 @@
 
 #include <stdint.h>
 
+#define DDS_FILE_HEADER_SIZE (uint32_t)(0x80) /* Magic and DDS_HEADER */
+
+/* Formats that can be converted to and from console textures */
+typedef enum
+{
+    DDS_FORMAT_UNKNOWN = 0,
+    DDS_FORMAT_DXT1,
+    DDS_FORMAT_DXT3,
+    DDS_FORMAT_DXT5,
+    DDS_FORMAT_A8R8G8B8,    /* BGRA in memory */
+    DDS_FORMAT_L8
+} DDS_FORMAT;
+
 typedef union
 {
     struct
@@ -130,4 +143,56 @@ typedef struct
 
 DDS_FILE* dds_header_from_data(const char* data);
 void dds_read_header(DDS_FILE* dds, const char* data);
-void dds_print_info(DDS_FILE* dds);
\ No newline at end of file
+void dds_print_info(DDS_FILE* dds);
+
+/*
+    Fills `dds` for a block compressed 2D texture.
+    `fourcc` is one of "DXT1", "DXT3", "DXT5" etc.
+    `block_size` is the size of a 4x4 block in bytes.
+*/
+void dds_init_bcn(DDS_FILE* dds,
+                  const uint32_t width, const uint32_t height,
+                  const uint32_t mipmap_count,
+                  const char* fourcc, const uint32_t block_size);
+
+/*
+    Writes `dds` to `out` as DDS_FILE_HEADER_SIZE bytes.
+*/
+void dds_write_header(const DDS_FILE* dds, uint8_t* out);
+
+/*
+    Returns the size of a block compressed surface in bytes.
+*/
+uint32_t dds_bcn_level_size(const uint32_t width, const uint32_t height, const uint32_t block_size);
+
+/*
+    Returns the amount of levels in a full mip chain down to 1x1.
+*/
+uint32_t dds_full_mip_count(const uint32_t width, const uint32_t height);
+
+/*
+    Returns the format of the texture; DDS_FORMAT_UNKNOWN if it's not one of DDS_FORMAT.
+*/
+DDS_FORMAT dds_get_format(const DDS_FILE* dds);
+
+/*
+    Returns the amount of levels stored in the file, at least 1.
+*/
+uint32_t dds_get_mip_count(const DDS_FILE* dds);
+
+/*
+    Returns the size of a `width`x`height` surface of `format` in bytes.
+*/
+uint32_t dds_format_level_size(const DDS_FORMAT format, const uint32_t width, const uint32_t height);
+
+/*
+    Encodes `width`x`height` RGBA8 pixels to a DDS of S3TC_FORMAT_* `format`
+    with s3tc_encode_image() and `quality`, see s3tc.h.
+    With `mipmaps` set, the full chain down to 1x1 is generated with a 2x2 box filter.
+    Blocks are encoded on `thread_count` threads (TP_THREADS_AUTO for all cores).
+    
+    Returns a pointer to the DDS file and its size in `dds_size`; NULL on error.
+*/
+uint8_t* dds_encode_rgba(const uint8_t* rgba, const uint32_t width, const uint32_t height,
+                         const uint8_t format, const uint8_t quality, const uint8_t mipmaps,
+                         const uint32_t thread_count, uint64_t* dds_size);
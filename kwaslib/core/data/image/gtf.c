@@ -6,6 +6,9 @@
 #include <string.h>
 
 #include <kwaslib/core/data/image/s3tc.h>
+#include <kwaslib/core/data/image/dds.h>
+#include <kwaslib/core/io/type_writers.h>
+#include <kwaslib/core/thread/thread_pool.h>
 
 GTF_FILE gtf_read_file(FU_FILE* gtf)
 {
@@ -37,6 +40,30 @@ GTF_FILE gtf_read_file(FU_FILE* gtf)
 	return header;
 }
 
+void gtf_write_header(const GTF_FILE* gtf, uint8_t* out)
+{
+	memset(out, 0, GTF_HEADER_SIZE);
+	
+	tw_write_u32be(gtf->version, &out[0x00]);
+	tw_write_u32be(gtf->texture_size, &out[0x04]);
+	tw_write_u32be(gtf->texture_count, &out[0x08]);
+	
+	tw_write_u32be(gtf->info.index, &out[0x0C]);
+	tw_write_u32be(gtf->info.offset, &out[0x10]);
+	tw_write_u32be(gtf->info.size, &out[0x14]);
+	
+	out[0x18] = gtf->info.tex.pf;
+	out[0x19] = gtf->info.tex.mipmaps;
+	out[0x1A] = gtf->info.tex.dimension;
+	out[0x1B] = gtf->info.tex.unk_1;
+	tw_write_u32be(gtf->info.tex.remaps, &out[0x1C]);
+	tw_write_u16be(gtf->info.tex.width, &out[0x20]);
+	tw_write_u16be(gtf->info.tex.height, &out[0x22]);
+	tw_write_u16be(gtf->info.tex.depth, &out[0x24]);
+	tw_write_u16be(gtf->info.tex.unk_2, &out[0x26]);
+	memcpy(&out[0x28], &gtf->info.tex.pad[0], 88);
+}
+
 IMAGE* gtf_to_image(const GTF_FILE* gtf)
 {
 	uint8_t fmt = FMT_RGBA;
@@ -70,66 +97,188 @@ IMAGE* gtf_to_image(const GTF_FILE* gtf)
 	/*
 		S3TC compressed textures
 	*/
-	IMAGE* img = img_create_blank_image(width, height, fmt);
-	IMAGE* block = img_create_blank_image(4, 4, fmt);
+	uint8_t s3tc_fmt = 0;
+	
+	switch(gtf_fmt)
+	{
+		case GTF_TEX_DXT1: s3tc_fmt = S3TC_FORMAT_DXT1; break;
+		case GTF_TEX_DXT3: s3tc_fmt = S3TC_FORMAT_DXT3; break;
+		case GTF_TEX_DXT5: s3tc_fmt = S3TC_FORMAT_DXT5; break;
+		default:
+			printf("Unknown gtf pixel format: 0x%02x\n", gtf_fmt);
+			return NULL;
+	}
+	
+	uint8_t* rgba = malloc((uint64_t)width*height*4);
+	s3tc_decode_image(s3tc_fmt, &gtf->data[0], width, height, rgba, width*4, TP_THREADS_AUTO);
+	IMAGE* img = img_load_from_data(width, height, rgba, FMT_RGBA);
+	free(rgba);
+	
+	/* DXT1 has no alpha, RGB sits in the same place of PIXEL */
+	if((img != NULL) && (fmt == FMT_RGB))
+	{
+		img->fmt = FMT_RGB;
+		img->bpp = FMT_RGB_BPP;
+	}
+	
+	return img;
+}
+
+uint8_t* gtf_to_dds(const GTF_FILE* gtf, uint64_t* dds_size)
+{
+	if(gtf->data == NULL) return NULL;
+	
+	const char* fourcc = NULL;
+	uint32_t block_size = 0;
+	
+	switch(gtf->info.tex.pf)
+	{
+		case GTF_TEX_DXT1: fourcc = "DXT1"; block_size = 8; break;
+		case GTF_TEX_DXT3: fourcc = "DXT3"; block_size = 16; break;
+		case GTF_TEX_DXT5: fourcc = "DXT5"; block_size = 16; break;
+		default: return NULL;
+	}
+	
+	const uint16_t width = gtf->info.tex.width;
+	const uint16_t height = gtf->info.tex.height;
+	
+	uint32_t mip_count = gtf->info.tex.mipmaps ? gtf->info.tex.mipmaps : 1;
+	const uint32_t full_count = dds_full_mip_count(width, height);
+	if(mip_count > full_count) mip_count = full_count;
+	
+	/* Levels follow each other, cut the chain where the data ends */
+	uint64_t data_size = 0;
+	
+	for(uint32_t i = 0; i != mip_count; ++i)
+	{
+		const uint32_t level_size = dds_bcn_level_size(width>>i, height>>i, block_size);
+		
+		if((i != 0) && ((data_size + level_size) > gtf->info.size))
+		{
+			mip_count = i;
+			break;
+		}
+		
+		data_size += level_size;
+	}
+	
+	const uint64_t copy_size = data_size < gtf->info.size ? data_size : gtf->info.size;
 	
-	uint8_t pixel_buf[64] = {0};
-	uint32_t data_it = 0;
+	uint8_t* out = (uint8_t*)calloc(1, DDS_FILE_HEADER_SIZE + data_size);
+	if(out == NULL) return NULL;
 	
-	for(uint32_t y = 0; y != height; y+=4)
+	DDS_FILE dds = {0};
+	dds_init_bcn(&dds, width, height, mip_count, fourcc, block_size);
+	dds_write_header(&dds, out);
+	memcpy(&out[DDS_FILE_HEADER_SIZE], gtf->data, copy_size);
+	
+	*dds_size = DDS_FILE_HEADER_SIZE + data_size;
+	return out;
+}
+
+uint8_t* gtf_from_dds(const uint8_t* dds_data, const uint64_t dds_size, uint64_t* gtf_size)
+{
+	if((dds_data == NULL) || (dds_size < DDS_FILE_HEADER_SIZE)) return NULL;
+	
+	DDS_FILE* dds = dds_header_from_data((const char*)dds_data);
+	if(dds == NULL) return NULL;
+	
+	const DDS_FORMAT dds_fmt = dds_get_format(dds);
+	const uint32_t width = dds->header.width;
+	const uint32_t height = dds->header.height;
+	uint32_t mip_count = dds_get_mip_count(dds);
+	free(dds);
+	
+	if((width == 0) || (height == 0) || (width > 0xFFFF) || (height > 0xFFFF)) return NULL;
+	
+	GTF_PIXELFORMAT pf = 0;
+	uint8_t swizzled = 0;
+	
+	switch(dds_fmt)
 	{
-		for(uint32_t x = 0; x != width; x+=4)
+		case DDS_FORMAT_DXT1:		pf = GTF_TEX_DXT1; break;
+		case DDS_FORMAT_DXT3:		pf = GTF_TEX_DXT3; break;
+		case DDS_FORMAT_DXT5:		pf = GTF_TEX_DXT5; break;
+		case DDS_FORMAT_A8R8G8B8:	pf = GTF_TEX_A8R8G8B8; swizzled = 1; break;
+		case DDS_FORMAT_L8:			pf = GTF_TEX_GRAY8; swizzled = 1; break;
+		default: return NULL;
+	}
+	
+	/* Swizzling only works on power of two textures */
+	if(swizzled && ((width & (width-1)) || (height & (height-1)))) return NULL;
+	
+	const uint32_t full_count = dds_full_mip_count(width, height);
+	if(mip_count > full_count) mip_count = full_count;
+	
+	uint64_t data_size = 0;
+	
+	for(uint32_t i = 0; i != mip_count; ++i)
+	{
+		data_size += dds_format_level_size(dds_fmt, width>>i, height>>i);
+	}
+	
+	if((DDS_FILE_HEADER_SIZE + data_size) > dds_size) return NULL;
+	
+	uint8_t* out = (uint8_t*)calloc(1, GTF_HEADER_SIZE + data_size);
+	if(out == NULL) return NULL;
+	
+	GTF_FILE gtf = {0};
+	gtf.version = GTF_VERSION;
+	gtf.texture_size = data_size;
+	gtf.texture_count = 1;
+	gtf.info.offset = GTF_HEADER_SIZE;
+	gtf.info.size = data_size;
+	gtf.info.tex.pf = pf;
+	gtf.info.tex.mipmaps = mip_count;
+	gtf.info.tex.dimension = 2;
+	gtf.info.tex.remaps = GTF_REMAP_DEFAULT;
+	gtf.info.tex.width = width;
+	gtf.info.tex.height = height;
+	gtf.info.tex.depth = 1;
+	gtf_write_header(&gtf, out);
+	
+	const uint8_t* src = &dds_data[DDS_FILE_HEADER_SIZE];
+	uint8_t* dst = &out[GTF_HEADER_SIZE];
+	
+	if(swizzled == 0) /* RSX reads compressed textures linearly */
+	{
+		memcpy(dst, src, data_size);
+	}
+	else
+	{
+		for(uint32_t i = 0; i != mip_count; ++i)
 		{
-			switch(gtf_fmt)
+			const uint16_t level_w = width>>i ? width>>i : 1;
+			const uint16_t level_h = height>>i ? height>>i : 1;
+			const uint32_t level_size = dds_format_level_size(dds_fmt, level_w, level_h);
+			
+			if(pf == GTF_TEX_GRAY8)
 			{
-				case GTF_TEX_DXT1:
-					s3tc_decode_dxt1_block(&gtf->data[data_it], &pixel_buf[0]);
-					data_it += 8;
-					
-					for(uint8_t i = 0; i != 16; ++i)
-					{
-						block->data[i].rgb.r = pixel_buf[i*3];
-						block->data[i].rgb.g = pixel_buf[i*3+1];
-						block->data[i].rgb.b = pixel_buf[i*3+2];
-					}
-					break;
-				case GTF_TEX_DXT3:
-					s3tc_decode_dxt3_block(&gtf->data[data_it], &pixel_buf[0]);
-					data_it += 16;
-					
-					for(uint8_t i = 0; i != 16; ++i)
-					{
-						block->data[i].rgba.r = pixel_buf[i*4];
-						block->data[i].rgba.g = pixel_buf[i*4+1];
-						block->data[i].rgba.b = pixel_buf[i*4+2];
-						block->data[i].rgba.a = pixel_buf[i*4+3];
-					}
-					break;
-				case GTF_TEX_DXT5:
-					s3tc_decode_dxt5_block(&gtf->data[data_it], &pixel_buf[0]);
-					data_it += 16;
-					
-					for(uint8_t i = 0; i != 16; ++i)
-					{
-						block->data[i].rgba.r = pixel_buf[i*4];
-						block->data[i].rgba.g = pixel_buf[i*4+1];
-						block->data[i].rgba.b = pixel_buf[i*4+2];
-						block->data[i].rgba.a = pixel_buf[i*4+3];
-					}
-					break;
-				default:
-					printf("Unknown gtf pixel format: 0x%02x\n", gtf_fmt);
-					img_free_image(block);
-					img_free_image(img);
-					return NULL;
+				gtf_linear_to_swizzle_gray(src, dst, level_w, level_h);
+			}
+			else
+			{
+				gtf_linear_to_swizzle_argb(src, dst, level_w, level_h);
+				
+				/* BGRA in DDS, ARGB on RSX */
+				for(uint32_t j = 0; j != level_size; j += 4)
+				{
+					const uint8_t b = dst[j];
+					const uint8_t g = dst[j+1];
+					dst[j] = dst[j+3];
+					dst[j+1] = dst[j+2];
+					dst[j+2] = g;
+					dst[j+3] = b;
+				}
 			}
 			
-			img_draw_on_image(img, block, x, y);
+			src += level_size;
+			dst += level_size;
 		}
 	}
-
-	img_free_image(block);
-	return img;
+	
+	*gtf_size = GTF_HEADER_SIZE + data_size;
+	return out;
 }
 
 void gtf_free(GTF_FILE* gtf)
@@ -245,4 +394,89 @@ void gtf_swizzle_to_linear_argb(const uint8_t* input, uint8_t* output, const uin
 			offs_x0 += y_incr;
 		}
 	}
-}
\ No newline at end of file
+}
+
+/*
+	Same walk as gtf_swizzle_to_linear_*, split so that
+	the swizzled position of a texel is `x_offsets[x] + y_offsets[y]`.
+*/
+static void gtf_swizzle_offsets(const uint16_t width, const uint16_t height, uint32_t* x_offsets, uint32_t* y_offsets)
+{
+	const uint32_t l2w = (uint32_t)gtf_log2(width);
+	const uint32_t l2h = (uint32_t)gtf_log2(height);
+	
+	uint32_t x_mask = 0x55555555;
+	uint32_t y_mask = 0xAAAAAAAA;
+	
+	uint32_t limit_mask = l2w < l2h ? l2w : l2h;
+	limit_mask = 1 << (limit_mask << 1);
+
+	x_mask = (x_mask | ~(limit_mask - 1));
+	y_mask = (y_mask & (limit_mask - 1));
+	
+	uint32_t offs_x = 0;
+	
+	for(uint32_t x = 0; x != width; ++x)
+	{
+		x_offsets[x] = offs_x;
+		offs_x = (offs_x - x_mask) & x_mask;
+	}
+	
+	uint32_t offs_y = 0;
+	uint32_t offs_x0 = 0;
+	
+	for(uint32_t y = 0; y != height; ++y)
+	{
+		y_offsets[y] = offs_y + offs_x0;
+		offs_y = (offs_y - y_mask) & y_mask;
+		
+		if(offs_y == 0)
+		{
+			offs_x0 += limit_mask;
+		}
+	}
+}
+
+void gtf_linear_to_swizzle_gray(const uint8_t* input, uint8_t* output, const uint16_t width, const uint16_t height)
+{
+	uint32_t* x_offsets = (uint32_t*)malloc(sizeof(uint32_t)*(width + height));
+	if(x_offsets == NULL) return;
+	uint32_t* y_offsets = &x_offsets[width];
+	
+	gtf_swizzle_offsets(width, height, x_offsets, y_offsets);
+	
+	for(uint32_t y = 0; y != height; ++y)
+	{
+		const uint8_t* src = &input[y*width];
+		uint8_t* dst = &output[y_offsets[y]];
+		
+		for(uint32_t x = 0; x != width; ++x)
+		{
+			dst[x_offsets[x]] = src[x];
+		}
+	}
+	
+	free(x_offsets);
+}
+
+void gtf_linear_to_swizzle_argb(const uint8_t* input, uint8_t* output, const uint16_t width, const uint16_t height)
+{
+	uint32_t* x_offsets = (uint32_t*)malloc(sizeof(uint32_t)*(width + height));
+	if(x_offsets == NULL) return;
+	uint32_t* y_offsets = &x_offsets[width];
+	
+	gtf_swizzle_offsets(width, height, x_offsets, y_offsets);
+	
+	for(uint32_t y = 0; y != height; ++y)
+	{
+		const uint8_t* src = &input[y*width*4];
+		uint8_t* dst = &output[y_offsets[y]*4];
+		
+		for(uint32_t x = 0; x != width; ++x)
+		{
+			memcpy(&dst[x_offsets[x]*4], &src[x*4], 4);
+		}
+	}
+	
+	free(x_offsets);
+}
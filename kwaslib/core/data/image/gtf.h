@@ -16,6 +16,10 @@
 	https://demonstrations.wolfram.com/ComparingXYCurvesAndZOrderCurvesForTextureCoding/
 */
 
+#define GTF_HEADER_SIZE (uint32_t)(0x80)
+#define GTF_VERSION (uint32_t)(0x02020000)
+#define GTF_REMAP_DEFAULT (uint32_t)(0xAAE4)
+
 typedef enum
 {
 	GTF_TEX_GRAY8 = 0x81,
@@ -58,8 +62,34 @@ typedef struct
 } GTF_FILE;
 
 GTF_FILE gtf_read_file(FU_FILE* gtf);
+
+/*
+	Writes the header of `gtf` to `out` as GTF_HEADER_SIZE bytes.
+*/
+void gtf_write_header(const GTF_FILE* gtf, uint8_t* out);
 IMAGE* gtf_to_image(const GTF_FILE* gtf);
 
+/*
+	Rewrites a DXT1/DXT3/DXT5 texture as a DDS file, along with its mip chain.
+	RSX keeps compressed textures in linear block order,
+	so levels are copied as they are, pixels are never decoded.
+	Mips that would be read past the texture data are left out of the chain.
+	
+	Returns a pointer to `dds_size` bytes of DDS file;
+	NULL if the texture is not DXT.
+*/
+uint8_t* gtf_to_dds(const GTF_FILE* gtf, uint64_t* dds_size);
+
+/*
+	Builds a GTF file with its mip chain from a DDS file.
+	DXT1/DXT3/DXT5 are stored as they are,
+	A8R8G8B8 and L8 are swizzled and need power of two dimensions.
+	
+	Returns a pointer to `gtf_size` bytes of GTF file;
+	NULL if the format is not supported or the file is too short.
+*/
+uint8_t* gtf_from_dds(const uint8_t* dds_data, const uint64_t dds_size, uint64_t* gtf_size);
+
 void gtf_free(GTF_FILE* gtf);
 
 /*
@@ -74,4 +104,11 @@ const double gtf_log2(const double v);
 	https://github.com/RPCS3/rpcs3/blob/master/rpcs3/Emu/RSX/rsx_utils.h#L371
 */
 void gtf_swizzle_to_linear_gray(const uint8_t* input, uint8_t* output, const uint16_t width, const uint16_t height);
-void gtf_swizzle_to_linear_argb(const uint8_t* input, uint8_t* output, const uint16_t width, const uint16_t height);
\ No newline at end of file
+void gtf_swizzle_to_linear_argb(const uint8_t* input, uint8_t* output, const uint16_t width, const uint16_t height);
+
+/*
+	Inverse of gtf_swizzle_to_linear_*.
+	Offsets are computed once per row and column, so a texel costs one table lookup each.
+*/
+void gtf_linear_to_swizzle_gray(const uint8_t* input, uint8_t* output, const uint16_t width, const uint16_t height);
+void gtf_linear_to_swizzle_argb(const uint8_t* input, uint8_t* output, const uint16_t width, const uint16_t height);
@@ -1,5 +1,19 @@
 #include "s3tc.h"
 
+#include <string.h>
+#include <math.h>
+
+#include <kwaslib/core/io/file_utils.h>
+#include <kwaslib/core/io/type_readers.h>
+#include <kwaslib/core/io/type_writers.h>
+#include <kwaslib/core/thread/thread_pool.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 /*
 	Converts 16-bit RGB565 to 24-bit RGB values.
 	`out` is expected to be pre-allicated and able to hold 3 bytes.
@@ -184,4 +198,933 @@ void s3tc_decode_dxt5_alpha_chunk(const uint8_t* chunk, uint8_t* out)
 		const uint8_t index = (alut>>(16+(i*3)))&0x07;
 		out[i] = a[index];
 	}
-}
\ No newline at end of file
+}
+
+/*
+	Vectors of 4 32-bit lanes for the image decoders.
+	Every operation has an SSE2, NEON and plain C version,
+	the decoder itself is written once on top of them.
+	Channel values never go past 16 bits, so signed compares
+	and the 16-bit multiplies in s3tc_vec_div3() and s3tc_vec_mul16()
+	are fine. s3tc_vec_mul16() also needs both values under 0x8000.
+*/
+#if defined(__SSE2__)
+
+typedef __m128i S3TC_VEC;
+
+static inline S3TC_VEC s3tc_vec_load(const uint32_t* src) { return _mm_loadu_si128((const __m128i*)src); }
+static inline S3TC_VEC s3tc_vec_set1(const uint32_t v) { return _mm_set1_epi32(v); }
+static inline void s3tc_vec_store(uint8_t* dst, const S3TC_VEC v) { _mm_storeu_si128((__m128i*)dst, v); }
+static inline S3TC_VEC s3tc_vec_add(const S3TC_VEC a, const S3TC_VEC b) { return _mm_add_epi32(a, b); }
+static inline S3TC_VEC s3tc_vec_sub(const S3TC_VEC a, const S3TC_VEC b) { return _mm_sub_epi32(a, b); }
+static inline S3TC_VEC s3tc_vec_mul16(const S3TC_VEC a, const S3TC_VEC b) { return _mm_madd_epi16(a, b); }
+static inline S3TC_VEC s3tc_vec_and(const S3TC_VEC a, const S3TC_VEC b) { return _mm_and_si128(a, b); }
+static inline S3TC_VEC s3tc_vec_or(const S3TC_VEC a, const S3TC_VEC b) { return _mm_or_si128(a, b); }
+static inline S3TC_VEC s3tc_vec_xor(const S3TC_VEC a, const S3TC_VEC b) { return _mm_xor_si128(a, b); }
+static inline S3TC_VEC s3tc_vec_cmpeq(const S3TC_VEC a, const S3TC_VEC b) { return _mm_cmpeq_epi32(a, b); }
+static inline S3TC_VEC s3tc_vec_cmpgt(const S3TC_VEC a, const S3TC_VEC b) { return _mm_cmpgt_epi32(a, b); }
+static inline S3TC_VEC s3tc_vec_shl(const S3TC_VEC a, const int n) { return _mm_slli_epi32(a, n); }
+static inline S3TC_VEC s3tc_vec_shr(const S3TC_VEC a, const int n) { return _mm_srli_epi32(a, n); }
+static inline S3TC_VEC s3tc_vec_div3(const S3TC_VEC a) { return _mm_mulhi_epu16(a, _mm_set1_epi32(21846)); }
+
+#elif defined(__ARM_NEON)
+
+typedef uint32x4_t S3TC_VEC;
+
+static inline S3TC_VEC s3tc_vec_load(const uint32_t* src) { return vld1q_u32(src); }
+static inline S3TC_VEC s3tc_vec_set1(const uint32_t v) { return vdupq_n_u32(v); }
+static inline void s3tc_vec_store(uint8_t* dst, const S3TC_VEC v) { vst1q_u8(dst, vreinterpretq_u8_u32(v)); }
+static inline S3TC_VEC s3tc_vec_add(const S3TC_VEC a, const S3TC_VEC b) { return vaddq_u32(a, b); }
+static inline S3TC_VEC s3tc_vec_sub(const S3TC_VEC a, const S3TC_VEC b) { return vsubq_u32(a, b); }
+static inline S3TC_VEC s3tc_vec_mul16(const S3TC_VEC a, const S3TC_VEC b) { return vmulq_u32(a, b); }
+static inline S3TC_VEC s3tc_vec_and(const S3TC_VEC a, const S3TC_VEC b) { return vandq_u32(a, b); }
+static inline S3TC_VEC s3tc_vec_or(const S3TC_VEC a, const S3TC_VEC b) { return vorrq_u32(a, b); }
+static inline S3TC_VEC s3tc_vec_xor(const S3TC_VEC a, const S3TC_VEC b) { return veorq_u32(a, b); }
+static inline S3TC_VEC s3tc_vec_cmpeq(const S3TC_VEC a, const S3TC_VEC b) { return vceqq_u32(a, b); }
+static inline S3TC_VEC s3tc_vec_cmpgt(const S3TC_VEC a, const S3TC_VEC b) { return vcgtq_u32(a, b); }
+static inline S3TC_VEC s3tc_vec_shl(const S3TC_VEC a, const int n) { return vshlq_u32(a, vdupq_n_s32(n)); }
+static inline S3TC_VEC s3tc_vec_shr(const S3TC_VEC a, const int n) { return vshlq_u32(a, vdupq_n_s32(-n)); }
+static inline S3TC_VEC s3tc_vec_div3(const S3TC_VEC a) { return vshrq_n_u32(vmulq_n_u32(a, 21846), 16); }
+
+#else
+
+typedef struct
+{
+	uint32_t v[4];
+} S3TC_VEC;
+
+#define S3TC_VEC_OP(expr) S3TC_VEC r; for(uint8_t i = 0; i != 4; ++i) r.v[i] = (expr); return r;
+
+static inline S3TC_VEC s3tc_vec_load(const uint32_t* src) { S3TC_VEC_OP(src[i]) }
+static inline S3TC_VEC s3tc_vec_set1(const uint32_t v) { S3TC_VEC_OP(v) }
+static inline void s3tc_vec_store(uint8_t* dst, const S3TC_VEC v) { memcpy(dst, &v.v[0], 16); }
+static inline S3TC_VEC s3tc_vec_add(const S3TC_VEC a, const S3TC_VEC b) { S3TC_VEC_OP(a.v[i] + b.v[i]) }
+static inline S3TC_VEC s3tc_vec_sub(const S3TC_VEC a, const S3TC_VEC b) { S3TC_VEC_OP(a.v[i] - b.v[i]) }
+static inline S3TC_VEC s3tc_vec_mul16(const S3TC_VEC a, const S3TC_VEC b) { S3TC_VEC_OP(a.v[i] * b.v[i]) }
+static inline S3TC_VEC s3tc_vec_and(const S3TC_VEC a, const S3TC_VEC b) { S3TC_VEC_OP(a.v[i] & b.v[i]) }
+static inline S3TC_VEC s3tc_vec_or(const S3TC_VEC a, const S3TC_VEC b) { S3TC_VEC_OP(a.v[i] | b.v[i]) }
+static inline S3TC_VEC s3tc_vec_xor(const S3TC_VEC a, const S3TC_VEC b) { S3TC_VEC_OP(a.v[i] ^ b.v[i]) }
+static inline S3TC_VEC s3tc_vec_cmpeq(const S3TC_VEC a, const S3TC_VEC b) { S3TC_VEC_OP(a.v[i] == b.v[i] ? 0xFFFFFFFF : 0) }
+static inline S3TC_VEC s3tc_vec_cmpgt(const S3TC_VEC a, const S3TC_VEC b) { S3TC_VEC_OP(a.v[i] > b.v[i] ? 0xFFFFFFFF : 0) }
+static inline S3TC_VEC s3tc_vec_shl(const S3TC_VEC a, const int n) { S3TC_VEC_OP(a.v[i] << n) }
+static inline S3TC_VEC s3tc_vec_shr(const S3TC_VEC a, const int n) { S3TC_VEC_OP(a.v[i] >> n) }
+static inline S3TC_VEC s3tc_vec_div3(const S3TC_VEC a) { S3TC_VEC_OP(a.v[i]/3) }
+
+#undef S3TC_VEC_OP
+
+#endif
+
+/* Packs channels to RGBA8 as it lies in memory on little endian */
+static inline S3TC_VEC s3tc_vec_pack(const S3TC_VEC r, const S3TC_VEC g, const S3TC_VEC b)
+{
+	return s3tc_vec_or(s3tc_vec_or(r, s3tc_vec_shl(g, 8)), s3tc_vec_shl(b, 16));
+}
+
+/* |a - b| */
+static inline S3TC_VEC s3tc_vec_absdiff(const S3TC_VEC a, const S3TC_VEC b)
+{
+	const S3TC_VEC neg = s3tc_vec_cmpgt(b, a);
+	const S3TC_VEC d = s3tc_vec_sub(a, b);
+	return s3tc_vec_sub(s3tc_vec_xor(d, neg), neg);
+}
+
+/* a where mask is set, b elsewhere */
+static inline S3TC_VEC s3tc_vec_select(const S3TC_VEC mask, const S3TC_VEC a, const S3TC_VEC b)
+{
+	return s3tc_vec_xor(b, s3tc_vec_and(mask, s3tc_vec_xor(a, b)));
+}
+
+/*
+	Color palettes of 4 blocks from their c0 and c1.
+	DXT1 switches to 3 colors and transparent black per block when c0 <= c1.
+	`pal` is indexed [color][block].
+*/
+static void s3tc_build_palettes(const uint32_t* c0, const uint32_t* c1,
+								const uint8_t dxt1, uint32_t pal[4][4])
+{
+	const S3TC_VEC v0 = s3tc_vec_load(c0);
+	const S3TC_VEC v1 = s3tc_vec_load(c1);
+	const S3TC_VEC mask5 = s3tc_vec_set1(0xF8);
+	const S3TC_VEC mask6 = s3tc_vec_set1(0xFC);
+
+	/* Same as s3tc_rgb565_to_rgb() */
+	const S3TC_VEC r0 = s3tc_vec_and(s3tc_vec_shr(v0, 8), mask5);
+	const S3TC_VEC g0 = s3tc_vec_and(s3tc_vec_shr(v0, 3), mask6);
+	const S3TC_VEC b0 = s3tc_vec_and(s3tc_vec_shl(v0, 3), mask5);
+	const S3TC_VEC r1 = s3tc_vec_and(s3tc_vec_shr(v1, 8), mask5);
+	const S3TC_VEC g1 = s3tc_vec_and(s3tc_vec_shr(v1, 3), mask6);
+	const S3TC_VEC b1 = s3tc_vec_and(s3tc_vec_shl(v1, 3), mask5);
+	
+	S3TC_VEC p0 = s3tc_vec_pack(r0, g0, b0);
+	S3TC_VEC p1 = s3tc_vec_pack(r1, g1, b1);
+	S3TC_VEC p2 = s3tc_vec_pack(s3tc_vec_div3(s3tc_vec_add(s3tc_vec_add(r0, r0), r1)),
+								s3tc_vec_div3(s3tc_vec_add(s3tc_vec_add(g0, g0), g1)),
+								s3tc_vec_div3(s3tc_vec_add(s3tc_vec_add(b0, b0), b1)));
+	S3TC_VEC p3 = s3tc_vec_pack(s3tc_vec_div3(s3tc_vec_add(s3tc_vec_add(r1, r1), r0)),
+								s3tc_vec_div3(s3tc_vec_add(s3tc_vec_add(g1, g1), g0)),
+								s3tc_vec_div3(s3tc_vec_add(s3tc_vec_add(b1, b1), b0)));
+	
+	if(dxt1)
+	{
+		const S3TC_VEC alpha = s3tc_vec_set1(0xFF000000);
+		const S3TC_VEC four = s3tc_vec_cmpgt(v0, v1);
+		const S3TC_VEC half = s3tc_vec_pack(s3tc_vec_shr(s3tc_vec_add(r0, r1), 1),
+											s3tc_vec_shr(s3tc_vec_add(g0, g1), 1),
+											s3tc_vec_shr(s3tc_vec_add(b0, b1), 1));
+		
+		p0 = s3tc_vec_or(p0, alpha);
+		p1 = s3tc_vec_or(p1, alpha);
+		p2 = s3tc_vec_or(s3tc_vec_select(four, p2, half), alpha);
+		p3 = s3tc_vec_and(four, s3tc_vec_or(p3, alpha));
+	}
+	
+	s3tc_vec_store((uint8_t*)&pal[0][0], p0);
+	s3tc_vec_store((uint8_t*)&pal[1][0], p1);
+	s3tc_vec_store((uint8_t*)&pal[2][0], p2);
+	s3tc_vec_store((uint8_t*)&pal[3][0], p3);
+}
+
+/*
+	Expands 4 2-bit indices from `bits` to colors.
+	`d1`-`d3` are the colors 1-3 xored with `p0`.
+*/
+static inline S3TC_VEC s3tc_expand_row(const uint32_t bits, const S3TC_VEC p0,
+									   const S3TC_VEC d1, const S3TC_VEC d2, const S3TC_VEC d3)
+{
+	static const uint32_t ones[4] = {1, 1<<2, 1<<4, 1<<6};
+	static const uint32_t twos[4] = {2, 2<<2, 2<<4, 2<<6};
+	static const uint32_t threes[4] = {3, 3<<2, 3<<4, 3<<6};
+	
+	const S3TC_VEC mask = s3tc_vec_load(threes);
+	const S3TC_VEC index = s3tc_vec_and(s3tc_vec_set1(bits), mask);
+	
+	S3TC_VEC color = p0;
+	color = s3tc_vec_xor(color, s3tc_vec_and(s3tc_vec_cmpeq(index, s3tc_vec_load(ones)), d1));
+	color = s3tc_vec_xor(color, s3tc_vec_and(s3tc_vec_cmpeq(index, s3tc_vec_load(twos)), d2));
+	color = s3tc_vec_xor(color, s3tc_vec_and(s3tc_vec_cmpeq(index, mask), d3));
+	return color;
+}
+
+/*
+	Alpha of a DXT3/DXT5 block, already shifted to the alpha byte.
+*/
+static void s3tc_decode_alpha(const uint8_t* chunk, const uint8_t format, uint32_t* out)
+{
+	uint8_t alpha[16];
+	
+	if(format == S3TC_FORMAT_DXT3) s3tc_decode_dxt3_alpha_chunk(chunk, alpha);
+	else s3tc_decode_dxt5_alpha_chunk(chunk, alpha);
+	
+	for(uint8_t i = 0; i != 16; ++i)
+	{
+		out[i] = (uint32_t)alpha[i]<<24;
+	}
+}
+
+/*
+	Decodes rows of blocks [`first`, `last`).
+*/
+static void s3tc_decode_block_rows(const uint8_t format, const uint8_t* data,
+								   const uint32_t width, const uint32_t height,
+								   uint8_t* out, const uint32_t stride,
+								   const uint32_t first, const uint32_t last)
+{
+	const uint8_t dxt1 = (format == S3TC_FORMAT_DXT1);
+	const uint32_t block_size = dxt1 ? 8 : 16;
+	const uint32_t color_offset = dxt1 ? 0 : 8;
+	const uint32_t blocks_x = (width+3)/4;
+	
+	for(uint32_t by = first; by != last; ++by)
+	{
+		const uint8_t* row = &data[(uint64_t)by*blocks_x*block_size];
+		const uint32_t rows = ((height - by*4) < 4) ? (height - by*4) : 4;
+		uint8_t* out_row = &out[(uint64_t)by*4*stride];
+		
+		for(uint32_t bx = 0; bx < blocks_x; bx += 4)
+		{
+			const uint32_t count = ((blocks_x - bx) < 4) ? (blocks_x - bx) : 4;
+			uint32_t c0[4] = {0};
+			uint32_t c1[4] = {0};
+			uint32_t pal[4][4];
+			
+			for(uint32_t i = 0; i != count; ++i)
+			{
+				const uint8_t* chunk = &row[(bx+i)*block_size + color_offset];
+				c0[i] = tr_read_u16le(&chunk[0]);
+				c1[i] = tr_read_u16le(&chunk[2]);
+			}
+			
+			s3tc_build_palettes(c0, c1, dxt1, pal);
+			
+			for(uint32_t i = 0; i != count; ++i)
+			{
+				const uint8_t* block = &row[(bx+i)*block_size];
+				const uint32_t indices = tr_read_u32le(&block[color_offset + 4]);
+				const uint32_t x = (bx+i)*4;
+				const uint32_t cols = ((width - x) < 4) ? (width - x) : 4;
+				uint32_t alpha[16];
+				
+				const S3TC_VEC p0 = s3tc_vec_set1(pal[0][i]);
+				const S3TC_VEC d1 = s3tc_vec_xor(p0, s3tc_vec_set1(pal[1][i]));
+				const S3TC_VEC d2 = s3tc_vec_xor(p0, s3tc_vec_set1(pal[2][i]));
+				const S3TC_VEC d3 = s3tc_vec_xor(p0, s3tc_vec_set1(pal[3][i]));
+				
+				if(!dxt1) s3tc_decode_alpha(block, format, alpha);
+				
+				for(uint32_t y = 0; y != rows; ++y)
+				{
+					S3TC_VEC color = s3tc_expand_row((indices>>(y*8))&0xFF, p0, d1, d2, d3);
+					uint8_t* dst = &out_row[(uint64_t)y*stride + (uint64_t)x*4];
+					
+					if(!dxt1) color = s3tc_vec_or(color, s3tc_vec_load(&alpha[y*4]));
+					
+					if(cols == 4)
+					{
+						s3tc_vec_store(dst, color);
+					}
+					else
+					{
+						uint8_t tmp[16];
+						s3tc_vec_store(tmp, color);
+						memcpy(dst, tmp, cols*4);
+					}
+				}
+			}
+		}
+	}
+}
+
+void s3tc_decode_image_dxt1(const uint8_t* data, const uint32_t width, const uint32_t height,
+							uint8_t* out, const uint32_t stride)
+{
+	s3tc_decode_block_rows(S3TC_FORMAT_DXT1, data, width, height, out, stride, 0, (height+3)/4);
+}
+
+void s3tc_decode_image_dxt3(const uint8_t* data, const uint32_t width, const uint32_t height,
+							uint8_t* out, const uint32_t stride)
+{
+	s3tc_decode_block_rows(S3TC_FORMAT_DXT3, data, width, height, out, stride, 0, (height+3)/4);
+}
+
+void s3tc_decode_image_dxt5(const uint8_t* data, const uint32_t width, const uint32_t height,
+							uint8_t* out, const uint32_t stride)
+{
+	s3tc_decode_block_rows(S3TC_FORMAT_DXT5, data, width, height, out, stride, 0, (height+3)/4);
+}
+
+typedef struct
+{
+	uint8_t format;
+	const uint8_t* data;
+	uint32_t width;
+	uint32_t height;
+	uint8_t* out;
+	uint32_t stride;
+	uint32_t block_rows;
+} S3TC_DECODE_JOB;
+
+static void s3tc_decode_band(void* user, const uint64_t index)
+{
+	const S3TC_DECODE_JOB* job = (const S3TC_DECODE_JOB*)user;
+	const uint32_t first = index*S3TC_BAND_BLOCK_ROWS;
+	uint32_t last = first + S3TC_BAND_BLOCK_ROWS;
+	if(last > job->block_rows) last = job->block_rows;
+	
+	s3tc_decode_block_rows(job->format, job->data, job->width, job->height,
+						   job->out, job->stride, first, last);
+}
+
+uint8_t s3tc_decode_image(const uint8_t format, const uint8_t* data,
+						  const uint32_t width, const uint32_t height,
+						  uint8_t* out, const uint32_t stride,
+						  const uint32_t thread_count)
+{
+	if((format != S3TC_FORMAT_DXT1) && (format != S3TC_FORMAT_DXT3) && (format != S3TC_FORMAT_DXT5))
+	{
+		return FU_ERROR;
+	}
+	
+	S3TC_DECODE_JOB job = {0};
+	job.format = format;
+	job.data = data;
+	job.width = width;
+	job.height = height;
+	job.out = out;
+	job.stride = stride;
+	job.block_rows = (height+3)/4;
+	
+	const uint64_t bands = (job.block_rows + S3TC_BAND_BLOCK_ROWS - 1)/S3TC_BAND_BLOCK_ROWS;
+	const uint8_t threaded = ((uint64_t)width*height) >= S3TC_THREADED_MIN_PIXELS;
+	
+	tp_parallel_for(bands, threaded ? thread_count : 1, s3tc_decode_band, &job);
+	
+	return FU_SUCCESS;
+}
+
+uint64_t s3tc_data_size(const uint8_t format, const uint32_t width, const uint32_t height)
+{
+	uint64_t block_size = 0;
+	
+	switch(format)
+	{
+		case S3TC_FORMAT_DXT1:
+		case S3TC_FORMAT_BC4: block_size = 8; break;
+		case S3TC_FORMAT_DXT3:
+		case S3TC_FORMAT_DXT5:
+		case S3TC_FORMAT_BC5: block_size = 16; break;
+		default: return 0;
+	}
+	
+	return (uint64_t)((width+3)/4)*((height+3)/4)*block_size;
+}
+
+/*
+	Encoder
+*/
+
+/*
+	Picks the closest palette entry for every pixel.
+	`ch` holds up to 3 channels of the 16 pixels, values up to 255.
+	Pixels with `skip` set (can be NULL) get index 0 and don't count to the error.
+	
+	Returns the sum of squared errors.
+*/
+static uint32_t s3tc_fit_indices(const uint32_t ch[3][16], const uint32_t channels,
+								 const uint32_t pal[8][3], const uint32_t pal_count,
+								 const uint8_t* skip, uint8_t* indices)
+{
+	uint32_t error = 0;
+	
+	for(uint32_t q = 0; q != 16; q += 4)
+	{
+		S3TC_VEC best = s3tc_vec_set1(0x7FFFFFFF);
+		S3TC_VEC best_index = s3tc_vec_set1(0);
+		
+		for(uint32_t k = 0; k != pal_count; ++k)
+		{
+			S3TC_VEC e = s3tc_vec_set1(0);
+			
+			for(uint32_t c = 0; c != channels; ++c)
+			{
+				const S3TC_VEC d = s3tc_vec_absdiff(s3tc_vec_load(&ch[c][q]), s3tc_vec_set1(pal[k][c]));
+				e = s3tc_vec_add(e, s3tc_vec_mul16(d, d));
+			}
+			
+			const S3TC_VEC closer = s3tc_vec_cmpgt(best, e);
+			best = s3tc_vec_select(closer, e, best);
+			best_index = s3tc_vec_select(closer, s3tc_vec_set1(k), best_index);
+		}
+		
+		uint32_t e[4];
+		uint32_t idx[4];
+		s3tc_vec_store((uint8_t*)&e[0], best);
+		s3tc_vec_store((uint8_t*)&idx[0], best_index);
+		
+		for(uint32_t i = 0; i != 4; ++i)
+		{
+			const uint8_t skipped = skip ? skip[q+i] : 0;
+			indices[q+i] = skipped ? 0 : idx[i];
+			error += skipped ? 0 : e[i];
+		}
+	}
+	
+	return error;
+}
+
+/*
+	RGB565 to RGB with the low bits replicated, like the hardware does it.
+*/
+static void s3tc_expand_565(const uint16_t c, uint32_t* out)
+{
+	const uint32_t r = (c>>11)&0x1F;
+	const uint32_t g = (c>>5)&0x3F;
+	const uint32_t b = c&0x1F;
+	out[0] = (r<<3) | (r>>2);
+	out[1] = (g<<2) | (g>>4);
+	out[2] = (b<<3) | (b>>2);
+}
+
+static uint16_t s3tc_quantize_565(const float* rgb)
+{
+	uint32_t q[3];
+	const float scale[3] = {31.0f, 63.0f, 31.0f};
+	
+	for(uint32_t c = 0; c != 3; ++c)
+	{
+		float v = rgb[c];
+		if(v < 0.0f) v = 0.0f;
+		if(v > 255.0f) v = 255.0f;
+		q[c] = (uint32_t)(v*scale[c]/255.0f + 0.5f);
+	}
+	
+	return (q[0]<<11) | (q[1]<<5) | q[2];
+}
+
+/*
+	Error of the endpoints with 4 colors, or 3 with the transparent one.
+	The order of c0 and c1 is fixed up when the block is written.
+*/
+static uint32_t s3tc_eval_colors(const uint32_t ch[3][16], const uint8_t* skip,
+								 const uint16_t c0, const uint16_t c1, const uint32_t colors,
+								 uint8_t* indices)
+{
+	uint32_t pal[8][3] = {{0}};
+	s3tc_expand_565(c0, &pal[0][0]);
+	s3tc_expand_565(c1, &pal[1][0]);
+	
+	for(uint32_t c = 0; c != 3; ++c)
+	{
+		if(colors == 4)
+		{
+			pal[2][c] = (2*pal[0][c] + pal[1][c])/3;
+			pal[3][c] = (pal[0][c] + 2*pal[1][c])/3;
+		}
+		else
+		{
+			pal[2][c] = (pal[0][c] + pal[1][c])/2;
+		}
+	}
+	
+	return s3tc_fit_indices(ch, 3, pal, colors, skip, indices);
+}
+
+/*
+	Mean and the principal axis of the pixels, from power iteration on the covariance.
+	Returns the amount of pixels used.
+*/
+static uint32_t s3tc_principal_axis(const uint32_t ch[3][16], const uint8_t* skip,
+									float* mean, float* axis)
+{
+	uint32_t count = 0;
+	mean[0] = mean[1] = mean[2] = 0.0f;
+	
+	for(uint32_t i = 0; i != 16; ++i)
+	{
+		if(skip[i]) continue;
+		for(uint32_t c = 0; c != 3; ++c) mean[c] += ch[c][i];
+		count += 1;
+	}
+	
+	if(count == 0) return 0;
+	
+	for(uint32_t c = 0; c != 3; ++c) mean[c] /= count;
+	
+	float cov[6] = {0};
+	for(uint32_t i = 0; i != 16; ++i)
+	{
+		if(skip[i]) continue;
+		const float r = ch[0][i] - mean[0];
+		const float g = ch[1][i] - mean[1];
+		const float b = ch[2][i] - mean[2];
+		cov[0] += r*r; cov[1] += r*g; cov[2] += r*b;
+		cov[3] += g*g; cov[4] += g*b; cov[5] += b*b;
+	}
+	
+	/* Starting from the row of the widest channel, (1,1,1) misses red-green gradients */
+	const uint32_t row[3][3] = {{0, 1, 2}, {1, 3, 4}, {2, 4, 5}};
+	const uint32_t widest = (cov[0] >= cov[3]) ? ((cov[0] >= cov[5]) ? 0 : 2) : ((cov[3] >= cov[5]) ? 1 : 2);
+	float v[3] = {cov[row[widest][0]], cov[row[widest][1]], cov[row[widest][2]]};
+	
+	if(cov[row[widest][widest]] <= 0.0f)
+	{
+		/* All pixels are the same */
+		v[0] = v[1] = v[2] = 1.0f;
+	}
+	
+	for(uint32_t it = 0; it != 8; ++it)
+	{
+		const float x = v[0]*cov[0] + v[1]*cov[1] + v[2]*cov[2];
+		const float y = v[0]*cov[1] + v[1]*cov[3] + v[2]*cov[4];
+		const float z = v[0]*cov[2] + v[1]*cov[4] + v[2]*cov[5];
+		
+		float m = fabsf(x);
+		if(fabsf(y) > m) m = fabsf(y);
+		if(fabsf(z) > m) m = fabsf(z);
+		if(m <= 0.0f) break;
+		
+		v[0] = x/m; v[1] = y/m; v[2] = z/m;
+	}
+	
+	const float len2 = v[0]*v[0] + v[1]*v[1] + v[2]*v[2];
+	const float inv = 1.0f/sqrtf(len2);
+	for(uint32_t c = 0; c != 3; ++c) axis[c] = v[c]*inv;
+	
+	return count;
+}
+
+/*
+	Cluster fit: pixels sorted along the axis are split into runs
+	that take the palette colors in order, every split is solved
+	with least squares for the endpoints and the best one is kept.
+*/
+static void s3tc_cluster_fit(const uint32_t ch[3][16], const uint8_t* skip,
+							 const float* axis, const uint32_t colors,
+							 float* best_a, float* best_b)
+{
+	uint32_t order[16];
+	float t[16];
+	uint32_t n = 0;
+	
+	/* Insertion sort by the projection */
+	for(uint32_t i = 0; i != 16; ++i)
+	{
+		if(skip[i]) continue;
+		
+		const float d = ch[0][i]*axis[0] + ch[1][i]*axis[1] + ch[2][i]*axis[2];
+		uint32_t j = n;
+		
+		while((j > 0) && (t[j-1] > d))
+		{
+			t[j] = t[j-1];
+			order[j] = order[j-1];
+			j -= 1;
+		}
+		
+		t[j] = d;
+		order[j] = i;
+		n += 1;
+	}
+	
+	/* Prefix sums of the sorted pixels */
+	float sum[17][3] = {{0}};
+	for(uint32_t i = 0; i != n; ++i)
+	{
+		for(uint32_t c = 0; c != 3; ++c)
+		{
+			sum[i+1][c] = sum[i][c] + ch[c][order[i]];
+		}
+	}
+	
+	/* Weight of the first endpoint per run, 3 color mode has the third run empty */
+	const float w1 = (colors == 4) ? (2.0f/3.0f) : 0.5f;
+	const float w2 = 1.0f/3.0f;
+	float best_error = 3.4e38f;
+	
+	for(uint32_t i = 0; i <= n; ++i)
+	{
+		for(uint32_t j = i; j <= n; ++j)
+		{
+			const uint32_t k_end = (colors == 4) ? n : j;
+			
+			for(uint32_t k = j; k <= k_end; ++k)
+			{
+				const float n0 = i;
+				const float n1 = j - i;
+				const float n2 = k - j;
+				const float n3 = n - k;
+				
+				const float alpha2 = n0 + n1*w1*w1 + n2*w2*w2;
+				const float beta2 = n3 + n1*(1.0f-w1)*(1.0f-w1) + n2*(1.0f-w2)*(1.0f-w2);
+				const float alphabeta = n1*w1*(1.0f-w1) + n2*w2*(1.0f-w2);
+				const float det = alpha2*beta2 - alphabeta*alphabeta;
+				
+				if((det < 1e-6f) && (det > -1e-6f)) continue;
+				
+				const float inv_det = 1.0f/det;
+				
+				float a[3];
+				float b[3];
+				float error = 0.0f;
+				
+				for(uint32_t c = 0; c != 3; ++c)
+				{
+					const float s0 = sum[i][c];
+					const float s1 = sum[j][c] - sum[i][c];
+					const float s2 = sum[k][c] - sum[j][c];
+					const float s3 = sum[n][c] - sum[k][c];
+					const float alphax = s0 + w1*s1 + w2*s2;
+					const float betax = s3 + (1.0f-w1)*s1 + (1.0f-w2)*s2;
+					
+					float va = (alphax*beta2 - betax*alphabeta)*inv_det;
+					float vb = (betax*alpha2 - alphax*alphabeta)*inv_det;
+					
+					if(va < 0.0f) va = 0.0f;
+					if(va > 255.0f) va = 255.0f;
+					if(vb < 0.0f) vb = 0.0f;
+					if(vb > 255.0f) vb = 255.0f;
+					
+					
+					a[c] = va;
+					b[c] = vb;
+					error += va*va*alpha2 + vb*vb*beta2
+						   + 2.0f*(va*vb*alphabeta - va*alphax - vb*betax);
+				}
+				
+				if(error < best_error)
+				{
+					best_error = error;
+					for(uint32_t c = 0; c != 3; ++c)
+					{
+						best_a[c] = a[c];
+						best_b[c] = b[c];
+					}
+				}
+			}
+		}
+	}
+}
+
+/*
+	Encodes the color part of a block (8 bytes).
+	With `dxt1` set pixels of alpha under 128 become the transparent color.
+*/
+static void s3tc_encode_color_block(const uint8_t* rgba, const uint8_t quality,
+									const uint8_t dxt1, uint8_t* out)
+{
+	uint32_t ch[3][16];
+	uint8_t skip[16] = {0};
+	uint32_t colors = 4;
+	
+	for(uint32_t i = 0; i != 16; ++i)
+	{
+		ch[0][i] = rgba[i*4];
+		ch[1][i] = rgba[i*4+1];
+		ch[2][i] = rgba[i*4+2];
+		
+		if(dxt1 && (rgba[i*4+3] < 128))
+		{
+			skip[i] = 1;
+			colors = 3;
+		}
+	}
+	
+	float mean[3];
+	float axis[3];
+	uint16_t c0 = 0;
+	uint16_t c1 = 0;
+	uint8_t indices[16] = {0};
+	
+	if(s3tc_principal_axis(ch, skip, mean, axis) != 0)
+	{
+		/* Range fit, the extremes of the pixels along the axis */
+		float t_min = 3.4e38f;
+		float t_max = -3.4e38f;
+		
+		for(uint32_t i = 0; i != 16; ++i)
+		{
+			if(skip[i]) continue;
+			
+			const float t = (ch[0][i]-mean[0])*axis[0] + (ch[1][i]-mean[1])*axis[1] + (ch[2][i]-mean[2])*axis[2];
+			if(t < t_min) t_min = t;
+			if(t > t_max) t_max = t;
+		}
+		
+		float a[3];
+		float b[3];
+		for(uint32_t c = 0; c != 3; ++c)
+		{
+			a[c] = mean[c] + axis[c]*t_max;
+			b[c] = mean[c] + axis[c]*t_min;
+		}
+		
+		c0 = s3tc_quantize_565(a);
+		c1 = s3tc_quantize_565(b);
+		uint32_t error = s3tc_eval_colors(ch, skip, c0, c1, colors, indices);
+		
+		if((quality == S3TC_QUALITY_HIGH) && (error != 0))
+		{
+			uint8_t cluster_indices[16];
+			s3tc_cluster_fit(ch, skip, axis, colors, a, b);
+			
+			const uint16_t a565 = s3tc_quantize_565(a);
+			const uint16_t b565 = s3tc_quantize_565(b);
+			const uint32_t cluster_error = s3tc_eval_colors(ch, skip, a565, b565, colors, cluster_indices);
+			
+			if(cluster_error < error)
+			{
+				c0 = a565;
+				c1 = b565;
+				memcpy(indices, cluster_indices, 16);
+			}
+		}
+	}
+	
+	/*
+		4 colors need c0 > c1, swapping the endpoints swaps 0-1 and 2-3.
+		Equal endpoints would switch to 3 colors, so everything takes c0.
+		3 colors need c0 <= c1, swapping only swaps 0-1.
+	*/
+	if(colors == 4)
+	{
+		if(c0 < c1)
+		{
+			const uint16_t tmp = c0; c0 = c1; c1 = tmp;
+			for(uint32_t i = 0; i != 16; ++i) indices[i] ^= 1;
+		}
+		else if(c0 == c1)
+		{
+			memset(indices, 0, 16);
+		}
+	}
+	else
+	{
+		if(c0 > c1)
+		{
+			const uint16_t tmp = c0; c0 = c1; c1 = tmp;
+			for(uint32_t i = 0; i != 16; ++i) if(indices[i] < 2) indices[i] ^= 1;
+		}
+		
+		for(uint32_t i = 0; i != 16; ++i) if(skip[i]) indices[i] = 3;
+	}
+	
+	uint32_t bits = 0;
+	for(uint32_t i = 0; i != 16; ++i) bits |= (uint32_t)indices[i]<<(i*2);
+	
+	tw_write_u16le(c0, &out[0]);
+	tw_write_u16le(c1, &out[2]);
+	tw_write_u32le(bits, &out[4]);
+}
+
+/*
+	Error of a single channel block with endpoints a0 and a1,
+	8 values when a0 > a1 and 6 with 0 and 255 otherwise.
+*/
+static uint32_t s3tc_eval_alpha(const uint32_t ch[3][16], const uint32_t a0, const uint32_t a1,
+								uint8_t* indices)
+{
+	uint32_t pal[8][3] = {{a0}, {a1}};
+	
+	if(a0 > a1)
+	{
+		for(uint32_t i = 1; i != 7; ++i) pal[i+1][0] = ((7-i)*a0 + i*a1)/7;
+	}
+	else
+	{
+		for(uint32_t i = 1; i != 5; ++i) pal[i+1][0] = ((5-i)*a0 + i*a1)/5;
+		pal[6][0] = 0;
+		pal[7][0] = 255;
+	}
+	
+	return s3tc_fit_indices(ch, 1, pal, 8, NULL, indices);
+}
+
+/*
+	Encodes one channel of the pixels as a DXT5 alpha/BC4 block (8 bytes).
+	High quality also searches around the endpoints and tries 6 values with 0 and 255.
+*/
+static void s3tc_encode_alpha_block(const uint8_t* rgba, const uint32_t channel,
+									const uint8_t quality, uint8_t* out)
+{
+	uint32_t ch[3][16];
+	uint32_t v_min = 255;
+	uint32_t v_max = 0;
+	uint32_t mid_min = 255;
+	uint32_t mid_max = 0;
+	
+	for(uint32_t i = 0; i != 16; ++i)
+	{
+		const uint32_t v = rgba[i*4 + channel];
+		ch[0][i] = v;
+		if(v < v_min) v_min = v;
+		if(v > v_max) v_max = v;
+		
+		if((v != 0) && (v != 255))
+		{
+			if(v < mid_min) mid_min = v;
+			if(v > mid_max) mid_max = v;
+		}
+	}
+	
+	uint8_t indices[16];
+	uint8_t candidate[16];
+	uint32_t a0 = v_max;
+	uint32_t a1 = v_min;
+	uint32_t error = s3tc_eval_alpha(ch, a0, a1, indices);
+	
+	if((quality == S3TC_QUALITY_HIGH) && (error != 0))
+	{
+		for(int32_t d0 = -2; d0 <= 2; ++d0)
+		{
+			for(int32_t d1 = -2; d1 <= 2; ++d1)
+			{
+				const int32_t t0 = (int32_t)v_max + d0;
+				const int32_t t1 = (int32_t)v_min + d1;
+				if((t0 > 255) || (t1 < 0) || (t0 <= t1)) continue;
+				
+				const uint32_t e = s3tc_eval_alpha(ch, t0, t1, candidate);
+				if(e < error)
+				{
+					error = e;
+					a0 = t0;
+					a1 = t1;
+					memcpy(indices, candidate, 16);
+				}
+			}
+		}
+		
+		if(mid_min <= mid_max)
+		{
+			const uint32_t e = s3tc_eval_alpha(ch, mid_min, mid_max, candidate);
+			if(e < error)
+			{
+				error = e;
+				a0 = mid_min;
+				a1 = mid_max;
+				memcpy(indices, candidate, 16);
+			}
+		}
+	}
+	
+	uint64_t bits = 0;
+	for(uint32_t i = 0; i != 16; ++i) bits |= (uint64_t)indices[i]<<(i*3);
+	
+	out[0] = a0;
+	out[1] = a1;
+	for(uint32_t i = 0; i != 6; ++i) out[2+i] = (bits>>(i*8))&0xFF;
+}
+
+uint8_t s3tc_encode_block(const uint8_t format, const uint8_t quality,
+						  const uint8_t* rgba, uint8_t* out)
+{
+	switch(format)
+	{
+		case S3TC_FORMAT_DXT1:
+			s3tc_encode_color_block(rgba, quality, 1, out);
+			break;
+		case S3TC_FORMAT_DXT3:
+			for(uint32_t i = 0; i != 8; ++i)
+			{
+				const uint32_t lo = (rgba[(i*2)*4 + 3] + 8)/17;
+				const uint32_t hi = (rgba[(i*2+1)*4 + 3] + 8)/17;
+				out[i] = lo | (hi<<4);
+			}
+			s3tc_encode_color_block(rgba, quality, 0, &out[8]);
+			break;
+		case S3TC_FORMAT_DXT5:
+			s3tc_encode_alpha_block(rgba, 3, quality, &out[0]);
+			s3tc_encode_color_block(rgba, quality, 0, &out[8]);
+			break;
+		case S3TC_FORMAT_BC4:
+			s3tc_encode_alpha_block(rgba, 0, quality, &out[0]);
+			break;
+		case S3TC_FORMAT_BC5:
+			s3tc_encode_alpha_block(rgba, 0, quality, &out[0]);
+			s3tc_encode_alpha_block(rgba, 1, quality, &out[8]);
+			break;
+		default:
+			return FU_ERROR;
+	}
+	
+	return FU_SUCCESS;
+}
+
+typedef struct
+{
+	uint8_t format;
+	uint8_t quality;
+	const uint8_t* rgba;
+	uint32_t width;
+	uint32_t height;
+	uint32_t stride;
+	uint8_t* out;
+	uint32_t block_size;
+} S3TC_ENCODE_JOB;
+
+static void s3tc_encode_block_row(void* user, const uint64_t index)
+{
+	const S3TC_ENCODE_JOB* job = (const S3TC_ENCODE_JOB*)user;
+	const uint32_t blocks_x = (job->width+3)/4;
+	uint8_t* out = &job->out[index*blocks_x*job->block_size];
+	uint8_t block[64];
+	
+	for(uint32_t bx = 0; bx != blocks_x; ++bx)
+	{
+		/* Edges are padded with the last row and column */
+		for(uint32_t y = 0; y != 4; ++y)
+		{
+			uint32_t py = index*4 + y;
+			if(py >= job->height) py = job->height - 1;
+			
+			for(uint32_t x = 0; x != 4; ++x)
+			{
+				uint32_t px = bx*4 + x;
+				if(px >= job->width) px = job->width - 1;
+				memcpy(&block[(y*4 + x)*4], &job->rgba[(uint64_t)py*job->stride + px*4], 4);
+			}
+		}
+		
+		s3tc_encode_block(job->format, job->quality, block, &out[bx*job->block_size]);
+	}
+}
+
+uint8_t s3tc_encode_image(const uint8_t format, const uint8_t quality,
+						  const uint8_t* rgba, const uint32_t width, const uint32_t height,
+						  const uint32_t stride, uint8_t* out, const uint32_t thread_count)
+{
+	const uint64_t size = s3tc_data_size(format, width, height);
+	if((size == 0) || (width == 0) || (height == 0)) return FU_ERROR;
+	
+	S3TC_ENCODE_JOB job = {0};
+	job.format = format;
+	job.quality = quality;
+	job.rgba = rgba;
+	job.width = width;
+	job.height = height;
+	job.stride = stride;
+	job.out = out;
+	job.block_size = s3tc_data_size(format, 4, 4);
+	
+	tp_parallel_for((height+3)/4, thread_count, s3tc_encode_block_row, &job);
+	
+	return FU_SUCCESS;
+}
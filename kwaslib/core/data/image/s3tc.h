@@ -8,6 +8,21 @@
 	https://www.reedbeta.com/blog/understanding-bcn-texture-compression-formats
 */
 
+/*
+	Defines
+*/
+#define S3TC_FORMAT_DXT1			(uint8_t)(1)
+#define S3TC_FORMAT_DXT3			(uint8_t)(3)
+#define S3TC_FORMAT_DXT5			(uint8_t)(5)
+#define S3TC_FORMAT_BC4				(uint8_t)(0x14)			/* ATI1, one channel */
+#define S3TC_FORMAT_BC5				(uint8_t)(0x15)			/* ATI2, two channels */
+
+#define S3TC_QUALITY_FAST			(uint8_t)(0)			/* Range fit */
+#define S3TC_QUALITY_HIGH			(uint8_t)(1)			/* Cluster fit and endpoint search */
+
+#define S3TC_BAND_BLOCK_ROWS		(uint32_t)(16)			/* Rows of blocks decoded by one thread at once */
+#define S3TC_THREADED_MIN_PIXELS	(uint64_t)(512*512)		/* Smaller images are decoded on the calling thread */
+
 /*
 	Converts 16-bit RGB565 to 24-bit RGB values.
 	`out` is expected to be pre-allicated and able to hold 3 bytes.
@@ -54,4 +69,69 @@ void s3tc_decode_dxt3_alpha_chunk(const uint8_t* chunk, uint8_t* out);
 	Decodes a DXT5 alpha chunk (8 bytes) to 16 alpha values (16 bytes).
 	`out` is expected to be pre-allocated and be able to hold 16 bytes of data.
 */
-void s3tc_decode_dxt5_alpha_chunk(const uint8_t* chunk, uint8_t* out);
\ No newline at end of file
+void s3tc_decode_dxt5_alpha_chunk(const uint8_t* chunk, uint8_t* out);
+
+/*
+	Image decoders.
+	
+	Blocks are read in rows of (width+3)/4 and written straight to `out`
+	as packed RGBA8, `stride` bytes between the rows of pixels.
+	Partial blocks on the right and bottom edges are clipped.
+	Output is the same as of the block decoders above, DXT1 gets
+	alpha of 255 (0 for the transparent color when c0 <= c1).
+	
+	Palettes of 4 blocks are built at once and indices are expanded
+	a row of 4 pixels at a time, with SSE2 or NEON if available.
+	`out` has to hold `stride`*`height` bytes.
+*/
+void s3tc_decode_image_dxt1(const uint8_t* data, const uint32_t width, const uint32_t height,
+							uint8_t* out, const uint32_t stride);
+void s3tc_decode_image_dxt3(const uint8_t* data, const uint32_t width, const uint32_t height,
+							uint8_t* out, const uint32_t stride);
+void s3tc_decode_image_dxt5(const uint8_t* data, const uint32_t width, const uint32_t height,
+							uint8_t* out, const uint32_t stride);
+
+/*
+	Decodes the image of S3TC_FORMAT_DXT* `format` like the functions above.
+	Images of at least S3TC_THREADED_MIN_PIXELS are split into bands
+	of S3TC_BAND_BLOCK_ROWS and decoded on `thread_count` threads
+	(TP_THREADS_AUTO for all cores).
+	
+	Returns FU_SUCCESS on success, FU_ERROR on unknown format.
+*/
+uint8_t s3tc_decode_image(const uint8_t format, const uint8_t* data,
+						  const uint32_t width, const uint32_t height,
+						  uint8_t* out, const uint32_t stride,
+						  const uint32_t thread_count);
+
+/*
+	Returns the size of the S3TC_FORMAT_* `format` data for the image, 0 on unknown format.
+*/
+uint64_t s3tc_data_size(const uint8_t format, const uint32_t width, const uint32_t height);
+
+/*
+	Encodes 16 RGBA8 pixels (64 bytes, rows of 4) to a block of S3TC_FORMAT_* `format`.
+	DXT1 gets the transparent color for pixels with alpha under 128,
+	BC4 is taken from red and BC5 from red and green.
+	
+	S3TC_QUALITY_FAST uses the extremes of the pixels along their principal axis,
+	S3TC_QUALITY_HIGH also tries every split of the pixels sorted along that axis
+	between the palette colors and searches around the alpha endpoints.
+	Candidates are compared on squared error of the decoded pixels.
+	
+	Returns FU_SUCCESS on success, FU_ERROR on unknown format.
+*/
+uint8_t s3tc_encode_block(const uint8_t format, const uint8_t quality,
+						  const uint8_t* rgba, uint8_t* out);
+
+/*
+	Encodes `width`x`height` RGBA8 pixels, `stride` bytes between the rows,
+	with s3tc_encode_block(). Partial blocks are padded with the edge pixels.
+	Rows of blocks are spread over `thread_count` threads (TP_THREADS_AUTO for all cores).
+	`out` has to hold s3tc_data_size() bytes.
+	
+	Returns FU_SUCCESS on success, FU_ERROR on unknown format or empty image.
+*/
+uint8_t s3tc_encode_image(const uint8_t format, const uint8_t quality,
+						  const uint8_t* rgba, const uint32_t width, const uint32_t height,
+						  const uint32_t stride, uint8_t* out, const uint32_t thread_count);
\ No newline at end of file
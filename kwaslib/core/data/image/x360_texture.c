@@ -3,10 +3,308 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
-#include <math.h>
 
 #include <kwaslib/core/data/image/s3tc.h>
+#include <kwaslib/core/data/image/dds.h>
 #include <kwaslib/core/cpu/endianness.h>
+#include <kwaslib/core/thread/thread_pool.h>
+
+/*
+	Where a level of the mip chain sits in the texture data.
+	Layout follows Xenia's texture_util: stored levels are padded
+	to power of two sizes, tiled ones also to 32x32 blocks.
+	Once the shorter side drops to 16 texels, the rest of the chain
+	is packed into the tile of that level at fixed offsets.
+*/
+typedef struct
+{
+	uint64_t offset;	/* Start of the stored level */
+	uint32_t pitch;		/* Stored row length in blocks */
+	uint32_t rows;		/* Stored amount of block rows */
+	uint32_t x;			/* Position in the stored level in blocks, for packed mips */
+	uint32_t y;
+} X360_MIP_LEVEL;
+
+/*
+	Block dimensions of formats that can be tiled.
+	Returns 1 if the format is supported, 0 otherwise.
+*/
+static uint8_t x360_texture_format_info(const uint32_t format, uint32_t* block_dim, uint32_t* block_size)
+{
+	switch(format)
+	{
+		case GPUTEXTUREFORMAT_8:		*block_dim = 1; *block_size = 1; return 1;
+		case GPUTEXTUREFORMAT_8_8_8_8:	*block_dim = 1; *block_size = 4; return 1;
+		case GPUTEXTUREFORMAT_DXT1:		*block_dim = 4; *block_size = 8; return 1;
+		case GPUTEXTUREFORMAT_DXT2_3:
+		case GPUTEXTUREFORMAT_DXT4_5:	*block_dim = 4; *block_size = 16; return 1;
+		default: return 0;
+	}
+}
+
+static uint32_t x360_texture_log2_ceil(const uint32_t value)
+{
+	uint32_t l2 = 0;
+	while((1u<<l2) < value) l2 += 1;
+	return l2;
+}
+
+static uint32_t x360_texture_align_32(const uint32_t value)
+{
+	return (value + 31) & ~31;
+}
+
+static uint32_t x360_texture_blocks(const uint32_t texels, const uint32_t block_dim)
+{
+	return texels ? (texels + block_dim - 1)/block_dim : 1;
+}
+
+/*
+	Level's offset in the packed tile, in blocks.
+	Returns 1 if the level is packed, 0 otherwise.
+*/
+static uint8_t x360_texture_packed_offset(const uint32_t width, const uint32_t height,
+										  const uint32_t level, const uint32_t block_dim,
+										  uint32_t* packed_base, uint32_t* x, uint32_t* y)
+{
+	const uint32_t l2w = x360_texture_log2_ceil(width);
+	const uint32_t l2h = x360_texture_log2_ceil(height);
+	const uint32_t l2_size = l2w < l2h ? l2w : l2h;
+	
+	*x = 0;
+	*y = 0;
+	
+	if(l2_size > (4 + level)) return 0;
+	
+	*packed_base = (l2_size > 4) ? (l2_size - 4) : 0;
+	const uint32_t packed_level = level - *packed_base;
+	
+	if(packed_level < 3)
+	{
+		if(l2w > l2h) *y = 16 >> packed_level;
+		else *x = 16 >> packed_level;
+	}
+	else
+	{
+		if(l2w > l2h) *x = (1u << (l2w - *packed_base)) >> (packed_level - 2);
+		else *y = (1u << (l2h - *packed_base)) >> (packed_level - 2);
+	}
+	
+	*x /= block_dim;
+	*y /= block_dim;
+	
+	return 1;
+}
+
+/*
+	Stored size of the level in blocks.
+*/
+static void x360_texture_stored_level(const D3DBaseTexture* xpr, const uint32_t level,
+									  const uint32_t block_dim, const uint32_t block_size,
+									  uint32_t* pitch, uint32_t* rows)
+{
+	const uint32_t width = xpr->format.size.two_dee.width + 1;
+	const uint32_t height = xpr->format.size.two_dee.height + 1;
+	uint32_t w = 0;
+	uint32_t h = 0;
+	
+	if(level == 0)
+	{
+		const uint32_t pitch_blocks = xpr->format.pitch*32/block_dim; /* Pitch is in 32 texels */
+		w = x360_texture_blocks(width, block_dim);
+		h = x360_texture_blocks(height, block_dim);
+		if(w < pitch_blocks) w = pitch_blocks;
+	}
+	else
+	{
+		const uint32_t lw = (1u << x360_texture_log2_ceil(width)) >> level;
+		const uint32_t lh = (1u << x360_texture_log2_ceil(height)) >> level;
+		w = x360_texture_blocks(lw ? lw : 1, block_dim);
+		h = x360_texture_blocks(lh ? lh : 1, block_dim);
+	}
+	
+	if(xpr->format.tiled)
+	{
+		w = x360_texture_align_32(w);
+		h = x360_texture_align_32(h);
+	}
+	else /* Linear rows are 256 bytes aligned */
+	{
+		w = (((w*block_size) + 255) & ~255)/block_size;
+	}
+	
+	*pitch = w;
+	*rows = h;
+}
+
+/*
+	Tiled addresses of 8 and 16 bit formats reach past pitch*rows,
+	levels take whole 4KB pages like on the console.
+*/
+static uint64_t x360_texture_level_size(const uint8_t tiled, const uint32_t pitch, const uint32_t rows, const uint32_t block_size)
+{
+	const uint64_t size = (uint64_t)pitch*rows*block_size;
+	return tiled ? ((size + 0xFFF) & ~0xFFFULL) : size;
+}
+
+static X360_MIP_LEVEL x360_texture_mip_level(const D3DBaseTexture* xpr, const uint32_t level,
+											 const uint32_t block_dim, const uint32_t block_size)
+{
+	X360_MIP_LEVEL mip = {0};
+	const uint32_t width = xpr->format.size.two_dee.width + 1;
+	const uint32_t height = xpr->format.size.two_dee.height + 1;
+	
+	/* Levels are stored until the packed one */
+	uint32_t last = level;
+	
+	if(xpr->format.tiled && xpr->format.packed_mips)
+	{
+		uint32_t packed_base = 0;
+		
+		if(x360_texture_packed_offset(width, height, level, block_dim, &packed_base, &mip.x, &mip.y))
+		{
+			last = packed_base;
+		}
+	}
+	
+	x360_texture_stored_level(xpr, last, block_dim, block_size, &mip.pitch, &mip.rows);
+	
+	if(last == 0)
+	{
+		return mip;
+	}
+	
+	/* Mips either have their own address or follow the base level */
+	uint32_t base_pitch = 0;
+	uint32_t base_rows = 0;
+	x360_texture_stored_level(xpr, 0, block_dim, block_size, &base_pitch, &base_rows);
+	
+	mip.offset = x360_texture_level_size(1, base_pitch, base_rows, block_size);
+	
+	if(xpr->format.mip_address > xpr->format.base_address)
+	{
+		mip.offset = (uint64_t)(xpr->format.mip_address - xpr->format.base_address) << 12;
+	}
+	
+	for(uint32_t i = 1; i != last; ++i)
+	{
+		uint32_t pitch = 0;
+		uint32_t rows = 0;
+		x360_texture_stored_level(xpr, i, block_dim, block_size, &pitch, &rows);
+		mip.offset += x360_texture_level_size(xpr->format.tiled, pitch, rows, block_size);
+	}
+	
+	return mip;
+}
+
+static inline void x360_texture_copy_block(uint8_t* dst, const uint8_t* src, const uint32_t block_size)
+{
+	/* Constant sizes let the compiler turn these into plain moves */
+	switch(block_size)
+	{
+		case 1:		*dst = *src; break;
+		case 4:		memcpy(dst, src, 4); break;
+		case 8:		memcpy(dst, src, 8); break;
+		case 16:	memcpy(dst, src, 16); break;
+		default:	memcpy(dst, src, block_size);
+	}
+}
+
+/*
+	Copies `width`x`height` blocks between a linear surface and a stored level.
+	Tiled offsets repeat every `period` block rows shifted by a whole band,
+	so they are computed once per row of the period instead of for every block.
+	Blocks that would land outside of `stored_size` are skipped.
+*/
+static void x360_texture_copy_level(uint8_t* stored, const uint64_t stored_size,
+									const X360_MIP_LEVEL* mip, const uint8_t tiled,
+									uint8_t* linear, const uint32_t width, const uint32_t height,
+									const uint32_t block_size, const uint8_t to_stored)
+{
+	const uint32_t log2_bpp = (block_size / 4) + ((block_size / 2) >> (block_size / 4));
+	uint32_t period = 1;
+	uint32_t* offsets = NULL;
+	
+	if(tiled)
+	{
+		uint32_t a = 512;
+		uint32_t b = (mip->pitch/32) << (log2_bpp + 7);
+		
+		while(b)
+		{
+			const uint32_t t = a % b;
+			a = b;
+			b = t;
+		}
+		
+		period = 32*(512/a);
+		offsets = (uint32_t*)malloc(sizeof(uint32_t)*period*width);
+		if(offsets == NULL) return;
+		
+		for(uint32_t y = 0; y != period; ++y)
+		{
+			const uint32_t row_offset = TiledOffset2DRow(y, mip->pitch, log2_bpp);
+			
+			for(uint32_t x = 0; x != width; ++x)
+			{
+				offsets[y*width + x] = TiledOffset2DColumn(mip->x + x, y, log2_bpp, row_offset);
+			}
+		}
+	}
+	
+	const uint64_t band_size = (uint64_t)period*mip->pitch*block_size;
+	uint8_t* lin = linear;
+	
+	for(uint32_t y = 0; y != height; ++y)
+	{
+		const uint32_t sy = mip->y + y;
+		const uint32_t* row = tiled ? &offsets[(sy % period)*width] : NULL;
+		const uint64_t row_start = tiled ? mip->offset + (sy / period)*band_size
+										 : mip->offset + ((uint64_t)sy*mip->pitch + mip->x)*block_size;
+		
+		/* Tiled rows are checked per block, linear ones only at the end */
+		const uint64_t row_end = tiled ? stored_size : row_start + (uint64_t)width*block_size;
+		
+		if(row_end > stored_size)
+		{
+			for(uint32_t x = 0; x != width; ++x)
+			{
+				const uint64_t src = row_start + (uint64_t)x*block_size;
+				
+				if((src + block_size) <= stored_size)
+				{
+					if(to_stored) x360_texture_copy_block(&stored[src], &lin[x*block_size], block_size);
+					else x360_texture_copy_block(&lin[x*block_size], &stored[src], block_size);
+				}
+			}
+		}
+		else if(tiled == 0)
+		{
+			if(to_stored) memcpy(&stored[row_start], lin, (uint64_t)width*block_size);
+			else memcpy(lin, &stored[row_start], (uint64_t)width*block_size);
+		}
+		else if(to_stored)
+		{
+			for(uint32_t x = 0; x != width; ++x)
+			{
+				const uint64_t src = row_start + row[x];
+				if((src + block_size) <= stored_size) x360_texture_copy_block(&stored[src], &lin[x*block_size], block_size);
+			}
+		}
+		else
+		{
+			for(uint32_t x = 0; x != width; ++x)
+			{
+				const uint64_t src = row_start + row[x];
+				if((src + block_size) <= stored_size) x360_texture_copy_block(&lin[x*block_size], &stored[src], block_size);
+			}
+		}
+		
+		lin += (uint64_t)width*block_size;
+	}
+	
+	free(offsets);
+}
 
 IMAGE* x360_texture_to_image(const D3DBaseTexture xpr, uint8_t* data, const uint64_t data_size)
 {
@@ -23,7 +321,6 @@ IMAGE* x360_texture_to_image(const D3DBaseTexture xpr, uint8_t* data, const uint
 	
 	uint8_t fmt = 0;
 	const uint8_t xpr_fmt = xpr.format.data_format;
-	uint8_t* data_ptr = data;
 
 	switch(xpr_fmt)
 	{
@@ -37,124 +334,305 @@ IMAGE* x360_texture_to_image(const D3DBaseTexture xpr, uint8_t* data, const uint
 	
 	printf("X360: W:%u|H:%u %u %u %u %u\n", width, height, xpr_fmt, fmt, xpr.format.tiled, xpr.format.endian);
 	
-	if(xpr_fmt == GPUTEXTUREFORMAT_8)
+	uint32_t block_dim = 0;
+	uint32_t block_size = 0;
+	
+	if(x360_texture_format_info(xpr_fmt, &block_dim, &block_size) == 0)
+	{
+		printf("Unknown xpr pixel format: 0x%02x\n", xpr_fmt);
+		return NULL;
+	}
+	
+	/* Base level only, read the same way as the DDS path does */
+	const X360_MIP_LEVEL mip = x360_texture_mip_level(&xpr, 0, block_dim, block_size);
+	const uint32_t blocks_w = x360_texture_blocks(width, block_dim);
+	const uint32_t blocks_h = x360_texture_blocks(height, block_dim);
+	const uint64_t level_size = (uint64_t)blocks_w*blocks_h*block_size;
+	
+	uint8_t* level = (uint8_t*)calloc(1, level_size);
+	if(level == NULL) return NULL;
+	
+	x360_texture_copy_level(data, data_size, &mip, xpr.format.tiled, level,
+							blocks_w, blocks_h, block_size, 0);
+	
+	/* Uncompressed pixels are already in the order of their IMAGE format */
+	if(block_dim == 1)
+	{
+		IMAGE* img_raw = img_load_from_data(width, height, level, fmt);
+		free(level);
+		return img_raw;
+	}
+	
+	/*
+		S3TC compressed textures
+	*/
+	
+	x360_texture_swap_endian(level, level_size, xpr.format.endian);
+	
+	uint8_t s3tc_fmt = 0;
+	
+	switch(xpr_fmt)
+	{
+		case GPUTEXTUREFORMAT_DXT1:		s3tc_fmt = S3TC_FORMAT_DXT1; break;
+		case GPUTEXTUREFORMAT_DXT2_3:	s3tc_fmt = S3TC_FORMAT_DXT3; break;
+		default:						s3tc_fmt = S3TC_FORMAT_DXT5; break;
+	}
+	
+	uint8_t* rgba = malloc((uint64_t)width*height*4);
+	s3tc_decode_image(s3tc_fmt, level, width, height, rgba, width*4, TP_THREADS_AUTO);
+	IMAGE* img = img_load_from_data(width, height, rgba, FMT_RGBA);
+	free(rgba);
+	free(level);
+	
+	/* DXT1 has no alpha, RGB sits in the same place of PIXEL */
+	if((img != NULL) && (fmt == FMT_RGB))
+	{
+		img->fmt = FMT_RGB;
+		img->bpp = FMT_RGB_BPP;
+	}
+	
+	return img;
+}
+
+uint8_t* x360_texture_to_dds(const D3DBaseTexture xpr, const uint8_t* data, const uint64_t data_size, uint64_t* dds_size)
+{
+	if(data == NULL) return NULL;
+	if(xpr.format.type != GPUCONSTANTTYPE_TEXTURE) return NULL;
+	if(xpr.format.dimension != GPUDIMENSION_2D) return NULL;
+	
+	const char* fourcc = NULL;
+	uint32_t block_dim = 0;
+	uint32_t block_size = 0;
+	
+	switch(xpr.format.data_format)
+	{
+		case GPUTEXTUREFORMAT_DXT1:		fourcc = "DXT1"; break;
+		case GPUTEXTUREFORMAT_DXT2_3:	fourcc = "DXT3"; break;
+		case GPUTEXTUREFORMAT_DXT4_5:	fourcc = "DXT5"; break;
+		default: return NULL;
+	}
+	
+	x360_texture_format_info(xpr.format.data_format, &block_dim, &block_size);
+	
+	const uint32_t width = xpr.format.size.two_dee.width + 1;
+	const uint32_t height = xpr.format.size.two_dee.height + 1;
+	
+	/* Mips that aren't in the data are cut off */
+	X360_MIP_LEVEL mips[16] = {0};
+	uint32_t mip_count = xpr.format.max_mip_level + 1;
+	const uint32_t full_count = dds_full_mip_count(width, height);
+	if(mip_count > full_count) mip_count = full_count;
+	
+	uint64_t out_size = DDS_FILE_HEADER_SIZE;
+	
+	for(uint32_t i = 0; i != mip_count; ++i)
 	{
-		uint8_t* pixel_data = calloc(1, width*height);
+		mips[i] = x360_texture_mip_level(&xpr, i, block_dim, block_size);
+		const uint64_t stored_end = mips[i].offset + x360_texture_level_size(xpr.format.tiled, mips[i].pitch, mips[i].rows, block_size);
 		
-		if(xpr.format.tiled) x360_texture_untile(data_size, data_ptr, pixel_data, width, height, xpr_fmt);
-		else memcpy(pixel_data, data_ptr, width*height);
+		if((i != 0) && (stored_end > data_size))
+		{
+			mip_count = i;
+			break;
+		}
 		
-		IMAGE* img_gray = img_load_from_data(width, height, pixel_data, fmt);
-		free(pixel_data);
-		return img_gray;
+		out_size += dds_bcn_level_size(width>>i, height>>i, block_size);
 	}
 	
-	if(xpr_fmt == GPUTEXTUREFORMAT_8_8_8_8)
+	uint8_t* out = (uint8_t*)calloc(1, out_size);
+	if(out == NULL) return NULL;
+	
+	DDS_FILE dds = {0};
+	dds_init_bcn(&dds, width, height, mip_count, fourcc, block_size);
+	dds_write_header(&dds, out);
+	
+	uint8_t* level_ptr = &out[DDS_FILE_HEADER_SIZE];
+	
+	for(uint32_t i = 0; i != mip_count; ++i)
 	{
-		uint8_t* pixel_data = calloc(1, width*height*4);
+		const uint32_t level_w = width>>i ? width>>i : 1;
+		const uint32_t level_h = height>>i ? height>>i : 1;
+		const uint32_t level_size = dds_bcn_level_size(level_w, level_h, block_size);
 		
-		if(xpr.format.tiled) x360_texture_untile(data_size, data_ptr, pixel_data, width, height, xpr_fmt);
-		else memcpy(pixel_data, data_ptr, width*height*4);
+		x360_texture_copy_level((uint8_t*)data, data_size, &mips[i], xpr.format.tiled, level_ptr,
+								x360_texture_blocks(level_w, block_dim),
+								x360_texture_blocks(level_h, block_dim),
+								block_size, 0);
+		x360_texture_swap_endian(level_ptr, level_size, xpr.format.endian);
 		
-		IMAGE* img_argb = img_load_from_data(width, height, pixel_data, fmt);
-		free(pixel_data);
-		return img_argb;
+		level_ptr += level_size;
 	}
 	
-	/* Convert data to correct endianess */
-	switch(xpr.format.endian)
+	*dds_size = out_size;
+	return out;
+}
+
+uint8_t* x360_texture_from_dds(const uint8_t* dds_data, const uint64_t dds_size, D3DBaseTexture* xpr, uint64_t* data_size)
+{
+	if((dds_data == NULL) || (dds_size < DDS_FILE_HEADER_SIZE)) return NULL;
+	
+	DDS_FILE* dds = dds_header_from_data((const char*)dds_data);
+	if(dds == NULL) return NULL;
+	
+	const DDS_FORMAT dds_fmt = dds_get_format(dds);
+	const uint32_t width = dds->header.width;
+	const uint32_t height = dds->header.height;
+	uint32_t mip_count = dds_get_mip_count(dds);
+	free(dds);
+	
+	if((width == 0) || (height == 0) || (width > 8192) || (height > 8192)) return NULL;
+	
+	uint32_t format = 0;
+	uint32_t endian = GPUENDIAN_NONE;
+	
+	switch(dds_fmt)
 	{
-		case GPUENDIAN_8IN16:
-			uint16_t* data16 = (uint16_t*)data;
-			for(uint64_t i = 0; i != data_size/2; ++i)
-				data16[i] = ed_swap_endian_16(data16[i]);
-			break;
+		case DDS_FORMAT_DXT1:		format = GPUTEXTUREFORMAT_DXT1; endian = GPUENDIAN_8IN16; break;
+		case DDS_FORMAT_DXT3:		format = GPUTEXTUREFORMAT_DXT2_3; endian = GPUENDIAN_8IN16; break;
+		case DDS_FORMAT_DXT5:		format = GPUTEXTUREFORMAT_DXT4_5; endian = GPUENDIAN_8IN16; break;
+		case DDS_FORMAT_A8R8G8B8:	format = GPUTEXTUREFORMAT_8_8_8_8; endian = GPUENDIAN_8IN32; break;
+		case DDS_FORMAT_L8:			format = GPUTEXTUREFORMAT_8; break;
+		default: return NULL;
 	}
 	
-	if(xpr.format.tiled)
+	uint32_t block_dim = 0;
+	uint32_t block_size = 0;
+	x360_texture_format_info(format, &block_dim, &block_size);
+	
+	const uint32_t full_count = dds_full_mip_count(width, height);
+	if(mip_count > full_count) mip_count = full_count;
+	if(mip_count > 16) mip_count = 16;
+	
+	/* Fetch constant the way XGSetTextureHeader fills it */
+	D3DBaseTexture tex = {0};
+	tex.base.common.type = D3DRTYPE_TEXTURE;
+	tex.base.reference_count = 1;
+	tex.format.type = GPUCONSTANTTYPE_TEXTURE;
+	tex.format.tiled = 1;
+	tex.format.pitch = x360_texture_align_32(x360_texture_blocks(width, block_dim))*block_dim/32;
+	tex.format.data_format = format;
+	tex.format.endian = endian;
+	tex.format.size.two_dee.width = width - 1;
+	tex.format.size.two_dee.height = height - 1;
+	tex.format.swizzle_x = 0;
+	tex.format.swizzle_y = 1;
+	tex.format.swizzle_z = 2;
+	tex.format.swizzle_w = 3;
+	tex.format.max_mip_level = mip_count - 1;
+	tex.format.dimension = GPUDIMENSION_2D;
+	tex.format.packed_mips = 1;
+	
+	/* Mips start on the next page after the base level */
+	X360_MIP_LEVEL mips[16] = {0};
+	uint64_t out_size = 0;
+	uint64_t dds_pos = DDS_FILE_HEADER_SIZE;
+	
+	for(uint32_t i = 0; i != mip_count; ++i)
 	{
-		uint8_t* pixel_data = NULL;
+		mips[i] = x360_texture_mip_level(&tex, i, block_dim, block_size);
 		
-		switch(xpr_fmt)
+		if(mips[i].offset && (tex.format.mip_address == 0))
 		{
-			case GPUTEXTUREFORMAT_DXT1:
-			case GPUTEXTUREFORMAT_DXT2_3:
-			case GPUTEXTUREFORMAT_DXT4_5:
-				pixel_data = calloc(1, data_size);
-				x360_texture_untile(data_size, data_ptr, pixel_data, width, height, xpr_fmt);
-				data_ptr = pixel_data;
-				break;
-			default: break;
+			tex.format.mip_address = mips[i].offset >> 12;
 		}
+		
+		const uint64_t stored_end = mips[i].offset + x360_texture_level_size(1, mips[i].pitch, mips[i].rows, block_size);
+		if(stored_end > out_size) out_size = stored_end;
+		
+		dds_pos += dds_format_level_size(dds_fmt, width>>i, height>>i);
 	}
 	
-	/*
-		S3TC compressed textures
-	*/
+	if(dds_pos > dds_size) return NULL;
 	
-	IMAGE* img = img_create_blank_image(width, height, fmt);
-	IMAGE* block = img_create_blank_image(4, 4, fmt);
+	uint8_t* out = (uint8_t*)calloc(1, out_size);
+	if(out == NULL) return NULL;
 	
-	uint8_t pixel_buf[64] = {0};
-	uint32_t data_it = 0;
+	/* Endian swaps are their own inverse and stay within a block */
+	uint8_t* level_ptr = (uint8_t*)&dds_data[DDS_FILE_HEADER_SIZE];
 	
-	for(uint32_t y = 0; y != height; y+=4)
+	for(uint32_t i = 0; i != mip_count; ++i)
 	{
-		for(uint32_t x = 0; x != width; x+=4)
-		{
-			switch(xpr_fmt)
-			{
-				case GPUTEXTUREFORMAT_DXT1:
-					s3tc_decode_dxt1_block(&data_ptr[data_it], &pixel_buf[0]);
-					data_it += 8;
-					
-					for(uint8_t i = 0; i != 16; ++i)
-					{
-						block->data[i].rgb.r = pixel_buf[i*3];
-						block->data[i].rgb.g = pixel_buf[i*3+1];
-						block->data[i].rgb.b = pixel_buf[i*3+2];
-					}
-					break;
-				case GPUTEXTUREFORMAT_DXT2_3:
-					s3tc_decode_dxt3_block(&data_ptr[data_it], &pixel_buf[0]);
-					data_it += 16;
-					
-					for(uint8_t i = 0; i != 16; ++i)
-					{
-						block->data[i].rgba.r = pixel_buf[i*4];
-						block->data[i].rgba.g = pixel_buf[i*4+1];
-						block->data[i].rgba.b = pixel_buf[i*4+2];
-						block->data[i].rgba.a = pixel_buf[i*4+3];
-					}
-					break;
-				case GPUTEXTUREFORMAT_DXT4_5:
-					s3tc_decode_dxt5_block(&data_ptr[data_it], &pixel_buf[0]);
-					data_it += 16;
-					
-					for(uint8_t i = 0; i != 16; ++i)
-					{
-						block->data[i].rgba.r = pixel_buf[i*4];
-						block->data[i].rgba.g = pixel_buf[i*4+1];
-						block->data[i].rgba.b = pixel_buf[i*4+2];
-						block->data[i].rgba.a = pixel_buf[i*4+3];
-					}
-					break;
-				default:
-					printf("Unknown xpr pixel format: 0x%02x\n", xpr_fmt);
-					img_free_image(block);
-					img_free_image(img);
-					return NULL;
-			}
-			
-			img_draw_on_image(img, block, x, y);
-		}
+		const uint32_t level_w = width>>i ? width>>i : 1;
+		const uint32_t level_h = height>>i ? height>>i : 1;
+		
+		x360_texture_copy_level(out, out_size, &mips[i], 1, level_ptr,
+								x360_texture_blocks(level_w, block_dim),
+								x360_texture_blocks(level_h, block_dim),
+								block_size, 1);
+		
+		level_ptr += dds_format_level_size(dds_fmt, level_w, level_h);
 	}
+	
+	x360_texture_swap_endian(out, out_size, endian);
+	
+	*xpr = tex;
+	*data_size = out_size;
+	return out;
+}
 
-	if(data != data_ptr) free(data_ptr);
+uint64_t x360_texture_tiled_size(const uint16_t width, const uint16_t height, GPUTEXTUREFORMAT format)
+{
+	uint32_t block_dim = 0;
+	uint32_t block_size = 0;
+	
+	if(x360_texture_format_info(format, &block_dim, &block_size) == 0) return 0;
+	
+	return x360_texture_level_size(1,
+								   x360_texture_align_32(x360_texture_blocks(width, block_dim)),
+								   x360_texture_align_32(x360_texture_blocks(height, block_dim)),
+								   block_size);
+}
 
-	img_free_image(block);
+void x360_texture_tile(const uint32_t output_size, const uint8_t* input_buffer, uint8_t* output_buffer, const uint16_t width, const uint16_t height, GPUTEXTUREFORMAT format)
+{
+	uint32_t block_dim = 0;
+	uint32_t block_size = 0;
 	
-	return img;
+	if(x360_texture_format_info(format, &block_dim, &block_size) == 0) return;
+	
+	X360_MIP_LEVEL mip = {0};
+	mip.pitch = x360_texture_align_32(x360_texture_blocks(width, block_dim));
+	mip.rows = x360_texture_align_32(x360_texture_blocks(height, block_dim));
+	
+	x360_texture_copy_level(output_buffer, output_size, &mip, 1, (uint8_t*)input_buffer,
+							x360_texture_blocks(width, block_dim),
+							x360_texture_blocks(height, block_dim),
+							block_size, 1);
+}
+
+void x360_texture_swap_endian(uint8_t* data, const uint64_t size, const uint8_t endian)
+{
+	switch(endian)
+	{
+		case GPUENDIAN_8IN16:
+			for(uint64_t i = 0; (i+2) <= size; i += 2)
+			{
+				const uint8_t t = data[i];
+				data[i] = data[i+1];
+				data[i+1] = t;
+			}
+			break;
+		case GPUENDIAN_8IN32:
+			for(uint64_t i = 0; (i+4) <= size; i += 4)
+			{
+				uint32_t v = 0;
+				memcpy(&v, &data[i], 4);
+				v = ed_swap_endian_32(v);
+				memcpy(&data[i], &v, 4);
+			}
+			break;
+		case GPUENDIAN_16IN32:
+			for(uint64_t i = 0; (i+4) <= size; i += 4)
+			{
+				uint8_t t[2] = {data[i], data[i+1]};
+				data[i] = data[i+2];
+				data[i+1] = data[i+3];
+				data[i+2] = t[0];
+				data[i+3] = t[1];
+			}
+			break;
+		default: break;
+	}
 }
 
 // https://github.com/BinomialLLC/crunch/blob/ea9b8d8c00c8329791256adafa8cf11e4e7942a2/inc/crn_decomp.h#L4108
@@ -175,131 +653,3 @@ uint32_t TiledOffset2DColumn(uint32_t x, uint32_t y, uint32_t log2_bpp, uint32_t
   return ((offset & ~0x1FF) << 3) + ((offset & 0x1C0) << 2) + (offset & 0x3F) +
          ((y & 16) << 7) + (((((y & 8) >> 2) + (x >> 3)) & 3) << 6);
 }
-
-void Untile(const uint8_t* input_buffer, uint8_t* output_buffer,
-			const uint16_t width, const uint16_t height,
-			const uint32_t input_bytes_per_block, const uint32_t output_bytes_per_block,
-			const uint32_t pitch)
-{
-	uint32_t output_pitch = pitch * output_bytes_per_block;
-
-	uint32_t offset_x = 0;
-	uint32_t offset_y = 0;
-
-	// Bytes per pixel
-	uint32_t log2_bpp = (input_bytes_per_block / 4) +
-				      ((input_bytes_per_block / 2) >> (input_bytes_per_block / 4));
-
-	// Offset to the current row, in bytes.
-	uint32_t output_row_offset = 0;
-	for (uint32_t y = 0; y < height; y++)
-	{
-		uint32_t input_row_offset = TiledOffset2DRow(offset_y + y,
-													 pitch,
-													 log2_bpp);
-
-		// Go block-by-block on this row.
-		uint32_t output_offset = output_row_offset;
-
-		for (uint32_t x = 0; x < width; x++)
-		{
-			uint32_t input_offset = TiledOffset2DColumn(offset_x + x, 
-														offset_y + y, 
-														log2_bpp,
-														input_row_offset);
-
-			input_offset >>= log2_bpp;
-
-			memcpy(&output_buffer[output_offset], 
-				   &input_buffer[input_offset * input_bytes_per_block],
-				   output_bytes_per_block);
-
-			output_offset += output_bytes_per_block;
-		}
-
-		output_row_offset += output_pitch;
-	}
-}
-
-void x360_texture_untile(const uint32_t input_size, const uint8_t* input_buffer, uint8_t* output_buffer, const uint16_t width, const uint16_t height, GPUTEXTUREFORMAT format)
-{
-	uint32_t block_size = 0;
-	uint32_t texel_pitch = 0;
-	
-	switch(format)
-	{
-		case GPUTEXTUREFORMAT_8:
-			block_size = 1;
-			texel_pitch = 1;
-			break;
-		case GPUTEXTUREFORMAT_8_8_8_8:
-			block_size = 1;
-			texel_pitch = 4;
-			break;
-		case GPUTEXTUREFORMAT_DXT1:
-		case GPUTEXTUREFORMAT_CTX1:
-			block_size = 4;
-			texel_pitch = 8;
-			break;
-		case GPUTEXTUREFORMAT_DXT2_3:
-		case GPUTEXTUREFORMAT_DXT4_5:
-			block_size = 4;
-			texel_pitch = 16;
-			break;
-		default: break;
-	}
-	
-	uint32_t block_width = floor((width/(float)block_size));
-	uint32_t block_height = floor((height/(float)block_size));
-	
-	for(uint32_t j = 0; j != block_height; ++j)
-	{
-		for(uint32_t i = 0; i != block_width; ++i)
-		{
-			uint32_t block_offset = j*block_width+i;
-
-			uint32_t x = x360_texture_address_2d_tiled_x(block_offset, block_width, texel_pitch);
-			uint32_t y = x360_texture_address_2d_tiled_y(block_offset, block_width, texel_pitch);
-			
-			uint32_t src_offset = j*block_width*texel_pitch + i*texel_pitch;
-			uint32_t dst_offset = y*block_width*texel_pitch + x*texel_pitch;
-			
-			if(dst_offset < input_size)
-				memcpy(&output_buffer[dst_offset], &input_buffer[src_offset], texel_pitch);
-		}
-	}
-}
-
-uint32_t x360_texture_address_2d_tiled_x(uint32_t offset, uint32_t width, uint32_t texel_pitch)
-{
-	uint32_t aligned_width = (width + 31) & ~31;
-
-	uint32_t LogBpp = (texel_pitch >> 2) + ((texel_pitch >> 1) >> (texel_pitch >> 2));
-	uint32_t OffsetB = offset << LogBpp;
-	uint32_t OffsetT = ((OffsetB & ~4095) >> 3) + ((OffsetB & 1792) >> 2) + (OffsetB & 63);
-	uint32_t OffsetM = OffsetT >> (7 + LogBpp);
-
-	uint32_t MacroX = ((OffsetM % (aligned_width >> 5)) << 2);
-	uint32_t Tile = ((((OffsetT >> (5 + LogBpp)) & 2) + (OffsetB >> 6)) & 3);
-	uint32_t Macro = (MacroX + Tile) << 3;
-	uint32_t Micro = ((((OffsetT >> 1) & ~15) + (OffsetT & 15)) & ((texel_pitch << 3) - 1)) >> LogBpp;
-
-	return (Macro + Micro);
-}
-
-uint32_t x360_texture_address_2d_tiled_y(uint32_t offset, uint32_t width, uint32_t texel_pitch)
-{
-    uint32_t aligned_width = (width + 31) & ~31;
-
-    uint32_t LogBpp = (texel_pitch >> 2) + ((texel_pitch >> 1) >> (texel_pitch >> 2));
-    uint32_t OffsetB = offset << LogBpp;
-    uint32_t OffsetT = ((OffsetB & ~4095) >> 3) + ((OffsetB & 1792) >> 2) + (OffsetB & 63);
-    uint32_t OffsetM = OffsetT >> (7 + LogBpp);
-
-    uint32_t MacroY = ((uint32_t)floor(OffsetM / (aligned_width >> 5)) << 2);
-    uint32_t Tile = ((OffsetT >> (6 + LogBpp)) & 1) + (((OffsetB & 2048) >> 10));
-    uint32_t Macro = (MacroY + Tile) << 3;
-    uint32_t Micro = ((((OffsetT & (((texel_pitch << 6) - 1) & ~31)) + ((OffsetT & 15) << 1)) >> (3 + LogBpp)) & ~1);
-
-    return (Macro + Micro + ((OffsetT & 16) >> 4));
-}
\ No newline at end of file
@@ -129,16 +129,55 @@ typedef struct
 	GPUTEXTURE_FETCH_CONSTANT format;
 } D3DBaseTexture;
 
+/*
+	Decodes the base level of an 8, 8_8_8_8 or DXT1/DXT3/DXT5 texture.
+	Tiled data is read with the same layout as x360_texture_to_dds().
+	`data` is not modified.
+	
+	Returns a pointer to IMAGE; NULL if the texture is not supported.
+*/
 IMAGE* x360_texture_to_image(const D3DBaseTexture xpr, uint8_t* data, const uint64_t data_size);
 
+/*
+	Rewrites a DXT1/DXT3/DXT5 texture as a DDS file, along with its mip chain.
+	Levels are untiled and byte swapped block by block, pixels are never decoded.
+	Mips that would be read past `data_size` are left out of the chain.
+	`data` is not modified.
+	
+	Returns a pointer to `dds_size` bytes of DDS file;
+	NULL if the texture is not a 2D DXT texture.
+*/
+uint8_t* x360_texture_to_dds(const D3DBaseTexture xpr, const uint8_t* data, const uint64_t data_size, uint64_t* dds_size);
+
+/*
+	Builds tiled texture data with its mip chain from a DDS file,
+	the inverse of x360_texture_to_dds().
+	DXT1/DXT3/DXT5, A8R8G8B8 and L8 are supported.
+	`xpr` is filled with the matching fetch constant,
+	mips are addressed relative to the start of the data.
+	
+	Returns a pointer to `data_size` bytes of texture data;
+	NULL if the format is not supported or the file is too short.
+*/
+uint8_t* x360_texture_from_dds(const uint8_t* dds_data, const uint64_t dds_size, D3DBaseTexture* xpr, uint64_t* data_size);
+
+/*
+	Swaps bytes of `size` bytes of data in place, as set in GPUTEXTURE_FETCH_CONSTANT.endian.
+*/
+void x360_texture_swap_endian(uint8_t* data, const uint64_t size, const uint8_t endian);
+
 uint32_t TiledOffset2DRow(uint32_t y, uint32_t width, uint32_t log2_bpp);
 uint32_t TiledOffset2DColumn(uint32_t x, uint32_t y, uint32_t log2_bpp, uint32_t base_offset);
-void Untile(const uint8_t* input_buffer, uint8_t* output_buffer,
-			const uint16_t width, const uint16_t height,
-			const uint32_t input_bytes_per_block, const uint32_t output_bytes_per_block,
-			const uint32_t pitch);
-			
-void x360_texture_untile(const uint32_t input_size, const uint8_t* input_buffer, uint8_t* output_buffer, const uint16_t width, const uint16_t height, GPUTEXTUREFORMAT format);
-
-uint32_t x360_texture_address_2d_tiled_x(uint32_t offset, uint32_t width, uint32_t texel_pitch);
-uint32_t x360_texture_address_2d_tiled_y(uint32_t offset, uint32_t width, uint32_t texel_pitch);
\ No newline at end of file
+
+/*
+	Size of a tiled surface, padded to 32x32 blocks and 4KB.
+	Returns the size in bytes; 0 if the format can't be tiled.
+*/
+uint64_t x360_texture_tiled_size(const uint16_t width, const uint16_t height, GPUTEXTUREFORMAT format);
+
+/*
+	Tiles a single 8, 8_8_8_8 or DXT1/3/5 level, with the pitch padded to 32 blocks.
+	`output_buffer` has to hold x360_texture_tiled_size() bytes,
+	nothing is written past `output_size`.
+*/
+void x360_texture_tile(const uint32_t output_size, const uint8_t* input_buffer, uint8_t* output_buffer, const uint16_t width, const uint16_t height, GPUTEXTUREFORMAT format);
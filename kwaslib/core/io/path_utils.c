@@ -9,14 +9,14 @@
 int pu_is_file(const char* path)
 {
     struct stat st;
-    stat(path, &st);
+    if(stat(path, &st) != 0) return 0;
     return S_ISREG(st.st_mode);
 }
 
 int pu_is_dir(const char* path)
 {
     struct stat st;
-    stat(path, &st);
+    if(stat(path, &st) != 0) return 0;
     return S_ISDIR(st.st_mode);
 }
 
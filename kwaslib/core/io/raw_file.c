@@ -0,0 +1,404 @@
+#if defined(__linux__)
+#define _GNU_SOURCE /* copy_file_range */
+#endif
+
+#include "raw_file.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#if defined(__WIN32__) || defined(__MINGW32__)
+#include <io.h>
+#include <windows.h>
+#else
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+#include "file_utils.h"
+
+RF_FILE* rf_open(const char* path, const uint8_t mode)
+{
+    int flags = O_RDONLY;
+
+    if(mode == RF_WRITE) flags = O_RDWR | O_CREAT | O_TRUNC;
+    if(mode == RF_UPDATE) flags = O_RDWR;
+
+#if defined(__WIN32__) || defined(__MINGW32__)
+    flags |= O_BINARY;
+    const int fd = open(path, flags, S_IREAD | S_IWRITE);
+#else
+    const int fd = open(path, flags, 0644);
+#endif
+
+    if(fd < 0)
+    {
+        return NULL;
+    }
+
+    RF_FILE* rf = (RF_FILE*)calloc(1, sizeof(RF_FILE));
+    rf->fd = fd;
+    rf->writeable = (mode != RF_READ);
+
+    if(mode != RF_WRITE)
+    {
+        rf->size = fu_get_file_size(path);
+    }
+
+    return rf;
+}
+
+RF_FILE* rf_close(RF_FILE* rf)
+{
+    if(rf)
+    {
+        close(rf->fd);
+        free(rf);
+    }
+
+    return NULL;
+}
+
+uint8_t rf_pread(RF_FILE* rf, uint8_t* out, const uint64_t size, const uint64_t offset)
+{
+    uint64_t done = 0;
+
+    while(done != size)
+    {
+        const uint64_t left = size - done;
+        const uint32_t req = (left > 0x40000000) ? 0x40000000 : left;
+
+#if defined(__WIN32__) || defined(__MINGW32__)
+        OVERLAPPED ov = {0};
+        const uint64_t pos = offset + done;
+        ov.Offset = (DWORD)(pos & 0xFFFFFFFF);
+        ov.OffsetHigh = (DWORD)(pos >> 32);
+        DWORD ret = 0;
+
+        if(ReadFile((HANDLE)_get_osfhandle(rf->fd), &out[done], req, &ret, &ov) == 0)
+        {
+            return FU_ERROR;
+        }
+#else
+        const ssize_t ret = pread(rf->fd, &out[done], req, offset + done);
+
+        if(ret < 0)
+        {
+            return FU_ERROR;
+        }
+#endif
+
+        /* Read past the end of file */
+        if(ret == 0)
+        {
+            return FU_ERROR;
+        }
+
+        done += ret;
+    }
+
+    return FU_SUCCESS;
+}
+
+uint8_t rf_pwrite(RF_FILE* rf, const uint8_t* data, const uint64_t size, const uint64_t offset)
+{
+    if(rf->writeable == 0)
+    {
+        return FU_ERROR;
+    }
+
+    uint64_t done = 0;
+
+    while(done != size)
+    {
+        const uint64_t left = size - done;
+        const uint32_t req = (left > 0x40000000) ? 0x40000000 : left;
+
+#if defined(__WIN32__) || defined(__MINGW32__)
+        OVERLAPPED ov = {0};
+        const uint64_t pos = offset + done;
+        ov.Offset = (DWORD)(pos & 0xFFFFFFFF);
+        ov.OffsetHigh = (DWORD)(pos >> 32);
+        DWORD ret = 0;
+
+        if(WriteFile((HANDLE)_get_osfhandle(rf->fd), &data[done], req, &ret, &ov) == 0)
+        {
+            return FU_ERROR;
+        }
+#else
+        const ssize_t ret = pwrite(rf->fd, &data[done], req, offset + done);
+
+        if(ret <= 0)
+        {
+            return FU_ERROR;
+        }
+#endif
+
+        done += ret;
+    }
+
+    /* Writers on other threads can grow the size too */
+    const uint64_t end = offset + size;
+    uint64_t cur = __atomic_load_n(&rf->size, __ATOMIC_RELAXED);
+
+    while((end > cur)
+          && (__atomic_compare_exchange_n(&rf->size, &cur, end, 1,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED) == 0))
+    {
+    }
+
+    return FU_SUCCESS;
+}
+
+uint8_t rf_set_size(RF_FILE* rf, const uint64_t size)
+{
+    if(rf->writeable == 0)
+    {
+        return FU_ERROR;
+    }
+
+#if defined(__WIN32__) || defined(__MINGW32__)
+    const int ret = _chsize_s(rf->fd, size);
+#else
+    const int ret = ftruncate(rf->fd, size);
+#endif
+
+    if(ret != 0)
+    {
+        return FU_ERROR;
+    }
+
+    rf->size = size;
+
+    return FU_SUCCESS;
+}
+
+static RF_MAP* rf_map_file(const char* path, const uint8_t writeable)
+{
+    const uint64_t size = fu_get_file_size(path);
+
+    if(size == 0)
+    {
+        return NULL;
+    }
+
+#if defined(__WIN32__) || defined(__MINGW32__)
+    const DWORD access = writeable ? (GENERIC_READ | GENERIC_WRITE) : GENERIC_READ;
+    HANDLE file = CreateFileA(path, access, FILE_SHARE_READ, NULL,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+
+    if(file == INVALID_HANDLE_VALUE)
+    {
+        return NULL;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, NULL, writeable ? PAGE_READWRITE : PAGE_READONLY,
+                                        0, 0, NULL);
+    CloseHandle(file);
+
+    if(mapping == NULL)
+    {
+        return NULL;
+    }
+
+    uint8_t* data = (uint8_t*)MapViewOfFile(mapping, writeable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, 0);
+
+    if(data == NULL)
+    {
+        CloseHandle(mapping);
+        return NULL;
+    }
+#else
+    const int fd = open(path, writeable ? O_RDWR : O_RDONLY);
+
+    if(fd < 0)
+    {
+        return NULL;
+    }
+
+    void* ptr = mmap(NULL, size, writeable ? (PROT_READ | PROT_WRITE) : PROT_READ,
+                     MAP_SHARED, fd, 0);
+    close(fd);
+
+    if(ptr == MAP_FAILED)
+    {
+        return NULL;
+    }
+
+    uint8_t* data = (uint8_t*)ptr;
+    void* mapping = NULL;
+#endif
+
+    RF_MAP* map = (RF_MAP*)calloc(1, sizeof(RF_MAP));
+    map->data = data;
+    map->size = size;
+    map->writeable = writeable;
+    map->handle = mapping;
+
+    return map;
+}
+
+RF_MAP* rf_map(const char* path)
+{
+    return rf_map_file(path, 0);
+}
+
+RF_MAP* rf_map_rw(const char* path)
+{
+    return rf_map_file(path, 1);
+}
+
+RF_MAP* rf_unmap(RF_MAP* map)
+{
+    if(map)
+    {
+#if defined(__WIN32__) || defined(__MINGW32__)
+        if(map->writeable)
+        {
+            FlushViewOfFile((LPCVOID)map->data, 0);
+        }
+
+        UnmapViewOfFile((LPCVOID)map->data);
+        CloseHandle((HANDLE)map->handle);
+#else
+        if(map->writeable)
+        {
+            msync(map->data, map->size, MS_SYNC);
+        }
+
+        munmap(map->data, map->size);
+#endif
+        free(map);
+    }
+
+    return NULL;
+}
+
+uint8_t rf_write_source(RF_FILE* rf, const uint64_t offset, const RF_SOURCE* src)
+{
+    if(src->size == 0)
+    {
+        return FU_SUCCESS;
+    }
+
+    switch(src->type)
+    {
+        case RF_SOURCE_BUFFER:
+            return rf_pwrite(rf, src->data, src->size, offset);
+        case RF_SOURCE_PATH:
+        case RF_SOURCE_FUNC:
+            break;
+        default:
+            return FU_ERROR;
+    }
+
+    RF_FILE* in = NULL;
+
+    if(src->type == RF_SOURCE_PATH)
+    {
+        in = rf_open(src->path, RF_READ);
+
+        if(in == NULL)
+        {
+            return FU_ERROR;
+        }
+    }
+
+    const uint64_t chunk_size = (src->size < RF_CHUNK_SIZE) ? src->size : RF_CHUNK_SIZE;
+    uint8_t* chunk = (uint8_t*)malloc(chunk_size);
+    uint8_t status = FU_SUCCESS;
+
+    for(uint64_t done = 0; done < src->size; done += chunk_size)
+    {
+        const uint64_t left = src->size - done;
+        const uint64_t req = (left < chunk_size) ? left : chunk_size;
+
+        if(in)
+        {
+            status = rf_pread(in, chunk, req, src->path_offset + done);
+        }
+        else
+        {
+            status = src->func(src->user, chunk, done, req);
+        }
+
+        if(status != FU_SUCCESS)
+        {
+            break;
+        }
+
+        status = rf_pwrite(rf, chunk, req, offset + done);
+
+        if(status != FU_SUCCESS)
+        {
+            break;
+        }
+    }
+
+    free(chunk);
+    in = rf_close(in);
+
+    return status;
+}
+
+uint8_t rf_copy_to_fd(RF_FILE* rf, const uint64_t offset, const uint64_t size, const int fd)
+{
+    uint64_t done = 0;
+
+#if defined(__linux__)
+    /* Falls back to reads on old kernels, pipes and across filesystems */
+    while(done != size)
+    {
+        loff_t in_pos = offset + done;
+        const uint64_t left = size - done;
+        const ssize_t ret = copy_file_range(rf->fd, &in_pos, fd, NULL,
+                                            (left > 0x40000000) ? 0x40000000 : left, 0);
+
+        if(ret <= 0)
+        {
+            break;
+        }
+
+        done += ret;
+    }
+#endif
+
+    if(done == size)
+    {
+        return FU_SUCCESS;
+    }
+
+    const uint64_t chunk_size = ((size - done) < RF_CHUNK_SIZE) ? (size - done) : RF_CHUNK_SIZE;
+    uint8_t* chunk = (uint8_t*)malloc(chunk_size);
+    uint8_t status = FU_SUCCESS;
+
+    while((done != size) && (status == FU_SUCCESS))
+    {
+        const uint64_t left = size - done;
+        const uint64_t req = (left < chunk_size) ? left : chunk_size;
+
+        status = rf_pread(rf, chunk, req, offset + done);
+
+        for(uint64_t written = 0; (written != req) && (status == FU_SUCCESS);)
+        {
+            const int ret = write(fd, &chunk[written], req - written);
+
+            if(ret <= 0)
+            {
+                status = FU_ERROR;
+            }
+            else
+            {
+                written += ret;
+            }
+        }
+
+        done += req;
+    }
+
+    free(chunk);
+
+    return status;
+}
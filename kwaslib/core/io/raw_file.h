@@ -0,0 +1,186 @@
+#pragma once
+
+#if defined(__unix__) || defined(__linux__)
+#define _FILE_OFFSET_BITS 64
+#endif
+
+/*
+    Positional file I/O.
+
+    Reads and writes at absolute offsets without moving a shared
+    file position, so writers can emit sections in any order and
+    leave padding as holes (which read back as zeros).
+
+    rf_pread(), rf_pwrite() and rf_write_source() can be called
+    on the same RF_FILE from many threads at once, as long as
+    the written ranges don't overlap. rf_set_size() and rf_close()
+    can't run next to any other call on that RF_FILE.
+*/
+
+#include <stdint.h>
+
+#define RF_READ                 (uint8_t)(0)
+#define RF_WRITE                (uint8_t)(1) /* Creates or truncates the file */
+#define RF_UPDATE               (uint8_t)(2) /* Reads and writes an existing file */
+
+#define RF_CHUNK_SIZE           (uint64_t)(1024*1024)
+
+#define RF_SOURCE_NONE          (uint8_t)(0)
+#define RF_SOURCE_BUFFER        (uint8_t)(1)
+#define RF_SOURCE_PATH          (uint8_t)(2)
+#define RF_SOURCE_FUNC          (uint8_t)(3)
+
+typedef struct
+{
+    int fd;
+    uint8_t writeable;
+    uint64_t size;      /* Current size of the file */
+} RF_FILE;
+
+/*
+    View of a whole file.
+    Writes to `data` go straight to the file if it was mapped with rf_map_rw().
+*/
+typedef struct
+{
+    uint8_t* data;      /* Read-only unless `writeable` */
+    uint64_t size;
+    uint8_t writeable;
+    void* handle;       /* Mapping handle on Windows */
+} RF_MAP;
+
+/*
+    Callback for RF_SOURCE_FUNC.
+    Has to fill `out` with `size` bytes starting at `offset` of the payload.
+
+    Returns FU_SUCCESS on success, FU_ERROR otherwise.
+*/
+typedef uint8_t (*RF_SOURCE_FUNC_PTR)(void* user, uint8_t* out,
+                                      const uint64_t offset, const uint64_t size);
+
+/*
+    Where the payload of an archive entry comes from.
+*/
+typedef struct
+{
+    uint8_t type;               /* RF_SOURCE_* */
+    uint64_t size;
+
+    const uint8_t* data;        /* RF_SOURCE_BUFFER, can be a mapped file */
+
+    const char* path;           /* RF_SOURCE_PATH */
+    uint64_t path_offset;       /* Offset of the payload in the file */
+
+    RF_SOURCE_FUNC_PTR func;    /* RF_SOURCE_FUNC */
+    void* user;
+} RF_SOURCE;
+
+/*
+    Opens a file for positional I/O.
+
+    Returns NULL on error.
+*/
+RF_FILE* rf_open(const char* path, const uint8_t mode);
+
+/*
+    Closes the file and frees the structure.
+
+    Returns NULL.
+*/
+RF_FILE* rf_close(RF_FILE* rf);
+
+/*
+    Reads exactly `size` bytes at `offset`.
+
+    Returns FU_SUCCESS on success, FU_ERROR otherwise.
+*/
+uint8_t rf_pread(RF_FILE* rf, uint8_t* out, const uint64_t size, const uint64_t offset);
+
+/*
+    Writes exactly `size` bytes at `offset`.
+    Gaps left behind the previous end of file read back as zeros.
+
+    Returns FU_SUCCESS on success, FU_ERROR otherwise.
+*/
+uint8_t rf_pwrite(RF_FILE* rf, const uint8_t* data, const uint64_t size, const uint64_t offset);
+
+/*
+    Truncates or extends the file to `size`.
+    Extended part is a hole/zeros.
+
+    Returns FU_SUCCESS on success, FU_ERROR otherwise.
+*/
+uint8_t rf_set_size(RF_FILE* rf, const uint64_t size);
+
+/*
+    Maps the whole file read-only.
+    Pages are loaded on access, so the file is never read as a whole.
+
+    Returns NULL on error or if the file is empty.
+*/
+RF_MAP* rf_map(const char* path);
+
+/*
+    Maps the whole file for reading and writing.
+    File size can't change through the mapping.
+
+    Returns NULL on error or if the file is empty.
+*/
+RF_MAP* rf_map_rw(const char* path);
+
+/*
+    Unmaps the file and frees the structure.
+    Changes of a writeable mapping are flushed to the file.
+
+    Returns NULL.
+*/
+RF_MAP* rf_unmap(RF_MAP* map);
+
+/*
+    Copies the payload from `src` to `offset` in `rf`,
+    RF_CHUNK_SIZE bytes at a time.
+
+    Returns FU_SUCCESS on success, FU_ERROR otherwise.
+*/
+uint8_t rf_write_source(RF_FILE* rf, const uint64_t offset, const RF_SOURCE* src);
+
+/*
+    Appends `size` bytes from `offset` of `rf` to the descriptor `fd`,
+    at its current position. Uses copy_file_range() when it can,
+    so the data doesn't pass through user space.
+
+    Returns FU_SUCCESS on success, FU_ERROR otherwise.
+*/
+uint8_t rf_copy_to_fd(RF_FILE* rf, const uint64_t offset, const uint64_t size, const int fd);
+
+/*
+    Source constructors
+*/
+static inline RF_SOURCE rf_source_buffer(const uint8_t* data, const uint64_t size)
+{
+    RF_SOURCE src = {0};
+    src.type = RF_SOURCE_BUFFER;
+    src.size = size;
+    src.data = data;
+    return src;
+}
+
+static inline RF_SOURCE rf_source_path(const char* path, const uint64_t offset, const uint64_t size)
+{
+    RF_SOURCE src = {0};
+    src.type = RF_SOURCE_PATH;
+    src.size = size;
+    src.path = path;
+    src.path_offset = offset;
+    return src;
+}
+
+static inline RF_SOURCE rf_source_func(RF_SOURCE_FUNC_PTR func, void* user, const uint64_t size)
+{
+    RF_SOURCE src = {0};
+    src.type = RF_SOURCE_FUNC;
+    src.size = size;
+    src.func = func;
+    src.user = user;
+    return src;
+}
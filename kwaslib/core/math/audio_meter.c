@@ -0,0 +1,322 @@
+#include "audio_meter.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+/* 4 lanes, works the same with SSE2 and NEON */
+typedef float AM_V4F __attribute__((vector_size(16)));
+typedef int32_t AM_V4I __attribute__((vector_size(16)));
+
+/*
+    BS.1770 filters, derived for any sample rate
+    https://github.com/jiixyj/libebur128/blob/master/ebur128/ebur128.c
+*/
+static void am_init_filters(AM_METER* meter)
+{
+    const double rate = meter->sample_rate;
+    
+    /* High shelf, +4 dB */
+    double f0 = 1681.974450955533;
+    double q = 0.7071752369554196;
+    const double vh = pow(10.0, 3.999843853973347/20.0);
+    const double vb = pow(vh, 0.4996667741545416);
+    double k = tan(M_PI*f0/rate);
+    double a0 = 1.0 + k/q + k*k;
+    
+    meter->shelf[0] = (vh + vb*k/q + k*k)/a0;
+    meter->shelf[1] = 2.0*(k*k - vh)/a0;
+    meter->shelf[2] = (vh - vb*k/q + k*k)/a0;
+    meter->shelf[3] = 2.0*(k*k - 1.0)/a0;
+    meter->shelf[4] = (1.0 - k/q + k*k)/a0;
+    
+    /* High pass, RLB */
+    f0 = 38.13547087602444;
+    q = 0.5003270373238773;
+    k = tan(M_PI*f0/rate);
+    a0 = 1.0 + k/q + k*k;
+    
+    meter->highpass[0] = 1.0;
+    meter->highpass[1] = -2.0;
+    meter->highpass[2] = 1.0;
+    meter->highpass[3] = 2.0*(k*k - 1.0)/a0;
+    meter->highpass[4] = (1.0 - k/q + k*k)/a0;
+}
+
+AM_METER* am_create(const uint8_t channel_count, const uint32_t sample_rate)
+{
+    if((channel_count == 0) || (sample_rate < 1000))
+    {
+        return NULL;
+    }
+    
+    AM_METER* meter = (AM_METER*)calloc(1, sizeof(AM_METER));
+    meter->channel_count = channel_count;
+    meter->sample_rate = sample_rate;
+    meter->step_samples = (uint64_t)sample_rate*AM_STEP_MS/1000;
+    meter->state = (double*)calloc(channel_count*4, sizeof(double));
+    meter->weights = (double*)calloc(channel_count, sizeof(double));
+    meter->step_power = (double*)calloc(channel_count, sizeof(double));
+    meter->sum = (double*)calloc(channel_count, sizeof(double));
+    meter->steps = cvec_create(sizeof(double));
+    meter->work = (float*)malloc(meter->step_samples*sizeof(float));
+    
+    /* 5.1 has LFE skipped and surrounds at +1.5 dB */
+    for(uint32_t c = 0; c != channel_count; ++c)
+    {
+        meter->weights[c] = 1.0;
+    }
+    
+    if(channel_count == 6)
+    {
+        meter->weights[3] = 0.0;
+        meter->weights[4] = 1.41;
+        meter->weights[5] = 1.41;
+    }
+    
+    am_init_filters(meter);
+    
+    return meter;
+}
+
+AM_METER* am_free(AM_METER* meter)
+{
+    if(meter)
+    {
+        meter->steps = cvec_destroy(meter->steps);
+        free(meter->work);
+        free(meter->sum);
+        free(meter->step_power);
+        free(meter->weights);
+        free(meter->state);
+        free(meter);
+    }
+    
+    return NULL;
+}
+
+static double am_biquad(const double* f, double* z, const double x)
+{
+    /* Transposed direct form II */
+    const double y = f[0]*x + z[0];
+    z[0] = f[1]*x - f[3]*y + z[1];
+    z[1] = f[2]*x - f[4]*y;
+    return y;
+}
+
+/* Plain statistics of `count` samples, vector accumulators over 4 lanes */
+static void am_measure_plain(AM_METER* meter, const uint32_t channel, const float* x, const uint32_t count)
+{
+    const AM_V4F one = {1.0f, 1.0f, 1.0f, 1.0f};
+    AM_V4F vpeak = {0};
+    AM_V4F vsum = {0};
+    AM_V4F vsq = {0};
+    AM_V4I vclip = {0};
+    uint32_t i = 0;
+    
+    for(; (i + 4) <= count; i += 4)
+    {
+        AM_V4F v;
+        memcpy(&v, &x[i], sizeof(AM_V4F));
+        
+        /* Clearing the sign bit */
+        const AM_V4F a = (AM_V4F)((AM_V4I)v & 0x7FFFFFFF);
+        const AM_V4I bigger = a > vpeak;
+        vpeak = (AM_V4F)(((AM_V4I)a & bigger) | ((AM_V4I)vpeak & ~bigger));
+        
+        vsum += v;
+        vsq += v*v;
+        vclip -= a >= one*(32767.0f/32768.0f);
+    }
+    
+    float peak = 0.0f;
+    double sum = 0.0;
+    double sum_sq = 0.0;
+    uint64_t clipped = 0;
+    
+    for(uint32_t l = 0; l != 4; ++l)
+    {
+        if(vpeak[l] > peak) peak = vpeak[l];
+        sum += vsum[l];
+        sum_sq += vsq[l];
+        clipped += vclip[l];
+    }
+    
+    for(; i != count; ++i)
+    {
+        const float a = fabsf(x[i]);
+        if(a > peak) peak = a;
+        sum += x[i];
+        sum_sq += x[i]*x[i];
+        clipped += (a >= (32767.0f/32768.0f));
+    }
+    
+    if(peak > meter->peak) meter->peak = peak;
+    meter->sum[channel] += sum;
+    meter->sum_sq += sum_sq;
+    meter->clipped += clipped;
+}
+
+static double am_square_sum(const float* x, const uint32_t count)
+{
+    AM_V4F vsq = {0};
+    uint32_t i = 0;
+    
+    for(; (i + 4) <= count; i += 4)
+    {
+        AM_V4F v;
+        memcpy(&v, &x[i], sizeof(AM_V4F));
+        vsq += v*v;
+    }
+    
+    double sum_sq = (double)vsq[0] + vsq[1] + vsq[2] + vsq[3];
+    
+    for(; i != count; ++i)
+    {
+        sum_sq += x[i]*x[i];
+    }
+    
+    return sum_sq;
+}
+
+void am_feed(AM_METER* meter, const int16_t* pcm, const uint32_t sample_count)
+{
+    const uint32_t channels = meter->channel_count;
+    uint32_t done = 0;
+    
+    /* Pieces never cross a gating step */
+    while(done != sample_count)
+    {
+        uint32_t count = meter->step_samples - meter->step_pos;
+        if(count > (sample_count - done)) count = sample_count - done;
+        
+        for(uint32_t c = 0; c != channels; ++c)
+        {
+            const int16_t* in = &pcm[(uint64_t)done*channels + c];
+            float* x = meter->work;
+            
+            for(uint32_t i = 0; i != count; ++i)
+            {
+                x[i] = in[(uint64_t)i*channels]*(1.0f/32768.0f);
+            }
+            
+            am_measure_plain(meter, c, x, count);
+            
+            /* K-weighting is recursive, so it stays scalar */
+            double* z = &meter->state[c*4];
+            
+            for(uint32_t i = 0; i != count; ++i)
+            {
+                x[i] = am_biquad(meter->highpass, &z[2], am_biquad(meter->shelf, z, x[i]));
+            }
+            
+            meter->step_power[c] += am_square_sum(x, count);
+        }
+        
+        meter->step_pos += count;
+        meter->sample_count += count;
+        done += count;
+        
+        if(meter->step_pos == meter->step_samples)
+        {
+            double power = 0.0;
+            
+            for(uint32_t c = 0; c != channels; ++c)
+            {
+                power += meter->weights[c]*meter->step_power[c]/meter->step_samples;
+                meter->step_power[c] = 0.0;
+            }
+            
+            cvec_push_back(meter->steps, &power);
+            meter->step_pos = 0;
+        }
+    }
+}
+
+double am_to_db(const double value)
+{
+    return (value > 0.0) ? 20.0*log10(value) : -INFINITY;
+}
+
+static double am_power_to_lufs(const double power)
+{
+    return (power > 0.0) ? (-0.691 + 10.0*log10(power)) : -INFINITY;
+}
+
+void am_get_result(AM_METER* meter, AM_RESULT* result)
+{
+    memset(result, 0, sizeof(AM_RESULT));
+    result->peak = meter->peak;
+    result->clipped = meter->clipped;
+    result->sample_count = meter->sample_count;
+    result->integrated = -INFINITY;
+    
+    if(meter->sample_count == 0)
+    {
+        return;
+    }
+    
+    result->rms = sqrt(meter->sum_sq/((double)meter->sample_count*meter->channel_count));
+    
+    for(uint32_t c = 0; c != meter->channel_count; ++c)
+    {
+        const double dc = fabs(meter->sum[c]/meter->sample_count);
+        if(dc > result->dc_offset) result->dc_offset = dc;
+    }
+    
+    /* Gating blocks out of overlapping steps */
+    const uint64_t steps = cvec_size(meter->steps);
+    
+    if(steps < AM_GATE_STEPS)
+    {
+        return;
+    }
+    
+    const double* step = (const double*)cvec_data(meter->steps);
+    const uint64_t block_count = steps - AM_GATE_STEPS + 1;
+    double* blocks = (double*)malloc(block_count*sizeof(double));
+    
+    for(uint64_t i = 0; i != block_count; ++i)
+    {
+        blocks[i] = 0.0;
+        
+        for(uint32_t j = 0; j != AM_GATE_STEPS; ++j)
+        {
+            blocks[i] += step[i + j];
+        }
+        
+        blocks[i] /= AM_GATE_STEPS;
+    }
+    
+    double gate = 0.0;
+    
+    for(uint32_t pass = 0; pass != 2; ++pass)
+    {
+        const double threshold = pass ? gate : AM_ABSOLUTE_GATE;
+        double sum = 0.0;
+        uint64_t count = 0;
+        
+        for(uint64_t i = 0; i != block_count; ++i)
+        {
+            if(am_power_to_lufs(blocks[i]) > threshold)
+            {
+                sum += blocks[i];
+                count += 1;
+            }
+        }
+        
+        if(count == 0)
+        {
+            break;
+        }
+        
+        gate = am_power_to_lufs(sum/count) + AM_RELATIVE_GATE;
+        
+        if(pass)
+        {
+            result->integrated = am_power_to_lufs(sum/count);
+        }
+    }
+    
+    free(blocks);
+}
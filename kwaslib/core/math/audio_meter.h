@@ -0,0 +1,90 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <kwaslib/core/data/cvector.h>
+
+/*
+    Level measurement of 16-bit PCM, fed in chunks.
+    
+    Loudness follows ITU-R BS.1770-4 / EBU R128: K-weighting,
+    400 ms gating blocks with 75% overlap, -70 LUFS absolute
+    and -10 LU relative gate.
+*/
+
+/*
+    Defines
+*/
+#define AM_STEP_MS          (uint32_t)(100)     /* Gating block hop */
+#define AM_GATE_STEPS       (uint32_t)(4)       /* Steps per gating block */
+#define AM_ABSOLUTE_GATE    (double)(-70.0)
+#define AM_RELATIVE_GATE    (double)(-10.0)
+
+/*
+    Types
+*/
+typedef struct
+{
+    double peak;            /* Largest absolute sample, 1.0 is full scale */
+    double rms;             /* Over all channels, 1.0 is full scale */
+    double dc_offset;       /* Largest absolute channel mean, 1.0 is full scale */
+    double integrated;      /* LUFS, -INFINITY if everything got gated */
+    uint64_t clipped;       /* Samples at full scale */
+    uint64_t sample_count;  /* Per channel */
+} AM_RESULT;
+
+typedef struct
+{
+    uint8_t channel_count;
+    uint32_t sample_rate;
+    uint32_t step_samples;  /* Samples per channel in AM_STEP_MS */
+    uint32_t step_pos;
+    
+    double shelf[5];        /* K-weighting biquads, b0 b1 b2 a1 a2 */
+    double highpass[5];
+    double* state;          /* Four per channel */
+    double* weights;        /* Channel weight of the loudness sum */
+    double* step_power;     /* K-weighted square sum of the current step, per channel */
+    double* sum;            /* Per channel */
+    double sum_sq;
+    
+    float peak;
+    uint64_t clipped;
+    uint64_t sample_count;
+    
+    CVEC steps;             /* double, weighted mean square of every finished step */
+    float* work;            /* step_samples floats */
+} AM_METER;
+
+/*
+    Implementation
+*/
+
+/*
+    Allocates a meter for interleaved PCM of `channel_count` channels.
+    
+    Returns a pointer to the meter, NULL on bad parameters.
+*/
+AM_METER* am_create(const uint8_t channel_count, const uint32_t sample_rate);
+
+/*
+    Frees the meter.
+    
+    Returns NULL.
+*/
+AM_METER* am_free(AM_METER* meter);
+
+/*
+    Measures `sample_count` samples per channel of interleaved PCM.
+*/
+void am_feed(AM_METER* meter, const int16_t* pcm, const uint32_t sample_count);
+
+/*
+    Fills `result` with the measurements of everything fed so far.
+*/
+void am_get_result(AM_METER* meter, AM_RESULT* result);
+
+/*
+    Returns `value` in dB, -INFINITY for 0.
+*/
+double am_to_db(const double value);
@@ -0,0 +1,271 @@
+#include "thread_pool.h"
+
+#include <stdlib.h>
+#include <pthread.h>
+
+#if defined(__WIN32__) || defined(__MINGW32__)
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+typedef struct TP_TASK TP_TASK;
+
+struct TP_TASK
+{
+    TP_TASK_FUNC func;
+    void* arg;
+    TP_TASK* next;
+};
+
+struct TP_POOL
+{
+    pthread_t* threads;
+    uint32_t thread_count;
+
+    pthread_mutex_t lock;
+    pthread_cond_t task_ready;
+    pthread_cond_t idle;
+
+    TP_TASK* head;
+    TP_TASK* tail;
+    uint32_t running;
+    uint8_t stop;
+};
+
+typedef struct
+{
+    TP_FOR_FUNC func;
+    void* user;
+    uint64_t count;
+    uint64_t next;
+    pthread_mutex_t lock;
+} TP_FOR_CTX;
+
+static void* tp_worker(void* arg)
+{
+    TP_POOL* pool = (TP_POOL*)arg;
+
+    while(1)
+    {
+        pthread_mutex_lock(&pool->lock);
+
+        while((pool->head == NULL) && (pool->stop == 0))
+        {
+            pthread_cond_wait(&pool->task_ready, &pool->lock);
+        }
+
+        if(pool->head == NULL) /* Stopping */
+        {
+            pthread_mutex_unlock(&pool->lock);
+            break;
+        }
+
+        TP_TASK* task = pool->head;
+        pool->head = task->next;
+        if(pool->head == NULL) pool->tail = NULL;
+        pool->running += 1;
+
+        pthread_mutex_unlock(&pool->lock);
+
+        task->func(task->arg);
+        free(task);
+
+        pthread_mutex_lock(&pool->lock);
+        pool->running -= 1;
+
+        if((pool->head == NULL) && (pool->running == 0))
+        {
+            pthread_cond_broadcast(&pool->idle);
+        }
+
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    return NULL;
+}
+
+uint32_t tp_get_cpu_count()
+{
+#if defined(__WIN32__) || defined(__MINGW32__)
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    const long count = si.dwNumberOfProcessors;
+#else
+    const long count = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+
+    return (count > 0) ? (uint32_t)count : 1;
+}
+
+TP_POOL* tp_create(const uint32_t thread_count)
+{
+    TP_POOL* pool = (TP_POOL*)calloc(1, sizeof(TP_POOL));
+
+    if(pool == NULL)
+    {
+        return NULL;
+    }
+
+    pool->thread_count = thread_count ? thread_count : tp_get_cpu_count();
+    pool->threads = (pthread_t*)calloc(pool->thread_count, sizeof(pthread_t));
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->task_ready, NULL);
+    pthread_cond_init(&pool->idle, NULL);
+
+    /* Only the workers that started get joined later */
+    uint32_t started = 0;
+
+    for(uint32_t i = 0; i != pool->thread_count; ++i)
+    {
+        if(pthread_create(&pool->threads[started], NULL, tp_worker, pool) == 0)
+        {
+            started += 1;
+        }
+    }
+
+    pool->thread_count = started;
+
+    /* Tasks would never run */
+    if(started == 0)
+    {
+        return tp_destroy(pool);
+    }
+
+    return pool;
+}
+
+TP_POOL* tp_destroy(TP_POOL* pool)
+{
+    if(pool)
+    {
+        tp_wait(pool);
+
+        pthread_mutex_lock(&pool->lock);
+        pool->stop = 1;
+        pthread_cond_broadcast(&pool->task_ready);
+        pthread_mutex_unlock(&pool->lock);
+
+        for(uint32_t i = 0; i != pool->thread_count; ++i)
+        {
+            pthread_join(pool->threads[i], NULL);
+        }
+
+        pthread_cond_destroy(&pool->idle);
+        pthread_cond_destroy(&pool->task_ready);
+        pthread_mutex_destroy(&pool->lock);
+
+        free(pool->threads);
+        free(pool);
+    }
+
+    return NULL;
+}
+
+void tp_push(TP_POOL* pool, TP_TASK_FUNC func, void* arg)
+{
+    TP_TASK* task = (TP_TASK*)calloc(1, sizeof(TP_TASK));
+    task->func = func;
+    task->arg = arg;
+
+    pthread_mutex_lock(&pool->lock);
+
+    if(pool->tail) pool->tail->next = task;
+    else pool->head = task;
+    pool->tail = task;
+
+    pthread_cond_signal(&pool->task_ready);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void tp_wait(TP_POOL* pool)
+{
+    pthread_mutex_lock(&pool->lock);
+
+    while((pool->head != NULL) || (pool->running != 0))
+    {
+        pthread_cond_wait(&pool->idle, &pool->lock);
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+}
+
+uint32_t tp_get_thread_count(TP_POOL* pool)
+{
+    return pool->thread_count;
+}
+
+static void* tp_for_worker(void* arg)
+{
+    TP_FOR_CTX* ctx = (TP_FOR_CTX*)arg;
+
+    while(1)
+    {
+        pthread_mutex_lock(&ctx->lock);
+        const uint64_t index = ctx->next;
+        ctx->next += 1;
+        pthread_mutex_unlock(&ctx->lock);
+
+        if(index >= ctx->count)
+        {
+            break;
+        }
+
+        ctx->func(ctx->user, index);
+    }
+
+    return NULL;
+}
+
+void tp_parallel_for(const uint64_t count, const uint32_t thread_count,
+                     TP_FOR_FUNC func, void* user)
+{
+    uint32_t threads = thread_count ? thread_count : tp_get_cpu_count();
+
+    if(threads > count)
+    {
+        threads = count;
+    }
+
+    /* Not worth spawning anything */
+    if(threads <= 1)
+    {
+        for(uint64_t i = 0; i != count; ++i)
+        {
+            func(user, i);
+        }
+
+        return;
+    }
+
+    TP_FOR_CTX ctx = {0};
+    ctx.func = func;
+    ctx.user = user;
+    ctx.count = count;
+    pthread_mutex_init(&ctx.lock, NULL);
+
+    /* Calling thread is one of the workers */
+    pthread_t* workers = (pthread_t*)calloc(threads-1, sizeof(pthread_t));
+
+    uint32_t started = 0;
+
+    for(uint32_t i = 0; i != (threads-1); ++i)
+    {
+        if(pthread_create(&workers[started], NULL, tp_for_worker, &ctx) == 0)
+        {
+            started += 1;
+        }
+    }
+
+    /* Takes whatever the workers that failed to start would have done */
+    tp_for_worker(&ctx);
+
+    for(uint32_t i = 0; i != started; ++i)
+    {
+        pthread_join(workers[i], NULL);
+    }
+
+    free(workers);
+    pthread_mutex_destroy(&ctx.lock);
+}
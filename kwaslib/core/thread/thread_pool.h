@@ -0,0 +1,62 @@
+#pragma once
+
+/*
+    Simple thread pool built on pthreads (winpthreads on MinGW).
+
+    Tasks are executed in FIFO order by a fixed amount of workers.
+    For loops over independent items there's tp_parallel_for(),
+    which hands out indices from a shared counter.
+*/
+
+#include <stdint.h>
+
+#define TP_THREADS_AUTO     (uint32_t)(0)
+
+typedef void (*TP_TASK_FUNC)(void* arg);
+typedef void (*TP_FOR_FUNC)(void* user, const uint64_t index);
+
+typedef struct TP_POOL TP_POOL;
+
+/*
+    Returns the amount of logical CPUs, at least 1.
+*/
+uint32_t tp_get_cpu_count();
+
+/*
+    Creates a pool with `thread_count` workers.
+    TP_THREADS_AUTO uses tp_get_cpu_count().
+    Workers that fail to start are left out of the pool.
+
+    Returns a pointer to the pool; NULL on error or if no worker started.
+*/
+TP_POOL* tp_create(const uint32_t thread_count);
+
+/*
+    Waits for all queued tasks, stops the workers and frees the pool.
+
+    Returns NULL.
+*/
+TP_POOL* tp_destroy(TP_POOL* pool);
+
+/*
+    Queues a task. `arg` is passed as-is to `func`.
+*/
+void tp_push(TP_POOL* pool, TP_TASK_FUNC func, void* arg);
+
+/*
+    Blocks until the queue is empty and no task is running.
+*/
+void tp_wait(TP_POOL* pool);
+
+/*
+    Returns the amount of workers in the pool.
+*/
+uint32_t tp_get_thread_count(TP_POOL* pool);
+
+/*
+    Calls `func(user, i)` for every i in [0, count) using `thread_count` threads.
+    Indices are handed out one by one, so uneven items balance themselves.
+    With 1 thread (or count of 1) everything runs on the calling thread.
+*/
+void tp_parallel_for(const uint64_t count, const uint32_t thread_count,
+                     TP_FOR_FUNC func, void* user);
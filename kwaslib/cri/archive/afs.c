@@ -3,9 +3,12 @@
 
 #include <kwaslib/core/io/string_utils.h>
 #include <kwaslib/core/io/type_readers.h>
+#include <kwaslib/core/io/type_writers.h>
 #include <kwaslib/core/io/date_utils.h>
 #include <kwaslib/core/math/boundary.h>
+#include <kwaslib/core/thread/thread_pool.h>
 #include <kwaslib/cri/audio/adx.h>
+#include <kwaslib/cri/compression/crilayla.h>
 
 #include "afs.h"
 #include "afs_parse.h"
@@ -15,7 +18,7 @@ AFS_FILE* afs_alloc()
 {
     AFS_FILE* afs = (AFS_FILE*)calloc(1, sizeof(AFS_FILE));
     afs->entries = cvec_create(sizeof(AFS_ENTRY));
-    cvec_resize(afs->entries, AFS_MAX_FILES);
+    afs->slots = (uint16_t*)calloc(AFS_MAX_FILES, sizeof(uint16_t));
     afs->has_metadata = AFS_NO_METADATA;
     return afs;
 }
@@ -65,12 +68,8 @@ AFS_FILE* afs_read_from_data(const uint8_t* data, const uint32_t size)
         
         if(entry_offset && entry_size)
         {
-            AFS_ENTRY* cur_entry = afs_get_entry_by_id(afs, i);
-                        
-            cur_entry->data = (uint8_t*)calloc(1, entry_size);
-            cur_entry->size = entry_size;
-            cur_entry->data_type = afs_get_file_type(&data[entry_offset], entry_size);
-            memcpy(&cur_entry->data[0], &data[entry_offset], entry_size);
+            /* Ids only go up, so every entry lands at the end */
+            AFS_ENTRY* cur_entry = afs_set_entry_data(afs, i, &data[entry_offset], entry_size, NULL, 0);
             
             if(afs->has_metadata)
             {
@@ -96,7 +95,6 @@ AFS_FILE* afs_read_from_data(const uint8_t* data, const uint32_t size)
 FU_FILE* afs_write_to_fu(AFS_FILE* afs, const uint32_t block_size)
 {
     const uint32_t file_count = afs_get_count(afs);
-    const uint32_t first_file_id = afs_get_first_entry_id(afs);
     const uint32_t last_file_id = afs_get_last_entry_id(afs);
     
     const uint32_t metadata_entry_pos = afs_id_to_entry_offset(last_file_id+1);
@@ -124,58 +122,132 @@ FU_FILE* afs_write_to_fu(AFS_FILE* afs, const uint32_t block_size)
     
     uint32_t data_counter = data_offset;
     uint32_t metadata_counter = metadata_offset;
-    for(uint32_t i = first_file_id; i != (last_file_id+1); ++i)
+    for(uint32_t i = 0; i != file_count; ++i)
     {
-        AFS_ENTRY* entry = afs_get_entry_by_id(afs, i);
+        AFS_ENTRY* entry = afs_get_entry_by_index(afs, i);
         
-        if(entry->data && entry->size)
+        const uint32_t entry_offset = afs_id_to_entry_offset(entry->id);
+        fu_seek(fafs, entry_offset, FU_SEEK_SET);
+        
+        fu_write_u32(fafs, data_counter, FU_LITTLE_ENDIAN);
+        fu_write_u32(fafs, entry->size, FU_LITTLE_ENDIAN);
+        
+        fu_seek(fafs, data_counter, FU_SEEK_SET);
+        fu_write_data(fafs, entry->data, entry->size);
+        
+        data_counter += entry->size;
+        data_counter += bound_calc_leftover(block_size, data_counter);
+        
+        if(afs->has_metadata)
         {
-            const uint32_t entry_offset = afs_id_to_entry_offset(i);
-            fu_seek(fafs, entry_offset, FU_SEEK_SET);
+            fu_seek(fafs, metadata_counter, FU_SEEK_SET);
             
-            fu_write_u32(fafs, data_counter, FU_LITTLE_ENDIAN);
+            fu_write_data(fafs, (uint8_t*)entry->metadata.name, AFS_ENTRY_METADATA_NAME_SIZE);
+            fu_write_u16(fafs, entry->metadata.year, FU_LITTLE_ENDIAN);
+            fu_write_u16(fafs, entry->metadata.month, FU_LITTLE_ENDIAN);
+            fu_write_u16(fafs, entry->metadata.day, FU_LITTLE_ENDIAN);
+            fu_write_u16(fafs, entry->metadata.hour, FU_LITTLE_ENDIAN);
+            fu_write_u16(fafs, entry->metadata.minute, FU_LITTLE_ENDIAN);
+            fu_write_u16(fafs, entry->metadata.second, FU_LITTLE_ENDIAN);
             fu_write_u32(fafs, entry->size, FU_LITTLE_ENDIAN);
             
-            fu_seek(fafs, data_counter, FU_SEEK_SET);
-            fu_write_data(fafs, entry->data, entry->size);
-            
-            data_counter += entry->size;
-            data_counter += bound_calc_leftover(block_size, data_counter);
-            
-            if(afs->has_metadata)
-            {
-                fu_seek(fafs, metadata_counter, FU_SEEK_SET);
-                
-                fu_write_data(fafs, (uint8_t*)entry->metadata.name, AFS_ENTRY_METADATA_NAME_SIZE);
-                fu_write_u16(fafs, entry->metadata.year, FU_LITTLE_ENDIAN);
-                fu_write_u16(fafs, entry->metadata.month, FU_LITTLE_ENDIAN);
-                fu_write_u16(fafs, entry->metadata.day, FU_LITTLE_ENDIAN);
-                fu_write_u16(fafs, entry->metadata.hour, FU_LITTLE_ENDIAN);
-                fu_write_u16(fafs, entry->metadata.minute, FU_LITTLE_ENDIAN);
-                fu_write_u16(fafs, entry->metadata.second, FU_LITTLE_ENDIAN);
-                fu_write_u32(fafs, entry->size, FU_LITTLE_ENDIAN);
-                
-                metadata_counter += AFS_ENTRY_METADATA_SIZE;
-            }
+            metadata_counter += AFS_ENTRY_METADATA_SIZE;
         }
     }
         
     return fafs;
 }
 
-AFS_FILE* afs_free(AFS_FILE* afs)
+uint8_t afs_write_to_rf(AFS_FILE* afs, RF_FILE* out, const uint32_t block_size,
+                        const RF_SOURCE* sources)
 {
-    for(uint64_t i = 0; i != AFS_MAX_FILES; ++i)
+    const uint32_t file_count = afs_get_count(afs);
+    const uint32_t last_file_id = afs_get_last_entry_id(afs);
+    
+    const uint32_t metadata_entry_pos = afs_id_to_entry_offset(last_file_id+1);
+    const uint32_t metadata_size = file_count*AFS_ENTRY_METADATA_SIZE;
+    const uint32_t metadata_size_aligned = metadata_size + bound_calc_leftover(block_size, metadata_size);
+    
+    uint32_t data_offset = metadata_entry_pos+AFS_ENTRY_SIZE;
+    data_offset += bound_calc_leftover(block_size, data_offset);
+    const uint32_t data_size = afs_get_data_section_size(afs, block_size);
+    
+    const uint32_t metadata_offset = data_offset + data_size;
+    const uint32_t file_size = metadata_offset + metadata_size_aligned;
+    
+    /* Only the entry table and metadata are kept in memory */
+    uint8_t* toc = (uint8_t*)calloc(1, metadata_entry_pos+AFS_ENTRY_SIZE);
+    uint8_t* metadata = (uint8_t*)calloc(1, metadata_size+1);
+    uint8_t status = FU_SUCCESS;
+    
+    tw_write_array((const uint8_t*)AFS_MAGIC, 4, &toc[0]);
+    tw_write_u32le(file_count, &toc[4]);
+    tw_write_u32le(metadata_offset, &toc[metadata_entry_pos]);
+    tw_write_u32le(metadata_size, &toc[metadata_entry_pos+4]);
+    
+    uint32_t data_counter = data_offset;
+    uint32_t metadata_counter = 0;
+    for(uint32_t i = 0; (i != file_count) && (status == FU_SUCCESS); ++i)
     {
-        AFS_ENTRY* entry = afs_get_entry_by_id(afs, i);
+        AFS_ENTRY* entry = afs_get_entry_by_index(afs, i);
+        
+        const uint32_t entry_offset = afs_id_to_entry_offset(entry->id);
+        tw_write_u32le(data_counter, &toc[entry_offset]);
+        tw_write_u32le(entry->size, &toc[entry_offset+4]);
+        
+        if(sources)
+        {
+            status = rf_write_source(out, data_counter, &sources[entry->id]);
+        }
+        else
+        {
+            status = rf_pwrite(out, entry->data, entry->size, data_counter);
+        }
+        
+        data_counter += entry->size;
+        data_counter += bound_calc_leftover(block_size, data_counter);
         
-        if(entry->size)
+        if(afs->has_metadata)
         {
-            free(entry->data);
+            uint8_t* m = &metadata[metadata_counter];
+            tw_write_array((const uint8_t*)entry->metadata.name, AFS_ENTRY_METADATA_NAME_SIZE, &m[0]);
+            tw_write_u16le(entry->metadata.year, &m[AFS_ENTRY_METADATA_NAME_SIZE]);
+            tw_write_u16le(entry->metadata.month, &m[AFS_ENTRY_METADATA_NAME_SIZE+2]);
+            tw_write_u16le(entry->metadata.day, &m[AFS_ENTRY_METADATA_NAME_SIZE+4]);
+            tw_write_u16le(entry->metadata.hour, &m[AFS_ENTRY_METADATA_NAME_SIZE+6]);
+            tw_write_u16le(entry->metadata.minute, &m[AFS_ENTRY_METADATA_NAME_SIZE+8]);
+            tw_write_u16le(entry->metadata.second, &m[AFS_ENTRY_METADATA_NAME_SIZE+10]);
+            tw_write_u32le(entry->size, &m[AFS_ENTRY_METADATA_NAME_SIZE+12]);
+            
+            metadata_counter += AFS_ENTRY_METADATA_SIZE;
         }
     }
     
+    if(status == FU_SUCCESS)
+        status = rf_pwrite(out, toc, metadata_entry_pos+AFS_ENTRY_SIZE, 0);
+    
+    if((status == FU_SUCCESS) && metadata_counter)
+        status = rf_pwrite(out, metadata, metadata_counter, metadata_offset);
+    
+    /* Padding between entries and at the end are holes */
+    if(status == FU_SUCCESS)
+        status = rf_set_size(out, file_size);
+    
+    free(toc);
+    free(metadata);
+    
+    return status;
+}
+
+AFS_FILE* afs_free(AFS_FILE* afs)
+{
+    for(uint32_t i = 0; i != afs_get_count(afs); ++i)
+    {
+        free(afs_get_entry_by_index(afs, i)->data);
+    }
+    
     afs->entries = cvec_destroy(afs->entries);
+    free(afs->slots);
     free(afs);
     
     return NULL;
@@ -183,25 +255,101 @@ AFS_FILE* afs_free(AFS_FILE* afs)
 
 AFS_ENTRY* afs_get_entry_by_id(AFS_FILE* afs, const uint64_t id)
 {
-    return (AFS_ENTRY*)cvec_at(afs->entries, id);
+    if((id >= AFS_MAX_FILES) || (afs->slots[id] == 0))
+    {
+        return NULL;
+    }
+    
+    return (AFS_ENTRY*)cvec_at(afs->entries, afs->slots[id] - 1);
+}
+
+AFS_ENTRY* afs_get_entry_by_index(AFS_FILE* afs, const uint32_t index)
+{
+    if(index >= cvec_size(afs->entries))
+    {
+        return NULL;
+    }
+    
+    return (AFS_ENTRY*)cvec_at(afs->entries, index);
+}
+
+/* Points the slots of entries from `first` on at their position */
+static void afs_update_slots(AFS_FILE* afs, const uint32_t first)
+{
+    for(uint32_t i = first; i != cvec_size(afs->entries); ++i)
+    {
+        afs->slots[afs_get_entry_by_index(afs, i)->id] = i + 1;
+    }
+}
+
+static uint32_t afs_aligned_size(const uint32_t size)
+{
+    return size + bound_calc_leftover(AFS_BLOCK_SIZE_DEFAULT, size);
 }
 
 AFS_ENTRY* afs_set_entry_data(AFS_FILE* afs, const uint32_t id,
                               const uint8_t* data, const uint32_t size,
                               const char* name, const time_t timestamp)
 {
+    if(id >= AFS_MAX_FILES)
+    {
+        return NULL;
+    }
+    
     AFS_ENTRY* entry = afs_get_entry_by_id(afs, id);
     
-    /* Entry is already present. Remove it */
-    if(entry->data)
+    if(size == 0)
     {
         afs_remove_entry(afs, id);
+        return NULL;
     }
-
-    entry->data_type = afs_get_file_type(data, size);
+    
+    if(entry)
+    {
+        /* Entry is already present. Replace it in its slot */
+        free(entry->data);
+        afs->data_size -= afs_aligned_size(entry->size);
+        memset(entry, 0, sizeof(AFS_ENTRY));
+        entry->id = id;
+    }
+    else
+    {
+        /* Entries stay sorted by id, appending is the common case */
+        const AFS_ENTRY empty = {.id = id};
+        uint32_t pos = cvec_size(afs->entries);
+        
+        if(pos && (afs_get_entry_by_index(afs, pos-1)->id > id))
+        {
+            uint32_t low = 0;
+            
+            while(low < pos)
+            {
+                const uint32_t mid = (low + pos)/2;
+                if(afs_get_entry_by_index(afs, mid)->id < id) low = mid + 1;
+                else pos = mid;
+            }
+            
+            cvec_insert(afs->entries, pos, (void*)&empty);
+        }
+        else
+        {
+            cvec_push_back(afs->entries, (void*)&empty);
+        }
+        
+        afs_update_slots(afs, pos);
+        entry = afs_get_entry_by_index(afs, pos);
+    }
+    
     entry->size = size;
-    entry->data = (uint8_t*)calloc(1, size);
-    memcpy(entry->data, data, size);
+    afs->data_size += afs_aligned_size(size);
+    
+    /* Entries without data are written from an RF_SOURCE */
+    if(data)
+    {
+        entry->data_type = afs_get_file_type(data, size);
+        entry->data = (uint8_t*)calloc(1, size);
+        memcpy(entry->data, data, size);
+    }
     
     entry->metadata.file_size = size;
     
@@ -248,31 +396,22 @@ void afs_remove_entry(AFS_FILE* afs, const uint32_t id)
 {
     AFS_ENTRY* entry = afs_get_entry_by_id(afs, id);
     
-    if(entry->data)
+    if(entry)
     {
+        const uint32_t pos = afs->slots[id] - 1;
+        
         free(entry->data);
-        memset(entry, 0, sizeof(AFS_ENTRY));
+        afs->data_size -= afs_aligned_size(entry->size);
+        afs->slots[id] = 0;
+        
+        cvec_erase(afs->entries, pos);
+        afs_update_slots(afs, pos);
     }
 }
 
 const uint32_t afs_get_count(AFS_FILE* afs)
 {
-    uint32_t count = 0;
-    
-    if(afs)
-    {
-        for(uint32_t i = 0; i != AFS_MAX_FILES; ++i)
-        {
-            AFS_ENTRY* entry = afs_get_entry_by_id(afs, i);
-            
-            if(entry->data && entry->size)
-            {
-                count += 1;
-            }
-        }
-    }
-    
-    return count;
+    return afs ? cvec_size(afs->entries) : 0;
 }
 
 const uint32_t afs_id_to_entry_offset(const uint32_t id)
@@ -305,6 +444,85 @@ const uint8_t afs_get_file_type(const uint8_t* data, const uint32_t size)
     if(is_adx == ADX_TYPE_ADX) return AFS_DATA_ADX;
     if(is_adx == ADX_TYPE_AHX) return AFS_DATA_AHX;
     if(is_afs) return AFS_DATA_AFS;
+    if(crilayla_is_compressed(data, size)) return AFS_DATA_CRILAYLA;
     
     return AFS_DATA_BIN;
 }
+
+typedef struct
+{
+    uint8_t* data;
+    uint32_t* offsets;      /* Pairs of offset and size */
+    CRI_ADX_KEY old_key;
+    CRI_ADX_KEY new_key;
+    uint8_t new_type;
+    uint8_t* status;
+} AFS_REKEY_CTX;
+
+static void afs_rekey_worker(void* user, const uint64_t i)
+{
+    AFS_REKEY_CTX* ctx = (AFS_REKEY_CTX*)user;
+    uint8_t* data = &ctx->data[ctx->offsets[i*2]];
+    const uint32_t size = ctx->offsets[i*2+1];
+    
+    ctx->status[i] = adx_rekey(data, size, ctx->old_key, ctx->new_key, ctx->new_type);
+}
+
+uint32_t afs_rekey_adx(uint8_t* data, const uint32_t size,
+                       const CRI_ADX_KEY old_key, const CRI_ADX_KEY new_key,
+                       const uint8_t new_type, const uint32_t thread_count)
+{
+    if(afs_check_if_valid(data, size) == AFS_ERROR)
+    {
+        return 0;
+    }
+    
+    const uint32_t first_file_id = afs_find_first_file_index(data, size);
+    
+    if(first_file_id == AFS_ERROR)
+    {
+        return 0;
+    }
+    
+    const uint32_t file_count = afs_count_possible_files(first_file_id, data);
+    const uint32_t metadata_index = afs_find_metadata_index(first_file_id, file_count, data);
+    
+    /* Only the table is read, ADXs are found by their magic */
+    AFS_REKEY_CTX ctx = {0};
+    ctx.data = data;
+    ctx.offsets = (uint32_t*)calloc((metadata_index - first_file_id + 1)*2, sizeof(uint32_t));
+    ctx.old_key = old_key;
+    ctx.new_key = new_key;
+    ctx.new_type = new_type;
+    uint32_t adx_count = 0;
+    
+    for(uint32_t i = first_file_id; i != metadata_index; ++i)
+    {
+        const uint32_t entry_pos = afs_id_to_entry_offset(i);
+        const uint32_t entry_offset = tr_read_u32le(&data[entry_pos]);
+        const uint32_t entry_size = tr_read_u32le(&data[entry_pos+4]);
+        
+        if(entry_offset && entry_size && (entry_offset < size) && (entry_size <= (size - entry_offset))
+           && (afs_get_file_type(&data[entry_offset], entry_size) == AFS_DATA_ADX))
+        {
+            ctx.offsets[adx_count*2] = entry_offset;
+            ctx.offsets[adx_count*2+1] = entry_size;
+            adx_count += 1;
+        }
+    }
+    
+    ctx.status = (uint8_t*)calloc(adx_count + 1, 1);
+    tp_parallel_for(adx_count, thread_count, afs_rekey_worker, &ctx);
+    
+    uint32_t rekeyed = 0;
+    
+    for(uint32_t i = 0; i != adx_count; ++i)
+    {
+        rekeyed += ctx.status[i];
+    }
+    
+    free(ctx.status);
+    free(ctx.offsets);
+    
+    return rekeyed;
+}
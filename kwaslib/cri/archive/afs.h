@@ -25,7 +25,9 @@
 #include <time.h>
 
 #include <kwaslib/core/io/file_utils.h>
+#include <kwaslib/core/io/raw_file.h>
 #include <kwaslib/core/data/cvector.h>
+#include <kwaslib/core/crypto/cri_key.h>
 
 /*
     Defines
@@ -49,6 +51,7 @@
 #define AFS_DATA_ADX                    (uint8_t)(1)
 #define AFS_DATA_AHX                    (uint8_t)(2)
 #define AFS_DATA_AFS                    (uint8_t)(3)
+#define AFS_DATA_CRILAYLA               (uint8_t)(4)
 
 /*
     Structures
@@ -71,7 +74,7 @@ struct AFS_ENTRY
 {
     AFS_ENTRY_METADATA metadata;
     uint8_t* data;
-    /*uint32_t id;*/    /* Index in CVEC entries */
+    uint32_t id;
     uint32_t size;
     uint8_t data_type;  /* ADX, AFS or BIN */
 };
@@ -86,7 +89,9 @@ struct AFS_HEADER
 typedef struct AFS_FILE AFS_FILE;
 struct AFS_FILE
 {
-    CVEC entries;           /* Vector of AFS_ENTRY */
+    CVEC entries;           /* Vector of AFS_ENTRY, only present ones, sorted by id */
+    uint16_t* slots;        /* AFS_MAX_FILES of index in entries + 1, 0 if missing */
+    uint32_t data_size;     /* Sum of entry sizes aligned to AFS_BLOCK_SIZE_DEFAULT */
     uint8_t has_metadata;
 };
 
@@ -120,6 +125,16 @@ AFS_FILE* afs_read_from_data(const uint8_t* data, const uint32_t size);
 */
 FU_FILE* afs_write_to_fu(AFS_FILE* afs, const uint32_t block_size);
 
+/*
+    Writes the AFS file straight to `out`.
+    Payload of entry `id` comes from `sources[id]`,
+    or from entry->data if `sources` is NULL.
+    
+    Returns FU_SUCCESS on success, FU_ERROR otherwise.
+*/
+uint8_t afs_write_to_rf(AFS_FILE* afs, RF_FILE* out, const uint32_t block_size,
+                        const RF_SOURCE* sources);
+
 /*
     Frees the entire structure and the pointer.
     
@@ -130,15 +145,25 @@ AFS_FILE* afs_free(AFS_FILE* afs);
 /*
     Returns a pointer to specified entry.
     If entry doesn't exist, returns NULL.
+    Adding or removing entries invalidates the pointer.
 */
 AFS_ENTRY* afs_get_entry_by_id(AFS_FILE* afs, const uint64_t id);
 
+/*
+    Entries are kept in id order, `index` goes up to afs_get_count().
+    
+    Returns a pointer to the entry; NULL if out of range.
+*/
+AFS_ENTRY* afs_get_entry_by_index(AFS_FILE* afs, const uint32_t index);
+
 /*
     Will insert data to entry specified by id.
     If entry exists, it will replace its data.
     If the name is NULL, it will use the id as filename.
+    If the data is NULL, only the size is set.
+    A size of 0 removes the entry.
     
-    Returns a pointer to specified entry.
+    Returns a pointer to specified entry, NULL if it got removed.
 */
 AFS_ENTRY* afs_set_entry_data(AFS_FILE* afs, const uint32_t id,
                               const uint8_t* data, const uint32_t size,
@@ -150,7 +175,7 @@ AFS_ENTRY* afs_set_entry_data(AFS_FILE* afs, const uint32_t id,
 void afs_remove_entry(AFS_FILE* afs, const uint32_t id);
 
 /*
-    Returns the amount of files present in entries vector.
+    Returns the amount of present entries.
 */
 const uint32_t afs_get_count(AFS_FILE* afs);
 
@@ -169,3 +194,14 @@ const uint32_t afs_id_to_metadata_offset(const uint32_t meta_pos, const uint32_t
     Returns the type of file, ADX, AHX, AFS or raw binary.
 */
 const uint8_t afs_get_file_type(const uint8_t* data, const uint32_t size);
+
+/*
+    Re-keys every ADX of the AFS at `data` in place, see adx_rekey().
+    Only the frame scales of each ADX are touched, the archive layout stays the same.
+    Files are spread over `thread_count` threads (0 for all cores).
+    
+    Returns the amount of re-keyed ADXs.
+*/
+uint32_t afs_rekey_adx(uint8_t* data, const uint32_t size,
+                       const CRI_ADX_KEY old_key, const CRI_ADX_KEY new_key,
+                       const uint8_t new_type, const uint32_t thread_count);
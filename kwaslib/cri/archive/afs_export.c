@@ -4,49 +4,33 @@
 
 const uint32_t afs_get_first_entry_id(AFS_FILE* afs)
 {
-    for(uint32_t i = 0; i != AFS_MAX_FILES; ++i)
-    {
-        AFS_ENTRY* entry = afs_get_entry_by_id(afs, i);
-        
-        if(entry->data && entry->size)
-        {
-            return i;
-        }
-    }
+    AFS_ENTRY* entry = afs_get_entry_by_index(afs, 0);
     
-    return (uint32_t)AFS_ERROR;
+    return entry ? entry->id : (uint32_t)AFS_ERROR;
 }
 
 const uint32_t afs_get_last_entry_id(AFS_FILE* afs)
 {
-    for(int32_t i = (AFS_MAX_FILES-1); i != -1; --i)
-    {
-        AFS_ENTRY* entry = afs_get_entry_by_id(afs, i);
-        
-        if(entry->data && entry->size)
-        {
-            return i;
-        }
-    }
+    AFS_ENTRY* entry = afs_get_entry_by_index(afs, afs_get_count(afs) - 1);
     
-    return (uint32_t)AFS_ERROR;
+    return entry ? entry->id : (uint32_t)AFS_ERROR;
 }
 
 const uint32_t afs_get_data_section_size(AFS_FILE* afs, const uint32_t block_size)
 {
+    /* Kept up to date for the default */
+    if(block_size == AFS_BLOCK_SIZE_DEFAULT)
+    {
+        return afs->data_size;
+    }
+    
     uint32_t size = 0;
     
-    for(uint32_t i = 0; i != AFS_MAX_FILES; ++i)
+    for(uint32_t i = 0; i != afs_get_count(afs); ++i)
     {
-        AFS_ENTRY* entry = afs_get_entry_by_id(afs, i);
-        
-        if(entry->data && entry->size)
-        {
-            size += entry->size;
-            const uint32_t left = bound_calc_leftover(block_size, size);
-            size += left;
-        }
+        size += afs_get_entry_by_index(afs, i)->size;
+        size += bound_calc_leftover(block_size, size);
     }
     
     return size;
-}
\ No newline at end of file
+}
@@ -0,0 +1,381 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include <kwaslib/core/io/type_readers.h>
+#include <kwaslib/core/io/type_writers.h>
+#include <kwaslib/core/io/date_utils.h>
+#include <kwaslib/core/math/boundary.h>
+
+#include "afs_toc.h"
+#include "afs_parse.h"
+
+static void afs_toc_read_metadata(AFS_TOC_ENTRY* entry, const uint8_t* m)
+{
+    tr_read_array(&m[0], AFS_ENTRY_METADATA_NAME_SIZE, (uint8_t*)entry->metadata.name);
+    entry->metadata.year = tr_read_u16le(&m[AFS_ENTRY_METADATA_NAME_SIZE]);
+    entry->metadata.month = tr_read_u16le(&m[AFS_ENTRY_METADATA_NAME_SIZE+2]);
+    entry->metadata.day = tr_read_u16le(&m[AFS_ENTRY_METADATA_NAME_SIZE+4]);
+    entry->metadata.hour = tr_read_u16le(&m[AFS_ENTRY_METADATA_NAME_SIZE+6]);
+    entry->metadata.minute = tr_read_u16le(&m[AFS_ENTRY_METADATA_NAME_SIZE+8]);
+    entry->metadata.second = tr_read_u16le(&m[AFS_ENTRY_METADATA_NAME_SIZE+10]);
+    entry->metadata.file_size = tr_read_u32le(&m[AFS_ENTRY_METADATA_NAME_SIZE+12]);
+
+    entry->timestamp = du_values_to_epoch(entry->metadata.year, entry->metadata.month,
+                                          entry->metadata.day, entry->metadata.hour,
+                                          entry->metadata.minute, entry->metadata.second);
+}
+
+/*
+    Fills `toc` from the header table in `data`.
+    `data` is AFS_TOC_MAX_SIZE long, zeroed past the part read from the file.
+*/
+static uint8_t afs_toc_parse(AFS_TOC* toc, const uint8_t* data, const uint32_t size)
+{
+    const uint32_t first_file_id = afs_find_first_file_index(data, size);
+
+    if(first_file_id == AFS_ERROR)
+    {
+        return FU_ERROR;
+    }
+
+    const uint32_t file_count = afs_count_possible_files(first_file_id, data);
+    const uint32_t metadata_index = afs_find_metadata_index(first_file_id, file_count, data);
+    const uint32_t metadata_offset = afs_id_to_entry_offset(metadata_index);
+    const uint32_t metadata_pos = tr_read_u32le(&data[metadata_offset]);
+    const uint32_t metadata_size = tr_read_u32le(&data[metadata_offset+4]);
+    uint8_t* metadata = NULL;
+
+    if(metadata_pos && metadata_size && ((uint64_t)metadata_pos + metadata_size <= toc->file->size))
+    {
+        metadata = (uint8_t*)malloc(metadata_size);
+
+        if(rf_pread(toc->file, metadata, metadata_size, metadata_pos) == FU_SUCCESS)
+        {
+            toc->has_metadata = AFS_HAS_METADATA;
+            toc->metadata_offset = metadata_pos;
+            toc->metadata_size = metadata_size;
+        }
+    }
+
+    toc->entries = (AFS_TOC_ENTRY*)calloc(metadata_index - first_file_id + 1, sizeof(AFS_TOC_ENTRY));
+    uint32_t metadata_it = 0;
+
+    for(uint32_t i = first_file_id; i != metadata_index; ++i)
+    {
+        const uint32_t entry_pos = afs_id_to_entry_offset(i);
+        const uint32_t entry_offset = tr_read_u32le(&data[entry_pos]);
+        const uint32_t entry_size = tr_read_u32le(&data[entry_pos+4]);
+
+        if((entry_offset == 0) || (entry_size == 0))
+        {
+            continue;
+        }
+
+        AFS_TOC_ENTRY* entry = &toc->entries[toc->count];
+        entry->id = i;
+        entry->offset = entry_offset;
+        entry->size = entry_size;
+        toc->count += 1;
+
+        if(toc->has_metadata && ((metadata_it+1)*AFS_ENTRY_METADATA_SIZE <= metadata_size))
+        {
+            afs_toc_read_metadata(entry, &metadata[metadata_it*AFS_ENTRY_METADATA_SIZE]);
+            metadata_it += 1;
+        }
+        else
+        {
+            sprintf(entry->metadata.name, "%05u.bin", i);
+            entry->metadata.file_size = entry_size;
+        }
+    }
+
+    free(metadata);
+
+    return FU_SUCCESS;
+}
+
+static AFS_TOC* afs_open_toc_mode(const char* path, const uint8_t mode)
+{
+    RF_FILE* file = rf_open(path, mode);
+
+    if(file == NULL)
+    {
+        return NULL;
+    }
+
+    /* Zeroed past what's read, so parsing never leaves the buffer */
+    uint8_t* data = (uint8_t*)calloc(1, AFS_TOC_MAX_SIZE);
+    const uint32_t head_size = (file->size < AFS_FILE_MIN_SIZE) ? file->size : AFS_FILE_MIN_SIZE;
+    uint32_t toc_size = (file->size < AFS_TOC_MAX_SIZE) ? file->size : AFS_TOC_MAX_SIZE;
+
+    if((rf_pread(file, data, head_size, 0) != FU_SUCCESS)
+       || (afs_check_if_valid(data, file->size) == AFS_ERROR))
+    {
+        free(data);
+        rf_close(file);
+        return NULL;
+    }
+
+    /* Table ends where the first file begins, usually inside the first block */
+    const uint32_t first_file_id = afs_find_first_file_index(data, head_size);
+
+    if(first_file_id != AFS_ERROR)
+    {
+        const uint32_t first_offset = tr_read_u32le(&data[afs_id_to_entry_offset(first_file_id)]);
+
+        if(first_offset < toc_size)
+        {
+            toc_size = first_offset;
+        }
+    }
+
+    if((toc_size > head_size)
+       && (rf_pread(file, &data[head_size], toc_size - head_size, head_size) != FU_SUCCESS))
+    {
+        free(data);
+        rf_close(file);
+        return NULL;
+    }
+
+    AFS_TOC* toc = (AFS_TOC*)calloc(1, sizeof(AFS_TOC));
+    toc->file = file;
+
+    if(afs_toc_parse(toc, data, toc_size) != FU_SUCCESS)
+    {
+        toc = afs_close_toc(toc);
+    }
+
+    free(data);
+
+    return toc;
+}
+
+AFS_TOC* afs_open_toc(const char* path)
+{
+    return afs_open_toc_mode(path, RF_READ);
+}
+
+AFS_TOC* afs_open_toc_rw(const char* path)
+{
+    return afs_open_toc_mode(path, RF_UPDATE);
+}
+
+AFS_TOC* afs_close_toc(AFS_TOC* toc)
+{
+    if(toc)
+    {
+        toc->file = rf_close(toc->file);
+        free(toc->entries);
+        free(toc);
+    }
+
+    return NULL;
+}
+
+AFS_TOC_ENTRY* afs_toc_find_by_id(AFS_TOC* toc, const uint32_t id)
+{
+    uint32_t low = 0;
+    uint32_t high = toc->count;
+
+    while(low < high)
+    {
+        const uint32_t mid = (low + high)/2;
+        if(toc->entries[mid].id < id) low = mid + 1;
+        else high = mid;
+    }
+
+    if((low != toc->count) && (toc->entries[low].id == id))
+    {
+        return &toc->entries[low];
+    }
+
+    return NULL;
+}
+
+AFS_TOC_ENTRY* afs_toc_find_by_name(AFS_TOC* toc, const char* name)
+{
+    if(strlen(name) > AFS_ENTRY_METADATA_NAME_SIZE)
+    {
+        return NULL;
+    }
+
+    for(uint32_t i = 0; i != toc->count; ++i)
+    {
+        if(strncmp(toc->entries[i].metadata.name, name, AFS_ENTRY_METADATA_NAME_SIZE) == 0)
+        {
+            return &toc->entries[i];
+        }
+    }
+
+    return NULL;
+}
+
+uint8_t afs_read_entry(AFS_TOC* toc, const AFS_TOC_ENTRY* entry, uint8_t* out)
+{
+    return rf_pread(toc->file, out, entry->size, entry->offset);
+}
+
+uint8_t afs_copy_entry_to_fd(AFS_TOC* toc, const AFS_TOC_ENTRY* entry, const int fd)
+{
+    return rf_copy_to_fd(toc->file, entry->offset, entry->size, fd);
+}
+
+static uint8_t afs_toc_zero_func(void* user, uint8_t* out, const uint64_t offset, const uint64_t size)
+{
+    memset(out, 0, size);
+    return FU_SUCCESS;
+}
+
+/* Start of whatever follows `offset` in the file, 0 if nothing does */
+static uint64_t afs_toc_next_start(AFS_TOC* toc, const uint32_t offset)
+{
+    uint64_t next = 0;
+
+    for(uint32_t i = 0; i != toc->count; ++i)
+    {
+        const uint32_t cur = toc->entries[i].offset;
+
+        if((cur > offset) && ((next == 0) || (cur < next)))
+        {
+            next = cur;
+        }
+    }
+
+    if(toc->has_metadata && (toc->metadata_offset > offset)
+       && ((next == 0) || (toc->metadata_offset < next)))
+    {
+        next = toc->metadata_offset;
+    }
+
+    return next;
+}
+
+uint8_t afs_toc_replace_entry(AFS_TOC* toc, AFS_TOC_ENTRY* entry, const RF_SOURCE* src,
+                              const char* name, const time_t timestamp)
+{
+    RF_FILE* rf = toc->file;
+
+    if((rf->writeable == 0) || (src->size == 0) || (src->size > UINT32_MAX))
+    {
+        return AFS_ERROR;
+    }
+
+    const uint32_t new_size = src->size;
+    const uint64_t old_end = (uint64_t)entry->offset + entry->size;
+    const uint64_t next_start = afs_toc_next_start(toc, entry->offset);
+    uint64_t slot_end = old_end + bound_calc_leftover(AFS_BLOCK_SIZE_DEFAULT, old_end);
+    uint8_t result = AFS_REPLACE_IN_PLACE;
+    uint32_t offset = entry->offset;
+
+    if(next_start == 0)
+    {
+        /* Nothing follows, the file can just grow or shrink */
+        slot_end = UINT32_MAX;
+    }
+    else if(slot_end > next_start)
+    {
+        /* Packed with a smaller block size */
+        slot_end = next_start;
+    }
+
+    if((offset + (uint64_t)new_size) > slot_end)
+    {
+        if(entry == &toc->entries[0])
+        {
+            return AFS_ERROR;
+        }
+
+        const uint64_t end = rf->size + bound_calc_leftover(AFS_BLOCK_SIZE_DEFAULT, rf->size);
+
+        if((end + new_size) > UINT32_MAX)
+        {
+            return AFS_ERROR;
+        }
+
+        offset = end;
+        result = AFS_REPLACE_RELOCATED;
+    }
+
+    if(rf_write_source(rf, offset, src) != FU_SUCCESS)
+    {
+        return AFS_ERROR;
+    }
+
+    const uint64_t new_end = (uint64_t)offset + new_size;
+    const uint64_t new_end_aligned = new_end + bound_calc_leftover(AFS_BLOCK_SIZE_DEFAULT, new_end);
+
+    if((result == AFS_REPLACE_RELOCATED) || (next_start == 0))
+    {
+        /* Entry ends the file, keep it padded to a block */
+        if(rf_set_size(rf, new_end_aligned) != FU_SUCCESS)
+        {
+            return AFS_ERROR;
+        }
+    }
+    else if(new_end < old_end)
+    {
+        /* Leftovers of the old data would end up in the padding */
+        const RF_SOURCE zeros = rf_source_func(afs_toc_zero_func, NULL, old_end - new_end);
+
+        if(rf_write_source(rf, new_end, &zeros) != FU_SUCCESS)
+        {
+            return AFS_ERROR;
+        }
+    }
+
+    uint8_t toc_entry[AFS_ENTRY_SIZE] = {0};
+    tw_write_u32le(offset, &toc_entry[0]);
+    tw_write_u32le(new_size, &toc_entry[4]);
+
+    if(rf_pwrite(rf, toc_entry, AFS_ENTRY_SIZE, afs_id_to_entry_offset(entry->id)) != FU_SUCCESS)
+    {
+        return AFS_ERROR;
+    }
+
+    entry->offset = offset;
+    entry->size = new_size;
+    entry->metadata.file_size = new_size;
+
+    if(timestamp)
+    {
+        int y,m,d,h,min,s;
+        du_epoch_to_values(timestamp, &y, &m, &d, &h, &min, &s);
+        entry->metadata.year = y;
+        entry->metadata.month = m;
+        entry->metadata.day = d;
+        entry->metadata.hour = h;
+        entry->metadata.minute = min;
+        entry->metadata.second = s;
+        entry->timestamp = timestamp;
+    }
+
+    if(name)
+    {
+        memset(entry->metadata.name, 0, AFS_ENTRY_METADATA_NAME_SIZE);
+        snprintf(entry->metadata.name, AFS_ENTRY_METADATA_NAME_SIZE, "%s", name);
+    }
+
+    const uint32_t index = entry - toc->entries;
+
+    if(toc->has_metadata && ((index+1)*AFS_ENTRY_METADATA_SIZE <= toc->metadata_size))
+    {
+        uint8_t m[AFS_ENTRY_METADATA_SIZE] = {0};
+        tw_write_array((const uint8_t*)entry->metadata.name, AFS_ENTRY_METADATA_NAME_SIZE, &m[0]);
+        tw_write_u16le(entry->metadata.year, &m[AFS_ENTRY_METADATA_NAME_SIZE]);
+        tw_write_u16le(entry->metadata.month, &m[AFS_ENTRY_METADATA_NAME_SIZE+2]);
+        tw_write_u16le(entry->metadata.day, &m[AFS_ENTRY_METADATA_NAME_SIZE+4]);
+        tw_write_u16le(entry->metadata.hour, &m[AFS_ENTRY_METADATA_NAME_SIZE+6]);
+        tw_write_u16le(entry->metadata.minute, &m[AFS_ENTRY_METADATA_NAME_SIZE+8]);
+        tw_write_u16le(entry->metadata.second, &m[AFS_ENTRY_METADATA_NAME_SIZE+10]);
+        tw_write_u32le(entry->metadata.file_size, &m[AFS_ENTRY_METADATA_NAME_SIZE+12]);
+
+        if(rf_pwrite(rf, m, AFS_ENTRY_METADATA_SIZE,
+                     toc->metadata_offset + index*AFS_ENTRY_METADATA_SIZE) != FU_SUCCESS)
+        {
+            return AFS_ERROR;
+        }
+    }
+
+    return result;
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include "afs.h"
+
+/*
+    Read-only view of an AFS archive on disk.
+    Only the header table and the metadata section are read,
+    entry data is read on demand with positional I/O.
+    Archives of any size take the same time and memory to open.
+*/
+
+/*
+    Defines
+*/
+
+/* Header and every possible entry, including the metadata one */
+#define AFS_TOC_MAX_SIZE        (uint32_t)(AFS_HEADER_SIZE + (AFS_MAX_FILES+1)*AFS_ENTRY_SIZE)
+
+#define AFS_REPLACE_IN_PLACE    (uint8_t)(0)
+#define AFS_REPLACE_RELOCATED   (uint8_t)(1) /* Moved to the end of the file */
+
+/*
+    Structures
+*/
+typedef struct AFS_TOC_ENTRY AFS_TOC_ENTRY;
+struct AFS_TOC_ENTRY
+{
+    AFS_ENTRY_METADATA metadata;    /* Filled with the id as name if missing */
+    uint32_t id;
+    uint32_t offset;
+    uint32_t size;
+    time_t timestamp;               /* From the metadata, 0 if missing */
+};
+
+typedef struct AFS_TOC AFS_TOC;
+struct AFS_TOC
+{
+    RF_FILE* file;
+    uint8_t has_metadata;
+    uint32_t metadata_offset;       /* Metadata record of entries[i] is at i*AFS_ENTRY_METADATA_SIZE */
+    uint32_t metadata_size;
+    uint32_t count;
+    AFS_TOC_ENTRY* entries;         /* Sorted by id */
+};
+
+/*
+    Functions
+*/
+
+/*
+    Opens the AFS at `path` and reads its table of contents.
+    The file stays open until afs_close_toc().
+
+    Returns a pointer to AFS_TOC; NULL on error.
+*/
+AFS_TOC* afs_open_toc(const char* path);
+
+/*
+    Same as afs_open_toc(), with the file open for afs_toc_replace_entry().
+
+    Returns a pointer to AFS_TOC; NULL on error.
+*/
+AFS_TOC* afs_open_toc_rw(const char* path);
+
+/*
+    Closes the file and frees the structure.
+
+    Returns NULL.
+*/
+AFS_TOC* afs_close_toc(AFS_TOC* toc);
+
+/*
+    Binary search over the ids.
+
+    Returns a pointer to the entry; NULL if not found.
+*/
+AFS_TOC_ENTRY* afs_toc_find_by_id(AFS_TOC* toc, const uint32_t id);
+
+/*
+    Compares against the metadata names.
+
+    Returns a pointer to the first entry with that name; NULL if not found.
+*/
+AFS_TOC_ENTRY* afs_toc_find_by_name(AFS_TOC* toc, const char* name);
+
+/*
+    Reads the whole entry to `out`, which has to hold entry->size bytes.
+    Safe to call from multiple threads at once.
+
+    Returns FU_SUCCESS on success, FU_ERROR otherwise.
+*/
+uint8_t afs_read_entry(AFS_TOC* toc, const AFS_TOC_ENTRY* entry, uint8_t* out);
+
+/*
+    Appends the entry to the descriptor `fd` at its current position,
+    see rf_copy_to_fd().
+
+    Returns FU_SUCCESS on success, FU_ERROR otherwise.
+*/
+uint8_t afs_copy_entry_to_fd(AFS_TOC* toc, const AFS_TOC_ENTRY* entry, const int fd);
+
+/*
+    Replaces the data of `entry` in the file, leaving the rest of the archive alone.
+    Data that fits in the block padding of the old data, or anywhere if the entry
+    is the last thing in the file, is written over it. Otherwise the entry is moved
+    to the end of the file and its old space is left unused.
+    Then the table and the metadata record (size, date, name unless `name` is NULL)
+    are updated, both in the file and in `entry`.
+    The first entry can't be moved, the table ends where its data starts.
+
+    Returns AFS_REPLACE_IN_PLACE, AFS_REPLACE_RELOCATED or AFS_ERROR.
+*/
+uint8_t afs_toc_replace_entry(AFS_TOC* toc, AFS_TOC_ENTRY* entry, const RF_SOURCE* src,
+                              const char* name, const time_t timestamp);
@@ -0,0 +1,647 @@
+#include "cpk.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <kwaslib/core/io/type_readers.h>
+#include <kwaslib/core/io/path_utils.h>
+#include <kwaslib/core/math/boundary.h>
+#include <kwaslib/core/thread/thread_pool.h>
+#include <kwaslib/cri/utf/utf_load.h>
+#include <kwaslib/cri/compression/crilayla.h>
+
+typedef struct
+{
+    CPK_FILE* cpk;
+    const char* out_dir;
+    uint8_t* status;        /* FU_SUCCESS/FU_ERROR per entry */
+} CPK_EXTRACT_CTX;
+
+/*
+    Tables
+*/
+static UTF_TABLE* cpk_read_table(CPK_FILE* cpk, const uint64_t offset, const char* magic)
+{
+    const RF_MAP* map = cpk->map;
+
+    if((offset + CPK_SECTION_HEADER_SIZE) > map->size)
+    {
+        return NULL;
+    }
+
+    const uint8_t* section = &map->data[offset];
+
+    if(su_cmp_char((const char*)section, 4, magic, 4) != SU_STRINGS_MATCH)
+    {
+        return NULL;
+    }
+
+    const uint64_t utf_size = tr_read_u64le(&section[8]);
+
+    if((utf_size < (8 + UTF_TABLE_HEADER_SIZE))
+       || (utf_size > (map->size - offset - CPK_SECTION_HEADER_SIZE)))
+    {
+        return NULL;
+    }
+
+    const uint8_t* utf_data = &section[CPK_SECTION_HEADER_SIZE];
+
+    if(su_cmp_char((const char*)utf_data, 4, UTF_MAGIC, 4) == SU_STRINGS_MATCH)
+    {
+        return utf_table_fits(utf_data, utf_size) ? utf_load_from_data(utf_data) : NULL;
+    }
+
+    /* Encrypted, decrypt a copy since the mapping is read-only */
+    uint8_t* copy = tr_read_array_alloc(utf_data, utf_size);
+    cpk_decrypt_utf(copy, utf_size);
+    UTF_TABLE* utf = utf_table_fits(copy, utf_size) ? utf_load_from_data(copy) : NULL;
+    free(copy);
+
+    return utf;
+}
+
+static uint8_t cpk_table_has_rows(UTF_TABLE* utf)
+{
+    return utf && utf_table_get_column_count(utf) && utf_table_get_row_count(utf);
+}
+
+static uint64_t cpk_get_uint(UTF_TABLE* utf, const char* name, const uint32_t row_id)
+{
+    UTF_COLUMN* col = utf_table_get_column_by_name(utf, name);
+
+    if((col == NULL) || (row_id >= cvec_size(col->rows)))
+    {
+        return 0;
+    }
+
+    UTF_ROW* row = utf_table_get_row_from_col_by_id(col, row_id);
+
+    switch(col->type)
+    {
+        case UTF_COLUMN_TYPE_UINT8:
+        case UTF_COLUMN_TYPE_SINT8:
+            return row->data.u8;
+        case UTF_COLUMN_TYPE_UINT16:
+        case UTF_COLUMN_TYPE_SINT16:
+            return row->data.u16;
+        case UTF_COLUMN_TYPE_UINT32:
+        case UTF_COLUMN_TYPE_SINT32:
+            return row->data.u32;
+        case UTF_COLUMN_TYPE_UINT64:
+        case UTF_COLUMN_TYPE_SINT64:
+            return row->data.u64;
+    }
+
+    return 0;
+}
+
+/*
+    Tables without the column only have stored entries.
+*/
+static uint64_t cpk_get_extract_size(UTF_TABLE* utf, const uint32_t row_id, const uint64_t size)
+{
+    if(utf_table_get_column_by_name(utf, "ExtractSize") == NULL)
+    {
+        return size;
+    }
+
+    return cpk_get_uint(utf, "ExtractSize", row_id);
+}
+
+/*
+    Sections other than the header are optional, offset of 0 means there's none.
+*/
+static UTF_TABLE* cpk_read_section(CPK_FILE* cpk, const char* offset_column, const char* magic)
+{
+    const uint64_t offset = cpk_get_uint(cpk->header, offset_column, 0);
+    return offset ? cpk_read_table(cpk, offset, magic) : NULL;
+}
+
+static SU_STRING* cpk_get_string(UTF_TABLE* utf, const char* name, const uint32_t row_id)
+{
+    UTF_COLUMN* col = utf_table_get_column_by_name(utf, name);
+
+    if((col == NULL) || (col->type != UTF_COLUMN_TYPE_STRING)
+       || (row_id >= cvec_size(col->rows)))
+    {
+        return NULL;
+    }
+
+    SU_STRING* str = utf_table_get_row_from_col_by_id(col, row_id)->data.str;
+
+    /* CRI tools write <NULL> for empty strings */
+    if((str == NULL) || (su_cmp_string_char(str, "<NULL>", 6) == SU_STRINGS_MATCH))
+    {
+        return NULL;
+    }
+
+    return str;
+}
+
+/*
+    Entries
+*/
+static void cpk_parse_toc(CPK_FILE* cpk, const uint64_t toc_offset)
+{
+    const uint32_t rows = utf_table_get_row_count(cpk->toc);
+
+    /* File offsets are relative to whichever comes first */
+    uint64_t base = cpk->content_offset;
+
+    if(toc_offset && ((base == 0) || (toc_offset < base)))
+    {
+        base = toc_offset;
+    }
+
+    cvec_resize(cpk->entries, rows);
+
+    for(uint32_t i = 0; i != rows; ++i)
+    {
+        CPK_ENTRY* entry = cpk_get_entry_by_index(cpk, i);
+        SU_STRING* dir = cpk_get_string(cpk->toc, "DirName", i);
+        SU_STRING* name = cpk_get_string(cpk->toc, "FileName", i);
+
+        entry->path = su_create_string("", 0);
+
+        if(dir && dir->size)
+        {
+            su_insert_string(entry->path, -1, dir);
+            su_insert_char(entry->path, -1, "/", 1);
+        }
+
+        if(name)
+        {
+            su_insert_string(entry->path, -1, name);
+        }
+
+        entry->id = cpk_get_uint(cpk->toc, "ID", i);
+        entry->offset = base + cpk_get_uint(cpk->toc, "FileOffset", i);
+        entry->size = cpk_get_uint(cpk->toc, "FileSize", i);
+        entry->extract_size = cpk_get_extract_size(cpk->toc, i, entry->size);
+    }
+}
+
+static void cpk_append_itoc_entries(CPK_FILE* cpk, UTF_TABLE* data)
+{
+    if(cpk_table_has_rows(data) == 0)
+    {
+        return;
+    }
+
+    const uint32_t rows = utf_table_get_row_count(data);
+
+    for(uint32_t i = 0; i != rows; ++i)
+    {
+        CPK_ENTRY entry = {0};
+        entry.id = cpk_get_uint(data, "ID", i);
+        entry.size = cpk_get_uint(data, "FileSize", i);
+        entry.extract_size = cpk_get_extract_size(data, i, entry.size);
+        cvec_push_back(cpk->entries, &entry);
+    }
+}
+
+static UTF_TABLE* cpk_get_embedded_table(UTF_TABLE* utf, const char* name)
+{
+    UTF_COLUMN* col = utf_table_get_column_by_name(utf, name);
+
+    if((col == NULL) || (col->type != UTF_COLUMN_TYPE_VLDATA))
+    {
+        return NULL;
+    }
+
+    UTF_ROW* row = utf_table_get_row_from_col_by_id(col, 0);
+
+    return (row->embed_type == UTF_TABLE_VL_UTF) ? row->embed.utf : NULL;
+}
+
+static int cpk_cmp_entry_id(const void* a, const void* b)
+{
+    const CPK_ENTRY* e1 = *(CPK_ENTRY* const*)a;
+    const CPK_ENTRY* e2 = *(CPK_ENTRY* const*)b;
+    return (e1->id > e2->id) - (e1->id < e2->id);
+}
+
+static int cpk_cmp_entry_path(const void* a, const void* b)
+{
+    const CPK_ENTRY* e1 = *(CPK_ENTRY* const*)a;
+    const CPK_ENTRY* e2 = *(CPK_ENTRY* const*)b;
+    return strcmp(e1->path->ptr, e2->path->ptr);
+}
+
+static void cpk_parse_itoc(CPK_FILE* cpk)
+{
+    /* With TOC, ITOC only maps ids to TOC rows */
+    if(cpk->toc)
+    {
+        if(utf_table_get_column_by_name(cpk->itoc, "TocIndex") == NULL)
+        {
+            return;
+        }
+
+        const uint32_t rows = utf_table_get_row_count(cpk->itoc);
+
+        for(uint32_t i = 0; i != rows; ++i)
+        {
+            const uint64_t toc_index = cpk_get_uint(cpk->itoc, "TocIndex", i);
+
+            if(toc_index < cpk_get_entry_count(cpk))
+            {
+                CPK_ENTRY* entry = cpk_get_entry_by_index(cpk, toc_index);
+                entry->id = cpk_get_uint(cpk->itoc, "ID", i);
+            }
+        }
+
+        return;
+    }
+
+    /* Files with 16-bit sizes in DataL, the rest in DataH */
+    cpk_append_itoc_entries(cpk, cpk_get_embedded_table(cpk->itoc, "DataL"));
+    cpk_append_itoc_entries(cpk, cpk_get_embedded_table(cpk->itoc, "DataH"));
+
+    const uint32_t count = cpk_get_entry_count(cpk);
+
+    if(count == 0)
+    {
+        return;
+    }
+
+    /* Data is stored in id order, every file aligned */
+    CPK_ENTRY** sorted = (CPK_ENTRY**)calloc(count, sizeof(CPK_ENTRY*));
+
+    for(uint32_t i = 0; i != count; ++i)
+    {
+        sorted[i] = cpk_get_entry_by_index(cpk, i);
+    }
+
+    qsort(sorted, count, sizeof(CPK_ENTRY*), cpk_cmp_entry_id);
+
+    uint64_t offset = cpk->content_offset;
+
+    for(uint32_t i = 0; i != count; ++i)
+    {
+        CPK_ENTRY* entry = sorted[i];
+        char name[16] = {0};
+        const uint32_t name_size = snprintf(name, 16, "%u", entry->id);
+
+        entry->path = su_create_string(name, name_size);
+        entry->offset = offset;
+
+        offset += entry->size;
+
+        if(cpk->align)
+        {
+            offset += bound_calc_leftover(cpk->align, offset);
+        }
+    }
+
+    free(sorted);
+}
+
+static void cpk_parse_etoc(CPK_FILE* cpk)
+{
+    const uint32_t rows = utf_table_get_row_count(cpk->etoc);
+    const uint32_t count = cpk_get_entry_count(cpk);
+
+    /* ETOC has one more row than TOC */
+    for(uint32_t i = 0; (i != rows) && (i != count); ++i)
+    {
+        CPK_ENTRY* entry = cpk_get_entry_by_index(cpk, i);
+        entry->update_time = cpk_get_uint(cpk->etoc, "UpdateDateTime", i);
+    }
+}
+
+static void cpk_build_indices(CPK_FILE* cpk)
+{
+    const uint32_t count = cpk_get_entry_count(cpk);
+
+    cpk->id_index = (CPK_ENTRY**)calloc(count + 1, sizeof(CPK_ENTRY*));
+    cpk->path_index = (CPK_ENTRY**)calloc(count + 1, sizeof(CPK_ENTRY*));
+
+    for(uint32_t i = 0; i != count; ++i)
+    {
+        cpk->id_index[i] = cpk_get_entry_by_index(cpk, i);
+        cpk->path_index[i] = cpk->id_index[i];
+    }
+
+    qsort(cpk->id_index, count, sizeof(CPK_ENTRY*), cpk_cmp_entry_id);
+    qsort(cpk->path_index, count, sizeof(CPK_ENTRY*), cpk_cmp_entry_path);
+}
+
+/*
+    Implementation
+*/
+CPK_FILE* cpk_open(const char* path)
+{
+    RF_MAP* map = rf_map(path);
+
+    if(map == NULL)
+    {
+        return NULL;
+    }
+
+    CPK_FILE* cpk = (CPK_FILE*)calloc(1, sizeof(CPK_FILE));
+    cpk->map = map;
+    cpk->entries = cvec_create(sizeof(CPK_ENTRY));
+
+    /* The header is at the start of the file */
+    cpk->header = cpk_read_table(cpk, 0, CPK_MAGIC);
+
+    if(cpk_table_has_rows(cpk->header) == 0)
+    {
+        return cpk_close(cpk);
+    }
+
+    cpk->content_offset = cpk_get_uint(cpk->header, "ContentOffset", 0);
+    cpk->content_size = cpk_get_uint(cpk->header, "ContentSize", 0);
+    cpk->align = cpk_get_uint(cpk->header, "Align", 0);
+
+    const uint64_t toc_offset = cpk_get_uint(cpk->header, "TocOffset", 0);
+
+    cpk->toc = cpk_read_section(cpk, "TocOffset", CPK_TOC_MAGIC);
+    cpk->itoc = cpk_read_section(cpk, "ItocOffset", CPK_ITOC_MAGIC);
+    cpk->etoc = cpk_read_section(cpk, "EtocOffset", CPK_ETOC_MAGIC);
+    cpk->gtoc = cpk_read_section(cpk, "GtocOffset", CPK_GTOC_MAGIC);
+
+    if(cpk_table_has_rows(cpk->toc))
+    {
+        cpk_parse_toc(cpk, toc_offset);
+    }
+    else
+    {
+        cpk->toc = utf_table_destroy(cpk->toc);
+    }
+
+    if(cpk_table_has_rows(cpk->itoc))
+    {
+        cpk_parse_itoc(cpk);
+    }
+
+    if(cpk->toc && cpk_table_has_rows(cpk->etoc))
+    {
+        cpk_parse_etoc(cpk);
+    }
+
+    cpk_build_indices(cpk);
+
+    return cpk;
+}
+
+CPK_FILE* cpk_close(CPK_FILE* cpk)
+{
+    if(cpk)
+    {
+        for(uint32_t i = 0; i != cpk_get_entry_count(cpk); ++i)
+        {
+            CPK_ENTRY* entry = cpk_get_entry_by_index(cpk, i);
+
+            if(entry->path)
+            {
+                entry->path = su_free(entry->path);
+            }
+        }
+
+        cpk->entries = cvec_destroy(cpk->entries);
+        free(cpk->id_index);
+        free(cpk->path_index);
+
+        cpk->header = utf_table_destroy(cpk->header);
+        cpk->toc = utf_table_destroy(cpk->toc);
+        cpk->itoc = utf_table_destroy(cpk->itoc);
+        cpk->etoc = utf_table_destroy(cpk->etoc);
+        cpk->gtoc = utf_table_destroy(cpk->gtoc);
+
+        cpk->map = rf_unmap(cpk->map);
+        free(cpk);
+    }
+
+    return NULL;
+}
+
+void cpk_decrypt_utf(uint8_t* data, const uint64_t size)
+{
+    uint32_t key = CPK_UTF_KEY_SEED;
+
+    for(uint64_t i = 0; i != size; ++i)
+    {
+        data[i] ^= (uint8_t)(key & 0xFF);
+        key *= CPK_UTF_KEY_MULT;
+    }
+}
+
+const uint32_t cpk_get_entry_count(CPK_FILE* cpk)
+{
+    return cvec_size(cpk->entries);
+}
+
+CPK_ENTRY* cpk_get_entry_by_index(CPK_FILE* cpk, const uint32_t index)
+{
+    return (CPK_ENTRY*)cvec_at(cpk->entries, index);
+}
+
+CPK_ENTRY* cpk_find_entry_by_id(CPK_FILE* cpk, const uint32_t id)
+{
+    uint32_t low = 0;
+    uint32_t high = cpk_get_entry_count(cpk);
+
+    while(low < high)
+    {
+        const uint32_t mid = low + (high - low)/2;
+        CPK_ENTRY* entry = cpk->id_index[mid];
+
+        if(entry->id == id)
+        {
+            return entry;
+        }
+
+        if(entry->id < id) low = mid + 1;
+        else high = mid;
+    }
+
+    return NULL;
+}
+
+CPK_ENTRY* cpk_find_entry_by_path(CPK_FILE* cpk, const char* path)
+{
+    uint32_t low = 0;
+    uint32_t high = cpk_get_entry_count(cpk);
+
+    while(low < high)
+    {
+        const uint32_t mid = low + (high - low)/2;
+        CPK_ENTRY* entry = cpk->path_index[mid];
+        const int cmp = strcmp(entry->path->ptr, path);
+
+        if(cmp == 0)
+        {
+            return entry;
+        }
+
+        if(cmp < 0) low = mid + 1;
+        else high = mid;
+    }
+
+    return NULL;
+}
+
+const uint8_t* cpk_get_entry_data(CPK_FILE* cpk, CPK_ENTRY* entry)
+{
+    if((entry->offset > cpk->map->size)
+       || (entry->size > (cpk->map->size - entry->offset)))
+    {
+        return NULL;
+    }
+
+    return &cpk->map->data[entry->offset];
+}
+
+uint8_t* cpk_read_entry(CPK_FILE* cpk, CPK_ENTRY* entry, uint64_t* size)
+{
+    const uint8_t* data = cpk_get_entry_data(cpk, entry);
+
+    if(data == NULL)
+    {
+        return NULL;
+    }
+
+    if(cpk_entry_is_compressed(entry) && crilayla_is_compressed(data, entry->size))
+    {
+        return crilayla_decompress(data, entry->size, size);
+    }
+
+    uint8_t* out = (uint8_t*)malloc(entry->size + 1);
+    memcpy(out, data, entry->size);
+    *size = entry->size;
+
+    return out;
+}
+
+uint8_t cpk_extract_entry(CPK_FILE* cpk, CPK_ENTRY* entry, const char* out_path)
+{
+    const uint8_t* data = cpk_get_entry_data(cpk, entry);
+
+    if(data == NULL)
+    {
+        return FU_ERROR;
+    }
+
+    /* Stored entries are copied straight from the mapping */
+    uint8_t* decompressed = NULL;
+    uint64_t size = entry->size;
+
+    if(cpk_entry_is_compressed(entry) && crilayla_is_compressed(data, entry->size))
+    {
+        decompressed = crilayla_decompress(data, entry->size, &size);
+
+        if(decompressed == NULL)
+        {
+            return FU_ERROR;
+        }
+
+        data = decompressed;
+    }
+
+    RF_FILE* out = rf_open(out_path, RF_WRITE);
+    uint8_t status = FU_ERROR;
+
+    if(out)
+    {
+        const RF_SOURCE src = rf_source_buffer(data, size);
+        status = rf_write_source(out, 0, &src);
+        out = rf_close(out);
+    }
+
+    free(decompressed);
+
+    return status;
+}
+
+/*
+    Creates every directory leading to the file.
+    Other workers may create the same ones, so existing dirs aren't an error.
+*/
+static void cpk_create_parent_dirs(SU_STRING* path)
+{
+    for(uint32_t i = 1; i < path->size; ++i)
+    {
+        if(path->ptr[i] == '/')
+        {
+            path->ptr[i] = '\0';
+            pu_create_dir_char(path->ptr);
+            path->ptr[i] = '/';
+        }
+    }
+}
+
+/*
+    Paths come from the archive, they can't leave the output directory.
+*/
+static uint8_t cpk_path_is_safe(SU_STRING* path)
+{
+    if((path->size == 0) || (path->ptr[0] == '/') || (path->ptr[0] == '\\')
+       || ((path->size > 1) && (path->ptr[1] == ':')))
+    {
+        return 0;
+    }
+
+    uint32_t start = 0;
+
+    for(uint32_t i = 0; i <= path->size; ++i)
+    {
+        if((i == path->size) || (path->ptr[i] == '/') || (path->ptr[i] == '\\'))
+        {
+            if(((i - start) == 2) && (path->ptr[start] == '.') && (path->ptr[start + 1] == '.'))
+            {
+                return 0;
+            }
+
+            start = i + 1;
+        }
+    }
+
+    return 1;
+}
+
+static void cpk_extract_worker(void* user, const uint64_t index)
+{
+    CPK_EXTRACT_CTX* ctx = (CPK_EXTRACT_CTX*)user;
+    CPK_ENTRY* entry = cpk_get_entry_by_index(ctx->cpk, index);
+
+    if(cpk_path_is_safe(entry->path) == 0)
+    {
+        ctx->status[index] = FU_ERROR;
+        return;
+    }
+
+    SU_STRING* out_path = su_create_string(ctx->out_dir, strlen(ctx->out_dir));
+    su_insert_char(out_path, -1, "/", 1);
+    su_insert_string(out_path, -1, entry->path);
+
+    cpk_create_parent_dirs(out_path);
+    ctx->status[index] = cpk_extract_entry(ctx->cpk, entry, out_path->ptr);
+
+    out_path = su_free(out_path);
+}
+
+uint32_t cpk_extract_all(CPK_FILE* cpk, const char* out_dir, const uint32_t thread_count)
+{
+    const uint32_t count = cpk_get_entry_count(cpk);
+    CPK_EXTRACT_CTX ctx = {0};
+    ctx.cpk = cpk;
+    ctx.out_dir = out_dir;
+    ctx.status = (uint8_t*)calloc(count + 1, 1);
+
+    pu_create_dir_char(out_dir);
+    tp_parallel_for(count, thread_count, cpk_extract_worker, &ctx);
+
+    uint32_t failed = 0;
+
+    for(uint32_t i = 0; i != count; ++i)
+    {
+        failed += (ctx.status[i] != FU_SUCCESS);
+    }
+
+    free(ctx.status);
+
+    return failed;
+}
@@ -0,0 +1,143 @@
+#pragma once
+
+/*
+    CRIWARE CPK archive.
+
+    Every section is a 0x10 byte header (magic, flags, u64 LE size)
+    followed by an @UTF table, which may be encrypted.
+
+    CPK         - CpkHeader, offsets and sizes of the other sections
+    TOC         - File names, directories, sizes and offsets
+    ITOC        - File ids. Without TOC it's the only file list
+                  and offsets are implied by id order and alignment
+    ETOC        - Update dates of TOC entries
+    GTOC        - Groups/attributes, kept as-is
+
+    Archive is never read as a whole. It's mapped and entries
+    point straight into the mapping.
+*/
+
+#include <stdint.h>
+
+#include <kwaslib/core/io/string_utils.h>
+#include <kwaslib/core/io/file_utils.h>
+#include <kwaslib/core/io/raw_file.h>
+#include <kwaslib/core/data/cvector.h>
+
+#include <kwaslib/cri/utf/utf_table.h>
+
+/*
+    Defines
+*/
+#define CPK_MAGIC                   (const char*)"CPK "
+#define CPK_TOC_MAGIC               (const char*)"TOC "
+#define CPK_ITOC_MAGIC              (const char*)"ITOC"
+#define CPK_ETOC_MAGIC              (const char*)"ETOC"
+#define CPK_GTOC_MAGIC              (const char*)"GTOC"
+#define CPK_SECTION_HEADER_SIZE     (uint8_t)(0x10)
+
+/* @UTF table encryption */
+#define CPK_UTF_KEY_SEED            (uint32_t)(0x0000655F)
+#define CPK_UTF_KEY_MULT            (uint32_t)(0x00004115)
+
+/*
+    Structures
+*/
+typedef struct CPK_ENTRY CPK_ENTRY;
+struct CPK_ENTRY
+{
+    uint32_t id;
+    SU_STRING* path;        /* DirName/FileName, id for ITOC-only archives */
+    uint64_t offset;        /* Absolute offset in the archive */
+    uint64_t size;          /* Stored size */
+    uint64_t extract_size;  /* Size after decompression */
+    uint64_t update_time;   /* From ETOC, 0 if missing */
+};
+
+typedef struct CPK_FILE CPK_FILE;
+struct CPK_FILE
+{
+    RF_MAP* map;
+
+    UTF_TABLE* header;
+    UTF_TABLE* toc;
+    UTF_TABLE* itoc;
+    UTF_TABLE* etoc;
+    UTF_TABLE* gtoc;
+
+    uint64_t content_offset;
+    uint64_t content_size;
+    uint16_t align;
+
+    CVEC entries;           /* Array of CPK_ENTRY, in TOC order */
+    CPK_ENTRY** id_index;   /* Entries sorted by id */
+    CPK_ENTRY** path_index; /* Entries sorted by path */
+};
+
+/*
+    Maps the archive and parses all of its tables.
+
+    Returns a pointer to CPK_FILE; NULL on error.
+*/
+CPK_FILE* cpk_open(const char* path);
+
+/*
+    Frees tables, entries and unmaps the archive.
+
+    Returns NULL.
+*/
+CPK_FILE* cpk_close(CPK_FILE* cpk);
+
+/*
+    Decrypts an encrypted @UTF table in place.
+*/
+void cpk_decrypt_utf(uint8_t* data, const uint64_t size);
+
+/*
+    Entry access.
+    Lookups by id and path are binary searches.
+
+    Return a pointer to entry; NULL if not found.
+*/
+const uint32_t cpk_get_entry_count(CPK_FILE* cpk);
+CPK_ENTRY* cpk_get_entry_by_index(CPK_FILE* cpk, const uint32_t index);
+CPK_ENTRY* cpk_find_entry_by_id(CPK_FILE* cpk, const uint32_t id);
+CPK_ENTRY* cpk_find_entry_by_path(CPK_FILE* cpk, const char* path);
+
+/*
+    Returns a pointer to stored data of the entry inside the mapping;
+    NULL if the entry goes past the end of the archive.
+*/
+const uint8_t* cpk_get_entry_data(CPK_FILE* cpk, CPK_ENTRY* entry);
+
+/*
+    Compressed entries are CRILAYLA.
+    Tables without ExtractSize only have stored entries.
+*/
+static inline uint8_t cpk_entry_is_compressed(CPK_ENTRY* entry)
+{
+    return (entry->extract_size != entry->size);
+}
+
+/*
+    Reads the entry, decompressing it if needed.
+
+    Returns a pointer to new buffer and its size in `size`; NULL on error.
+*/
+uint8_t* cpk_read_entry(CPK_FILE* cpk, CPK_ENTRY* entry, uint64_t* size);
+
+/*
+    Writes the entry to `out_path`, decompressing it if needed.
+
+    Returns FU_SUCCESS on success, FU_ERROR otherwise.
+*/
+uint8_t cpk_extract_entry(CPK_FILE* cpk, CPK_ENTRY* entry, const char* out_path);
+
+/*
+    Extracts every entry to `out_dir`, creating directories on the way.
+    Entries are distributed over `thread_count` threads (TP_THREADS_AUTO for all cores),
+    each one copying (or decompressing) its own range of the mapping.
+
+    Returns the amount of entries that failed.
+*/
+uint32_t cpk_extract_all(CPK_FILE* cpk, const char* out_dir, const uint32_t thread_count);
@@ -1,8 +1,12 @@
 #include "adx.h"
 
 #include <stdlib.h>
+#include <string.h>
+#include <math.h>
 
 #include <kwaslib/core/io/type_readers.h>
+#include <kwaslib/core/io/type_writers.h>
+#include <kwaslib/core/thread/thread_pool.h>
 
 ADX_FILE* adx_alloc()
 {
@@ -192,4 +196,504 @@ const uint8_t adx_check_if_valid(const uint8_t* data, const uint32_t size)
     }
     
     return ADX_TYPE_ADX;
-}
\ No newline at end of file
+}
+
+static uint8_t adx_is_enc_type(const uint8_t type)
+{
+    return (type == ADX_ENC_NONE) || (type == ADX_ENC_TYPE8) || (type == ADX_ENC_TYPE9);
+}
+
+uint8_t adx_rekey(uint8_t* data, const uint32_t size,
+                  const CRI_ADX_KEY old_key, const CRI_ADX_KEY new_key,
+                  const uint8_t new_type)
+{
+    if(adx_check_if_valid(data, size) != ADX_TYPE_ADX)
+    {
+        return 0;
+    }
+    
+    const uint8_t old_type = data[ADX_ENC_OFFSET];
+    const uint8_t frame_size = data[5];
+    
+    if(!adx_is_enc_type(old_type) || !adx_is_enc_type(new_type) || (frame_size <= 2))
+    {
+        return 0;
+    }
+    
+    /* An all-zero key keeps its stream at zero */
+    const CRI_ADX_KEY zero = {0};
+    const CRI_ADX_KEY* old_stream = (old_type != ADX_ENC_NONE) ? &old_key : &zero;
+    const CRI_ADX_KEY* new_stream = (new_type != ADX_ENC_NONE) ? &new_key : &zero;
+    uint16_t old_xor = old_stream->start;
+    uint16_t new_xor = new_stream->start;
+    
+    /*
+        Stream steps once per frame, channels interleaved.
+        Scales are 13 bit and XOR values 15 bit, so the end marker (0x8001)
+        is the first frame with the top bit set.
+    */
+    uint32_t pos = 4 + tr_read_u16be(&data[2]);
+    
+    while(((pos + frame_size) <= size) && ((data[pos] & 0x80) == 0))
+    {
+        const uint16_t mask = old_xor ^ new_xor;
+        data[pos] ^= mask >> 8;
+        data[pos+1] ^= mask & 0xFF;
+        
+        old_xor = cri_key_adx_next(old_xor, old_stream);
+        new_xor = cri_key_adx_next(new_xor, new_stream);
+        pos += frame_size;
+    }
+    
+    data[ADX_ENC_OFFSET] = new_type;
+    
+    return 1;
+}
+
+uint8_t adx_decrypt(uint8_t* data, const uint32_t size, const CRI_ADX_KEY key)
+{
+    const CRI_ADX_KEY zero = {0};
+    return adx_rekey(data, size, key, zero, ADX_ENC_NONE);
+}
+
+uint8_t adx_encrypt(uint8_t* data, const uint32_t size,
+                    const CRI_ADX_KEY key, const uint8_t type)
+{
+    if((size <= ADX_ENC_OFFSET) || (data[ADX_ENC_OFFSET] != ADX_ENC_NONE) || (type == ADX_ENC_NONE))
+    {
+        return 0;
+    }
+    
+    const CRI_ADX_KEY zero = {0};
+    return adx_rekey(data, size, zero, key, type);
+}
+
+/*
+    Decoder
+*/
+ADX_DECODER* adx_decoder_open(const uint8_t* data, const uint32_t size, const CRI_ADX_KEY key)
+{
+    if(adx_check_if_valid(data, size) != ADX_TYPE_ADX)
+    {
+        return NULL;
+    }
+    
+    const uint32_t data_start = 4 + tr_read_u16be(&data[2]);
+    const uint8_t encoding_type = data[4];
+    const uint8_t frame_size = data[5];
+    const uint8_t channels = data[7];
+    const uint8_t enc_type = data[ADX_ENC_OFFSET];
+    
+    if((encoding_type != 3) || (frame_size <= 2) || (channels == 0)
+       || (data_start > size) || !adx_is_enc_type(enc_type))
+    {
+        return NULL;
+    }
+    
+    ADX_DECODER* dec = (ADX_DECODER*)calloc(1, sizeof(ADX_DECODER));
+    dec->frames = &data[data_start];
+    dec->frame_count = (size - data_start)/((uint32_t)frame_size*channels);
+    dec->channel_count = channels;
+    dec->frame_size = frame_size;
+    dec->sample_rate = tr_read_u32be(&data[8]);
+    dec->sample_count = tr_read_u32be(&data[12]);
+    dec->hist = (int32_t*)calloc(2*channels, sizeof(int32_t));
+    adx_calc_coefs(tr_read_u16be(&data[16]), dec->sample_rate, &dec->coef1, &dec->coef2);
+    
+    if(enc_type != ADX_ENC_NONE)
+    {
+        dec->key = key;
+        dec->xor = key.start;
+    }
+    
+    return dec;
+}
+
+ADX_DECODER* adx_decoder_close(ADX_DECODER* dec)
+{
+    if(dec)
+    {
+        free(dec->hist);
+        free(dec);
+    }
+    
+    return NULL;
+}
+
+uint32_t adx_decode(ADX_DECODER* dec, int16_t* pcm, const uint32_t max_samples)
+{
+    const uint32_t channels = dec->channel_count;
+    const uint32_t samples_frame = (dec->frame_size - 2)*2;
+    uint32_t written = 0;
+    
+    while(((written + samples_frame) <= max_samples)
+          && (dec->frame < dec->frame_count) && (dec->position < dec->sample_count))
+    {
+        uint32_t count = dec->sample_count - dec->position;
+        if(count > samples_frame) count = samples_frame;
+        
+        const uint8_t* row = &dec->frames[(uint64_t)dec->frame*dec->frame_size*channels];
+        
+        for(uint32_t c = 0; c != channels; ++c)
+        {
+            const uint8_t* frame = &row[c*dec->frame_size];
+            
+            /* Same order as adx_rekey(), the end marker stops everything */
+            if(frame[0] & 0x80)
+            {
+                dec->frame = dec->frame_count;
+                return written;
+            }
+            
+            const int32_t scale = ((tr_read_u16be(frame) ^ dec->xor) & 0x1FFF) + 1;
+            dec->xor = cri_key_adx_next(dec->xor, &dec->key);
+            
+            int32_t* hist = &dec->hist[c*2];
+            int16_t* out = &pcm[written*channels + c];
+            
+            for(uint32_t i = 0; i != count; ++i)
+            {
+                const uint8_t byte = frame[2 + i/2];
+                const int32_t nibble = (i & 1) ? ((int8_t)(byte << 4) >> 4) : ((int8_t)byte >> 4);
+                int32_t y = nibble*scale + ((hist[0]*dec->coef1 + hist[1]*dec->coef2) >> 12);
+                
+                if(y > 32767) y = 32767;
+                if(y < -32768) y = -32768;
+                
+                hist[1] = hist[0];
+                hist[0] = y;
+                out[i*channels] = y;
+            }
+        }
+        
+        dec->frame += 1;
+        dec->position += count;
+        written += count;
+    }
+    
+    return written;
+}
+
+/*
+    Encoder
+*/
+void adx_calc_coefs(const uint16_t highpass_freq, const uint32_t sample_rate,
+                    int32_t* coef1, int32_t* coef2)
+{
+    const double z = cos(2.0*M_PI*highpass_freq/sample_rate);
+    const double a = M_SQRT2 - z;
+    const double b = M_SQRT2 - 1.0;
+    const double c = (a - sqrt((a+b)*(a-b)))/b;
+    
+    *coef1 = (int32_t)(c*8192.0);
+    *coef2 = (int32_t)(c*c*-4096.0);
+}
+
+/* 4 lanes, works the same with SSE2 and NEON */
+typedef int32_t ADX_V4I __attribute__((vector_size(16)));
+typedef float ADX_V4F __attribute__((vector_size(16)));
+
+static inline ADX_V4I adx_v4_min(const ADX_V4I a, const ADX_V4I b)
+{
+    const ADX_V4I m = a < b;
+    return (a & m) | (b & ~m);
+}
+
+static inline ADX_V4I adx_v4_max(const ADX_V4I a, const ADX_V4I b)
+{
+    const ADX_V4I m = a > b;
+    return (a & m) | (b & ~m);
+}
+
+static inline ADX_V4I adx_v4_clamp(const ADX_V4I v, const int32_t lo, const int32_t hi)
+{
+    const ADX_V4I vlo = {lo, lo, lo, lo};
+    const ADX_V4I vhi = {hi, hi, hi, hi};
+    return adx_v4_min(adx_v4_max(v, vlo), vhi);
+}
+
+/*
+    Encodes one frame of ADX_SAMPLES_PER_FRAME samples.
+    `x` has the two input samples before the frame at x[-2] and x[-1].
+    `hist` holds the last two decoded samples and gets updated.
+*/
+static void adx_encode_frame(const int32_t* x, int32_t hist[2],
+                             const int32_t coef1, const int32_t coef2, uint8_t* out)
+{
+    /* Range of the residual against the input, it has no feedback */
+    ADX_V4I vlo = {0};
+    ADX_V4I vhi = {0};
+    
+    for(uint32_t i = 0; i != ADX_SAMPLES_PER_FRAME; i += 4)
+    {
+        ADX_V4I s0, s1, s2;
+        memcpy(&s0, &x[i], sizeof(ADX_V4I));
+        memcpy(&s1, &x[i] - 1, sizeof(ADX_V4I));
+        memcpy(&s2, &x[i] - 2, sizeof(ADX_V4I));
+        
+        const ADX_V4I res = s0 - ((s1*coef1 + s2*coef2) >> 12);
+        vlo = adx_v4_min(vlo, res);
+        vhi = adx_v4_max(vhi, res);
+    }
+    
+    int32_t lo = 0;
+    int32_t hi = 0;
+    
+    for(uint32_t i = 0; i != 4; ++i)
+    {
+        if(vlo[i] < lo) lo = vlo[i];
+        if(vhi[i] > hi) hi = vhi[i];
+    }
+    
+    int32_t base = (hi + 6)/7;
+    if(((-lo + 7)/8) > base) base = (-lo + 7)/8;
+    if(base < 1) base = 1;
+    
+    /*
+        Quantization feeds back through the history, so every lane
+        runs the whole frame with a different scale and the best one wins.
+    */
+    const ADX_V4I scale = adx_v4_clamp((ADX_V4I){base, base + base/8 + 1, base + base/4 + 1, base + base/2 + 1},
+                                       1, 0x2000);
+    const ADX_V4F inv = (ADX_V4F){1.0f, 1.0f, 1.0f, 1.0f} / __builtin_convertvector(scale, ADX_V4F);
+    ADX_V4I h1 = {hist[0], hist[0], hist[0], hist[0]};
+    ADX_V4I h2 = {hist[1], hist[1], hist[1], hist[1]};
+    ADX_V4F err = {0};
+    ADX_V4I q[ADX_SAMPLES_PER_FRAME];
+    
+    for(uint32_t i = 0; i != ADX_SAMPLES_PER_FRAME; ++i)
+    {
+        const ADX_V4I pred = (h1*coef1 + h2*coef2) >> 12;
+        const ADX_V4I diff = x[i] - pred;
+        
+        /* Offset keeps the truncation a rounding for the whole nibble range */
+        const ADX_V4F qf = __builtin_convertvector(diff, ADX_V4F)*inv + 8.5f;
+        q[i] = adx_v4_clamp(__builtin_convertvector(qf, ADX_V4I) - 8, -8, 7);
+        
+        const ADX_V4I y = adx_v4_clamp(q[i]*scale + pred, -32768, 32767);
+        const ADX_V4F d = __builtin_convertvector(x[i] - y, ADX_V4F);
+        err += d*d;
+        h2 = h1;
+        h1 = y;
+    }
+    
+    uint32_t best = 0;
+    
+    for(uint32_t i = 1; i != 4; ++i)
+    {
+        if(err[i] < err[best]) best = i;
+    }
+    
+    tw_write_u16be(scale[best] - 1, &out[0]);
+    
+    for(uint32_t i = 0; i != ADX_SAMPLES_PER_FRAME; i += 2)
+    {
+        out[2 + i/2] = ((q[i][best] & 0xF) << 4) | (q[i+1][best] & 0xF);
+    }
+    
+    hist[0] = h1[best];
+    hist[1] = h2[best];
+}
+
+typedef struct
+{
+    const int16_t* pcm;
+    uint32_t sample_count;      /* Per channel, without alignment */
+    uint32_t align;             /* Silent samples in front */
+    uint8_t channels;
+    uint8_t frame_size;
+    int32_t coef1;
+    int32_t coef2;
+    uint32_t frame_count;       /* Per channel */
+    uint32_t segment_count;     /* Per channel */
+    uint8_t* frames;            /* First frame in the output */
+    int32_t* hist;              /* Decoded history after every frame */
+} ADX_ENCODE_CTX;
+
+static void adx_encode_load(ADX_ENCODE_CTX* ctx, const uint32_t channel,
+                            const int64_t first, const uint32_t count, int32_t* out)
+{
+    for(uint32_t i = 0; i != count; ++i)
+    {
+        const int64_t s = first + i - ctx->align;
+        out[i] = ((s >= 0) && (s < ctx->sample_count)) ? ctx->pcm[s*ctx->channels + channel] : 0;
+    }
+}
+
+static int32_t* adx_encode_hist(ADX_ENCODE_CTX* ctx, const uint32_t channel, const uint32_t frame)
+{
+    return &ctx->hist[((uint64_t)channel*ctx->frame_count + frame)*2];
+}
+
+static void adx_encode_frame_at(ADX_ENCODE_CTX* ctx, const uint32_t channel,
+                                const uint32_t frame, int32_t hist[2])
+{
+    int32_t x[2 + ADX_SAMPLES_PER_FRAME];
+    adx_encode_load(ctx, channel, (int64_t)frame*ADX_SAMPLES_PER_FRAME - 2, 2 + ADX_SAMPLES_PER_FRAME, x);
+    
+    uint8_t* out = &ctx->frames[((uint64_t)frame*ctx->channels + channel)*ctx->frame_size];
+    adx_encode_frame(&x[2], hist, ctx->coef1, ctx->coef2, out);
+    
+    int32_t* stored = adx_encode_hist(ctx, channel, frame);
+    stored[0] = hist[0];
+    stored[1] = hist[1];
+}
+
+static void adx_encode_segment_worker(void* user, const uint64_t idx)
+{
+    ADX_ENCODE_CTX* ctx = (ADX_ENCODE_CTX*)user;
+    const uint32_t channel = idx % ctx->channels;
+    const uint32_t first = (idx / ctx->channels)*ADX_ENCODE_SEGMENT;
+    uint32_t last = first + ADX_ENCODE_SEGMENT;
+    if(last > ctx->frame_count) last = ctx->frame_count;
+    
+    /* Input stands in for the decoded history of the previous segment */
+    int32_t x[2];
+    adx_encode_load(ctx, channel, (int64_t)first*ADX_SAMPLES_PER_FRAME - 2, 2, x);
+    int32_t hist[2] = {x[1], x[0]};
+    
+    for(uint32_t f = first; f != last; ++f)
+    {
+        adx_encode_frame_at(ctx, channel, f, hist);
+    }
+}
+
+static void adx_encode_seam_worker(void* user, const uint64_t channel)
+{
+    ADX_ENCODE_CTX* ctx = (ADX_ENCODE_CTX*)user;
+    uint32_t next = 0;
+    
+    /*
+        Re-encode from every segment start with the real history
+        until a frame ends with the same history as before.
+    */
+    for(uint32_t s = 1; s < ctx->segment_count; ++s)
+    {
+        uint32_t f = s*ADX_ENCODE_SEGMENT;
+        if(f < next) continue;
+        
+        for(; f != ctx->frame_count; ++f)
+        {
+            const int32_t* prev = adx_encode_hist(ctx, channel, f-1);
+            const int32_t* old = adx_encode_hist(ctx, channel, f);
+            const int32_t old_hist[2] = {old[0], old[1]};
+            int32_t hist[2] = {prev[0], prev[1]};
+            
+            adx_encode_frame_at(ctx, channel, f, hist);
+            
+            if((hist[0] == old_hist[0]) && (hist[1] == old_hist[1]))
+                break;
+        }
+        
+        next = f + 1;
+    }
+}
+
+SU_STRING* adx_encode(const int16_t* pcm, const uint32_t sample_count,
+                      const ADX_ENCODE_PARAMS* params)
+{
+    const uint8_t channels = params->channel_count;
+    
+    if((pcm == NULL) || (sample_count == 0) || (channels == 0) || (params->sample_rate == 0)
+       || ((params->version != 3) && (params->version != 4)))
+    {
+        return NULL;
+    }
+    
+    if(params->loop && ((params->loop_start >= params->loop_end) || (params->loop_end > sample_count)))
+    {
+        return NULL;
+    }
+    
+    const uint8_t frame_size = ADX_FRAME_SIZE_DEFAULT;
+    const uint16_t highpass = params->highpass_freq ? params->highpass_freq : ADX_HIGHPASS_DEFAULT;
+    
+    /* Loop start has to begin a frame */
+    uint32_t align = 0;
+    
+    if(params->loop && (params->loop_start % ADX_SAMPLES_PER_FRAME))
+    {
+        align = ADX_SAMPLES_PER_FRAME - (params->loop_start % ADX_SAMPLES_PER_FRAME);
+    }
+    
+    const uint32_t total_samples = sample_count + align;
+    uint32_t frame_count = total_samples/ADX_SAMPLES_PER_FRAME;
+    if(total_samples%ADX_SAMPLES_PER_FRAME)
+        frame_count += 1;
+    
+    /* Header, (c)CRI right before the data */
+    uint32_t loop_pos = 20;
+    
+    if(params->version == 4)
+    {
+        loop_pos += 4 + 4*((channels < 2) ? 2 : channels);
+    }
+    
+    const uint32_t data_start = loop_pos + 24 + 6;
+    const uint32_t frame_row = frame_size*channels;
+    const uint64_t file_size = data_start + (uint64_t)frame_count*frame_row + frame_size;
+    
+    if(file_size > 0xFFFFFFFF)
+    {
+        return NULL;
+    }
+    
+    SU_STRING* adx = su_create_string(NULL, file_size);
+    uint8_t* d = (uint8_t*)adx->ptr;
+    memset(d, 0, file_size);
+    
+    tw_write_array((const uint8_t*)ADX_MAGIC, 2, &d[0]);
+    tw_write_u16be(data_start - 4, &d[2]);
+    d[4] = 3;
+    d[5] = frame_size;
+    d[6] = 4;
+    d[7] = channels;
+    tw_write_u32be(params->sample_rate, &d[8]);
+    tw_write_u32be(total_samples, &d[12]);
+    tw_write_u16be(highpass, &d[16]);
+    d[18] = params->version;
+    d[ADX_ENC_OFFSET] = ADX_ENC_NONE;
+    
+    if(params->loop)
+    {
+        const uint32_t loop_start = params->loop_start + align;
+        const uint32_t loop_end = params->loop_end + align;
+        const uint32_t end_frame = (loop_end + ADX_SAMPLES_PER_FRAME - 1)/ADX_SAMPLES_PER_FRAME;
+        
+        tw_write_u16be(align, &d[loop_pos]);
+        tw_write_u16be(1, &d[loop_pos+2]);
+        tw_write_u16be(0, &d[loop_pos+4]);
+        tw_write_u16be(1, &d[loop_pos+6]);
+        tw_write_u32be(loop_start, &d[loop_pos+8]);
+        tw_write_u32be(data_start + (loop_start/ADX_SAMPLES_PER_FRAME)*frame_row, &d[loop_pos+12]);
+        tw_write_u32be(loop_end, &d[loop_pos+16]);
+        tw_write_u32be(data_start + end_frame*frame_row, &d[loop_pos+20]);
+    }
+    
+    tw_write_array((const uint8_t*)ADX_CRI_COPYRIGHT_STR, 6, &d[data_start-6]);
+    
+    /* Frames */
+    ADX_ENCODE_CTX ctx = {0};
+    ctx.pcm = pcm;
+    ctx.sample_count = sample_count;
+    ctx.align = align;
+    ctx.channels = channels;
+    ctx.frame_size = frame_size;
+    adx_calc_coefs(highpass, params->sample_rate, &ctx.coef1, &ctx.coef2);
+    ctx.frame_count = frame_count;
+    ctx.segment_count = (frame_count + ADX_ENCODE_SEGMENT - 1)/ADX_ENCODE_SEGMENT;
+    ctx.frames = &d[data_start];
+    ctx.hist = (int32_t*)calloc((uint64_t)frame_count*channels*2, sizeof(int32_t));
+    
+    tp_parallel_for((uint64_t)ctx.segment_count*channels, params->thread_count, adx_encode_segment_worker, &ctx);
+    tp_parallel_for(channels, params->thread_count, adx_encode_seam_worker, &ctx);
+    
+    free(ctx.hist);
+    
+    /* Footer fills the last frame */
+    const uint32_t footer = data_start + frame_count*frame_row;
+    tw_write_array((const uint8_t*)"\x80\x01", 2, &d[footer]);
+    tw_write_u16be(frame_size - 4, &d[footer+2]);
+    
+    return adx;
+}
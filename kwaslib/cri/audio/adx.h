@@ -12,6 +12,7 @@
 
 #include <kwaslib/core/io/string_utils.h>
 #include <kwaslib/core/data/cvector.h>
+#include <kwaslib/core/crypto/cri_key.h>
 
 #define ADX_MAGIC               (const char*)"\x80\x00"
 #define ADX_CRI_COPYRIGHT_STR   (const char*)"(c)CRI"
@@ -21,6 +22,18 @@
 #define ADX_TYPE_ADX            (uint8_t)(1)
 #define ADX_TYPE_AHX            (uint8_t)(2)
 
+/* Stored in ADX_HEADER.revision, byte 0x13 */
+#define ADX_ENC_OFFSET          (uint8_t)(0x13)
+#define ADX_ENC_NONE            (uint8_t)(0)
+#define ADX_ENC_TYPE8           (uint8_t)(8)    /* Key from a passphrase */
+#define ADX_ENC_TYPE9           (uint8_t)(9)    /* Key from a 64-bit keycode */
+
+/* Encoder */
+#define ADX_FRAME_SIZE_DEFAULT  (uint8_t)(18)
+#define ADX_SAMPLES_PER_FRAME   (uint8_t)(32)
+#define ADX_HIGHPASS_DEFAULT    (uint16_t)(500)
+#define ADX_ENCODE_SEGMENT      (uint32_t)(1024)    /* Frames per thread job */
+
 typedef struct
 {
     uint8_t s1 : 4;
@@ -62,7 +75,7 @@ typedef struct
     uint32_t sample_count;
     int16_t highpass_freq;
     uint8_t version;
-    uint8_t revision;
+    uint8_t revision;       /* Encryption type, ADX_ENC_* */
     
     uint16_t alignment_samples;
     uint16_t loop_count;
@@ -89,6 +102,41 @@ typedef struct
     ADX_FOOTER footer;
 } ADX_FILE;
 
+/*
+    Settings of adx_encode().
+*/
+typedef struct
+{
+    uint32_t sample_rate;
+    uint8_t channel_count;
+    uint8_t version;            /* 3 or 4 */
+    uint16_t highpass_freq;     /* 0 for ADX_HIGHPASS_DEFAULT */
+    uint8_t loop;               /* Loop points are used only if set */
+    uint32_t loop_start;        /* First sample of the loop */
+    uint32_t loop_end;          /* Sample after the last one of the loop */
+    uint32_t thread_count;      /* 0 for all cores */
+} ADX_ENCODE_PARAMS;
+
+/*
+    Streaming decoder state, see adx_decoder_open().
+*/
+typedef struct
+{
+    const uint8_t* frames;      /* First frame of the first channel */
+    uint32_t frame_count;       /* Per channel, that fit in the data */
+    uint32_t frame;             /* Next frame to decode */
+    uint8_t channel_count;
+    uint8_t frame_size;
+    uint32_t sample_rate;
+    uint32_t sample_count;      /* Per channel */
+    uint32_t position;          /* Samples per channel decoded so far */
+    int32_t coef1;
+    int32_t coef2;
+    int32_t* hist;              /* Two samples per channel */
+    CRI_ADX_KEY key;            /* All zero when plain */
+    uint16_t xor;               /* XOR of the next frame */
+} ADX_DECODER;
+
 /*
     Implementation
 */
@@ -123,4 +171,76 @@ const uint32_t adx_get_file_size(ADX_FILE* adx);
     Checks if the file is either ADX or AHX.
     Returns ADX_TYPE_BAD on error.
 */
-const uint8_t adx_check_if_valid(const uint8_t* data, const uint32_t size);
\ No newline at end of file
+const uint8_t adx_check_if_valid(const uint8_t* data, const uint32_t size);
+
+/*
+    Re-encrypts the ADX at `data` in place, without decoding.
+    Frames are decrypted with `old_key` if the header says they're encrypted,
+    then encrypted with `new_key` as `new_type`, in a single XOR of each frame scale.
+    Nothing but the 2-byte scales and the encryption byte is touched.
+    ADX_ENC_NONE as `new_type` leaves the file decrypted.
+    
+    Returns 1 on success, 0 if it's not an ADX or the type is unknown.
+*/
+uint8_t adx_rekey(uint8_t* data, const uint32_t size,
+                  const CRI_ADX_KEY old_key, const CRI_ADX_KEY new_key,
+                  const uint8_t new_type);
+
+/*
+    Decrypts the ADX in place, if it's encrypted.
+    
+    Returns 1 on success, 0 if it's not an ADX or the type is unknown.
+*/
+uint8_t adx_decrypt(uint8_t* data, const uint32_t size, const CRI_ADX_KEY key);
+
+/*
+    Encrypts a plain ADX in place as `type`.
+    
+    Returns 1 on success, 0 if it's not a plain ADX or the type is unknown.
+*/
+uint8_t adx_encrypt(uint8_t* data, const uint32_t size,
+                    const CRI_ADX_KEY key, const uint8_t type);
+
+/*
+    Returns the prediction coefficients for a highpass frequency and sample rate.
+*/
+void adx_calc_coefs(const uint16_t highpass_freq, const uint32_t sample_rate,
+                    int32_t* coef1, int32_t* coef2);
+
+/*
+    Encodes `sample_count` samples per channel of interleaved 16-bit PCM to ADX.
+    A loop start that is not on a frame boundary is aligned by prepending silence.
+    
+    Channels and segments of ADX_ENCODE_SEGMENT frames are encoded on separate threads.
+    History is handed across segment boundaries afterwards, so the result
+    doesn't depend on the amount of threads.
+    
+    Returns the file as a SU_STRING, NULL on bad parameters.
+*/
+SU_STRING* adx_encode(const int16_t* pcm, const uint32_t sample_count,
+                      const ADX_ENCODE_PARAMS* params);
+
+/*
+    Sets up decoding of the ADX at `data` without copying it.
+    `key` is used only if the header says the file is encrypted.
+    Only encoding type 3 (coefficients from the highpass frequency) is supported.
+    
+    Returns the decoder, NULL if it's not a supported ADX.
+*/
+ADX_DECODER* adx_decoder_open(const uint8_t* data, const uint32_t size, const CRI_ADX_KEY key);
+
+/*
+    Frees the decoder, the data given to adx_decoder_open() stays as it is.
+    
+    Returns NULL.
+*/
+ADX_DECODER* adx_decoder_close(ADX_DECODER* dec);
+
+/*
+    Decodes whole frames into `pcm` as interleaved 16-bit samples,
+    up to `max_samples` per channel. It has to fit at least one frame,
+    (frame_size-2)*2 samples.
+    
+    Returns the amount of samples per channel written, 0 at the end.
+*/
+uint32_t adx_decode(ADX_DECODER* dec, int16_t* pcm, const uint32_t max_samples);
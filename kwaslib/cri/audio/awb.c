@@ -6,6 +6,8 @@
 #include <kwaslib/core/io/type_readers.h>
 #include <kwaslib/core/io/type_writers.h>
 #include <kwaslib/core/math/boundary.h>
+#include <kwaslib/core/thread/thread_pool.h>
+#include <kwaslib/core/crypto/cri_key.h>
 #include <kwaslib/cri/audio/hca.h>
 #include <kwaslib/cri/audio/adx.h>
 
@@ -31,6 +33,49 @@ AWB_FILE* awb_free(AWB_FILE* awb)
     return NULL;
 }
 
+/* Offsets and the file size are u16 or u32 */
+static inline uint32_t awb_read_offset(const uint8_t* data, const uint8_t offset_size)
+{
+    return (offset_size == 2) ? tr_read_u16le(data) : tr_read_u32le(data);
+}
+
+static inline void awb_write_offset(const uint32_t offset, const uint8_t offset_size, uint8_t* data)
+{
+    if(offset_size == 2) tw_write_u16le(offset, data);
+    else tw_write_u32le(offset, data);
+}
+
+typedef struct
+{
+    AWB_FILE* awb;
+    const uint8_t* data;
+    uint32_t file_size;
+} AWB_LOAD_CTX;
+
+static void awb_load_worker(void* user, const uint64_t index)
+{
+    AWB_LOAD_CTX* ctx = (AWB_LOAD_CTX*)user;
+    AWB_ENTRY* entry = awb_get_entry_by_id(ctx->awb, index);
+    
+    /* Entry can't go past the next one */
+    uint32_t end = ctx->file_size;
+    
+    if((index+1) != awb_get_file_count(ctx->awb))
+    {
+        end = awb_get_entry_by_id(ctx->awb, index+1)->offset;
+    }
+    
+    /* Offsets are almost never at the start of audio data */
+    const uint32_t fixed_offset = awb_fix_offset(entry->offset, ctx->awb->header.alignment);
+    const uint8_t* data_offset = &ctx->data[fixed_offset];
+    const uint32_t max_size = (end > fixed_offset) ? (end - fixed_offset) : 0;
+    entry->size = awb_probe_data(data_offset, max_size, &entry->type);
+    
+    /* Read the file data */
+    entry->data = (uint8_t*)calloc(1, entry->size);
+    tr_read_array(data_offset, entry->size, &entry->data[0]);
+}
+
 AWB_FILE* awb_load_from_data(const uint8_t* data, const uint32_t size)
 {
     if(su_cmp_char((const char*)data, 4, AWB_MAGIC, 4) != 0)
@@ -63,7 +108,7 @@ AWB_FILE* awb_load_from_data(const uint8_t* data, const uint32_t size)
     const uint32_t ids_offset = 16;
     const uint32_t offsets_offset = ids_offset + h->file_count*h->id_size;
     const uint32_t file_size_offset = offsets_offset + h->file_count*h->offset_size;
-    const uint32_t file_size = tr_read_u32le(&data[file_size_offset]);
+    const uint32_t file_size = awb_read_offset(&data[file_size_offset], h->offset_size);
 
     for(uint32_t i = 0; i != h->file_count; ++i)
     {
@@ -74,78 +119,16 @@ AWB_FILE* awb_load_from_data(const uint8_t* data, const uint32_t size)
         if(h->id_size == 2) entry->id = tr_read_u16le(&data[id_pos]);
         else if(h->id_size == 4) entry->id = tr_read_u32le(&data[id_pos]);
         
-        if(h->offset_size == 2) entry->offset = tr_read_u16le(&data[offset_pos]);
-        else if(h->offset_size == 4) entry->offset = tr_read_u32le(&data[offset_pos]);
-        
-        /* Offsets are almost never at the start of audio data */
-        const uint32_t fixed_offset = awb_fix_offset(entry->offset, h->alignment);
-        const uint32_t temp_size = file_size-fixed_offset;
-        const uint8_t* data_offset = &data[fixed_offset];
-        entry->type = AWB_DATA_BIN;
-        
-        /* Getting the file size of the ADX file */
-        ADX_FILE* adx = adx_load_from_data(data_offset, temp_size);
-        
-        if(adx)
-        {
-            const uint8_t adx_type = adx_check_if_valid(data_offset, temp_size);
-            switch(adx_type)
-            {
-                case ADX_TYPE_AHX:  entry->type = AWB_DATA_AHX; break;
-                default:            entry->type = AWB_DATA_ADX;
-            }
-            entry->size = adx_get_file_size(adx);
-            
-            goto read_file_data;
-        }
-        
-        /* ADX failed. Next is HCA. */
-        HCA_HEADER hca = hca_read_header_from_data(data_offset, temp_size);
-        
-        if(hca.sections.comp || hca.sections.dec)
-        {
-            const uint8_t hca_header_hash = hca_check_block_hash(data_offset, hca.data_offset);
-            
-            if(hca_header_hash)
-            {
-                entry->type = AWB_DATA_HCA;
-                entry->size = hca_get_file_size(hca);
-                const uint32_t valid_blocks = hca_count_valid_blocks(data_offset, temp_size, hca);
-                
-                /* It's a prefetch HCA*/
-                if(hca.fmt.block_count != valid_blocks)
-                {
-                    hca.fmt.block_count = valid_blocks;
-                    entry->size = hca_get_file_size(hca);
-                }
-                
-                goto read_file_data;
-            }
-        }
-        
-        /* N3DS format used in Lost World */
-        const BCWAV_HEADER bcwav = bcwav_read_header_from_data(data_offset, temp_size);
-        
-        if(bcwav.header_size == BCWAV_HEADER_SIZE)
-        {
-            entry->type = AWB_DATA_BCWAV;
-            entry->size = bcwav.file_size;
-            
-            goto read_file_data;
-        }
-        
-        /* Not ADX or HCA or BCWAV */
-        if(entry->type == AWB_DATA_BIN)
-        {
-            entry->size = temp_size;
-        }
-        
-read_file_data:
-        /* Read the file data */
-        entry->data = (uint8_t*)calloc(1, entry->size);
-        tr_read_array(data_offset, entry->size, &entry->data[0]);
+        entry->offset = awb_read_offset(&data[offset_pos], h->offset_size);
     }
     
+    /* Probing and copying of entries is independent */
+    AWB_LOAD_CTX ctx = {0};
+    ctx.awb = awb;
+    ctx.data = data;
+    ctx.file_size = file_size;
+    tp_parallel_for(h->file_count, TP_THREADS_AUTO, awb_load_worker, &ctx);
+    
     return awb;
 }
 
@@ -153,24 +136,91 @@ AWB_ENTRY* awb_append_entry(AWB_FILE* awb, const uint32_t id, const uint8_t* dat
 {
     AWB_ENTRY entry = {0};
     entry.id = id;
-    entry.data = (uint8_t*)calloc(1, size);
-    memcpy(entry.data, data, size);
     entry.size = size;
     
+    /* Entries without data are written from an RF_SOURCE */
+    if(data)
+    {
+        entry.data = (uint8_t*)calloc(1, size);
+        memcpy(entry.data, data, size);
+    }
+    
     cvec_push_back(awb->entries, &entry);
     return awb_get_entry_by_id(awb, cvec_size(awb->entries)-1);
 }
 
 SU_STRING* awb_to_data(AWB_FILE* awb)
 {
-    AWB_HEADER* h = &awb->header;
+    const uint32_t data_size = awb_update(awb);
+
+    /* Data buffer */
+    SU_STRING* afs2_data = su_create_string(NULL, data_size);
+    awb_write_to_data(awb, data_size, (uint8_t*)&afs2_data->ptr[0]);
     
+    return afs2_data;
+}
+
+void awb_write_to_data(AWB_FILE* awb, const uint32_t data_size, uint8_t* data)
+{
     const uint32_t entries_count = cvec_size(awb->entries);
-    const uint32_t header_size = AWB_HEADER_SIZE
-                                 + (h->offset_size+h->id_size)*entries_count
-                                 + 4;
     
-    uint32_t data_size = header_size;
+    awb_header_to_data(awb, data_size, data);
+    uint32_t pos = awb_get_header_size(awb);
+    
+    /* Writing file data, padding in between is zeroed */
+    for(uint32_t i = 0; i != entries_count; ++i)
+    {
+        AWB_ENTRY* entry = awb_get_entry_by_id(awb, i);
+        const uint32_t file_data_pos = awb_fix_offset(entry->offset, awb->header.alignment);
+        
+        memset(&data[pos], 0, file_data_pos - pos);
+        tw_write_array(entry->data, entry->size, &data[file_data_pos]);
+        pos = file_data_pos + entry->size;
+    }
+    
+    memset(&data[pos], 0, data_size - pos);
+}
+
+uint8_t awb_write_to_rf(AWB_FILE* awb, RF_FILE* out, const RF_SOURCE* sources)
+{
+    const uint32_t data_size = awb_update(awb);
+    const uint32_t header_size = awb_get_header_size(awb);
+    
+    uint8_t* header = (uint8_t*)calloc(1, header_size);
+    awb_header_to_data(awb, data_size, header);
+    uint8_t status = rf_pwrite(out, header, header_size, 0);
+    free(header);
+    
+    for(uint32_t i = 0; (i != cvec_size(awb->entries)) && (status == FU_SUCCESS); ++i)
+    {
+        AWB_ENTRY* entry = awb_get_entry_by_id(awb, i);
+        const uint32_t file_data_pos = awb_fix_offset(entry->offset, awb->header.alignment);
+        
+        if(sources)
+        {
+            status = rf_write_source(out, file_data_pos, &sources[i]);
+        }
+        else
+        {
+            status = rf_pwrite(out, entry->data, entry->size, file_data_pos);
+        }
+    }
+    
+    /* Alignment padding is a hole */
+    if(status == FU_SUCCESS)
+    {
+        status = rf_set_size(out, data_size);
+    }
+    
+    return status;
+}
+
+const uint32_t awb_update(AWB_FILE* awb)
+{
+    AWB_HEADER* h = &awb->header;
+    const uint32_t entries_count = cvec_size(awb->entries);
+    
+    uint32_t data_size = awb_get_header_size(awb);
     
     /* Recalculating offsets and file size */
     for(uint32_t i = 0; i != entries_count; ++i)
@@ -181,11 +231,32 @@ SU_STRING* awb_to_data(AWB_FILE* awb)
         data_size += entry->size;
     }
     
-    data_size = awb_fix_offset(data_size, h->alignment);
+    /* Last offset has to fit too, otherwise offsets grow to u32 */
+    if((h->offset_size == 2) && (awb_fix_offset(data_size, h->alignment) > UINT16_MAX))
+    {
+        h->offset_size = 4;
+        return awb_update(awb);
+    }
+    
+    h->file_count = entries_count;
+    
+    return awb_fix_offset(data_size, h->alignment);
+}
 
-    /* Data buffer */
-    SU_STRING* afs2_data = su_create_string(NULL, data_size);
-    uint8_t* data = (uint8_t*)&afs2_data->ptr[0];
+const uint32_t awb_get_header_size(AWB_FILE* awb)
+{
+    AWB_HEADER* h = &awb->header;
+    
+    /* Offsets have one more entry for the end of data */
+    return AWB_HEADER_SIZE
+           + (h->offset_size+h->id_size)*cvec_size(awb->entries)
+           + h->offset_size;
+}
+
+void awb_header_to_data(AWB_FILE* awb, const uint32_t data_size, uint8_t* data)
+{
+    AWB_HEADER* h = &awb->header;
+    const uint32_t entries_count = cvec_size(awb->entries);
     
     /* Writing header */
     tw_write_array((const uint8_t*)AWB_MAGIC, 4, &data[0]);
@@ -197,30 +268,24 @@ SU_STRING* awb_to_data(AWB_FILE* awb)
     tw_write_u16le(h->alignment, &data[12]);
     tw_write_u16le(h->subkey, &data[14]);
     
-    /* Writing ids, offsets and file data */
+    /* Writing ids and offsets */
     const uint32_t ids_offset = 16;
     const uint32_t offsets_offset = ids_offset + entries_count*h->id_size;
     const uint32_t file_size_offset = offsets_offset + entries_count*h->offset_size;
     
-    tw_write_u32le(data_size, &data[file_size_offset]);
+    awb_write_offset(data_size, h->offset_size, &data[file_size_offset]);
     
     for(uint32_t i = 0; i != entries_count; ++i)
     {
         AWB_ENTRY* entry = awb_get_entry_by_id(awb, i);
         const uint32_t id_pos = ids_offset + h->id_size*i;
         const uint32_t offset_pos = offsets_offset + h->offset_size*i;
-        const uint32_t file_data_pos = awb_fix_offset(entry->offset, h->alignment);
         
         if(h->id_size == 2) tw_write_u16le(entry->id, &data[id_pos]);
-        else if(h->id_size == 4) tw_write_u32le(entry->id, &data[id_pos]);;
-        
-        if(h->offset_size == 2) tw_write_u16le(entry->offset, &data[offset_pos]);
-        else if(h->offset_size == 4) tw_write_u32le(entry->offset, &data[offset_pos]);
+        else if(h->id_size == 4) tw_write_u32le(entry->id, &data[id_pos]);
         
-        tw_write_array(entry->data, entry->size, &data[file_data_pos]);
+        awb_write_offset(entry->offset, h->offset_size, &data[offset_pos]);
     }
-    
-    return afs2_data;
 }
 
 AWB_ENTRY* awb_get_entry_by_id(AWB_FILE* awb, const uint32_t id)
@@ -237,4 +302,285 @@ const uint32_t awb_fix_offset(const uint32_t offset, const uint32_t alignment)
 {
     const uint32_t add = bound_calc_leftover(alignment, offset);
     return offset+add;
-}
\ No newline at end of file
+}
+
+const uint32_t awb_probe_data(const uint8_t* data, const uint32_t size, uint8_t* type)
+{
+    /* Getting the file size of the ADX file */
+    ADX_FILE* adx = adx_load_from_data(data, size);
+    
+    if(adx)
+    {
+        const uint8_t adx_type = adx_check_if_valid(data, size);
+        switch(adx_type)
+        {
+            case ADX_TYPE_AHX:  *type = AWB_DATA_AHX; break;
+            default:            *type = AWB_DATA_ADX;
+        }
+        
+        const uint32_t adx_size = adx_get_file_size(adx);
+        adx = adx_free(adx);
+        return adx_size;
+    }
+    
+    /* ADX failed. Next is HCA. */
+    HCA_HEADER hca = hca_read_header_from_data(data, size);
+    
+    if(hca.sections.comp || hca.sections.dec)
+    {
+        const uint8_t hca_header_hash = hca_check_block_hash(data, hca.data_offset);
+        
+        if(hca_header_hash)
+        {
+            *type = AWB_DATA_HCA;
+            const uint32_t valid_blocks = hca_count_valid_blocks(data, size, hca);
+            
+            /* It's a prefetch HCA*/
+            hca.fmt.block_count = valid_blocks;
+            
+            return hca_get_file_size(hca);
+        }
+    }
+    
+    /* N3DS format used in Lost World */
+    const BCWAV_HEADER bcwav = bcwav_read_header_from_data(data, size);
+    
+    if(bcwav.header_size == BCWAV_HEADER_SIZE)
+    {
+        *type = AWB_DATA_BCWAV;
+        return bcwav.file_size;
+    }
+    
+    /* Not ADX or HCA or BCWAV */
+    *type = AWB_DATA_BIN;
+    return size;
+}
+
+static int awb_index_cmp(const void* a, const void* b)
+{
+    const AWB_INDEX_ENTRY* ea = (const AWB_INDEX_ENTRY*)a;
+    const AWB_INDEX_ENTRY* eb = (const AWB_INDEX_ENTRY*)b;
+    
+    if(ea->id != eb->id) return (ea->id < eb->id) ? -1 : 1;
+    
+    /* Keep archive order for duplicate ids */
+    return (ea->index < eb->index) ? -1 : (ea->index > eb->index);
+}
+
+AWB_INDEX* awb_open_index(const uint8_t* data, const uint32_t size)
+{
+    if((size < AWB_HEADER_SIZE)
+       || (su_cmp_char((const char*)data, 4, AWB_MAGIC, 4) != 0))
+    {
+        return NULL;
+    }
+    
+    AWB_INDEX* index = (AWB_INDEX*)calloc(1, sizeof(AWB_INDEX));
+    AWB_HEADER* h = &index->header;
+    index->data = data;
+    index->size = size;
+    
+    /* Header */
+    tr_read_array(&data[0], 4, (uint8_t*)&h->magic[0]);
+    h->version = data[4];
+    h->offset_size = data[5];
+    h->id_size = data[6];
+    h->unk = data[7];
+    h->file_count = tr_read_u32le(&data[8]);
+    h->alignment = tr_read_u16le(&data[12]);
+    h->subkey = tr_read_u16le(&data[14]);
+    
+    const uint32_t ids_offset = 16;
+    const uint64_t offsets_offset = ids_offset + (uint64_t)h->file_count*h->id_size;
+    const uint64_t file_size_offset = offsets_offset + (uint64_t)h->file_count*h->offset_size;
+    
+    if(((h->id_size != 2) && (h->id_size != 4))
+       || ((h->offset_size != 2) && (h->offset_size != 4))
+       || ((file_size_offset + h->offset_size) > size))
+    {
+        return awb_close_index(index);
+    }
+    
+    const uint32_t file_size = awb_read_offset(&data[file_size_offset], h->offset_size);
+    index->entries = (AWB_INDEX_ENTRY*)calloc(h->file_count, sizeof(AWB_INDEX_ENTRY));
+    uint8_t sorted = 1;
+    
+    for(uint32_t i = 0; i != h->file_count; ++i)
+    {
+        AWB_INDEX_ENTRY* entry = &index->entries[i];
+        const uint32_t id_pos = ids_offset + h->id_size*i;
+        const uint64_t offset_pos = offsets_offset + h->offset_size*i;
+        uint32_t end = file_size;
+        
+        if(h->id_size == 2) entry->id = tr_read_u16le(&data[id_pos]);
+        else entry->id = tr_read_u32le(&data[id_pos]);
+        
+        entry->offset = awb_read_offset(&data[offset_pos], h->offset_size);
+        
+        /* Next offset ends this entry */
+        if((i+1) != h->file_count)
+        {
+            end = awb_read_offset(&data[offset_pos + h->offset_size], h->offset_size);
+        }
+        
+        entry->index = i;
+        entry->offset = awb_fix_offset(entry->offset, h->alignment);
+        entry->type = AWB_DATA_UNKNOWN;
+        
+        if(end > size) end = size;
+        entry->size = (end > entry->offset) ? (end - entry->offset) : 0;
+        
+        if(i && (entry[-1].id > entry->id))
+        {
+            sorted = 0;
+        }
+    }
+    
+    /* Ids are almost always written in order */
+    if(sorted == 0)
+    {
+        qsort(index->entries, h->file_count, sizeof(AWB_INDEX_ENTRY), awb_index_cmp);
+    }
+    
+    return index;
+}
+
+AWB_INDEX* awb_close_index(AWB_INDEX* index)
+{
+    if(index)
+    {
+        free(index->entries);
+        free(index);
+    }
+    
+    return NULL;
+}
+
+AWB_INDEX_ENTRY* awb_index_find_by_id(AWB_INDEX* index, const uint32_t id)
+{
+    uint32_t low = 0;
+    uint32_t high = index->header.file_count;
+    
+    /* Lower bound, so the first of duplicate ids is found */
+    while(low < high)
+    {
+        const uint32_t mid = low + (high - low)/2;
+        
+        if(index->entries[mid].id < id) low = mid + 1;
+        else high = mid;
+    }
+    
+    if((low != index->header.file_count) && (index->entries[low].id == id))
+    {
+        return &index->entries[low];
+    }
+    
+    return NULL;
+}
+
+const uint8_t* awb_index_get_data(AWB_INDEX* index, AWB_INDEX_ENTRY* entry)
+{
+    /* Truncated archives or broken offsets */
+    if((entry->size == 0)
+       || (entry->offset >= index->size)
+       || (entry->size > (index->size - entry->offset)))
+    {
+        return NULL;
+    }
+    
+    const uint8_t* data = &index->data[entry->offset];
+    
+    if(entry->type == AWB_DATA_UNKNOWN)
+    {
+        const uint32_t size = awb_probe_data(data, entry->size, &entry->type);
+        
+        /* Probed size can't go past the next entry */
+        if(size < entry->size)
+        {
+            entry->size = size;
+        }
+    }
+    
+    return data;
+}
+
+const uint32_t awb_index_get_file_count(AWB_INDEX* index)
+{
+    return index->header.file_count;
+}
+
+typedef struct
+{
+    AWB_INDEX* index;
+    uint64_t old_key;
+    uint64_t new_key;
+    uint16_t new_type;
+    CRI_ADX_KEY adx_old_key;
+    CRI_ADX_KEY adx_new_key;
+    uint8_t adx_new_type;
+    uint8_t* status;
+} AWB_REKEY_CTX;
+
+static void awb_rekey_worker(void* user, const uint64_t i)
+{
+    AWB_REKEY_CTX* ctx = (AWB_REKEY_CTX*)user;
+    AWB_INDEX_ENTRY* entry = &ctx->index->entries[i];
+    uint8_t* data = (uint8_t*)awb_index_get_data(ctx->index, entry);
+    
+    if(data == NULL)
+    {
+        return;
+    }
+    
+    switch(entry->type)
+    {
+        case AWB_DATA_HCA:
+            ctx->status[i] = hca_rekey(data, entry->size, ctx->old_key, ctx->new_key, ctx->new_type, 1);
+            break;
+        case AWB_DATA_ADX:
+            ctx->status[i] = adx_rekey(data, entry->size, ctx->adx_old_key, ctx->adx_new_key, ctx->adx_new_type);
+            break;
+    }
+}
+
+uint32_t awb_rekey(uint8_t* data, const uint32_t size,
+                   const uint64_t old_key, const uint64_t new_key,
+                   const uint16_t new_subkey, const uint16_t new_type,
+                   const uint8_t adx_new_type, const uint32_t thread_count)
+{
+    AWB_INDEX* index = awb_open_index(data, size);
+    
+    if(index == NULL)
+    {
+        return 0;
+    }
+    
+    const uint32_t file_count = awb_index_get_file_count(index);
+    
+    AWB_REKEY_CTX ctx = {0};
+    ctx.index = index;
+    ctx.old_key = cri_key_scramble(old_key, index->header.subkey);
+    ctx.new_key = cri_key_scramble(new_key, new_subkey);
+    ctx.new_type = new_type;
+    ctx.adx_old_key = cri_key_adx_type9(old_key, index->header.subkey);
+    ctx.adx_new_key = cri_key_adx_type9(new_key, new_subkey);
+    ctx.adx_new_type = adx_new_type;
+    ctx.status = (uint8_t*)calloc(file_count + 1, 1);
+    
+    /* Many small files, so every thread takes whole ones */
+    tp_parallel_for(file_count, thread_count, awb_rekey_worker, &ctx);
+    
+    uint32_t rekeyed = 0;
+    
+    for(uint32_t i = 0; i != file_count; ++i)
+    {
+        rekeyed += ctx.status[i];
+    }
+    
+    tw_write_u16le(new_subkey, &data[14]);
+    
+    free(ctx.status);
+    index = awb_close_index(index);
+    
+    return rekeyed;
+}
@@ -9,6 +9,8 @@
 #include <stdint.h>
 
 #include <kwaslib/core/io/string_utils.h>
+#include <kwaslib/core/io/file_utils.h>
+#include <kwaslib/core/io/raw_file.h>
 #include <kwaslib/core/data/cvector.h>
 
 #define AWB_MAGIC       (const char*)"AFS2"
@@ -19,6 +21,7 @@
 #define AWB_DATA_HCA    2
 #define AWB_DATA_BCWAV  3
 #define AWB_DATA_AHX    4
+#define AWB_DATA_UNKNOWN 0xFF    /* Index entry not probed yet */
 
 typedef struct
 {
@@ -50,6 +53,31 @@ typedef struct
     CVEC entries;
 } AWB_FILE;
 
+/*
+    Entry of an AWB_INDEX.
+    Data stays in the archive, only its location is kept.
+*/
+typedef struct
+{
+    uint32_t id;
+    uint32_t index;     /* Position in the id/offset arrays */
+    uint32_t offset;    /* Aligned start of the data */
+    uint32_t size;      /* Space up to the next entry, exact size after probing */
+    uint8_t type;       /* AWB_DATA_*, AWB_DATA_UNKNOWN until probed */
+} AWB_INDEX_ENTRY;
+
+/*
+    Lookup table built from the header, ids and offsets only.
+    Doesn't own the archive data, it has to outlive the index.
+*/
+typedef struct
+{
+    AWB_HEADER header;
+    const uint8_t* data;
+    uint32_t size;
+    AWB_INDEX_ENTRY* entries;   /* Sorted by id */
+} AWB_INDEX;
+
 /*
     Implementation
 */
@@ -58,14 +86,115 @@ AWB_FILE* awb_alloc();
 
 AWB_FILE* awb_free(AWB_FILE* awb);
 
+/*
+    Loads the whole AWB, copying every entry.
+    Entries are probed and copied on all cores, order stays the same.
+    
+    Returns a pointer to AWB_FILE; NULL on error.
+*/
 AWB_FILE* awb_load_from_data(const uint8_t* data, const uint32_t size);
 
 AWB_ENTRY* awb_append_entry(AWB_FILE* awb, const uint32_t id, const uint8_t* data, const uint32_t size);
 
+/*
+    Serializes the AWB into a buffer allocated once for the whole file.
+    
+    Returns a pointer to SU_STRING with the data.
+*/
 SU_STRING* awb_to_data(AWB_FILE* awb);
 
+/*
+    Writes the whole AWB to `data` in one pass, padding included.
+    `data` has to hold `data_size` bytes returned by awb_update().
+*/
+void awb_write_to_data(AWB_FILE* awb, const uint32_t data_size, uint8_t* data);
+
+/*
+    Writes the AWB straight to `out`.
+    Payload of entry `i` comes from `sources[i]`,
+    or from entry->data if `sources` is NULL.
+    
+    Returns FU_SUCCESS on success, FU_ERROR otherwise.
+*/
+uint8_t awb_write_to_rf(AWB_FILE* awb, RF_FILE* out, const RF_SOURCE* sources);
+
+/*
+    Recalculates offsets of all entries.
+    u16 offsets are switched to u32 if the archive doesn't fit in them.
+    
+    Returns the size of the whole AWB file.
+*/
+const uint32_t awb_update(AWB_FILE* awb);
+
+/*
+    Returns the size of header, ids, offsets and file size fields.
+*/
+const uint32_t awb_get_header_size(AWB_FILE* awb);
+
+/*
+    Writes the header, ids, offsets and file size to `data`.
+    Offsets have to be calculated by awb_update() first.
+*/
+void awb_header_to_data(AWB_FILE* awb, const uint32_t data_size, uint8_t* data);
+
 AWB_ENTRY* awb_get_entry_by_id(AWB_FILE* awb, const uint32_t id);
 
 const uint32_t awb_get_file_count(AWB_FILE* awb);
 
 const uint32_t awb_fix_offset(const uint32_t offset, const uint32_t alignment);
+
+/*
+    Checks if the data is ADX, AHX, HCA or BCWAV and how long it is.
+    `size` is the most the file can take.
+    
+    Returns the size of the file and its AWB_DATA_* in `type`.
+*/
+const uint32_t awb_probe_data(const uint8_t* data, const uint32_t size, uint8_t* type);
+
+/*
+    Reads the header, ids and offsets of the AWB at `data`.
+    Nothing is probed or copied.
+    
+    Returns a pointer to AWB_INDEX; NULL on error.
+*/
+AWB_INDEX* awb_open_index(const uint8_t* data, const uint32_t size);
+
+/*
+    Frees the index, not the archive data.
+    
+    Returns NULL.
+*/
+AWB_INDEX* awb_close_index(AWB_INDEX* index);
+
+/*
+    Binary search over the ids.
+    
+    Returns a pointer to the entry; NULL if not found.
+*/
+AWB_INDEX_ENTRY* awb_index_find_by_id(AWB_INDEX* index, const uint32_t id);
+
+/*
+    Probes the entry on first access, setting its type and exact size.
+    Probing modifies the entry, so one entry shouldn't be accessed
+    from multiple threads at once.
+    
+    Returns a pointer to the entry data inside the archive;
+    NULL if the entry is empty or doesn't fit in the archive.
+*/
+const uint8_t* awb_index_get_data(AWB_INDEX* index, AWB_INDEX_ENTRY* entry);
+
+const uint32_t awb_index_get_file_count(AWB_INDEX* index);
+
+/*
+    Re-keys every HCA and ADX of the AWB at `data` in place, see hca_rekey() and adx_rekey().
+    `old_key` is mixed with the subkey from the header, `new_key` with `new_subkey`,
+    which then replaces it. HCAs become `new_type`, ADXs `adx_new_type`,
+    ADX keys are derived as type 9. Other entries are left as they are.
+    Files are spread over `thread_count` threads (0 for all cores).
+    
+    Returns the amount of re-keyed files.
+*/
+uint32_t awb_rekey(uint8_t* data, const uint32_t size,
+                   const uint64_t old_key, const uint64_t new_key,
+                   const uint16_t new_subkey, const uint16_t new_type,
+                   const uint8_t adx_new_type, const uint32_t thread_count);
@@ -1,6 +1,15 @@
 #include "hca.h"
 
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
 #include <kwaslib/core/io/type_readers.h>
+#include <kwaslib/core/io/type_writers.h>
+#include <kwaslib/core/thread/thread_pool.h>
+
+/* Blocks handed to a thread at once */
+#define HCA_REKEY_BATCH     (uint32_t)(256)
 
 /* 
     Reads the section name without encryption
@@ -123,3 +132,1577 @@ HCA_HEADER hca_read_header_from_data(const uint8_t* data, const uint32_t size)
 
     return h;
 }
+
+static void hca_cipher_init_static(uint8_t table[256])
+{
+    uint32_t v = 0;
+    
+    for(uint32_t i = 1; i != 0xFF; ++i)
+    {
+        v = (v*13 + 11) & 0xFF;
+        
+        /* 0 and 0xFF stay as they are */
+        if((v == 0) || (v == 0xFF))
+            v = (v*13 + 11) & 0xFF;
+        
+        table[i] = v;
+    }
+    
+    table[0] = 0;
+    table[0xFF] = 0xFF;
+}
+
+static void hca_cipher_init_nibbles(uint8_t out[16], uint8_t key)
+{
+    const uint32_t mul = ((key & 1) << 3) | 5;
+    const uint32_t add = (key & 0xE) | 1;
+    key >>= 4;
+    
+    for(uint32_t i = 0; i != 16; ++i)
+    {
+        key = (key*mul + add) & 0xF;
+        out[i] = key;
+    }
+}
+
+static void hca_cipher_init_keyed(uint8_t table[256], uint64_t key)
+{
+    uint8_t kc[7] = {0};
+    uint8_t seed[16] = {0};
+    uint8_t rows[16] = {0};
+    uint8_t cols[16] = {0};
+    uint8_t base[256] = {0};
+    
+    if(key != 0)
+        key -= 1;
+    
+    for(uint32_t i = 0; i != 7; ++i)
+    {
+        kc[i] = key & 0xFF;
+        key >>= 8;
+    }
+    
+    seed[0x0] = kc[1];          seed[0x1] = kc[1] ^ kc[6];
+    seed[0x2] = kc[2] ^ kc[3];  seed[0x3] = kc[2];
+    seed[0x4] = kc[2] ^ kc[1];  seed[0x5] = kc[3] ^ kc[4];
+    seed[0x6] = kc[3];          seed[0x7] = kc[3] ^ kc[2];
+    seed[0x8] = kc[4] ^ kc[5];  seed[0x9] = kc[4];
+    seed[0xA] = kc[4] ^ kc[3];  seed[0xB] = kc[5] ^ kc[6];
+    seed[0xC] = kc[5];          seed[0xD] = kc[5] ^ kc[4];
+    seed[0xE] = kc[6] ^ kc[1];  seed[0xF] = kc[6];
+    
+    /* High nibbles from the first key byte, low ones from the seeds */
+    hca_cipher_init_nibbles(rows, kc[0]);
+    
+    for(uint32_t r = 0; r != 16; ++r)
+    {
+        hca_cipher_init_nibbles(cols, seed[r]);
+        
+        for(uint32_t c = 0; c != 16; ++c)
+        {
+            base[r*16 + c] = (rows[r] << 4) | cols[c];
+        }
+    }
+    
+    /* Shuffle, 0 and 0xFF stay as they are */
+    uint32_t x = 0;
+    uint32_t pos = 1;
+    
+    for(uint32_t i = 0; i != 256; ++i)
+    {
+        x = (x + 0x11) & 0xFF;
+        
+        if((base[x] != 0) && (base[x] != 0xFF))
+            table[pos++] = base[x];
+    }
+    
+    table[0] = 0;
+    table[0xFF] = 0xFF;
+}
+
+uint8_t hca_cipher_init(uint8_t table[256], const uint16_t type, const uint64_t key)
+{
+    switch(type)
+    {
+        case HCA_CIPH_NONE:
+            for(uint32_t i = 0; i != 256; ++i) table[i] = i;
+            return 1;
+        case HCA_CIPH_STATIC:
+            hca_cipher_init_static(table);
+            return 1;
+        case HCA_CIPH_KEYED:
+            hca_cipher_init_keyed(table, key);
+            return 1;
+    }
+    
+    return 0;
+}
+
+/*
+    Offset of the ciph section value; 0 if there's none.
+    Section names can have their high bits set.
+*/
+static uint32_t hca_find_ciph(const uint8_t* data, const uint32_t data_offset)
+{
+    for(uint32_t pos = 8; (pos + 6) <= (data_offset - 2); ++pos)
+    {
+        if(((data[pos] & 0x7F) == 'c') && ((data[pos+1] & 0x7F) == 'i')
+           && ((data[pos+2] & 0x7F) == 'p') && ((data[pos+3] & 0x7F) == 'h'))
+        {
+            return pos + 4;
+        }
+    }
+    
+    return 0;
+}
+
+typedef struct
+{
+    uint8_t* blocks;
+    uint32_t block_size;
+    uint32_t block_count;
+    uint8_t table[256];     /* Old decryption followed by new encryption */
+} HCA_REKEY_CTX;
+
+static void hca_rekey_worker(void* user, const uint64_t index)
+{
+    HCA_REKEY_CTX* ctx = (HCA_REKEY_CTX*)user;
+    const uint32_t first = index*HCA_REKEY_BATCH;
+    uint32_t last = first + HCA_REKEY_BATCH;
+    
+    if(last > ctx->block_count)
+        last = ctx->block_count;
+    
+    for(uint32_t i = first; i != last; ++i)
+    {
+        uint8_t* block = &ctx->blocks[(uint64_t)i*ctx->block_size];
+        const uint32_t payload_size = ctx->block_size - 2;
+        
+        for(uint32_t j = 0; j != payload_size; ++j)
+        {
+            block[j] = ctx->table[block[j]];
+        }
+        
+        tw_write_u16be(crc16_encode_umts(block, payload_size), &block[payload_size]);
+    }
+}
+
+uint8_t hca_rekey(uint8_t* data, const uint32_t size,
+                  const uint64_t old_key, const uint64_t new_key,
+                  const uint16_t new_type, const uint32_t thread_count)
+{
+    if(size < 8)
+        return 0;
+    
+    const HCA_HEADER h = hca_read_header_from_data(data, size);
+    uint32_t block_size = 0;
+    
+    if(h.sections.comp) block_size = h.comp.block_size;
+    else if(h.sections.dec) block_size = h.dec.block_size;
+    
+    if((h.sections.fmt == 0) || (block_size <= 2) || (h.data_offset < 10) || (h.data_offset > size))
+        return 0;
+    
+    /* Without a ciph section there's no room to store another type */
+    const uint32_t ciph_pos = hca_find_ciph(data, h.data_offset);
+    const uint16_t old_type = h.sections.ciph ? h.ciph.type : HCA_CIPH_NONE;
+    
+    if((ciph_pos == 0) && (new_type != HCA_CIPH_NONE))
+        return 0;
+    
+    uint8_t decrypt[256] = {0};
+    uint8_t encrypt[256] = {0};
+    uint8_t new_table[256] = {0};
+    
+    if((hca_cipher_init(decrypt, old_type, old_key) == 0)
+       || (hca_cipher_init(new_table, new_type, new_key) == 0))
+    {
+        return 0;
+    }
+    
+    /* Encryption is the inverse of the decryption table */
+    for(uint32_t i = 0; i != 256; ++i)
+    {
+        encrypt[new_table[i]] = i;
+    }
+    
+    HCA_REKEY_CTX ctx = {0};
+    ctx.blocks = &data[h.data_offset];
+    ctx.block_size = block_size;
+    ctx.block_count = h.fmt.block_count;
+    
+    for(uint32_t i = 0; i != 256; ++i)
+    {
+        ctx.table[i] = encrypt[decrypt[i]];
+    }
+    
+    /* Prefetch HCAs are cut short */
+    const uint32_t fitting_blocks = (size - h.data_offset)/block_size;
+    
+    if(ctx.block_count > fitting_blocks)
+        ctx.block_count = fitting_blocks;
+    
+    const uint64_t batches = (ctx.block_count + HCA_REKEY_BATCH - 1)/HCA_REKEY_BATCH;
+    tp_parallel_for(batches, thread_count, hca_rekey_worker, &ctx);
+    
+    /* Header */
+    if(ciph_pos)
+    {
+        tw_write_u16be(new_type, &data[ciph_pos]);
+        tw_write_u16be(crc16_encode_umts(data, h.data_offset - 2), &data[h.data_offset - 2]);
+    }
+    
+    return 1;
+}
+
+uint16_t hca_header_to_data(HCA_HEADER* h, uint8_t* data)
+{
+    uint32_t size = 8;
+    
+    if(h->sections.fmt) size += 4 + 12;
+    if(h->sections.comp) size += 4 + 12;
+    if(h->sections.dec) size += 4 + 8;
+    if(h->sections.vbr) size += 4 + 4;
+    if(h->sections.ath) size += 4 + 2;
+    if(h->sections.loop) size += 4 + 12;
+    if(h->sections.ciph) size += 4 + 2;
+    if(h->sections.rva) size += 4 + 4;
+    size += 2;
+    
+    if(h->data_offset < size)
+    {
+        h->data_offset = size;
+    }
+    
+    memset(data, 0, h->data_offset);
+    memcpy(data, HCA_MAGIC, 4);
+    data[4] = h->version_major;
+    data[5] = h->version_minor;
+    tw_write_u16be(h->data_offset, &data[6]);
+    uint32_t pos = 8;
+    
+    if(h->sections.fmt)
+    {
+        memcpy(&data[pos], "fmt\0", 4);
+        tw_write_u32be(((uint32_t)h->fmt.channel_count << 24) | h->fmt.sample_rate, &data[pos+4]);
+        tw_write_u32be(h->fmt.block_count, &data[pos+8]);
+        tw_write_u16be(h->fmt.inserted_samples, &data[pos+12]);
+        tw_write_u16be(h->fmt.appended_samples, &data[pos+14]);
+        pos += 16;
+    }
+    
+    if(h->sections.comp)
+    {
+        memcpy(&data[pos], "comp", 4);
+        tw_write_u16be(h->comp.block_size, &data[pos+4]);
+        data[pos+6] = h->comp.min_res;
+        data[pos+7] = h->comp.max_res;
+        data[pos+8] = h->comp.track_count;
+        data[pos+9] = h->comp.channel_config;
+        data[pos+10] = h->comp.total_band_count;
+        data[pos+11] = h->comp.base_band_count;
+        data[pos+12] = h->comp.stereo_band_count;
+        data[pos+13] = h->comp.bands_per_hfr_group;
+        data[pos+14] = h->comp.reserved[0];
+        data[pos+15] = h->comp.reserved[1];
+        pos += 16;
+    }
+    
+    if(h->sections.dec)
+    {
+        memcpy(&data[pos], "dec\0", 4);
+        tw_write_u16be(h->dec.block_size, &data[pos+4]);
+        data[pos+6] = h->dec.min_res;
+        data[pos+7] = h->dec.max_res;
+        data[pos+8] = h->dec.total_band_count;
+        data[pos+9] = h->dec.base_band_count;
+        data[pos+10] = ((h->dec.track_count & 0x0F) << 4) | (h->dec.channel_config & 0x0F);
+        data[pos+11] = h->dec.stereo_type;
+        pos += 12;
+    }
+    
+    if(h->sections.vbr)
+    {
+        memcpy(&data[pos], "vbr\0", 4);
+        tw_write_u16be(h->vbr.max_frame_size, &data[pos+4]);
+        tw_write_u16be(h->vbr.noise_level, &data[pos+6]);
+        pos += 8;
+    }
+    
+    if(h->sections.ath)
+    {
+        memcpy(&data[pos], "ath\0", 4);
+        tw_write_u16be(h->ath.ath_table_type, &data[pos+4]);
+        pos += 6;
+    }
+    
+    if(h->sections.loop)
+    {
+        memcpy(&data[pos], "loop", 4);
+        tw_write_u32be(h->loop.start, &data[pos+4]);
+        tw_write_u32be(h->loop.end, &data[pos+8]);
+        tw_write_u16be(h->loop.pre_loop_samples, &data[pos+12]);
+        tw_write_u16be(h->loop.post_loop_samples, &data[pos+14]);
+        pos += 16;
+    }
+    
+    if(h->sections.ciph)
+    {
+        memcpy(&data[pos], "ciph", 4);
+        tw_write_u16be(h->ciph.type, &data[pos+4]);
+        pos += 6;
+    }
+    
+    if(h->sections.rva)
+    {
+        memcpy(&data[pos], "rva\0", 4);
+        tw_write_f32be(h->rva.volume, &data[pos+4]);
+        pos += 8;
+    }
+    
+    tw_write_u16be(crc16_encode_umts(data, h->data_offset - 2), &data[h->data_offset - 2]);
+    
+    return h->data_offset;
+}
+
+/*
+    Encoder
+*/
+#define HCA_BANDS           HCA_SAMPLES_PER_SUBFRAME
+#define HCA_CODE_BITS       (uint32_t)(12)      /* Resolution 15, one less for zeroes */
+#define HCA_CODE_MAX        (int32_t)(2047)
+#define HCA_BLOCK_OVERHEAD  (uint32_t)(48)      /* Sync, noise level, boundary, checksum */
+
+/* 4 lanes, works the same with SSE2 and NEON */
+typedef float HCA_V4F __attribute__((vector_size(16)));
+
+typedef struct
+{
+    const int16_t* pcm;
+    uint32_t sample_count;
+    uint8_t channels;
+    uint32_t block_size;
+    uint32_t block_count;
+    uint8_t* blocks;
+    float window[2*HCA_BANDS];
+    float* dct;                 /* HCA_BANDS*HCA_BANDS, DCT-IV with IMDCT scaling */
+    float scaling[64];          /* Value range of every scalefactor */
+} HCA_ENCODE_CTX;
+
+typedef struct
+{
+    float peak;
+    uint32_t line;              /* channel*HCA_BANDS + band */
+} HCA_ENCODE_LINE;
+
+static double hca_bessel_i0(const double x)
+{
+    double sum = 1.0;
+    double term = 1.0;
+    
+    for(uint32_t k = 1; k != 64; ++k)
+    {
+        term *= (x/(2.0*k))*(x/(2.0*k));
+        sum += term;
+    }
+    
+    return sum;
+}
+
+/* Kaiser-Bessel derived, alpha 4 */
+static void hca_kbd_window(float* window)
+{
+    const uint32_t half = HCA_BANDS;
+    double kernel[HCA_BANDS+1];
+    double total = 0.0;
+    
+    for(uint32_t n = 0; n != (half+1); ++n)
+    {
+        const double r = 2.0*n/half - 1.0;
+        kernel[n] = hca_bessel_i0(M_PI*4.0*sqrt(1.0 - r*r));
+        total += kernel[n];
+    }
+    
+    double sum = 0.0;
+    
+    for(uint32_t n = 0; n != half; ++n)
+    {
+        sum += kernel[n];
+        window[n] = sqrt(sum/total);
+        window[2*half - 1 - n] = window[n];
+    }
+}
+
+static void hca_dct4(const float* in, const float* table, float* out)
+{
+    for(uint32_t k = 0; k != HCA_BANDS; ++k)
+    {
+        const float* row = &table[k*HCA_BANDS];
+        HCA_V4F acc = {0};
+        
+        for(uint32_t n = 0; n != HCA_BANDS; n += 4)
+        {
+            HCA_V4F a, b;
+            memcpy(&a, &in[n], sizeof(HCA_V4F));
+            memcpy(&b, &row[n], sizeof(HCA_V4F));
+            acc += a*b;
+        }
+        
+        out[k] = acc[0] + acc[1] + acc[2] + acc[3];
+    }
+}
+
+/*
+    MDCT of one subframe, 256 samples starting at `first` into 128 lines.
+*/
+static void hca_encode_mdct(HCA_ENCODE_CTX* ctx, const uint32_t channel, const int64_t first, float* out)
+{
+    const uint32_t half = HCA_BANDS/2;
+    float x[2*HCA_BANDS];
+    float u[HCA_BANDS];
+    
+    for(uint32_t n = 0; n != 2*HCA_BANDS; ++n)
+    {
+        const int64_t s = first + n;
+        const float v = ((s >= 0) && (s < ctx->sample_count)) ? ctx->pcm[s*ctx->channels + channel]/32768.0f : 0.0f;
+        x[n] = v*ctx->window[n];
+    }
+    
+    /* Folding (a, b, c, d) into (-c_r - d, a - b_r) */
+    for(uint32_t n = 0; n != half; ++n)
+    {
+        u[n] = -x[3*half - 1 - n] - x[3*half + n];
+        u[half + n] = x[n] - x[HCA_BANDS - 1 - n];
+    }
+    
+    hca_dct4(u, ctx->dct, out);
+}
+
+static uint32_t hca_scalefactor_cost(const uint8_t* sf, uint8_t* delta_bits)
+{
+    uint32_t nonzero = 0;
+    
+    for(uint32_t i = 0; i != HCA_BANDS; ++i)
+    {
+        nonzero |= sf[i];
+    }
+    
+    if(nonzero == 0)
+    {
+        *delta_bits = 0;
+        return 3;
+    }
+    
+    uint32_t best = 3 + 6*HCA_BANDS;
+    *delta_bits = 6;
+    
+    for(uint8_t bits = 1; bits != 6; ++bits)
+    {
+        const int32_t escape = (1 << bits) - 1;
+        uint32_t cost = 3 + 6;
+        
+        for(uint32_t i = 1; i != HCA_BANDS; ++i)
+        {
+            const int32_t code = sf[i] - sf[i-1] + (escape >> 1);
+            cost += ((code >= 0) && (code < escape)) ? bits : bits + 6;
+        }
+        
+        if(cost < best)
+        {
+            best = cost;
+            *delta_bits = bits;
+        }
+    }
+    
+    return best;
+}
+
+typedef struct
+{
+    uint8_t* data;
+    uint32_t pos;   /* In bits */
+} HCA_BIT_WRITER;
+
+static void hca_bits_write(HCA_BIT_WRITER* bw, const uint32_t value, uint32_t count)
+{
+    while(count)
+    {
+        const uint32_t free_bits = 8 - (bw->pos & 7);
+        const uint32_t n = (count < free_bits) ? count : free_bits;
+        const uint32_t chunk = (value >> (count - n)) & ((1u << n) - 1);
+        
+        bw->data[bw->pos >> 3] |= chunk << (free_bits - n);
+        bw->pos += n;
+        count -= n;
+    }
+}
+
+/* Bits of a block with the first `dropped` lines of `order` left out */
+static uint32_t hca_encode_block_cost(HCA_ENCODE_CTX* ctx, const uint8_t* sf, const uint16_t* cost,
+                                      const HCA_ENCODE_LINE* order, const uint32_t dropped, uint8_t* work)
+{
+    const uint32_t lines = ctx->channels*HCA_BANDS;
+    memcpy(work, sf, lines);
+    
+    for(uint32_t i = 0; i != dropped; ++i)
+    {
+        work[order[i].line] = 0;
+    }
+    
+    uint32_t bits = HCA_BLOCK_OVERHEAD;
+    uint8_t delta_bits = 0;
+    
+    for(uint32_t c = 0; c != ctx->channels; ++c)
+    {
+        bits += hca_scalefactor_cost(&work[c*HCA_BANDS], &delta_bits);
+    }
+    
+    for(uint32_t i = 0; i != lines; ++i)
+    {
+        if(work[i]) bits += cost[i];
+    }
+    
+    return bits;
+}
+
+static int hca_encode_line_cmp(const void* a, const void* b)
+{
+    const HCA_ENCODE_LINE* la = (const HCA_ENCODE_LINE*)a;
+    const HCA_ENCODE_LINE* lb = (const HCA_ENCODE_LINE*)b;
+    
+    if(la->peak != lb->peak) return (la->peak < lb->peak) ? -1 : 1;
+    return (la->line < lb->line) ? -1 : (la->line > lb->line);
+}
+
+static void hca_encode_block(HCA_ENCODE_CTX* ctx, const uint32_t block, float* spectra,
+                             int16_t* quant, uint8_t* sf, uint16_t* cost,
+                             HCA_ENCODE_LINE* order, uint8_t* work)
+{
+    const uint32_t channels = ctx->channels;
+    uint32_t coded = 0;
+    
+    /* Analysis and quantization, lines share a scalefactor over all subframes */
+    for(uint32_t c = 0; c != channels; ++c)
+    {
+        float* spec = &spectra[c*HCA_SUBFRAMES_PER_BLOCK*HCA_BANDS];
+        
+        for(uint32_t s = 0; s != HCA_SUBFRAMES_PER_BLOCK; ++s)
+        {
+            const int64_t first = (int64_t)block*HCA_SAMPLES_PER_BLOCK + s*HCA_BANDS - HCA_ENCODER_DELAY;
+            hca_encode_mdct(ctx, c, first, &spec[s*HCA_BANDS]);
+        }
+        
+        for(uint32_t i = 0; i != HCA_BANDS; ++i)
+        {
+            const uint32_t line = c*HCA_BANDS + i;
+            float peak = 0.0f;
+            
+            for(uint32_t s = 0; s != HCA_SUBFRAMES_PER_BLOCK; ++s)
+            {
+                const float v = fabsf(spec[s*HCA_BANDS + i]);
+                if(v > peak) peak = v;
+            }
+            
+            uint8_t f = 1;
+            while((f != 63) && (ctx->scaling[f] < peak)) f += 1;
+            
+            const float inv_gain = (float)(2*HCA_CODE_MAX + 1)/(2.0f*ctx->scaling[f]);
+            uint32_t bits = 0;
+            uint32_t nonzero = 0;
+            
+            for(uint32_t s = 0; s != HCA_SUBFRAMES_PER_BLOCK; ++s)
+            {
+                int32_t q = lrintf(spec[s*HCA_BANDS + i]*inv_gain);
+                if(q > HCA_CODE_MAX) q = HCA_CODE_MAX;
+                if(q < -HCA_CODE_MAX) q = -HCA_CODE_MAX;
+                
+                quant[(c*HCA_SUBFRAMES_PER_BLOCK + s)*HCA_BANDS + i] = q;
+                bits += q ? HCA_CODE_BITS : (HCA_CODE_BITS - 1);
+                nonzero |= q;
+            }
+            
+            sf[line] = nonzero ? f : 0;
+            cost[line] = bits;
+            
+            if(nonzero)
+            {
+                order[coded].peak = peak;
+                order[coded].line = line;
+                coded += 1;
+            }
+        }
+    }
+    
+    /* Quietest lines go first until the block fits */
+    const uint32_t budget = ctx->block_size*8;
+    
+    if(hca_encode_block_cost(ctx, sf, cost, order, 0, work) > budget)
+    {
+        qsort(order, coded, sizeof(HCA_ENCODE_LINE), hca_encode_line_cmp);
+        
+        uint32_t lo = 0;
+        uint32_t hi = coded;
+        
+        while(lo < hi)
+        {
+            const uint32_t mid = (lo + hi)/2;
+            
+            if(hca_encode_block_cost(ctx, sf, cost, order, mid, work) > budget)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        
+        while((lo < coded) && (hca_encode_block_cost(ctx, sf, cost, order, lo, work) > budget))
+            lo += 1;
+        
+        for(uint32_t i = 0; i != lo; ++i)
+        {
+            sf[order[i].line] = 0;
+        }
+    }
+    
+    /* Bitstream */
+    uint8_t* out = &ctx->blocks[(uint64_t)block*ctx->block_size];
+    HCA_BIT_WRITER bw = {out, 0};
+    
+    hca_bits_write(&bw, 0xFFFF, 16);
+    hca_bits_write(&bw, 0, 9);      /* Noise level 0 puts every band at max resolution */
+    hca_bits_write(&bw, 0, 7);
+    
+    for(uint32_t c = 0; c != channels; ++c)
+    {
+        const uint8_t* csf = &sf[c*HCA_BANDS];
+        uint8_t delta_bits = 0;
+        hca_scalefactor_cost(csf, &delta_bits);
+        hca_bits_write(&bw, delta_bits, 3);
+        
+        if(delta_bits == 6)
+        {
+            for(uint32_t i = 0; i != HCA_BANDS; ++i)
+                hca_bits_write(&bw, csf[i], 6);
+        }
+        else if(delta_bits)
+        {
+            const int32_t escape = (1 << delta_bits) - 1;
+            hca_bits_write(&bw, csf[0], 6);
+            
+            for(uint32_t i = 1; i != HCA_BANDS; ++i)
+            {
+                const int32_t code = csf[i] - csf[i-1] + (escape >> 1);
+                
+                if((code >= 0) && (code < escape))
+                {
+                    hca_bits_write(&bw, code, delta_bits);
+                }
+                else
+                {
+                    hca_bits_write(&bw, escape, delta_bits);
+                    hca_bits_write(&bw, csf[i], 6);
+                }
+            }
+        }
+    }
+    
+    for(uint32_t s = 0; s != HCA_SUBFRAMES_PER_BLOCK; ++s)
+    {
+        for(uint32_t c = 0; c != channels; ++c)
+        {
+            const int16_t* q = &quant[(c*HCA_SUBFRAMES_PER_BLOCK + s)*HCA_BANDS];
+            
+            for(uint32_t i = 0; i != HCA_BANDS; ++i)
+            {
+                if(sf[c*HCA_BANDS + i] == 0)
+                    continue;
+                
+                /* Magnitude and sign bit, zero has no sign bit */
+                if(q[i] == 0)
+                    hca_bits_write(&bw, 0, HCA_CODE_BITS - 1);
+                else
+                    hca_bits_write(&bw, (abs(q[i]) << 1) | (q[i] < 0), HCA_CODE_BITS);
+            }
+        }
+    }
+    
+    tw_write_u16be(crc16_encode_umts(out, ctx->block_size - 2), &out[ctx->block_size - 2]);
+}
+
+static void hca_encode_worker(void* user, const uint64_t index)
+{
+    HCA_ENCODE_CTX* ctx = (HCA_ENCODE_CTX*)user;
+    const uint32_t lines = ctx->channels*HCA_BANDS;
+    const uint32_t first = index*HCA_ENCODE_BATCH;
+    uint32_t last = first + HCA_ENCODE_BATCH;
+    
+    if(last > ctx->block_count)
+        last = ctx->block_count;
+    
+    float* spectra = (float*)malloc(lines*HCA_SUBFRAMES_PER_BLOCK*sizeof(float));
+    int16_t* quant = (int16_t*)malloc(lines*HCA_SUBFRAMES_PER_BLOCK*sizeof(int16_t));
+    uint8_t* sf = (uint8_t*)malloc(lines*2);
+    uint16_t* cost = (uint16_t*)malloc(lines*sizeof(uint16_t));
+    HCA_ENCODE_LINE* order = (HCA_ENCODE_LINE*)malloc(lines*sizeof(HCA_ENCODE_LINE));
+    
+    for(uint32_t i = first; i != last; ++i)
+    {
+        hca_encode_block(ctx, i, spectra, quant, sf, cost, order, &sf[lines]);
+    }
+    
+    free(order);
+    free(cost);
+    free(sf);
+    free(quant);
+    free(spectra);
+}
+
+SU_STRING* hca_encode(const int16_t* pcm, const uint32_t sample_count,
+                      const HCA_ENCODE_PARAMS* params)
+{
+    const uint8_t channels = params->channel_count;
+    
+    if((pcm == NULL) || (sample_count == 0) || (channels == 0)
+       || (params->sample_rate == 0) || (params->sample_rate > 0xFFFFFF))
+    {
+        return NULL;
+    }
+    
+    if(params->loop && ((params->loop_start >= params->loop_end) || (params->loop_end > sample_count)))
+    {
+        return NULL;
+    }
+    
+    /* Big enough for every band of every channel at full resolution */
+    uint32_t block_size = params->block_size;
+    
+    if(block_size == 0)
+    {
+        const uint32_t channel_bits = 3 + 6*HCA_BANDS + HCA_BANDS*HCA_SUBFRAMES_PER_BLOCK*HCA_CODE_BITS;
+        block_size = (HCA_BLOCK_OVERHEAD + channels*channel_bits + 7)/8;
+        if(block_size > 0xFFFF) block_size = 0xFFFF;
+    }
+    
+    if((block_size*8) < (HCA_BLOCK_OVERHEAD + channels*3))
+    {
+        return NULL;
+    }
+    
+    const uint64_t total = (uint64_t)sample_count + HCA_ENCODER_DELAY;
+    const uint32_t block_count = (total + HCA_SAMPLES_PER_BLOCK - 1)/HCA_SAMPLES_PER_BLOCK;
+    
+    /* Header */
+    HCA_HEADER h = {0};
+    memcpy(h.magic, HCA_MAGIC, 4);
+    h.version_major = 2;
+    h.version_minor = 0;
+    h.sections.fmt = 1;
+    h.fmt.channel_count = channels;
+    h.fmt.sample_rate = params->sample_rate;
+    h.fmt.block_count = block_count;
+    h.fmt.inserted_samples = HCA_ENCODER_DELAY;
+    h.fmt.appended_samples = (uint64_t)block_count*HCA_SAMPLES_PER_BLOCK - total;
+    h.sections.comp = 1;
+    h.comp.block_size = block_size;
+    h.comp.min_res = 1;
+    h.comp.max_res = 15;
+    h.comp.track_count = 1;
+    h.comp.total_band_count = HCA_BANDS;
+    h.comp.base_band_count = HCA_BANDS;
+    h.sections.ath = 1;
+    h.sections.ciph = 1;
+    
+    if(params->loop)
+    {
+        const uint32_t start = params->loop_start + HCA_ENCODER_DELAY;
+        const uint32_t end = params->loop_end + HCA_ENCODER_DELAY - 1;
+        
+        h.sections.loop = 1;
+        h.loop.start = start/HCA_SAMPLES_PER_BLOCK;
+        h.loop.end = end/HCA_SAMPLES_PER_BLOCK;
+        h.loop.pre_loop_samples = start%HCA_SAMPLES_PER_BLOCK;
+        h.loop.post_loop_samples = HCA_SAMPLES_PER_BLOCK - 1 - end%HCA_SAMPLES_PER_BLOCK;
+    }
+    
+    uint8_t header[256];
+    const uint16_t data_offset = hca_header_to_data(&h, header);
+    const uint64_t file_size = data_offset + (uint64_t)block_count*block_size;
+    
+    if(file_size > 0xFFFFFFFF)
+    {
+        return NULL;
+    }
+    
+    SU_STRING* hca = su_create_string(NULL, file_size);
+    uint8_t* data = (uint8_t*)hca->ptr;
+    memset(data, 0, file_size);
+    memcpy(data, header, data_offset);
+    
+    /* Tables */
+    HCA_ENCODE_CTX ctx = {0};
+    ctx.pcm = pcm;
+    ctx.sample_count = sample_count;
+    ctx.channels = channels;
+    ctx.block_size = block_size;
+    ctx.block_count = block_count;
+    ctx.blocks = &data[data_offset];
+    hca_kbd_window(ctx.window);
+    
+    ctx.dct = (float*)malloc(HCA_BANDS*HCA_BANDS*sizeof(float));
+    
+    for(uint32_t k = 0; k != HCA_BANDS; ++k)
+    {
+        for(uint32_t n = 0; n != HCA_BANDS; ++n)
+        {
+            /* Decoder runs an unscaled DCT-IV, which doubles as the inverse with 2/N */
+            ctx.dct[k*HCA_BANDS + n] = cos(M_PI/HCA_BANDS*(n + 0.5)*(k + 0.5))*2.0/HCA_BANDS;
+        }
+    }
+    
+    for(uint32_t i = 0; i != 64; ++i)
+    {
+        ctx.scaling[i] = pow(2.0, ((int32_t)i - 63)*53.0/128.0 + 3.5);
+    }
+    
+    const uint64_t jobs = (block_count + HCA_ENCODE_BATCH - 1)/HCA_ENCODE_BATCH;
+    tp_parallel_for(jobs, params->thread_count, hca_encode_worker, &ctx);
+    
+    free(ctx.dct);
+    
+    if((params->ciph_type != HCA_CIPH_NONE)
+       && (hca_rekey(data, file_size, 0, params->key, params->ciph_type, params->thread_count) == 0))
+    {
+        hca = su_free(hca);
+    }
+    
+    return hca;
+}
+
+/*
+    Decoder
+*/
+#define HCA_VERSION_V200    (uint16_t)(0x0200)
+
+/* Resolution from the noise level left after the scalefactor */
+static const uint8_t hca_resolution_curve[66] =
+{
+    15,14,14,14,14,14,14,13,13,13,13,13,13,12,12,12,
+    12,12,12,11,11,11,11,11,11,10,10,10,10,10,10,10,
+     9, 9, 9, 9, 9, 9, 8, 8, 8, 8, 8, 8, 7, 6, 6, 5,
+     4, 4, 4, 3, 3, 3, 2, 2, 2, 2, 1, 1, 1, 1, 1, 1,
+     1, 1
+};
+
+/* Bits of the longest code per resolution */
+static const uint8_t hca_code_max_bits[16] = {0, 2, 3, 3, 4, 4, 4, 4, 5, 6, 7, 8, 9, 10, 11, 12};
+
+/* Resolution r codes 2r+1 levels below 8 and 2^(r-3)-1 from 8 on */
+static const float hca_step_size[16] =
+{
+    0.0f,      2.0f/3,    2.0f/5,    2.0f/7,    2.0f/9,    2.0f/11,   2.0f/13,   2.0f/15,
+    2.0f/31,   2.0f/63,   2.0f/127,  2.0f/255,  2.0f/511,  2.0f/1023, 2.0f/2047, 2.0f/4095
+};
+
+/*
+    Prefix codes of resolutions below 8, indexed by the longest code.
+    Levels go 0, +1, -1, +2, -2, ... and the first ones are a bit shorter.
+*/
+static const uint8_t hca_code_bits[8][16] =
+{
+    {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0},
+    {1,1,2,2,0,0,0,0,0,0,0,0,0,0,0,0},
+    {2,2,2,2,2,2,3,3,0,0,0,0,0,0,0,0},
+    {2,2,3,3,3,3,3,3,0,0,0,0,0,0,0,0},
+    {3,3,3,3,3,3,3,3,3,3,3,3,3,3,4,4},
+    {3,3,3,3,3,3,3,3,3,3,4,4,4,4,4,4},
+    {3,3,3,3,3,3,4,4,4,4,4,4,4,4,4,4},
+    {3,3,4,4,4,4,4,4,4,4,4,4,4,4,4,4}
+};
+
+static const float hca_code_values[8][16] =
+{
+    {+0,+0,+0,+0,+0,+0,+0,+0,+0,+0,+0,+0,+0,+0,+0,+0},
+    {+0,+0,+1,-1,+0,+0,+0,+0,+0,+0,+0,+0,+0,+0,+0,+0},
+    {+0,+0,+1,+1,-1,-1,+2,-2,+0,+0,+0,+0,+0,+0,+0,+0},
+    {+0,+0,+1,-1,+2,-2,+3,-3,+0,+0,+0,+0,+0,+0,+0,+0},
+    {+0,+0,+1,+1,-1,-1,+2,+2,-2,-2,+3,+3,-3,-3,+4,-4},
+    {+0,+0,+1,+1,-1,-1,+2,+2,-2,-2,+3,-3,+4,-4,+5,-5},
+    {+0,+0,+1,+1,-1,-1,+2,-2,+3,-3,+4,-4,+5,-5,+6,-6},
+    {+0,+0,+1,-1,+2,-2,+3,-3,+4,-4,+5,-5,+6,-6,+7,-7}
+};
+
+/* Share of the primary channel left in the secondary, 7 splits it evenly */
+static const float hca_intensity_ratio[16] =
+{
+    14.0f/7, 13.0f/7, 12.0f/7, 11.0f/7, 10.0f/7, 9.0f/7, 8.0f/7, 7.0f/7,
+    6.0f/7,  5.0f/7,  4.0f/7,  3.0f/7,  2.0f/7,  1.0f/7, 0.0f,   0.0f
+};
+
+typedef struct
+{
+    const uint8_t* data;
+    uint32_t size;  /* In bits */
+    uint32_t pos;   /* In bits, past the size reads zeroes */
+} HCA_BIT_READER;
+
+static uint32_t hca_bits_peek(HCA_BIT_READER* br, const uint32_t count)
+{
+    if(count == 0)
+        return 0;
+    
+    const uint32_t byte = br->pos >> 3;
+    const uint32_t byte_count = (br->size + 7) >> 3;
+    uint32_t window = 0;
+    
+    for(uint32_t i = 0; i != 4; ++i)
+    {
+        window = (window << 8) | (((byte + i) < byte_count) ? br->data[byte + i] : 0);
+    }
+    
+    return (window << (br->pos & 7)) >> (32 - count);
+}
+
+static uint32_t hca_bits_read(HCA_BIT_READER* br, const uint32_t count)
+{
+    const uint32_t value = hca_bits_peek(br, count);
+    br->pos += count;
+    return value;
+}
+
+/*
+    Pairs up stereo channels of every track, the rest stay discrete.
+    Returns 1 on success, 0 on more than 8 channels per track.
+*/
+static uint8_t hca_decoder_channel_types(HCA_DECODER* dec, const uint8_t track_count, const uint8_t channel_config)
+{
+    const uint32_t per_track = dec->channel_count/track_count;
+    
+    if((dec->stereo_band_count == 0) || (per_track < 2))
+        return 1;
+    
+    /* P and S are a stereo pair, D is discrete */
+    const char* layouts[9] = {"", "", "PS", "PSD", "PSPS", "PSDPS", "PSDDPS", "PSDDPSD", "PSDDPSPS"};
+    
+    if(per_track > 8)
+        return 0;
+    
+    char layout[9] = {0};
+    strcpy(layout, layouts[per_track]);
+    
+    if((per_track == 4) && (channel_config != 0)) strcpy(layout, "PSDD");
+    if((per_track == 5) && (channel_config > 2)) strcpy(layout, "PSDDD");
+    
+    for(uint32_t t = 0; t != track_count; ++t)
+    {
+        for(uint32_t i = 0; i != per_track; ++i)
+        {
+            HCA_DECODER_CHANNEL* ch = &dec->channels[t*per_track + i];
+            
+            if(layout[i] == 'P') ch->type = HCA_CHANNEL_STEREO_PRIMARY;
+            if(layout[i] == 'S') ch->type = HCA_CHANNEL_STEREO_SECONDARY;
+        }
+    }
+    
+    return 1;
+}
+
+HCA_DECODER* hca_decoder_open(const uint8_t* data, const uint32_t size, const uint64_t key)
+{
+    /* Header is read without bounds, sections can reach past the checksum */
+    if((data == NULL) || (size < 8))
+        return NULL;
+    
+    const uint16_t data_offset = tr_read_u16be(&data[6]);
+    
+    if((data_offset < 10) || ((uint32_t)data_offset + 16 > size)
+       || (hca_check_block_hash(data, data_offset) == 0))
+    {
+        return NULL;
+    }
+    
+    const HCA_HEADER h = hca_read_header_from_data(data, size);
+    
+    if((su_cmp_char(HCA_MAGIC, 4, (const char*)h.magic, 4) != SU_STRINGS_MATCH)
+       || (h.sections.fmt == 0) || (h.sections.vbr)
+       || ((h.sections.comp == 0) && (h.sections.dec == 0)))
+    {
+        return NULL;
+    }
+    
+    uint16_t block_size = 0;
+    int8_t min_res = 0;
+    int8_t max_res = 0;
+    uint32_t total_band_count = 0;
+    uint32_t base_band_count = 0;
+    uint32_t stereo_band_count = 0;
+    uint32_t bands_per_hfr_group = 0;
+    uint8_t track_count = 0;
+    uint8_t channel_config = 0;
+    uint8_t ms_stereo = 0;
+    
+    if(h.sections.comp)
+    {
+        block_size = h.comp.block_size;
+        min_res = h.comp.min_res;
+        max_res = h.comp.max_res;
+        total_band_count = h.comp.total_band_count;
+        base_band_count = h.comp.base_band_count;
+        stereo_band_count = h.comp.stereo_band_count;
+        bands_per_hfr_group = h.comp.bands_per_hfr_group;
+        track_count = h.comp.track_count;
+        channel_config = h.comp.channel_config;
+        ms_stereo = h.comp.reserved[0];
+    }
+    else
+    {
+        /* Band counts are stored minus one */
+        block_size = h.dec.block_size;
+        min_res = h.dec.min_res;
+        max_res = h.dec.max_res;
+        total_band_count = h.dec.total_band_count + 1;
+        base_band_count = h.dec.stereo_type ? h.dec.base_band_count + 1 : total_band_count;
+        stereo_band_count = total_band_count - base_band_count;
+        track_count = h.dec.track_count & 0x0F;
+        channel_config = h.dec.channel_config & 0x0F;
+    }
+    
+    const uint8_t channel_count = h.fmt.channel_count;
+    const uint16_t ath_type = h.sections.ath ? h.ath.ath_table_type : (h.version_major < 2);
+    const uint16_t ciph_type = h.sections.ciph ? h.ciph.type : HCA_CIPH_NONE;
+    
+    if(track_count == 0)
+        track_count = 1;
+    
+    if((channel_count == 0) || (channel_count > HCA_MAX_CHANNELS) || (track_count > channel_count)
+       || (h.fmt.sample_rate == 0) || (h.fmt.block_count == 0) || (block_size < 8)
+       || (min_res < 0) || (max_res > 15) || (min_res > max_res)
+       || (total_band_count > HCA_SAMPLES_PER_SUBFRAME) || (base_band_count > total_band_count)
+       || ((base_band_count + stereo_band_count) > HCA_SAMPLES_PER_SUBFRAME)
+       || (ath_type != 0)) /* Only the flat curve */
+    {
+        return NULL;
+    }
+    
+    const uint64_t total_samples = (uint64_t)h.fmt.block_count*HCA_SAMPLES_PER_BLOCK;
+    
+    if(((uint64_t)h.fmt.inserted_samples + h.fmt.appended_samples) > total_samples)
+        return NULL;
+    
+    HCA_DECODER* dec = (HCA_DECODER*)calloc(1, sizeof(HCA_DECODER));
+    
+    if(hca_cipher_init(dec->cipher, ciph_type, key) == 0)
+    {
+        free(dec);
+        return NULL;
+    }
+    
+    /* Prefetch HCAs are cut short */
+    const uint32_t fitting_blocks = (size - data_offset)/block_size;
+    
+    dec->blocks = &data[data_offset];
+    dec->block_count = (h.fmt.block_count < fitting_blocks) ? h.fmt.block_count : fitting_blocks;
+    dec->block_size = block_size;
+    dec->channel_count = channel_count;
+    dec->sample_rate = h.fmt.sample_rate;
+    dec->sample_count = total_samples - h.fmt.inserted_samples - h.fmt.appended_samples;
+    dec->skip = h.fmt.inserted_samples;
+    dec->version = ((uint16_t)h.version_major << 8) | h.version_minor;
+    dec->min_res = min_res;
+    dec->max_res = max_res;
+    dec->base_band_count = base_band_count;
+    dec->stereo_band_count = stereo_band_count;
+    dec->total_band_count = total_band_count;
+    dec->bands_per_hfr_group = bands_per_hfr_group;
+    dec->ms_stereo = ms_stereo;
+    dec->volume = h.sections.rva ? h.rva.volume : 1.0f;
+    dec->random = 1;
+    
+    if(bands_per_hfr_group)
+    {
+        const uint32_t hfr_bands = total_band_count - base_band_count - stereo_band_count;
+        dec->hfr_group_count = (hfr_bands + bands_per_hfr_group - 1)/bands_per_hfr_group;
+    }
+    
+    dec->channels = (HCA_DECODER_CHANNEL*)calloc(channel_count, sizeof(HCA_DECODER_CHANNEL));
+    
+    if(hca_decoder_channel_types(dec, track_count, channel_config) == 0)
+    {
+        return hca_decoder_close(dec);
+    }
+    
+    for(uint32_t c = 0; c != channel_count; ++c)
+    {
+        HCA_DECODER_CHANNEL* ch = &dec->channels[c];
+        ch->coded_count = base_band_count;
+        
+        if(ch->type != HCA_CHANNEL_STEREO_SECONDARY)
+            ch->coded_count += stereo_band_count;
+    }
+    
+    /* Same value range as the encoder, conversion is the ratio of two scalefactors */
+    for(uint32_t i = 0; i != 64; ++i)
+    {
+        dec->dequant_scaling[i] = pow(2.0, ((int32_t)i - 63)*53.0/128.0 + 3.5);
+    }
+    
+    for(uint32_t i = 1; i != 128; ++i)
+    {
+        dec->scale_conversion[i] = pow(2.0, ((int32_t)i - 63)*53.0/128.0);
+    }
+    
+    hca_kbd_window(dec->window);
+    
+    dec->block_buf = (uint8_t*)malloc(block_size);
+    dec->dct = (float*)malloc(HCA_BANDS*HCA_BANDS*sizeof(float));
+    
+    for(uint32_t k = 0; k != HCA_BANDS; ++k)
+    {
+        for(uint32_t n = 0; n != HCA_BANDS; ++n)
+        {
+            /* Unscaled DCT-IV, the encoder's 2/N makes it the exact inverse */
+            dec->dct[k*HCA_BANDS + n] = cos(M_PI/HCA_BANDS*(n + 0.5)*(k + 0.5));
+        }
+    }
+    
+    return dec;
+}
+
+HCA_DECODER* hca_decoder_close(HCA_DECODER* dec)
+{
+    if(dec)
+    {
+        free(dec->channels);
+        free(dec->block_buf);
+        free(dec->dct);
+        free(dec);
+    }
+    
+    return NULL;
+}
+
+/*
+    Returns 1 on success, 0 if the scalefactors don't make sense.
+*/
+static uint8_t hca_unpack_scalefactors(HCA_DECODER* dec, HCA_DECODER_CHANNEL* ch, HCA_BIT_READER* br)
+{
+    const uint8_t delta_bits = hca_bits_read(br, 3);
+    uint32_t count = ch->coded_count;
+    uint32_t extra_count = 0;
+    
+    /* v3.0 codes the HFR scalefactors along with the rest */
+    if((ch->type != HCA_CHANNEL_STEREO_SECONDARY) && dec->hfr_group_count && (dec->version > HCA_VERSION_V200))
+    {
+        extra_count = dec->hfr_group_count;
+        count += extra_count;
+        
+        if(count > HCA_SAMPLES_PER_SUBFRAME)
+            return 0;
+    }
+    
+    if(delta_bits >= 6)
+    {
+        for(uint32_t i = 0; i != count; ++i)
+        {
+            ch->scalefactors[i] = hca_bits_read(br, 6);
+        }
+    }
+    else if(delta_bits)
+    {
+        const int32_t escape = (1 << delta_bits) - 1;
+        int32_t value = hca_bits_read(br, 6);
+        ch->scalefactors[0] = value;
+        
+        for(uint32_t i = 1; i != count; ++i)
+        {
+            const int32_t delta = hca_bits_read(br, delta_bits);
+            
+            if(delta == escape)
+            {
+                value = hca_bits_read(br, 6);
+            }
+            else
+            {
+                value += delta - (escape >> 1);
+                
+                /* Happens with a wrong key */
+                if((value < 0) || (value >= 64))
+                    return 0;
+            }
+            
+            ch->scalefactors[i] = value;
+        }
+    }
+    else
+    {
+        memset(ch->scalefactors, 0, HCA_SAMPLES_PER_SUBFRAME);
+    }
+    
+    /* HFR scalefactors live at the end, copied from the top so they don't overwrite themselves */
+    for(uint32_t i = 0; i != extra_count; ++i)
+    {
+        ch->scalefactors[HCA_SAMPLES_PER_SUBFRAME - 1 - i] = ch->scalefactors[count - 1 - i];
+    }
+    
+    return 1;
+}
+
+/*
+    Returns 1 on success, 0 if the intensities don't make sense.
+*/
+static uint8_t hca_unpack_intensity(HCA_DECODER* dec, HCA_DECODER_CHANNEL* ch, HCA_BIT_READER* br)
+{
+    if(ch->type != HCA_CHANNEL_STEREO_SECONDARY)
+    {
+        /* v2.0 stores the HFR scalefactors here */
+        if(dec->version <= HCA_VERSION_V200)
+        {
+            uint8_t* hfr_scales = &ch->scalefactors[HCA_SAMPLES_PER_SUBFRAME - dec->hfr_group_count];
+            
+            for(uint32_t i = 0; i != dec->hfr_group_count; ++i)
+            {
+                hfr_scales[i] = hca_bits_read(br, 6);
+            }
+        }
+        
+        return 1;
+    }
+    
+    uint8_t value = hca_bits_peek(br, 4);
+    
+    if(dec->version <= HCA_VERSION_V200)
+    {
+        if(value < 15)
+        {
+            for(uint32_t i = 0; i != HCA_SUBFRAMES_PER_BLOCK; ++i)
+                ch->intensity[i] = hca_bits_read(br, 4);
+        }
+        else
+        {
+            memset(ch->intensity, value, HCA_SUBFRAMES_PER_BLOCK);
+        }
+        
+        return 1;
+    }
+    
+    br->pos += 4;
+    
+    if(value == 15)
+    {
+        memset(ch->intensity, 7, HCA_SUBFRAMES_PER_BLOCK);
+        return 1;
+    }
+    
+    const uint8_t delta_bits = hca_bits_read(br, 2) + 1;
+    ch->intensity[0] = value;
+    
+    for(uint32_t i = 1; i != HCA_SUBFRAMES_PER_BLOCK; ++i)
+    {
+        if(delta_bits == 4)
+        {
+            value = hca_bits_read(br, 4);
+        }
+        else
+        {
+            const uint8_t escape = (1 << delta_bits) - 1;
+            const uint8_t delta = hca_bits_read(br, delta_bits);
+            
+            if(delta == escape)
+            {
+                value = hca_bits_read(br, 4);
+            }
+            else
+            {
+                value = value - (escape >> 1) + delta;
+                
+                if(value > 15)
+                    return 0;
+            }
+        }
+        
+        ch->intensity[i] = value;
+    }
+    
+    return 1;
+}
+
+static void hca_calc_resolution(HCA_DECODER* dec, HCA_DECODER_CHANNEL* ch, const uint32_t packed_noise_level)
+{
+    ch->noise_count = 0;
+    ch->valid_count = 0;
+    
+    for(uint32_t i = 0; i != ch->coded_count; ++i)
+    {
+        uint8_t res = 0;
+        
+        if(ch->scalefactors[i])
+        {
+            /* The flat ATH curve adds nothing to the noise level */
+            const int32_t noise_level = (packed_noise_level + i) >> 8;
+            const int32_t curve_pos = noise_level + 1 - ((5*ch->scalefactors[i]) >> 1);
+            
+            if(curve_pos < 0) res = 15;
+            else if(curve_pos <= 65) res = hca_resolution_curve[curve_pos];
+            
+            if(res > dec->max_res) res = dec->max_res;
+            if(res < dec->min_res) res = dec->min_res;
+            
+            if(res == 0)
+                ch->noises[ch->noise_count++] = i;
+            else
+                ch->noises[HCA_SAMPLES_PER_SUBFRAME - 1 - ch->valid_count++] = i;
+        }
+        
+        ch->resolution[i] = res;
+        ch->gain[i] = dec->dequant_scaling[ch->scalefactors[i]]*hca_step_size[res];
+    }
+    
+    memset(&ch->resolution[ch->coded_count], 0, HCA_SAMPLES_PER_SUBFRAME - ch->coded_count);
+}
+
+static void hca_dequantize(HCA_DECODER_CHANNEL* ch, HCA_BIT_READER* br, const uint32_t subframe)
+{
+    float* spectra = ch->spectra[subframe];
+    
+    for(uint32_t i = 0; i != ch->coded_count; ++i)
+    {
+        const uint8_t res = ch->resolution[i];
+        const uint8_t bits = hca_code_max_bits[res];
+        const uint32_t code = hca_bits_read(br, bits);
+        float value = 0.0f;
+        
+        if(res >= 8)
+        {
+            /* Magnitude and sign bit, zero has no sign bit */
+            const int32_t magnitude = code >> 1;
+            value = (code & 1) ? -magnitude : magnitude;
+            
+            if(magnitude == 0)
+                br->pos -= 1;
+        }
+        else
+        {
+            br->pos -= bits - hca_code_bits[res][code];
+            value = hca_code_values[res][code];
+        }
+        
+        spectra[i] = ch->gain[i]*value;
+    }
+    
+    memset(&spectra[ch->coded_count], 0, (HCA_SAMPLES_PER_SUBFRAME - ch->coded_count)*sizeof(float));
+}
+
+static void hca_reconstruct_noise(HCA_DECODER* dec, HCA_DECODER_CHANNEL* ch, const uint32_t subframe)
+{
+    /* Only when resolution 0 is allowed */
+    if((dec->min_res > 0) || (ch->valid_count == 0) || (ch->noise_count == 0))
+        return;
+    
+    if(dec->ms_stereo && (ch->type != HCA_CHANNEL_STEREO_PRIMARY))
+        return;
+    
+    float* spectra = ch->spectra[subframe];
+    
+    for(uint32_t i = 0; i != ch->noise_count; ++i)
+    {
+        dec->random = 0x343FD*dec->random + 0x269EC3;
+        
+        const uint32_t random_index = HCA_SAMPLES_PER_SUBFRAME - ch->valid_count
+                                      + (((dec->random & 0x7FFF)*ch->valid_count) >> 15);
+        const uint8_t noise_index = ch->noises[i];
+        const uint8_t valid_index = ch->noises[random_index];
+        int32_t sc_index = ch->scalefactors[noise_index] - ch->scalefactors[valid_index] + 62;
+        
+        if(sc_index < 0) sc_index = 0;
+        
+        spectra[noise_index] = dec->scale_conversion[sc_index]*spectra[valid_index];
+    }
+}
+
+static void hca_reconstruct_hfr(HCA_DECODER* dec, HCA_DECODER_CHANNEL* ch, const uint32_t subframe)
+{
+    if((ch->type == HCA_CHANNEL_STEREO_SECONDARY) || (dec->bands_per_hfr_group == 0))
+        return;
+    
+    const uint8_t* hfr_scales = &ch->scalefactors[HCA_SAMPLES_PER_SUBFRAME - dec->hfr_group_count];
+    float* spectra = ch->spectra[subframe];
+    
+    /* Low bands are mirrored, v3.0 mirrors only the first half of the groups */
+    const uint32_t mirror_groups = (dec->version <= HCA_VERSION_V200) ? dec->hfr_group_count : dec->hfr_group_count >> 1;
+    uint32_t high = dec->base_band_count + dec->stereo_band_count;
+    int32_t low = (int32_t)high - 1;
+    
+    for(uint32_t group = 0; group != dec->hfr_group_count; ++group)
+    {
+        const int32_t low_step = (group < mirror_groups) ? 1 : 0;
+        
+        for(uint32_t i = 0; i != dec->bands_per_hfr_group; ++i)
+        {
+            if((high >= dec->total_band_count) || (low < 0))
+                break;
+            
+            int32_t sc_index = hfr_scales[group] - ch->scalefactors[low] + 63;
+            
+            if(sc_index < 0) sc_index = 0;
+            if(sc_index > 127) sc_index = 127;
+            
+            spectra[high] = dec->scale_conversion[sc_index]*spectra[low];
+            high += 1;
+            low -= low_step;
+        }
+    }
+    
+    if(high)
+        spectra[high - 1] = 0.0f;
+}
+
+static void hca_apply_stereo(HCA_DECODER* dec, HCA_DECODER_CHANNEL* pair, const uint32_t subframe)
+{
+    if((pair[0].type != HCA_CHANNEL_STEREO_PRIMARY) || (pair[1].type != HCA_CHANNEL_STEREO_SECONDARY))
+        return;
+    
+    float* l = pair[0].spectra[subframe];
+    float* r = pair[1].spectra[subframe];
+    
+    /* Intensity, the secondary channel is a scaled copy of the primary */
+    const float ratio_l = hca_intensity_ratio[pair[1].intensity[subframe] & 0x0F];
+    const float ratio_r = 2.0f - ratio_l;
+    
+    for(uint32_t band = dec->base_band_count; band < dec->total_band_count; ++band)
+    {
+        r[band] = l[band]*ratio_r;
+        l[band] = l[band]*ratio_l;
+    }
+    
+    if(dec->ms_stereo)
+    {
+        const float ratio = (float)M_SQRT1_2;
+        
+        for(uint32_t band = dec->base_band_count; band < dec->total_band_count; ++band)
+        {
+            const float m = l[band];
+            const float s = r[band];
+            l[band] = (m + s)*ratio;
+            r[band] = (m - s)*ratio;
+        }
+    }
+}
+
+/*
+    IMDCT of one subframe, overlapped with the second half of the last one.
+    Unfolds (-c_r - d, a - b_r) back to (a - b_r, b - a_r, c + d_r, d + c_r).
+*/
+static void hca_decode_imdct(HCA_DECODER* dec, HCA_DECODER_CHANNEL* ch, const uint32_t subframe)
+{
+    const uint32_t half = HCA_BANDS/2;
+    const float* w = dec->window;
+    float* out = &ch->wave[subframe*HCA_BANDS];
+    float u[HCA_BANDS];
+    
+    hca_dct4(ch->spectra[subframe], dec->dct, u);
+    
+    for(uint32_t i = 0; i != half; ++i)
+    {
+        out[i] = w[i]*u[half + i] + ch->previous[i];
+        out[half + i] = ch->previous[half + i] - w[half + i]*u[HCA_BANDS - 1 - i];
+        ch->previous[i] = -w[HCA_BANDS - 1 - i]*u[half - 1 - i];
+        ch->previous[half + i] = -w[half - 1 - i]*u[i];
+    }
+}
+
+/*
+    Decodes the next block into the wave of every channel.
+    Returns 1 on success, 0 on a bad checksum or bitstream.
+*/
+static uint8_t hca_decode_block(HCA_DECODER* dec)
+{
+    const uint8_t* block = &dec->blocks[(uint64_t)dec->block*dec->block_size];
+    
+    if((tr_read_u16be(block) != 0xFFFF) || (hca_check_block_hash(block, dec->block_size) == 0))
+        return 0;
+    
+    for(uint32_t i = 0; i != dec->block_size; ++i)
+    {
+        dec->block_buf[i] = dec->cipher[block[i]];
+    }
+    
+    HCA_BIT_READER br = {dec->block_buf, (dec->block_size - 2)*8, 16};
+    const uint32_t noise_level = hca_bits_read(&br, 9);
+    const uint32_t boundary = hca_bits_read(&br, 7);
+    const uint32_t packed_noise_level = (noise_level << 8) - boundary;
+    
+    for(uint32_t c = 0; c != dec->channel_count; ++c)
+    {
+        HCA_DECODER_CHANNEL* ch = &dec->channels[c];
+        
+        if((hca_unpack_scalefactors(dec, ch, &br) == 0)
+           || (hca_unpack_intensity(dec, ch, &br) == 0))
+        {
+            return 0;
+        }
+        
+        hca_calc_resolution(dec, ch, packed_noise_level);
+    }
+    
+    for(uint32_t s = 0; s != HCA_SUBFRAMES_PER_BLOCK; ++s)
+    {
+        for(uint32_t c = 0; c != dec->channel_count; ++c)
+        {
+            hca_dequantize(&dec->channels[c], &br, s);
+        }
+        
+        for(uint32_t c = 0; c != dec->channel_count; ++c)
+        {
+            hca_reconstruct_noise(dec, &dec->channels[c], s);
+            hca_reconstruct_hfr(dec, &dec->channels[c], s);
+        }
+        
+        for(uint32_t c = 0; (c + 1) < dec->channel_count; ++c)
+        {
+            hca_apply_stereo(dec, &dec->channels[c], s);
+        }
+        
+        for(uint32_t c = 0; c != dec->channel_count; ++c)
+        {
+            hca_decode_imdct(dec, &dec->channels[c], s);
+        }
+    }
+    
+    /* Ran out of the block */
+    return br.pos <= br.size;
+}
+
+uint32_t hca_decode(HCA_DECODER* dec, int16_t* pcm, const uint32_t max_samples)
+{
+    uint32_t written = 0;
+    
+    while((dec->error == 0) && (dec->block != dec->block_count)
+          && (dec->position != dec->sample_count) && ((written + HCA_SAMPLES_PER_BLOCK) <= max_samples))
+    {
+        if(hca_decode_block(dec) == 0)
+        {
+            dec->error = 1;
+            break;
+        }
+        
+        /* Inserted and appended samples are left out */
+        const uint64_t block_start = (uint64_t)dec->block*HCA_SAMPLES_PER_BLOCK;
+        dec->block += 1;
+        
+        for(uint32_t i = 0; i != HCA_SAMPLES_PER_BLOCK; ++i)
+        {
+            const uint64_t sample = block_start + i;
+            
+            if((sample < dec->skip) || (dec->position == dec->sample_count))
+                continue;
+            
+            for(uint32_t c = 0; c != dec->channel_count; ++c)
+            {
+                const int32_t v = lrintf(dec->channels[c].wave[i]*dec->volume*32768.0f);
+                pcm[written*dec->channel_count + c] = (v > 32767) ? 32767 : ((v < -32768) ? -32768 : v);
+            }
+            
+            written += 1;
+            dec->position += 1;
+        }
+    }
+    
+    return written;
+}
@@ -20,6 +20,24 @@
 
 #define HCA_MAGIC   (const char*)"HCA\0"
 
+/* Block encryption, ciph section */
+#define HCA_CIPH_NONE       (uint16_t)(0)
+#define HCA_CIPH_STATIC     (uint16_t)(1)   /* Fixed table */
+#define HCA_CIPH_KEYED      (uint16_t)(56)  /* Table from a 56-bit key */
+
+/* Encoder */
+#define HCA_SAMPLES_PER_SUBFRAME    (uint32_t)(128)
+#define HCA_SUBFRAMES_PER_BLOCK     (uint32_t)(8)
+#define HCA_SAMPLES_PER_BLOCK       (uint32_t)(1024)
+#define HCA_ENCODER_DELAY           (uint16_t)(128)     /* Silence before the first sample */
+#define HCA_ENCODE_BATCH            (uint32_t)(64)      /* Blocks per thread job */
+
+/* Decoder */
+#define HCA_MAX_CHANNELS            (uint8_t)(16)
+#define HCA_CHANNEL_DISCRETE        (uint8_t)(0)
+#define HCA_CHANNEL_STEREO_PRIMARY  (uint8_t)(1)        /* Carries the intensity stereo bands */
+#define HCA_CHANNEL_STEREO_SECONDARY (uint8_t)(2)       /* Has only base bands and intensities */
+
 typedef struct
 {
     uint8_t channel_count;
@@ -114,6 +132,77 @@ typedef struct
     HCA_SECTION_RVA rva;
 } HCA_HEADER;
 
+/*
+    Settings of hca_encode().
+*/
+typedef struct
+{
+    uint32_t sample_rate;
+    uint8_t channel_count;
+    uint16_t block_size;        /* Constant size of every block, 0 to fit all bands */
+    uint8_t loop;               /* Loop points are used only if set */
+    uint32_t loop_start;        /* First sample of the loop */
+    uint32_t loop_end;          /* Sample after the last one of the loop */
+    uint16_t ciph_type;         /* HCA_CIPH_* */
+    uint64_t key;               /* For HCA_CIPH_KEYED */
+    uint32_t thread_count;      /* 0 for all cores */
+} HCA_ENCODE_PARAMS;
+
+/*
+    Per channel state of HCA_DECODER.
+*/
+typedef struct
+{
+    uint8_t type;               /* HCA_CHANNEL_* */
+    uint32_t coded_count;       /* Bands with scalefactors in the block */
+    uint8_t intensity[HCA_SUBFRAMES_PER_BLOCK];
+    uint8_t scalefactors[HCA_SAMPLES_PER_SUBFRAME];
+    uint8_t resolution[HCA_SAMPLES_PER_SUBFRAME];
+    uint8_t noises[HCA_SAMPLES_PER_SUBFRAME];   /* Noise bands from the start, coded ones from the end */
+    uint32_t noise_count;
+    uint32_t valid_count;
+    float gain[HCA_SAMPLES_PER_SUBFRAME];
+    float spectra[HCA_SUBFRAMES_PER_BLOCK][HCA_SAMPLES_PER_SUBFRAME];
+    float previous[HCA_SAMPLES_PER_SUBFRAME];   /* Second half of the last IMDCT */
+    float wave[HCA_SAMPLES_PER_BLOCK];
+} HCA_DECODER_CHANNEL;
+
+/*
+    Streaming decoder state, see hca_decoder_open().
+*/
+typedef struct
+{
+    const uint8_t* blocks;      /* First block */
+    uint32_t block_count;       /* That fit in the data */
+    uint32_t block;             /* Next block to decode */
+    uint16_t block_size;
+    uint8_t channel_count;
+    uint32_t sample_rate;
+    uint32_t sample_count;      /* Per channel, without inserted and appended samples */
+    uint32_t skip;              /* Inserted samples at the start */
+    uint32_t position;          /* Samples per channel decoded so far */
+    uint8_t error;              /* Set when a block couldn't be decoded */
+    
+    uint16_t version;           /* Major in the high byte */
+    uint8_t min_res;
+    uint8_t max_res;
+    uint8_t base_band_count;
+    uint8_t stereo_band_count;
+    uint8_t total_band_count;
+    uint8_t bands_per_hfr_group;
+    uint8_t hfr_group_count;
+    uint8_t ms_stereo;
+    float volume;
+    uint32_t random;            /* Noise filling */
+    uint8_t cipher[256];
+    uint8_t* block_buf;         /* Decrypted copy of the current block */
+    float dequant_scaling[64];
+    float scale_conversion[128];    /* 0 is silence, 63 is 1.0 */
+    float window[2*HCA_SAMPLES_PER_SUBFRAME];
+    float* dct;
+    HCA_DECODER_CHANNEL* channels;
+} HCA_DECODER;
+
 /*
     Implementation
 */
@@ -192,4 +281,76 @@ static inline uint32_t hca_count_valid_blocks(const uint8_t* data, const uint32_
     }
     
     return block_count;
-}
\ No newline at end of file
+}
+
+/*
+    Builds the decryption table of a cipher type.
+    Key only matters for HCA_CIPH_KEYED.
+    
+    Returns 1 on success, 0 on unknown type.
+*/
+uint8_t hca_cipher_init(uint8_t table[256], const uint16_t type, const uint64_t key);
+
+/*
+    Re-encrypts all blocks of the HCA at `data` in place, without decoding.
+    Blocks are decrypted with `old_key` and the type from the header, then encrypted
+    with `new_type` and `new_key` in a single table lookup per byte.
+    Block and header checksums are recalculated.
+    
+    Prefetch HCAs are handled, only blocks that fit in `size` are touched.
+    Blocks are split over `thread_count` threads (0 for all cores).
+    
+    Returns 1 on success, 0 if it's not a HCA or the type can't be changed.
+*/
+uint8_t hca_rekey(uint8_t* data, const uint32_t size,
+                  const uint64_t old_key, const uint64_t new_key,
+                  const uint16_t new_type, const uint32_t thread_count);
+
+/*
+    Writes the sections flagged in `h` and the header checksum.
+    `data` has to hold h->data_offset bytes, 0 as data_offset picks the smallest one.
+    
+    Returns the size of the header.
+*/
+uint16_t hca_header_to_data(HCA_HEADER* h, uint8_t* data);
+
+/*
+    Encodes `sample_count` samples per channel of interleaved 16-bit PCM to a v2.0 HCA
+    with fmt, comp, loop (optional), ath and ciph sections.
+    
+    Channels are coded independently, every coded band at full resolution.
+    If the bands don't fit `block_size`, the quietest ones are dropped.
+    Blocks don't depend on each other and are encoded in batches
+    of HCA_ENCODE_BATCH on separate threads.
+    
+    Returns the file as a SU_STRING, NULL on bad parameters.
+*/
+SU_STRING* hca_encode(const int16_t* pcm, const uint32_t sample_count,
+                      const HCA_ENCODE_PARAMS* params);
+
+/*
+    Sets up decoding of the HCA at `data` without copying it.
+    `key` is used only for HCA_CIPH_KEYED, already mixed with the AWB subkey.
+    VBR files and the ATH curve of v1.x files are not supported.
+    
+    Returns the decoder, NULL if it's not a supported HCA.
+*/
+HCA_DECODER* hca_decoder_open(const uint8_t* data, const uint32_t size, const uint64_t key);
+
+/*
+    Frees the decoder, the data given to hca_decoder_open() stays as it is.
+    
+    Returns NULL.
+*/
+HCA_DECODER* hca_decoder_close(HCA_DECODER* dec);
+
+/*
+    Decodes whole blocks into `pcm` as interleaved 16-bit samples,
+    up to `max_samples` per channel. It has to fit at least one block,
+    HCA_SAMPLES_PER_BLOCK samples.
+    Decoding stops at a block that fails its checksum or can't be unpacked
+    and sets dec->error.
+    
+    Returns the amount of samples per channel written, 0 at the end.
+*/
+uint32_t hca_decode(HCA_DECODER* dec, int16_t* pcm, const uint32_t max_samples);
@@ -0,0 +1,519 @@
+#include "crilayla.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <kwaslib/core/io/string_utils.h>
+#include <kwaslib/core/io/type_readers.h>
+#include <kwaslib/core/io/type_writers.h>
+#include <kwaslib/core/thread/thread_pool.h>
+
+#define CRILAYLA_HASH_BITS          (15)
+#define CRILAYLA_HASH_SIZE          (1 << CRILAYLA_HASH_BITS)
+#define CRILAYLA_NO_POS             (int32_t)(-1)
+
+/*
+    Bit reader.
+    Bytes come from the end of the bitstream, bits are kept MSB aligned in a 64-bit buffer
+    so a whole token can be read after a single refill.
+*/
+typedef struct
+{
+    const uint8_t* start;
+    const uint8_t* ptr;     /* One past the next byte to read */
+    uint64_t bits;
+    uint32_t count;
+} CRILAYLA_BIT_READER;
+
+/*
+    Bit writer.
+    Bytes are written forward and reversed once the stream is done.
+*/
+typedef struct
+{
+    uint8_t* out;
+    uint64_t pos;
+    uint64_t acc;
+    uint32_t count;
+} CRILAYLA_BIT_WRITER;
+
+typedef struct
+{
+    const uint8_t* data;
+    uint64_t size;
+    int32_t* head;
+    int32_t* prev;
+    uint64_t inserted;      /* Positions below this are in the hash chains */
+    uint32_t max_chain;
+    uint64_t nice_length;   /* Stop searching after finding a match this long */
+} CRILAYLA_MATCHER;
+
+typedef struct
+{
+    uint64_t length;
+    uint32_t distance;
+} CRILAYLA_MATCH;
+
+typedef struct
+{
+    CRILAYLA_JOB* jobs;
+    uint8_t effort;
+} CRILAYLA_BATCH_CTX;
+
+/*
+    Reading
+*/
+static inline void crilayla_refill(CRILAYLA_BIT_READER* br)
+{
+    if((br->ptr - br->start) >= 8)
+    {
+        /* Little endian load puts the byte right before `ptr` on top */
+        br->bits |= tr_read_u64le(br->ptr - 8) >> br->count;
+        br->ptr -= (63 - br->count) >> 3;
+        br->count |= 56;
+        return;
+    }
+
+    /* Near the start of the stream, past it are zeros */
+    while(br->count <= 56)
+    {
+        uint64_t byte = 0;
+
+        if(br->ptr != br->start)
+        {
+            br->ptr -= 1;
+            byte = *br->ptr;
+        }
+
+        br->bits |= byte << (56 - br->count);
+        br->count += 8;
+    }
+}
+
+static inline uint32_t crilayla_get_bits(CRILAYLA_BIT_READER* br, const uint32_t count)
+{
+    const uint32_t value = br->bits >> (64 - count);
+    br->bits <<= count;
+    br->count -= count;
+    return value;
+}
+
+uint8_t crilayla_is_compressed(const uint8_t* data, const uint64_t size)
+{
+    if(size < (CRILAYLA_HEADER_SIZE + CRILAYLA_PREFIX_SIZE))
+    {
+        return 0;
+    }
+
+    return (su_cmp_char((const char*)data, 8, CRILAYLA_MAGIC, 8) == SU_STRINGS_MATCH);
+}
+
+uint64_t crilayla_get_decompressed_size(const uint8_t* data, const uint64_t size)
+{
+    if(crilayla_is_compressed(data, size) == 0)
+    {
+        return 0;
+    }
+
+    return (uint64_t)tr_read_u32le(&data[8]) + CRILAYLA_PREFIX_SIZE;
+}
+
+uint8_t crilayla_decompress_to(const uint8_t* data, const uint64_t size, uint8_t* out)
+{
+    if(crilayla_is_compressed(data, size) == 0)
+    {
+        return 0;
+    }
+
+    const uint64_t data_size = tr_read_u32le(&data[8]);
+    const uint64_t stream_size = tr_read_u32le(&data[12]);
+
+    if((CRILAYLA_HEADER_SIZE + stream_size + CRILAYLA_PREFIX_SIZE) > size)
+    {
+        return 0;
+    }
+
+    const uint8_t* stream = &data[CRILAYLA_HEADER_SIZE];
+    CRILAYLA_BIT_READER br = {0};
+    br.start = stream;
+    br.ptr = &stream[stream_size];
+
+    /* Written backwards, `pos` is the next byte to write */
+    const uint64_t last = data_size + CRILAYLA_PREFIX_SIZE - 1;
+    int64_t pos = last;
+
+    while(pos >= CRILAYLA_PREFIX_SIZE)
+    {
+        crilayla_refill(&br);
+
+        if(crilayla_get_bits(&br, 1) == 0)
+        {
+            out[pos] = crilayla_get_bits(&br, 8);
+            pos -= 1;
+            continue;
+        }
+
+        const uint64_t distance = crilayla_get_bits(&br, 13) + 3;
+        uint64_t length = CRILAYLA_MIN_MATCH;
+        uint32_t chunk = crilayla_get_bits(&br, 2);
+        length += chunk;
+
+        if(chunk == 3)
+        {
+            chunk = crilayla_get_bits(&br, 3);
+            length += chunk;
+
+            if(chunk == 7)
+            {
+                chunk = crilayla_get_bits(&br, 5);
+                length += chunk;
+
+                if(chunk == 31)
+                {
+                    do
+                    {
+                        crilayla_refill(&br);
+                        chunk = crilayla_get_bits(&br, 8);
+                        length += chunk;
+                    }
+                    while(chunk == 255);
+                }
+            }
+        }
+
+        if(((pos + distance) > last) || (length > (uint64_t)(pos - CRILAYLA_PREFIX_SIZE + 1)))
+        {
+            return 0;
+        }
+
+        const uint8_t* src = &out[pos + distance - length + 1];
+        uint8_t* dst = &out[pos - length + 1];
+
+        if(distance >= length)
+        {
+            memcpy(dst, src, length);
+        }
+        else /* Overlapping, has to repeat bytes it just wrote */
+        {
+            for(int64_t i = length - 1; i >= 0; --i)
+            {
+                dst[i] = src[i];
+            }
+        }
+
+        pos -= length;
+    }
+
+    memcpy(out, &stream[stream_size], CRILAYLA_PREFIX_SIZE);
+
+    return 1;
+}
+
+uint8_t* crilayla_decompress(const uint8_t* data, const uint64_t size, uint64_t* out_size)
+{
+    const uint64_t dec_size = crilayla_get_decompressed_size(data, size);
+
+    if(dec_size == 0)
+    {
+        return NULL;
+    }
+
+    uint8_t* out = (uint8_t*)malloc(dec_size);
+
+    if(crilayla_decompress_to(data, size, out) == 0)
+    {
+        free(out);
+        return NULL;
+    }
+
+    *out_size = dec_size;
+
+    return out;
+}
+
+/*
+    Writing
+*/
+static inline void crilayla_put_bits(CRILAYLA_BIT_WRITER* bw, const uint32_t value, const uint32_t count)
+{
+    bw->acc = (bw->acc << count) | value;
+    bw->count += count;
+
+    while(bw->count >= 8)
+    {
+        bw->count -= 8;
+        bw->out[bw->pos] = (uint8_t)(bw->acc >> bw->count);
+        bw->pos += 1;
+    }
+}
+
+static inline void crilayla_flush_bits(CRILAYLA_BIT_WRITER* bw)
+{
+    if(bw->count)
+    {
+        bw->out[bw->pos] = (uint8_t)(bw->acc << (8 - bw->count));
+        bw->pos += 1;
+        bw->count = 0;
+    }
+}
+
+static void crilayla_put_match(CRILAYLA_BIT_WRITER* bw, const CRILAYLA_MATCH* match)
+{
+    static const uint8_t chunk_bits[4] = {2, 3, 5, 8};
+    uint64_t length = match->length - CRILAYLA_MIN_MATCH;
+
+    crilayla_put_bits(bw, 1, 1);
+    crilayla_put_bits(bw, match->distance - 3, 13);
+
+    for(uint32_t i = 0; i != 4; ++i)
+    {
+        const uint32_t max = (1 << chunk_bits[i]) - 1;
+        const uint32_t chunk = (length < max) ? length : max;
+        crilayla_put_bits(bw, chunk, chunk_bits[i]);
+        length -= chunk;
+
+        if(chunk != max)
+        {
+            return;
+        }
+    }
+
+    uint32_t chunk = 0;
+
+    do
+    {
+        chunk = (length < 255) ? length : 255;
+        crilayla_put_bits(bw, chunk, 8);
+        length -= chunk;
+    }
+    while(chunk == 255);
+}
+
+/*
+    Matching, hash chains over 3 byte sequences
+*/
+static inline uint32_t crilayla_hash(const uint8_t* data)
+{
+    const uint32_t v = (data[0] << 16) | (data[1] << 8) | data[2];
+    return (v * 2654435761u) >> (32 - CRILAYLA_HASH_BITS);
+}
+
+static void crilayla_insert_until(CRILAYLA_MATCHER* m, const uint64_t pos)
+{
+    const uint64_t end = (pos < (m->size - 2)) ? pos : (m->size - 2);
+
+    for(; m->inserted < end; ++m->inserted)
+    {
+        const uint32_t hash = crilayla_hash(&m->data[m->inserted]);
+        m->prev[m->inserted] = m->head[hash];
+        m->head[hash] = m->inserted;
+    }
+
+    if(m->inserted < pos)
+    {
+        m->inserted = pos;
+    }
+}
+
+static inline uint64_t crilayla_match_length(const uint8_t* a, const uint8_t* b, const uint64_t max)
+{
+    uint64_t length = 0;
+
+    while((length + 8) <= max)
+    {
+        if(tr_read_u64(&a[length]) != tr_read_u64(&b[length]))
+        {
+            break;
+        }
+
+        length += 8;
+    }
+
+    while((length < max) && (a[length] == b[length]))
+    {
+        length += 1;
+    }
+
+    return length;
+}
+
+static CRILAYLA_MATCH crilayla_find_match(CRILAYLA_MATCHER* m, const uint64_t pos)
+{
+    CRILAYLA_MATCH best = {0};
+    const uint64_t max = m->size - pos;
+
+    if(max < CRILAYLA_MIN_MATCH)
+    {
+        return best;
+    }
+
+    crilayla_insert_until(m, pos);
+
+    int32_t cand = m->head[crilayla_hash(&m->data[pos])];
+    uint32_t chain = m->max_chain;
+
+    while((cand != CRILAYLA_NO_POS) && chain--)
+    {
+        const uint64_t distance = pos - cand;
+
+        if(distance > CRILAYLA_MAX_DISTANCE)
+        {
+            break;
+        }
+
+        /* Distances of 1 and 2 can't be encoded */
+        if(distance >= 3)
+        {
+            const uint64_t length = crilayla_match_length(&m->data[cand], &m->data[pos], max);
+
+            if(length > best.length)
+            {
+                best.length = length;
+                best.distance = distance;
+
+                if(length >= m->nice_length)
+                {
+                    break;
+                }
+            }
+        }
+
+        cand = m->prev[cand];
+    }
+
+    if(best.length < CRILAYLA_MIN_MATCH)
+    {
+        best.length = 0;
+    }
+
+    return best;
+}
+
+uint8_t* crilayla_compress(const uint8_t* data, const uint64_t size,
+                           const uint8_t effort, uint64_t* out_size)
+{
+    if((size <= CRILAYLA_PREFIX_SIZE) || ((size - CRILAYLA_PREFIX_SIZE) > INT32_MAX))
+    {
+        return NULL;
+    }
+
+    /* Stream decodes back to front, so matching runs on reversed data */
+    const uint64_t n = size - CRILAYLA_PREFIX_SIZE;
+    uint8_t* rev = (uint8_t*)malloc(n);
+
+    for(uint64_t i = 0; i != n; ++i)
+    {
+        rev[i] = data[size - 1 - i];
+    }
+
+    CRILAYLA_MATCHER m = {0};
+    m.data = rev;
+    m.size = n;
+    m.head = (int32_t*)malloc(CRILAYLA_HASH_SIZE * sizeof(int32_t));
+    m.prev = (int32_t*)malloc(n * sizeof(int32_t));
+    memset(m.head, 0xFF, CRILAYLA_HASH_SIZE * sizeof(int32_t));
+
+    uint8_t lazy = 1;
+
+    switch(effort)
+    {
+        case CRILAYLA_EFFORT_FAST:
+            m.max_chain = 16;
+            m.nice_length = 32;
+            lazy = 0;
+            break;
+        case CRILAYLA_EFFORT_BEST:
+            m.max_chain = 4096;
+            m.nice_length = UINT64_MAX;
+            break;
+        default:
+            m.max_chain = 128;
+            m.nice_length = 258;
+    }
+
+    /* Literals take 9 bits, so this is the worst case */
+    CRILAYLA_BIT_WRITER bw = {0};
+    bw.out = (uint8_t*)malloc(n + n/8 + 16);
+
+    uint64_t pos = 0;
+
+    while(pos < n)
+    {
+        CRILAYLA_MATCH match = crilayla_find_match(&m, pos);
+
+        /* Take a literal if the next position has a longer match */
+        while(lazy && match.length && ((pos + 1) < n))
+        {
+            CRILAYLA_MATCH next = crilayla_find_match(&m, pos + 1);
+
+            if(next.length <= match.length)
+            {
+                break;
+            }
+
+            crilayla_put_bits(&bw, rev[pos], 9);
+            pos += 1;
+            match = next;
+        }
+
+        if(match.length == 0)
+        {
+            crilayla_put_bits(&bw, rev[pos], 9);
+            pos += 1;
+            continue;
+        }
+
+        crilayla_put_match(&bw, &match);
+        pos += match.length;
+    }
+
+    crilayla_flush_bits(&bw);
+
+    free(m.prev);
+    free(m.head);
+    free(rev);
+
+    const uint64_t total = CRILAYLA_HEADER_SIZE + bw.pos + CRILAYLA_PREFIX_SIZE;
+
+    if(total >= size)
+    {
+        free(bw.out);
+        return NULL;
+    }
+
+    uint8_t* out = (uint8_t*)malloc(total);
+    tw_write_array((const uint8_t*)CRILAYLA_MAGIC, 8, out);
+    tw_write_u32le(n, &out[8]);
+    tw_write_u32le(bw.pos, &out[12]);
+
+    for(uint64_t i = 0; i != bw.pos; ++i)
+    {
+        out[CRILAYLA_HEADER_SIZE + bw.pos - 1 - i] = bw.out[i];
+    }
+
+    memcpy(&out[CRILAYLA_HEADER_SIZE + bw.pos], data, CRILAYLA_PREFIX_SIZE);
+
+    free(bw.out);
+    *out_size = total;
+
+    return out;
+}
+
+static void crilayla_batch_worker(void* user, const uint64_t index)
+{
+    CRILAYLA_BATCH_CTX* ctx = (CRILAYLA_BATCH_CTX*)user;
+    CRILAYLA_JOB* job = &ctx->jobs[index];
+
+    job->out_size = 0;
+    job->out = crilayla_compress(job->data, job->size, ctx->effort, &job->out_size);
+}
+
+void crilayla_compress_batch(CRILAYLA_JOB* jobs, const uint64_t count,
+                             const uint8_t effort, const uint32_t thread_count)
+{
+    CRILAYLA_BATCH_CTX ctx = {0};
+    ctx.jobs = jobs;
+    ctx.effort = effort;
+
+    tp_parallel_for(count, thread_count, crilayla_batch_worker, &ctx);
+}
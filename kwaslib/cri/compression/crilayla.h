@@ -0,0 +1,86 @@
+#pragma once
+
+/*
+    CRILAYLA compression used in CPK, AFS and other CRIWARE containers.
+
+    Layout (little endian):
+        0x00    "CRILAYLA"
+        0x08    u32 size of the decompressed data without the prefix
+        0x0C    u32 size of the compressed bitstream
+        0x10    bitstream
+        ...     first 0x100 bytes of the file, stored as-is
+
+    Bitstream is read backwards from its last byte, MSB first.
+    Data is decompressed backwards too, from the end of the file
+    down to the prefix. Tokens:
+        0 + 8 bits                  literal
+        1 + 13 bits + length        copy of (13 bits + 3) bytes back, length of at least 3.
+                                    Extra length is stored in 2, 3, 5 and then 8 bit chunks,
+                                    every chunk read only if the previous one was all ones.
+*/
+
+#include <stdint.h>
+
+#define CRILAYLA_MAGIC              (const char*)"CRILAYLA"
+#define CRILAYLA_HEADER_SIZE        (uint8_t)(0x10)
+#define CRILAYLA_PREFIX_SIZE        (uint16_t)(0x100)
+
+#define CRILAYLA_MIN_MATCH          (uint32_t)(3)
+#define CRILAYLA_MAX_DISTANCE       (uint32_t)(0x1FFF + 3)
+
+/* How hard the encoder looks for matches */
+#define CRILAYLA_EFFORT_FAST        (uint8_t)(0)
+#define CRILAYLA_EFFORT_DEFAULT     (uint8_t)(1)
+#define CRILAYLA_EFFORT_BEST        (uint8_t)(2)
+
+/*
+    One item of a batch.
+    `out` is allocated by the batch and NULL if the data didn't compress.
+*/
+typedef struct
+{
+    const uint8_t* data;
+    uint64_t size;
+    uint8_t* out;
+    uint64_t out_size;
+} CRILAYLA_JOB;
+
+/*
+    Returns 1 if the data starts with a CRILAYLA header, 0 otherwise.
+*/
+uint8_t crilayla_is_compressed(const uint8_t* data, const uint64_t size);
+
+/*
+    Returns the size of decompressed data; 0 if the data is not CRILAYLA.
+*/
+uint64_t crilayla_get_decompressed_size(const uint8_t* data, const uint64_t size);
+
+/*
+    Decompresses into `out`, which has to hold crilayla_get_decompressed_size() bytes.
+
+    Returns 1 on success, 0 on malformed data.
+*/
+uint8_t crilayla_decompress_to(const uint8_t* data, const uint64_t size, uint8_t* out);
+
+/*
+    Decompresses into a new buffer.
+
+    Returns a pointer to the data and its size in `out_size`; NULL on error.
+*/
+uint8_t* crilayla_decompress(const uint8_t* data, const uint64_t size, uint64_t* out_size);
+
+/*
+    Compresses the data with CRILAYLA_EFFORT_*.
+    Data up to CRILAYLA_PREFIX_SIZE bytes or data that doesn't get smaller
+    is not compressed.
+
+    Returns a pointer to the compressed data and its size in `out_size`; NULL otherwise.
+*/
+uint8_t* crilayla_compress(const uint8_t* data, const uint64_t size,
+                           const uint8_t effort, uint64_t* out_size);
+
+/*
+    Compresses every job on `thread_count` threads (TP_THREADS_AUTO for all cores).
+*/
+void crilayla_compress_batch(CRILAYLA_JOB* jobs, const uint64_t count,
+                             const uint8_t effort, const uint32_t thread_count);
@@ -8,6 +8,10 @@
 #include <kwaslib/cri/archive/afs.h>
 #include <kwaslib/cri/archive/afs_parse.h>
 #include <kwaslib/cri/archive/afs_export.h>
+#include <kwaslib/cri/archive/afs_toc.h>
+#include <kwaslib/cri/archive/cpk.h>
+
+#include <kwaslib/cri/compression/crilayla.h>
 
 #include <kwaslib/cri/audio/adx.h>
 #include <kwaslib/cri/audio/awb.h>
@@ -18,5 +22,6 @@
 #include <kwaslib/cri/utf/utf_common.h>
 #include <kwaslib/cri/utf/utf_data_table.h>
 #include <kwaslib/cri/utf/utf_load.h>
+#include <kwaslib/cri/utf/utf_patch.h>
 #include <kwaslib/cri/utf/utf_string_table.h>
 #include <kwaslib/cri/utf/utf_table.h>
@@ -75,6 +75,137 @@ UTF_TABLE* utf_load_from_data(const uint8_t* data)
     return utf;
 }
 
+/*
+    Strings have to end before the end of the table.
+*/
+static uint8_t utf_string_fits(const uint8_t* th_ptr, const uint64_t table_size, const uint64_t offset)
+{
+    return (offset < table_size) && (memchr(&th_ptr[offset], '\0', table_size - offset) != NULL);
+}
+
+static uint8_t utf_record_fits(const uint8_t* th_ptr, const uint64_t table_size,
+                               const UTF_TABLE_HEADER* th, const uint8_t* data, const uint8_t type)
+{
+    const UTF_RECORD record = utf_read_record_by_type(data, type);
+    
+    if(type == UTF_COLUMN_TYPE_STRING)
+    {
+        return utf_string_fits(th_ptr, table_size, (uint64_t)th->string_table_offset + record.str_offset);
+    }
+    
+    if((type == UTF_COLUMN_TYPE_VLDATA) && record.vl.size)
+    {
+        const uint64_t offset = (uint64_t)th->data_offset + record.vl.offset;
+        
+        if((offset > table_size) || (record.vl.size > (table_size - offset)))
+        {
+            return 0;
+        }
+        
+        /* Embedded tables get loaded too */
+        if((record.vl.size >= 4)
+           && (su_cmp_char((const char*)&th_ptr[offset], 4, UTF_MAGIC, 4) == SU_STRINGS_MATCH))
+        {
+            return utf_table_fits(&th_ptr[offset], record.vl.size);
+        }
+    }
+    
+    return 1;
+}
+
+uint8_t utf_table_fits(const uint8_t* data, const uint64_t size)
+{
+    if(size < (8 + UTF_TABLE_HEADER_SIZE))
+    {
+        return 0;
+    }
+    
+    const UTF_HEADER header = utf_read_header(data);
+    
+    if((su_cmp_char(&header.id[0], 4, UTF_MAGIC, 4) != SU_STRINGS_MATCH)
+       || (header.table_size < UTF_TABLE_HEADER_SIZE)
+       || (header.table_size > (size - 8)))
+    {
+        return 0;
+    }
+    
+    const uint8_t* th_ptr = &data[8];
+    const uint64_t table_size = header.table_size;
+    const UTF_TABLE_HEADER th = utf_read_table_header(th_ptr);
+    
+    if((th.rows_offset > table_size)
+       || (th.string_table_offset > table_size)
+       || (th.data_offset > table_size)
+       || (((uint64_t)th.rows_width * th.rows_count) > (table_size - th.rows_offset))
+       || (utf_string_fits(th_ptr, table_size, (uint64_t)th.string_table_offset + th.name_offset) == 0))
+    {
+        return 0;
+    }
+    
+    /* Same walk as utf_read_schema and utf_load_from_data, without building anything */
+    uint64_t schema_pos = UTF_TABLE_HEADER_SIZE;
+    uint32_t rows_iter_offset = 0;
+    
+    for(uint32_t i = 0; i != th.columns_count; ++i)
+    {
+        if(schema_pos >= table_size)
+        {
+            return 0;
+        }
+        
+        UTF_SCHEMA_DESC desc;
+        tr_read_array(&th_ptr[schema_pos], 1, (uint8_t*)&desc);
+        schema_pos += 1;
+        
+        const uint8_t type_size = utf_get_type_size(desc.type);
+        
+        if(desc.name)
+        {
+            if((4 > (table_size - schema_pos))
+               || (utf_string_fits(th_ptr, table_size,
+                                   (uint64_t)th.string_table_offset + tr_read_u32be(&th_ptr[schema_pos])) == 0))
+            {
+                return 0;
+            }
+            
+            schema_pos += 4;
+        }
+        
+        if(desc.schema)
+        {
+            if((type_size > (table_size - schema_pos))
+               || (utf_record_fits(th_ptr, table_size, &th, &th_ptr[schema_pos], desc.type) == 0))
+            {
+                return 0;
+            }
+            
+            schema_pos += type_size;
+        }
+        
+        if(desc.row)
+        {
+            if(type_size > (th.rows_width - rows_iter_offset))
+            {
+                return 0;
+            }
+            
+            for(uint32_t j = 0; j != th.rows_count; ++j)
+            {
+                const uint64_t row_pos = th.rows_offset + (uint64_t)th.rows_width * j + rows_iter_offset;
+                
+                if(utf_record_fits(th_ptr, table_size, &th, &th_ptr[row_pos], desc.type) == 0)
+                {
+                    return 0;
+                }
+            }
+            
+            rows_iter_offset += type_size;
+        }
+    }
+    
+    return 1;
+}
+
 const UTF_HEADER utf_read_header(const uint8_t* data)
 {
     UTF_HEADER header = {0};
@@ -12,6 +12,14 @@
 
 UTF_TABLE* utf_load_from_data(const uint8_t* data);
 
+/*
+    Checks every offset of the table and its embedded tables,
+    utf_load_from_data trusts them.
+    
+    Returns 1 if the table fits in `size` bytes, 0 otherwise.
+*/
+uint8_t utf_table_fits(const uint8_t* data, const uint64_t size);
+
 const UTF_HEADER utf_read_header(const uint8_t* data);
 const UTF_TABLE_HEADER utf_read_table_header(const uint8_t* data);
 
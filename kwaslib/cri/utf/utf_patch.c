@@ -0,0 +1,519 @@
+#include "utf_patch.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+
+#include <kwaslib/core/io/file_utils.h>
+#include <kwaslib/core/io/type_readers.h>
+#include <kwaslib/core/io/type_writers.h>
+
+#include "utf_defines.h"
+#include "utf_common.h"
+#include "utf_load.h"
+
+typedef struct
+{
+    uint8_t* th_ptr;        /* Table header, all offsets are relative to it */
+    uint32_t size;          /* Size from the table header on */
+    UTF_TABLE_HEADER th;
+} UTF_PATCH_TABLE;
+
+typedef struct
+{
+    UTF_SCHEMA_DESC desc;
+    uint8_t* constant;      /* Value in schema */
+    uint32_t row_offset;    /* Offset in a row */
+} UTF_PATCH_COLUMN;
+
+static const char* UTF_PATCH_STATUS_STR[] =
+{
+    "OK", "Malformed path", "Not a valid @UTF table", "No such column",
+    "Row out of range", "Column type is not fixed-width",
+    "Column is constant for all rows", "Invalid value for the column type",
+    "Can't read the patch file"
+};
+
+static uint8_t utf_patch_open_table(uint8_t* data, const uint64_t size, UTF_PATCH_TABLE* t)
+{
+    if((size < (8 + UTF_TABLE_HEADER_SIZE))
+       || (memcmp(data, UTF_MAGIC, 4) != 0))
+    {
+        return UTF_PATCH_ERR_TABLE;
+    }
+
+    t->th_ptr = &data[8];
+    t->size = tr_read_u32be(&data[4]);
+    t->th = utf_read_table_header(t->th_ptr);
+
+    const UTF_TABLE_HEADER* th = &t->th;
+
+    if(((uint64_t)t->size + 8) > size
+       || (th->rows_offset < UTF_TABLE_HEADER_SIZE)
+       || (th->string_table_offset > t->size)
+       || (((uint64_t)th->rows_offset + (uint64_t)th->rows_width*th->rows_count) > t->size))
+    {
+        return UTF_PATCH_ERR_TABLE;
+    }
+
+    return UTF_PATCH_OK;
+}
+
+static uint8_t utf_patch_find_column(UTF_PATCH_TABLE* t, const char* name, const uint32_t name_size,
+                                     UTF_PATCH_COLUMN* col)
+{
+    uint8_t* schema_ptr = &t->th_ptr[UTF_TABLE_HEADER_SIZE];
+    uint8_t* schema_end = &t->th_ptr[t->th.rows_offset];
+    const char* strtbl = (const char*)&t->th_ptr[t->th.string_table_offset];
+    const uint32_t strtbl_size = t->size - t->th.string_table_offset;
+    uint32_t row_offset = 0;
+
+    for(uint32_t i = 0; i != t->th.columns_count; ++i)
+    {
+        UTF_SCHEMA_DESC desc;
+        uint32_t name_offset = UINT32_MAX;
+
+        if(schema_ptr >= schema_end)
+        {
+            return UTF_PATCH_ERR_TABLE;
+        }
+
+        tr_read_array(schema_ptr, 1, (uint8_t*)&desc);
+        schema_ptr += 1;
+
+        if(desc.name)
+        {
+            name_offset = tr_read_u32be(schema_ptr);
+            schema_ptr += 4;
+        }
+
+        uint8_t* constant = NULL;
+
+        if(desc.schema)
+        {
+            constant = schema_ptr;
+            schema_ptr += utf_get_type_size(desc.type);
+        }
+
+        if(schema_ptr > schema_end)
+        {
+            return UTF_PATCH_ERR_TABLE;
+        }
+
+        if((name_offset < strtbl_size)
+           && (name_size < (strtbl_size - name_offset))
+           && (memcmp(&strtbl[name_offset], name, name_size) == 0)
+           && (strtbl[name_offset + name_size] == '\0'))
+        {
+            col->desc = desc;
+            col->constant = constant;
+            col->row_offset = row_offset;
+            return UTF_PATCH_OK;
+        }
+
+        if(desc.row)
+        {
+            row_offset += utf_get_type_size(desc.type);
+        }
+    }
+
+    return UTF_PATCH_ERR_COLUMN;
+}
+
+/*
+    Parses `name[row]` and moves `path` past it.
+*/
+static uint8_t utf_patch_parse_segment(const char** path, const char** name,
+                                       uint32_t* name_size, uint32_t* row)
+{
+    const char* p = *path;
+    const char* open = strchr(p, '[');
+
+    if((open == NULL) || (open == p))
+    {
+        return UTF_PATCH_ERR_PATH;
+    }
+
+    *name = p;
+    *name_size = open - p;
+    p = open + 1;
+
+    if(*p == '*')
+    {
+        *row = UTF_PATCH_ALL_ROWS;
+        p += 1;
+    }
+    else
+    {
+        char* end = NULL;
+        errno = 0;
+        const unsigned long long value = strtoull(p, &end, 10);
+
+        if((end == p) || errno || (value >= UTF_PATCH_ALL_ROWS) || (*p == '-'))
+        {
+            return UTF_PATCH_ERR_PATH;
+        }
+
+        *row = value;
+        p = end;
+    }
+
+    if(*p != ']')
+    {
+        return UTF_PATCH_ERR_PATH;
+    }
+
+    p += 1;
+
+    if((*p != '\0') && (*p != '/'))
+    {
+        return UTF_PATCH_ERR_PATH;
+    }
+
+    *path = (*p == '/') ? (p + 1) : p;
+
+    return UTF_PATCH_OK;
+}
+
+uint8_t utf_patch_find_cell(uint8_t* data, const uint64_t size,
+                            const char* path, UTF_PATCH_CELL* cell)
+{
+    uint64_t table_size = size;
+
+    while(1)
+    {
+        UTF_PATCH_TABLE t;
+        UTF_PATCH_COLUMN col;
+        const char* name = NULL;
+        uint32_t name_size = 0;
+        uint32_t row = 0;
+        uint8_t status = utf_patch_open_table(data, table_size, &t);
+
+        if(status != UTF_PATCH_OK)
+        {
+            return status;
+        }
+
+        status = utf_patch_parse_segment(&path, &name, &name_size, &row);
+
+        if(status != UTF_PATCH_OK)
+        {
+            return status;
+        }
+
+        status = utf_patch_find_column(&t, name, name_size, &col);
+
+        if(status != UTF_PATCH_OK)
+        {
+            return status;
+        }
+
+        const uint8_t last = (*path == '\0');
+
+        if((row != UTF_PATCH_ALL_ROWS) && (row >= t.th.rows_count))
+        {
+            return UTF_PATCH_ERR_ROW;
+        }
+
+        /* Single row of a shared value */
+        if(col.desc.schema && (row != UTF_PATCH_ALL_ROWS) && (t.th.rows_count != 1))
+        {
+            if(last || (col.desc.type != UTF_COLUMN_TYPE_VLDATA))
+            {
+                return UTF_PATCH_ERR_CONSTANT;
+            }
+        }
+
+        uint8_t* ptr = NULL;
+
+        if(col.desc.schema)
+        {
+            ptr = col.constant;
+        }
+        else if(col.desc.row)
+        {
+            const uint32_t first = (row == UTF_PATCH_ALL_ROWS) ? 0 : row;
+            ptr = &t.th_ptr[t.th.rows_offset + t.th.rows_width*first + col.row_offset];
+        }
+        else /* Column without data */
+        {
+            return UTF_PATCH_ERR_TYPE;
+        }
+
+        if(last)
+        {
+            switch(col.desc.type)
+            {
+                case UTF_COLUMN_TYPE_STRING:
+                case UTF_COLUMN_TYPE_VLDATA:
+                case UTF_COLUMN_TYPE_UINT128:
+                case UTF_COLUMN_TYPE_UNDEFINED:
+                    return UTF_PATCH_ERR_TYPE;
+            }
+
+            cell->ptr = ptr;
+            cell->type = col.desc.type;
+
+            if(col.desc.schema || (row != UTF_PATCH_ALL_ROWS))
+            {
+                cell->stride = 0;
+                cell->count = 1;
+            }
+            else
+            {
+                cell->stride = t.th.rows_width;
+                cell->count = t.th.rows_count;
+            }
+
+            return UTF_PATCH_OK;
+        }
+
+        /* Going into an embedded table */
+        if((col.desc.type != UTF_COLUMN_TYPE_VLDATA) || (row == UTF_PATCH_ALL_ROWS))
+        {
+            return UTF_PATCH_ERR_PATH;
+        }
+
+        const uint64_t vl_offset = (uint64_t)t.th.data_offset + tr_read_u32be(ptr);
+        const uint64_t vl_size = tr_read_u32be(&ptr[4]);
+
+        if((vl_offset + vl_size) > t.size)
+        {
+            return UTF_PATCH_ERR_TABLE;
+        }
+
+        data = &t.th_ptr[vl_offset];
+        table_size = vl_size;
+    }
+}
+
+static uint8_t utf_patch_parse_uint(const char* value, const uint64_t max, uint64_t* out)
+{
+    char* end = NULL;
+
+    while(isspace((unsigned char)*value)) value += 1;
+
+    if(*value == '-')
+    {
+        return UTF_PATCH_ERR_VALUE;
+    }
+
+    errno = 0;
+    *out = strtoull(value, &end, 0);
+
+    while(isspace((unsigned char)*end)) end += 1;
+
+    if((end == value) || (*end != '\0') || errno || (*out > max))
+    {
+        return UTF_PATCH_ERR_VALUE;
+    }
+
+    return UTF_PATCH_OK;
+}
+
+static uint8_t utf_patch_parse_int(const char* value, const int64_t min, const int64_t max, int64_t* out)
+{
+    char* end = NULL;
+    errno = 0;
+    *out = strtoll(value, &end, 0);
+
+    while(isspace((unsigned char)*end)) end += 1;
+
+    if((end == value) || (*end != '\0') || errno || (*out < min) || (*out > max))
+    {
+        return UTF_PATCH_ERR_VALUE;
+    }
+
+    return UTF_PATCH_OK;
+}
+
+static uint8_t utf_patch_parse_double(const char* value, double* out)
+{
+    char* end = NULL;
+    errno = 0;
+    *out = strtod(value, &end);
+
+    while(isspace((unsigned char)*end)) end += 1;
+
+    if((end == value) || (*end != '\0') || errno)
+    {
+        return UTF_PATCH_ERR_VALUE;
+    }
+
+    return UTF_PATCH_OK;
+}
+
+uint8_t utf_patch_write_value(UTF_PATCH_CELL* cell, const char* value)
+{
+    uint8_t bytes[8] = {0};
+    uint64_t u = 0;
+    int64_t s = 0;
+    double d = 0;
+    uint8_t status = UTF_PATCH_OK;
+
+    /* Encode once, then copy to every row */
+    switch(cell->type)
+    {
+        case UTF_COLUMN_TYPE_UINT8:
+            status = utf_patch_parse_uint(value, UINT8_MAX, &u);
+            tw_write_u8(u, bytes);
+            break;
+        case UTF_COLUMN_TYPE_SINT8:
+            status = utf_patch_parse_int(value, INT8_MIN, INT8_MAX, &s);
+            tw_write_u8((uint8_t)s, bytes);
+            break;
+        case UTF_COLUMN_TYPE_UINT16:
+            status = utf_patch_parse_uint(value, UINT16_MAX, &u);
+            tw_write_u16be(u, bytes);
+            break;
+        case UTF_COLUMN_TYPE_SINT16:
+            status = utf_patch_parse_int(value, INT16_MIN, INT16_MAX, &s);
+            tw_write_u16be((uint16_t)s, bytes);
+            break;
+        case UTF_COLUMN_TYPE_UINT32:
+            status = utf_patch_parse_uint(value, UINT32_MAX, &u);
+            tw_write_u32be(u, bytes);
+            break;
+        case UTF_COLUMN_TYPE_SINT32:
+            status = utf_patch_parse_int(value, INT32_MIN, INT32_MAX, &s);
+            tw_write_u32be((uint32_t)s, bytes);
+            break;
+        case UTF_COLUMN_TYPE_UINT64:
+            status = utf_patch_parse_uint(value, UINT64_MAX, &u);
+            tw_write_u64be(u, bytes);
+            break;
+        case UTF_COLUMN_TYPE_SINT64:
+            status = utf_patch_parse_int(value, INT64_MIN, INT64_MAX, &s);
+            tw_write_u64be((uint64_t)s, bytes);
+            break;
+        case UTF_COLUMN_TYPE_FLOAT:
+            status = utf_patch_parse_double(value, &d);
+            tw_write_f32be((float)d, bytes);
+            break;
+        case UTF_COLUMN_TYPE_DOUBLE:
+            status = utf_patch_parse_double(value, &d);
+            tw_write_f64be(d, bytes);
+            break;
+        default:
+            return UTF_PATCH_ERR_TYPE;
+    }
+
+    if(status != UTF_PATCH_OK)
+    {
+        return status;
+    }
+
+    const uint8_t type_size = utf_get_type_size(cell->type);
+
+    for(uint32_t i = 0; i != cell->count; ++i)
+    {
+        memcpy(&cell->ptr[(uint64_t)cell->stride*i], bytes, type_size);
+    }
+
+    return UTF_PATCH_OK;
+}
+
+uint8_t utf_patch_set(uint8_t* data, const uint64_t size,
+                      const char* path, const char* value)
+{
+    UTF_PATCH_CELL cell = {0};
+    const uint8_t status = utf_patch_find_cell(data, size, path, &cell);
+
+    if(status != UTF_PATCH_OK)
+    {
+        return status;
+    }
+
+    return utf_patch_write_value(&cell, value);
+}
+
+static char* utf_patch_trim(char* str)
+{
+    while(isspace((unsigned char)*str)) str += 1;
+
+    char* end = str + strlen(str);
+
+    while((end != str) && isspace((unsigned char)end[-1])) end -= 1;
+
+    *end = '\0';
+
+    return str;
+}
+
+int32_t utf_patch_apply_file(uint8_t* data, const uint64_t size, const char* patch_path,
+                             void (*on_error)(const uint32_t line, const char* text, const uint8_t status))
+{
+    FU_FILE* f = fu_open(patch_path, 1);
+
+    if(f == NULL)
+    {
+        return -1;
+    }
+
+    /* Null-terminated copy to cut into lines */
+    char* text = (char*)calloc(1, f->size + 1);
+    memcpy(text, f->buf, f->size);
+    fu_close(f);
+    free(f);
+
+    int32_t failed = 0;
+    uint32_t line_number = 0;
+    char* line = text;
+
+    while(line)
+    {
+        char* next = strchr(line, '\n');
+
+        if(next)
+        {
+            *next = '\0';
+            next += 1;
+        }
+
+        line_number += 1;
+
+        char* comment = strchr(line, '#');
+        if(comment) *comment = '\0';
+
+        char* stmt = utf_patch_trim(line);
+
+        if(*stmt != '\0')
+        {
+            char* eq = strchr(stmt, '=');
+            uint8_t status = UTF_PATCH_ERR_PATH;
+
+            if(eq)
+            {
+                *eq = '\0';
+                status = utf_patch_set(data, size, utf_patch_trim(stmt), utf_patch_trim(eq + 1));
+            }
+
+            if(status != UTF_PATCH_OK)
+            {
+                failed += 1;
+
+                if(on_error)
+                {
+                    on_error(line_number, stmt, status);
+                }
+            }
+        }
+
+        line = next;
+    }
+
+    free(text);
+
+    return failed;
+}
+
+const char* utf_patch_status_str(const uint8_t status)
+{
+    if(status > UTF_PATCH_ERR_FILE)
+    {
+        return "Unknown";
+    }
+
+    return UTF_PATCH_STATUS_STR[status];
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+/*
+    In-place editing of @UTF tables.
+
+    Fixed-width cells (integers, float and double) are overwritten
+    right in the binary, without loading or rebuilding the table.
+    Strings, VLDATA and UINT128 could change the layout and are refused.
+
+    A cell is addressed by a path of column[row] pairs separated by '/'.
+    Every pair but the last one has to be a VLDATA cell with an embedded @UTF table.
+    Last pair is the cell to change, row can be `*` for the whole column.
+
+        CueTable[0]/Volume[3]
+        Header[0]/WaveformTable[0]/LoopFlag[*]
+
+    Schema-constant columns share one value for all rows,
+    so they can only be changed as a whole column or in a table with a single row.
+
+    Patch files have one `path = value` per line, # starts a comment.
+*/
+
+#include <stdint.h>
+
+#define UTF_PATCH_OK                (uint8_t)(0)
+#define UTF_PATCH_ERR_PATH          (uint8_t)(1)    /* Malformed path */
+#define UTF_PATCH_ERR_TABLE         (uint8_t)(2)    /* No valid @UTF table */
+#define UTF_PATCH_ERR_COLUMN        (uint8_t)(3)    /* No such column */
+#define UTF_PATCH_ERR_ROW           (uint8_t)(4)    /* Row out of range */
+#define UTF_PATCH_ERR_TYPE          (uint8_t)(5)    /* Not a fixed-width type */
+#define UTF_PATCH_ERR_CONSTANT      (uint8_t)(6)    /* Single row of a schema-constant column */
+#define UTF_PATCH_ERR_VALUE         (uint8_t)(7)    /* Value can't be parsed or doesn't fit */
+#define UTF_PATCH_ERR_FILE          (uint8_t)(8)    /* Patch file can't be read */
+
+#define UTF_PATCH_ALL_ROWS          (uint32_t)(-1)
+
+/*
+    Location of a cell in the binary table.
+*/
+typedef struct
+{
+    uint8_t* ptr;           /* First value */
+    uint32_t stride;        /* Distance between values of consecutive rows */
+    uint32_t count;         /* Amount of values to write */
+    uint8_t type;           /* UTF_COLUMN_TYPE */
+} UTF_PATCH_CELL;
+
+/*
+    Finds the cell addressed by `path` in the table at `data`.
+
+    Returns UTF_PATCH_OK on success, UTF_PATCH_ERR_* otherwise.
+*/
+uint8_t utf_patch_find_cell(uint8_t* data, const uint64_t size,
+                            const char* path, UTF_PATCH_CELL* cell);
+
+/*
+    Parses `value` according to the cell type and writes it.
+    Integers can be decimal or hex (0x).
+
+    Returns UTF_PATCH_OK on success, UTF_PATCH_ERR_* otherwise.
+*/
+uint8_t utf_patch_write_value(UTF_PATCH_CELL* cell, const char* value);
+
+/*
+    utf_patch_find_cell() and utf_patch_write_value() in one go.
+
+    Returns UTF_PATCH_OK on success, UTF_PATCH_ERR_* otherwise.
+*/
+uint8_t utf_patch_set(uint8_t* data, const uint64_t size,
+                      const char* path, const char* value);
+
+/*
+    Applies every line of a patch file. Lines that fail are reported
+    through `on_error` (can be NULL) and skipped.
+
+    Returns the amount of failed lines; -1 if the file can't be read.
+*/
+int32_t utf_patch_apply_file(uint8_t* data, const uint64_t size, const char* patch_path,
+                             void (*on_error)(const uint32_t line, const char* text, const uint8_t status));
+
+/*
+    Returns a description of the status.
+*/
+const char* utf_patch_status_str(const uint8_t status);
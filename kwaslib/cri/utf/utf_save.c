@@ -4,11 +4,10 @@
 #include <stdlib.h>
 
 #include <kwaslib/core/io/string_utils.h>
+#include <kwaslib/core/io/type_writers.h>
 #include <kwaslib/core/math/boundary.h>
 
 #include "utf_common.h"
-#include "utf_string_table.h"
-#include "utf_data_table.h"
 
 #include <kwaslib/cri/acb/acb_command.h>
 
@@ -17,172 +16,260 @@ FU_FILE* utf_save_to_fu(UTF_TABLE* utf)
     FU_FILE* utf_fu = fu_alloc_file();
     fu_create_mem_file(utf_fu);
     
-    UTF_HEADER header = {0};
-    UTF_TABLE_HEADER table_header = {0};
-    SU_STRING* data_table = su_create_string("", 0);
-    SU_STRING* string_table = su_create_string("", 0);
+    UTF_SAVE_LAYOUT* layout = utf_save_calc_layout(utf);
     
-    /* Name for the table is first in the string_table */
-    table_header.name_offset = utf_add_str_to_table(string_table, utf->name->ptr, utf->name->size);
-    
-    const uint8_t utf_present = utf_check_for_utf_tables(utf);
-    const uint32_t columns_count = utf_table_get_column_count(utf);
-    const uint32_t rows_count = utf_table_get_row_count(utf);
-    CVEC schema = utf_generate_schema(utf, data_table, string_table, utf_present);
-    const uint32_t rows_width = utf_get_row_size(schema);
-    
-    FU_FILE* schema_fu = utf_schema_to_fu(schema);
-    FU_FILE* rows_fu = utf_rows_to_fu(utf, schema, string_table, data_table, utf_present);
-
-    /*const uint32_t data_shift = bound_calc_leftover(16,
-                                8 + UTF_TABLE_HEADER_SIZE +
-                                schema_fu->size +
-                                rows_width*rows_count +
-                                string_table->size);*/
-    
-    /* Update remaining table header fields */
-    table_header.version = 1;
-    table_header.rows_offset = UTF_TABLE_HEADER_SIZE + schema_fu->size;
-    table_header.string_table_offset = table_header.rows_offset + rows_width*rows_count;
-    table_header.columns_count = columns_count;
-    table_header.data_offset = table_header.string_table_offset + string_table->size;
-    if(utf_present) table_header.data_offset += bound_calc_leftover(32, 8+table_header.data_offset);
-    table_header.rows_width = rows_width;
-    table_header.rows_count = rows_count;
-    
-    /* Update the header */
-    memcpy(&header.id[0], UTF_MAGIC, 4);
-    header.table_size = table_header.data_offset + data_table->size;         
-    header.table_size += bound_calc_leftover(4, header.table_size);
-    fu_change_buf_size(utf_fu, header.table_size+8);
-    
-    /* Merge everything */
-    fu_write_data(utf_fu, (const uint8_t*)&header.id[0], 4);
-    fu_write_u32(utf_fu, header.table_size, FU_BIG_ENDIAN);
+    fu_change_buf_size(utf_fu, layout->header.table_size+8);
+    utf_save_write_layout(layout, (uint8_t*)utf_fu->buf);
     
-    fu_write_u16(utf_fu, table_header.version, FU_BIG_ENDIAN);
-    fu_write_u16(utf_fu, table_header.rows_offset, FU_BIG_ENDIAN);
-    fu_write_u32(utf_fu, table_header.string_table_offset, FU_BIG_ENDIAN);
-    fu_write_u32(utf_fu, table_header.data_offset, FU_BIG_ENDIAN);
-    fu_write_u32(utf_fu, table_header.name_offset, FU_BIG_ENDIAN);
-    fu_write_u16(utf_fu, table_header.columns_count, FU_BIG_ENDIAN);
-    fu_write_u16(utf_fu, table_header.rows_width, FU_BIG_ENDIAN);
-    fu_write_u32(utf_fu, table_header.rows_count, FU_BIG_ENDIAN);
-    
-    fu_write_data(utf_fu, (const uint8_t*)schema_fu->buf, schema_fu->size);
-    if(rows_width) fu_write_data(utf_fu, (const uint8_t*)rows_fu->buf, rows_fu->size);
-    
-    fu_seek(utf_fu, table_header.string_table_offset+8, FU_SEEK_SET);
-    fu_write_data(utf_fu, (const uint8_t*)string_table->ptr, string_table->size);
-    
-    fu_seek(utf_fu, table_header.data_offset+8, FU_SEEK_SET);
-    fu_write_data(utf_fu, (const uint8_t*)data_table->ptr, data_table->size);
-    
-    /* Cleanup */
-    fu_close(schema_fu);
-    free(schema_fu);
-    fu_close(rows_fu);
-    free(rows_fu);
-    schema = cvec_destroy(schema);
-    data_table = su_free(data_table);
-    string_table = su_free(string_table);
+    layout = utf_save_free_layout(layout);
     
     return utf_fu;
 }
 
-CVEC utf_generate_schema(UTF_TABLE* utf,
-                         SU_STRING* data_table,
-                         SU_STRING* string_table,
-                         const uint8_t utf_present)
+UTF_SAVE_LAYOUT* utf_save_calc_layout(UTF_TABLE* utf)
 {
+    UTF_SAVE_LAYOUT* layout = (UTF_SAVE_LAYOUT*)calloc(1, sizeof(UTF_SAVE_LAYOUT));
+    layout->utf = utf;
+    layout->utf_present = utf_check_for_utf_tables(utf);
+    layout->cells = cvec_create(sizeof(UTF_SAVE_CELL));
+    
     const uint32_t columns_count = utf_table_get_column_count(utf);
-    CVEC schema = cvec_create(sizeof(UTF_SCHEMA_ENTRY));
-    cvec_resize(schema, columns_count);
+    const uint32_t rows_count = utf_table_get_row_count(utf);
+    
+    /* Name for the table is first in the string_table */
+    layout->string_table_size = utf->name->size + 1;
+    
+    /* Schema entries have only the name offset, every column is stored in rows */
+    uint32_t rows_width = 0;
     
     for(uint32_t i = 0; i != columns_count; ++i)
     {
         UTF_COLUMN* col = utf_table_get_column_by_id(utf, i);
-        UTF_SCHEMA_ENTRY* se = (UTF_SCHEMA_ENTRY*)cvec_at(schema, i);
-        
-        /*
-            Crashes Sonic Frontiers??
-            TODO: Figure out why it crashes
-        */
-        /*const uint8_t are_rows_the_same = utf_column_rows_the_same(col);*/
-        const uint8_t are_rows_the_same = 0;
-        
-        se->desc.type = col->type;
-        se->desc.name = 1;
-        se->desc.schema = are_rows_the_same ? 1 : 0;
-        se->desc.row = are_rows_the_same ? 0 : 1;
-        
-        se->name_offset = utf_add_str_to_table(string_table, col->name->ptr, col->name->size);
+        layout->schema_size += 1 + 4;
+        layout->string_table_size += col->name->size + 1;
+        rows_width += utf_get_type_size(col->type);
+    }
     
-        /* Data is in schema */
-        if(se->desc.schema)
+    /* Strings and VL data in row order */
+    for(uint32_t row_it = 0; row_it != rows_count; ++row_it)
+    {
+        for(uint32_t column_it = 0; column_it != columns_count; ++column_it)
         {
-            UTF_ROW* first_row = utf_table_get_row_from_col_by_id(col, 0);
-            utf_table_row_to_record(first_row, &se->record, se->desc.type,
-                                    string_table, data_table, utf_present);
+            UTF_COLUMN* col = utf_table_get_column_by_id(utf, column_it);
+            UTF_ROW* row = utf_table_get_row_xy(utf, column_it, row_it);
+            
+            if(col->type == UTF_COLUMN_TYPE_STRING)
+            {
+                layout->string_table_size += row->data.str->size + 1;
+            }
+            else if(col->type == UTF_COLUMN_TYPE_VLDATA)
+            {
+                UTF_SAVE_CELL cell = {0};
+                
+                switch(row->embed_type)
+                {
+                    case UTF_TABLE_VL_NONE:
+                        cell.size = row->data.vl->size;
+                        break;
+                    case UTF_TABLE_VL_UTF:
+                        cell.utf = utf_save_calc_layout(row->embed.utf);
+                        cell.size = cell.utf->header.table_size + 8;
+                        break;
+                    case UTF_TABLE_VL_AFS2:
+                        cell.afs2 = row->embed.afs2;
+                        cell.size = awb_update(cell.afs2);
+                        break;
+                    case UTF_TABLE_VL_ACBCMD:
+                        cell.blob = acb_cmd_to_data(row->embed.acbcmd);
+                        cell.size = cell.blob->size;
+                        break;
+                }
+                
+                /* Same rules as utf_add_data_to_table() */
+                if(cell.size)
+                {
+                    cell.offset = layout->data_table_size;
+                    layout->data_table_size += cell.size;
+                    
+                    if(layout->utf_present)
+                    {
+                        layout->data_table_size += bound_calc_leftover(UTF_DATA_BLOCK_SIZE,
+                                                                       layout->data_table_size);
+                    }
+                }
+                
+                cvec_push_back(layout->cells, &cell);
+            }
         }
     }
     
-    return schema;
+    /* Table header */
+    UTF_TABLE_HEADER* th = &layout->table_header;
+    th->version = 1;
+    th->rows_offset = UTF_TABLE_HEADER_SIZE + layout->schema_size;
+    th->string_table_offset = th->rows_offset + rows_width*rows_count;
+    th->columns_count = columns_count;
+    th->data_offset = th->string_table_offset + layout->string_table_size;
+    if(layout->utf_present) th->data_offset += bound_calc_leftover(32, 8+th->data_offset);
+    th->rows_width = rows_width;
+    th->rows_count = rows_count;
+    th->name_offset = 0;
+    
+    /* Header */
+    memcpy(&layout->header.id[0], UTF_MAGIC, 4);
+    layout->header.table_size = th->data_offset + layout->data_table_size;
+    layout->header.table_size += bound_calc_leftover(4, layout->header.table_size);
+    
+    return layout;
 }
 
-FU_FILE* utf_schema_to_fu(CVEC schema)
+void utf_save_write_layout(UTF_SAVE_LAYOUT* layout, uint8_t* out)
 {
-    FU_FILE* schema_fu = fu_alloc_file();
-    fu_create_mem_file(schema_fu);
+    UTF_TABLE* utf = layout->utf;
+    UTF_TABLE_HEADER* th = &layout->table_header;
+    
+    const uint32_t columns_count = th->columns_count;
+    const uint32_t rows_count = th->rows_count;
+    
+    /* Header */
+    tw_write_array((const uint8_t*)&layout->header.id[0], 4, &out[0]);
+    tw_write_u32be(layout->header.table_size, &out[4]);
+    
+    /* Table header, offsets are relative to it */
+    uint8_t* table = &out[8];
+    tw_write_u16be(th->version, &table[0]);
+    tw_write_u16be(th->rows_offset, &table[2]);
+    tw_write_u32be(th->string_table_offset, &table[4]);
+    tw_write_u32be(th->data_offset, &table[8]);
+    tw_write_u32be(th->name_offset, &table[12]);
+    tw_write_u16be(th->columns_count, &table[16]);
+    tw_write_u16be(th->rows_width, &table[18]);
+    tw_write_u32be(th->rows_count, &table[20]);
     
-    for(uint32_t i = 0; i != cvec_size(schema); ++i)
+    uint8_t* string_table = &table[th->string_table_offset];
+    uint8_t* data_table = &table[th->data_offset];
+    uint32_t str_pos = 0;
+    
+    tw_write_array((const uint8_t*)utf->name->ptr, utf->name->size, &string_table[str_pos]);
+    str_pos += utf->name->size + 1;
+    
+    /* Schema */
+    uint8_t* schema = &table[UTF_TABLE_HEADER_SIZE];
+    
+    for(uint32_t i = 0; i != columns_count; ++i)
     {
-        UTF_SCHEMA_ENTRY* se = (UTF_SCHEMA_ENTRY*)cvec_at(schema, i);
-        
-        fu_write_u8(schema_fu, *(const uint8_t*)&se->desc);
+        UTF_COLUMN* col = utf_table_get_column_by_id(utf, i);
+        UTF_SCHEMA_DESC desc = {0};
+        desc.type = col->type;
+        desc.name = 1;
+        desc.row = 1;
         
-        if(se->desc.name)
-        {
-            fu_write_u32(schema_fu, se->name_offset, FU_BIG_ENDIAN);
-        }
+        schema[0] = *(const uint8_t*)&desc;
+        tw_write_u32be(str_pos, &schema[1]);
+        schema += 5;
         
-        if(se->desc.schema)
-        {
-            utf_write_record_to_fu(schema_fu, &se->record, se->desc.type);
-        }
+        tw_write_array((const uint8_t*)col->name->ptr, col->name->size, &string_table[str_pos]);
+        str_pos += col->name->size + 1;
     }
     
-    return schema_fu;
-}
-
-FU_FILE* utf_rows_to_fu(UTF_TABLE* utf, CVEC schema,
-                        SU_STRING* string_table, SU_STRING* data_table,
-                        const uint8_t utf_present)
-{
-    FU_FILE* rows_fu = fu_alloc_file();
-    fu_create_mem_file(rows_fu);
-
-    const uint32_t columns_count = utf_table_get_column_count(utf);
-    const uint32_t rows_count = utf_table_get_row_count(utf);
+    /* Rows with strings and data */
+    uint8_t* rows = &table[th->rows_offset];
+    uint32_t cell_it = 0;
     
     for(uint32_t row_it = 0; row_it != rows_count; ++row_it)
     {
         for(uint32_t column_it = 0; column_it != columns_count; ++column_it)
         {
-            UTF_SCHEMA_ENTRY* se = (UTF_SCHEMA_ENTRY*)cvec_at(schema, column_it);
-            const uint8_t type = se->desc.type;
-
-            if(se->desc.row)
+            UTF_COLUMN* col = utf_table_get_column_by_id(utf, column_it);
+            UTF_ROW* row = utf_table_get_row_xy(utf, column_it, row_it);
+            
+            switch(col->type)
             {
-                UTF_ROW* row = utf_table_get_row_xy(utf, column_it, row_it);
-                UTF_RECORD record = {0};
-                utf_table_row_to_record(row, &record, type, string_table, data_table, utf_present);
-                utf_write_record_to_fu(rows_fu, &record, type);
+                case UTF_COLUMN_TYPE_UINT8:
+                case UTF_COLUMN_TYPE_SINT8:
+                    tw_write_u8(row->data.u8, rows);
+                    break;
+                case UTF_COLUMN_TYPE_UINT16:
+                case UTF_COLUMN_TYPE_SINT16:
+                    tw_write_u16be(row->data.u16, rows);
+                    break;
+                case UTF_COLUMN_TYPE_UINT32:
+                case UTF_COLUMN_TYPE_SINT32:
+                    tw_write_u32be(row->data.u32, rows);
+                    break;
+                case UTF_COLUMN_TYPE_UINT64:
+                case UTF_COLUMN_TYPE_SINT64:
+                    tw_write_u64be(row->data.u64, rows);
+                    break;
+                case UTF_COLUMN_TYPE_FLOAT:
+                    tw_write_f32be(row->data.f32, rows);
+                    break;
+                case UTF_COLUMN_TYPE_DOUBLE:
+                    tw_write_f64be(row->data.f64, rows);
+                    break;
+                case UTF_COLUMN_TYPE_STRING:
+                    tw_write_u32be(str_pos, rows);
+                    tw_write_array((const uint8_t*)row->data.str->ptr, row->data.str->size,
+                                   &string_table[str_pos]);
+                    str_pos += row->data.str->size + 1;
+                    break;
+                case UTF_COLUMN_TYPE_VLDATA:
+                    UTF_SAVE_CELL* cell = (UTF_SAVE_CELL*)cvec_at(layout->cells, cell_it);
+                    cell_it += 1;
+                    
+                    tw_write_u32be(cell->offset, &rows[0]);
+                    tw_write_u32be(cell->size, &rows[4]);
+                    
+                    if(cell->size == 0)
+                    {
+                        break;
+                    }
+                    
+                    if(cell->utf)
+                    {
+                        utf_save_write_layout(cell->utf, &data_table[cell->offset]);
+                    }
+                    else if(cell->afs2)
+                    {
+                        awb_write_to_data(cell->afs2, cell->size, &data_table[cell->offset]);
+                    }
+                    else if(cell->blob)
+                    {
+                        tw_write_array((const uint8_t*)cell->blob->ptr, cell->size,
+                                       &data_table[cell->offset]);
+                    }
+                    else
+                    {
+                        tw_write_array((const uint8_t*)row->data.vl->ptr, cell->size,
+                                       &data_table[cell->offset]);
+                    }
+                    break;
+                case UTF_COLUMN_TYPE_UINT128:
+                    tw_write_array(&row->data.u128[0], 16, rows);
+                    break;
             }
+            
+            rows += utf_get_type_size(col->type);
         }
     }
+}
+
+UTF_SAVE_LAYOUT* utf_save_free_layout(UTF_SAVE_LAYOUT* layout)
+{
+    if(layout)
+    {
+        for(uint32_t i = 0; i != cvec_size(layout->cells); ++i)
+        {
+            UTF_SAVE_CELL* cell = (UTF_SAVE_CELL*)cvec_at(layout->cells, i);
+            cell->utf = utf_save_free_layout(cell->utf);
+            if(cell->blob) cell->blob = su_free(cell->blob);
+        }
+        
+        layout->cells = cvec_destroy(layout->cells);
+        free(layout);
+    }
     
-    return rows_fu;
+    return NULL;
 }
 
 const uint8_t utf_column_rows_the_same(UTF_COLUMN* col)
@@ -278,139 +365,6 @@ const uint8_t utf_column_rows_the_same(UTF_COLUMN* col)
     return the_same;
 }
 
-void utf_table_row_to_record(UTF_ROW* row, UTF_RECORD* record, const uint8_t type,
-                             SU_STRING* string_table, SU_STRING* data_table,
-                             const uint8_t utf_present)
-{
-    switch(type)
-    {
-        case UTF_COLUMN_TYPE_UINT8:
-        case UTF_COLUMN_TYPE_SINT8:
-            record->u8 = row->data.u8;
-            break;    
-        case UTF_COLUMN_TYPE_UINT16:
-        case UTF_COLUMN_TYPE_SINT16:
-            record->u16 = row->data.u16;
-            break;
-        case UTF_COLUMN_TYPE_UINT32:
-        case UTF_COLUMN_TYPE_SINT32:
-            record->u32 = row->data.u32;
-            break;
-        case UTF_COLUMN_TYPE_UINT64:
-        case UTF_COLUMN_TYPE_SINT64:
-            record->u64 = row->data.u64;
-            break;
-        case UTF_COLUMN_TYPE_FLOAT:
-            record->f32 = row->data.f32;
-            break;
-        case UTF_COLUMN_TYPE_DOUBLE:
-            record->f64 = row->data.f64;
-            break;
-        case UTF_COLUMN_TYPE_STRING:
-            record->str_offset = utf_add_str_to_table(string_table,
-                                                      &row->data.str->ptr[0],
-                                                      row->data.str->size);
-            break;
-        case UTF_COLUMN_TYPE_VLDATA:
-            switch(row->embed_type)
-            {
-                case UTF_TABLE_VL_NONE:
-                    record->vl.offset = utf_add_data_to_table(data_table,
-                                        (const uint8_t*)&row->data.vl->ptr[0],
-                                        row->data.vl->size, utf_present);
-                    record->vl.size = row->data.vl->size;
-                    break;
-                case UTF_TABLE_VL_UTF:
-                    FU_FILE* utf_fu = utf_save_to_fu(row->embed.utf);
-                    record->vl.offset = utf_add_data_to_table(data_table,
-                                        (const uint8_t*)utf_fu->buf,
-                                        utf_fu->size, utf_present);
-                    record->vl.size = utf_fu->size;
-                    fu_close(utf_fu);
-                    free(utf_fu);
-                    break;
-                case UTF_TABLE_VL_AFS2:
-                    SU_STRING* afs2_str = awb_to_data(row->embed.afs2);
-                    record->vl.offset = utf_add_data_to_table(data_table,
-                                        (const uint8_t*)afs2_str->ptr,
-                                        afs2_str->size, utf_present);
-                    record->vl.size = afs2_str->size;
-                    afs2_str = su_free(afs2_str);
-                    break;
-                case UTF_TABLE_VL_ACBCMD:
-                    SU_STRING* acbcmd_str = acb_cmd_to_data(row->embed.acbcmd);
-                    record->vl.offset = utf_add_data_to_table(data_table,
-                                        (const uint8_t*)acbcmd_str->ptr,
-                                        acbcmd_str->size, utf_present);
-                    record->vl.size = acbcmd_str->size;
-                    acbcmd_str = su_free(acbcmd_str);
-                    break;
-            }
-
-            break;
-        case UTF_COLUMN_TYPE_UINT128:
-            memcpy(&record->u128[0], &row->data.u128[0], 16);
-            break;
-    }
-}
-
-void utf_write_record_to_fu(FU_FILE* fu, UTF_RECORD* record, const uint8_t type)
-{
-    switch(type)
-    {
-        case UTF_COLUMN_TYPE_UINT8:
-        case UTF_COLUMN_TYPE_SINT8:
-            fu_write_u8(fu, record->u8);
-            break;    
-        case UTF_COLUMN_TYPE_UINT16:
-        case UTF_COLUMN_TYPE_SINT16:
-            fu_write_u16(fu, record->u16, FU_BIG_ENDIAN);
-            break;
-        case UTF_COLUMN_TYPE_UINT32:
-        case UTF_COLUMN_TYPE_SINT32:
-            fu_write_u32(fu, record->u32, FU_BIG_ENDIAN);
-            break;
-        case UTF_COLUMN_TYPE_UINT64:
-        case UTF_COLUMN_TYPE_SINT64:
-            fu_write_u64(fu, record->u64, FU_BIG_ENDIAN);
-            break;
-        case UTF_COLUMN_TYPE_FLOAT:
-            fu_write_f32(fu, record->f32, FU_BIG_ENDIAN);
-            break;
-        case UTF_COLUMN_TYPE_DOUBLE:
-            fu_write_f64(fu, record->f64, FU_BIG_ENDIAN);
-            break;
-        case UTF_COLUMN_TYPE_STRING:
-            fu_write_u32(fu, record->str_offset, FU_BIG_ENDIAN);
-            break;
-        case UTF_COLUMN_TYPE_VLDATA:
-            fu_write_u32(fu, record->vl.offset, FU_BIG_ENDIAN);
-            fu_write_u32(fu, record->vl.size, FU_BIG_ENDIAN);
-            break;
-        case UTF_COLUMN_TYPE_UINT128:
-            fu_write_data(fu, &record->u128[0], 16);
-            break;
-    }
-}
-
-const uint32_t utf_get_row_size(CVEC schema)
-{
-    uint32_t rows_width = 0;
-    const uint32_t schema_size = cvec_size(schema);
-    
-    for(uint32_t i = 0; i != schema_size; ++i)
-    {
-        UTF_SCHEMA_ENTRY* se = (UTF_SCHEMA_ENTRY*)cvec_at(schema, i);
-
-        if(se->desc.row)
-        {
-            rows_width += utf_get_type_size(se->desc.type);
-        }
-    }
-    
-    return rows_width;
-}
-
 const uint8_t utf_check_for_utf_tables(UTF_TABLE* utf)
 {
     const uint32_t columns_count = utf_table_get_column_count(utf);
@@ -8,50 +8,71 @@
 #include "utf_defines.h"
 #include "utf_table.h"
 
+/*
+    Serializes the table in two passes.
+    First the sizes and offsets of every (nested) table are calculated,
+    then everything is written once into a single preallocated buffer.
+    
+    Returns a memory file with the @UTF table.
+*/
 FU_FILE* utf_save_to_fu(UTF_TABLE* utf);
 
 /*
-    Returns a cvector of UTF_SCHEMA_ENTRY
+    Layout of a VL cell in the data table.
+    Nested @UTF tables have their own layout and AFS2 has its offsets
+    calculated up front, both are written in place.
+    ACB commands are serialized in the size pass and kept in `blob`.
 */
-CVEC utf_generate_schema(UTF_TABLE* utf,
-                         SU_STRING* data_table,
-                         SU_STRING* string_table,
-                         const uint8_t utf_present);
-                         
+typedef struct UTF_SAVE_LAYOUT UTF_SAVE_LAYOUT;
 
-FU_FILE* utf_schema_to_fu(CVEC schema);
+typedef struct
+{
+    uint32_t offset;
+    uint32_t size;
+    UTF_SAVE_LAYOUT* utf;
+    AWB_FILE* afs2;
+    SU_STRING* blob;
+} UTF_SAVE_CELL;
 
-/*
-    Returns a memory file with generated rows section.
-*/
-FU_FILE* utf_rows_to_fu(UTF_TABLE* utf, CVEC schema,
-                        SU_STRING* string_table, SU_STRING* data_table,
-                        const uint8_t utf_present);
+struct UTF_SAVE_LAYOUT
+{
+    UTF_TABLE* utf;
+    uint8_t utf_present;
+    UTF_HEADER header;
+    UTF_TABLE_HEADER table_header;
+    uint32_t schema_size;
+    uint32_t string_table_size;
+    uint32_t data_table_size;
+    CVEC cells; /* UTF_SAVE_CELL, VL cells in row order */
+};
 
 /*
-    For inserting data into schema.
+    Calculates sizes and offsets of the table and all nested tables.
     
-    Returns 1 if data in all rows is the same.
-    Otherwise 0.
+    Returns a pointer to the allocated layout.
 */
-const uint8_t utf_column_rows_the_same(UTF_COLUMN* col);
+UTF_SAVE_LAYOUT* utf_save_calc_layout(UTF_TABLE* utf);
 
 /*
-
+    Writes the table described by `layout` to `out`.
+    `out` has to be zeroed and at least header.table_size+8 bytes long.
 */
-void utf_table_row_to_record(UTF_ROW* row, UTF_RECORD* record, const uint8_t type,
-                             SU_STRING* string_table, SU_STRING* data_table,
-                             const uint8_t utf_present);
+void utf_save_write_layout(UTF_SAVE_LAYOUT* layout, uint8_t* out);
 
 /*
-
-*/                          
-void utf_write_record_to_fu(FU_FILE* fu, UTF_RECORD* record, const uint8_t type);
+    Frees the layout with all nested layouts.
+    
+    Returns NULL.
+*/
+UTF_SAVE_LAYOUT* utf_save_free_layout(UTF_SAVE_LAYOUT* layout);
 
 /*
+    For inserting data into schema.
     
+    Returns 1 if data in all rows is the same.
+    Otherwise 0.
 */
-const uint32_t utf_get_row_size(CVEC schema);
+const uint8_t utf_column_rows_the_same(UTF_COLUMN* col);
 
 /*
     Returns true if the UTF table has any internal UTF tables
@@ -166,6 +166,23 @@ UTF_COLUMN* utf_table_get_column_by_id(UTF_TABLE* utf, const uint32_t id)
     return (UTF_COLUMN*)cvec_at(utf->columns, id);
 }
 
+UTF_COLUMN* utf_table_get_column_by_name(UTF_TABLE* utf, const char* name)
+{
+    const uint32_t name_size = strlen(name);
+
+    for(uint32_t i = 0; i != utf_table_get_column_count(utf); ++i)
+    {
+        UTF_COLUMN* col = utf_table_get_column_by_id(utf, i);
+
+        if(su_cmp_string_char(col->name, name, name_size) == SU_STRINGS_MATCH)
+        {
+            return col;
+        }
+    }
+
+    return NULL;
+}
+
 UTF_ROW* utf_table_get_row_xy(UTF_TABLE* utf, const uint32_t x, const uint32_t y)
 {
     UTF_COLUMN* col = utf_table_get_column_by_id(utf, x);
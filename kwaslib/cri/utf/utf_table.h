@@ -116,6 +116,13 @@ void utf_table_free_row_data(UTF_ROW* row, const uint8_t column_type);
 */
 UTF_COLUMN* utf_table_get_column_by_id(UTF_TABLE* utf, const uint32_t id);
 
+/*
+    Gets a column by its name from a table.
+
+    Returns a pointer to a column, NULL if there's no such column.
+*/
+UTF_COLUMN* utf_table_get_column_by_name(UTF_TABLE* utf, const char* name);
+
 /*
     Gets a row by axis.
     
@@ -0,0 +1,178 @@
+#include "bcwav.h"
+
+#include <stdlib.h>
+
+BCWAV_DECODER* bcwav_decoder_open(const uint8_t* data, const uint32_t size)
+{
+    const BCWAV_HEADER h = bcwav_read_header_from_data(data, size);
+    
+    if((h.header_size == 0) || (h.byte_order != 0xFEFF)
+       || ((uint64_t)h.info_block_offset + 0x20 > size)
+       || ((uint64_t)h.data_block_offset + 8 > size))
+    {
+        return NULL;
+    }
+    
+    const uint8_t* info = &data[h.info_block_offset];
+    const uint8_t* samples = &data[h.data_block_offset + 8];
+    const uint64_t samples_size = size - (h.data_block_offset + 8);
+    
+    if(memcmp(info, "INFO", 4) != 0)
+    {
+        return NULL;
+    }
+    
+    const uint8_t encoding = info[8];
+    const uint32_t sample_rate = tr_read_u32le(&info[12]);
+    const uint32_t sample_count = tr_read_u32le(&info[20]);
+    const uint32_t channel_count = tr_read_u32le(&info[28]);
+    
+    /* Channel references are relative to the count */
+    const uint8_t* refs = &info[28];
+    
+    if((encoding > BCWAV_ENC_DSP_ADPCM) || (channel_count == 0) || (channel_count > 0xFF)
+       || ((uint64_t)(refs - data) + 4 + channel_count*8 > size))
+    {
+        return NULL;
+    }
+    
+    /* Bytes a channel takes */
+    uint64_t channel_size = 0;
+    
+    switch(encoding)
+    {
+        case BCWAV_ENC_PCM8:
+            channel_size = sample_count;
+            break;
+        case BCWAV_ENC_PCM16:
+            channel_size = (uint64_t)sample_count*2;
+            break;
+        case BCWAV_ENC_DSP_ADPCM:
+            channel_size = (((uint64_t)sample_count + BCWAV_DSP_FRAME_SAMPLES - 1)/BCWAV_DSP_FRAME_SAMPLES)*BCWAV_DSP_FRAME_SIZE;
+            break;
+    }
+    
+    BCWAV_DECODER* dec = (BCWAV_DECODER*)calloc(1, sizeof(BCWAV_DECODER));
+    dec->encoding = encoding;
+    dec->channel_count = channel_count;
+    dec->sample_rate = sample_rate;
+    dec->sample_count = sample_count;
+    dec->channels = (BCWAV_CHANNEL*)calloc(channel_count, sizeof(BCWAV_CHANNEL));
+    
+    for(uint32_t c = 0; c != channel_count; ++c)
+    {
+        const uint64_t ch_pos = (uint64_t)(refs - data) + tr_read_u32le(&refs[4 + c*8 + 4]);
+        
+        if(ch_pos + 20 > size)
+        {
+            return bcwav_decoder_close(dec);
+        }
+        
+        const uint8_t* ch_info = &data[ch_pos];
+        const uint32_t sample_offset = tr_read_u32le(&ch_info[4]);
+        
+        if((uint64_t)sample_offset + channel_size > samples_size)
+        {
+            return bcwav_decoder_close(dec);
+        }
+        
+        BCWAV_CHANNEL* ch = &dec->channels[c];
+        ch->data = &samples[sample_offset];
+        
+        if(encoding == BCWAV_ENC_DSP_ADPCM)
+        {
+            /* Coefficients, then predictor/scale and history */
+            const uint64_t adpcm_pos = ch_pos + tr_read_u32le(&ch_info[12]);
+            
+            if(adpcm_pos + 38 > size)
+            {
+                return bcwav_decoder_close(dec);
+            }
+            
+            for(uint32_t i = 0; i != 16; ++i)
+            {
+                ch->coefs[i] = tr_read_u16le(&data[adpcm_pos + i*2]);
+            }
+            
+            ch->hist1 = (int16_t)tr_read_u16le(&data[adpcm_pos + 34]);
+            ch->hist2 = (int16_t)tr_read_u16le(&data[adpcm_pos + 36]);
+        }
+    }
+    
+    return dec;
+}
+
+BCWAV_DECODER* bcwav_decoder_close(BCWAV_DECODER* dec)
+{
+    if(dec)
+    {
+        free(dec->channels);
+        free(dec);
+    }
+    
+    return NULL;
+}
+
+static int16_t bcwav_decode_dsp(BCWAV_CHANNEL* ch, const uint32_t pos)
+{
+    const uint32_t in_frame = pos%BCWAV_DSP_FRAME_SAMPLES;
+    const uint8_t* frame = &ch->data[(pos/BCWAV_DSP_FRAME_SAMPLES)*BCWAV_DSP_FRAME_SIZE];
+    
+    if(in_frame == 0)
+    {
+        ch->pred_scale = frame[0];
+    }
+    
+    const uint8_t byte = frame[1 + in_frame/2];
+    const int32_t nibble = (in_frame & 1) ? ((int8_t)(byte << 4) >> 4) : ((int8_t)byte >> 4);
+    const int32_t pred = (ch->pred_scale >> 4) & 7;
+    const int32_t scale = 1 << (ch->pred_scale & 0xF);
+    
+    int32_t y = ((nibble*scale) << 11) + 1024 + ch->coefs[pred*2]*ch->hist1 + ch->coefs[pred*2 + 1]*ch->hist2;
+    y >>= 11;
+    
+    if(y > 32767) y = 32767;
+    if(y < -32768) y = -32768;
+    
+    ch->hist2 = ch->hist1;
+    ch->hist1 = y;
+    
+    return y;
+}
+
+uint32_t bcwav_decode(BCWAV_DECODER* dec, int16_t* pcm, const uint32_t max_samples)
+{
+    uint32_t count = dec->sample_count - dec->position;
+    if(count > max_samples) count = max_samples;
+    
+    for(uint32_t c = 0; c != dec->channel_count; ++c)
+    {
+        BCWAV_CHANNEL* ch = &dec->channels[c];
+        int16_t* out = &pcm[c];
+        
+        for(uint32_t i = 0; i != count; ++i)
+        {
+            const uint32_t pos = dec->position + i;
+            int16_t y = 0;
+            
+            switch(dec->encoding)
+            {
+                case BCWAV_ENC_PCM8:
+                    y = (int16_t)((int8_t)ch->data[pos] << 8);
+                    break;
+                case BCWAV_ENC_PCM16:
+                    y = (int16_t)tr_read_u16le(&ch->data[pos*2]);
+                    break;
+                case BCWAV_ENC_DSP_ADPCM:
+                    y = bcwav_decode_dsp(ch, pos);
+                    break;
+            }
+            
+            out[i*dec->channel_count] = y;
+        }
+    }
+    
+    dec->position += count;
+    
+    return count;
+}
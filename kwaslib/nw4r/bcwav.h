@@ -3,6 +3,7 @@
 #include <stdint.h>
 #include <string.h>
 
+#include <kwaslib/core/io/string_utils.h>
 #include <kwaslib/core/io/type_readers.h>
 
 /*
@@ -15,6 +16,15 @@
 #define BCWAV_MAGIC         (const char*)"CWAV"
 #define BCWAV_HEADER_SIZE   (uint16_t)(0x40)
 
+/* INFO block encoding */
+#define BCWAV_ENC_PCM8      (uint8_t)(0)
+#define BCWAV_ENC_PCM16     (uint8_t)(1)
+#define BCWAV_ENC_DSP_ADPCM (uint8_t)(2)
+#define BCWAV_ENC_IMA_ADPCM (uint8_t)(3)
+
+#define BCWAV_DSP_FRAME_SIZE    (uint8_t)(8)
+#define BCWAV_DSP_FRAME_SAMPLES (uint8_t)(14)
+
 /*
     Types
 */
@@ -40,9 +50,54 @@ typedef struct
     uint8_t padding[0x14];      /* To 32-byte boundary */
 } BCWAV_HEADER;
 
+/*
+    Streaming decoder state, see bcwav_decoder_open().
+*/
+typedef struct
+{
+    const uint8_t* data;        /* Sample data of the channel */
+    int16_t coefs[16];          /* DSP ADPCM only */
+    int32_t hist1;
+    int32_t hist2;
+    uint8_t pred_scale;
+} BCWAV_CHANNEL;
+
+typedef struct
+{
+    uint8_t encoding;           /* BCWAV_ENC_* */
+    uint8_t channel_count;
+    uint32_t sample_rate;
+    uint32_t sample_count;      /* Per channel */
+    uint32_t position;          /* Samples per channel decoded so far */
+    BCWAV_CHANNEL* channels;
+} BCWAV_DECODER;
+
 /*
     Functions
 */
+
+/*
+    Sets up decoding of the CWAV at `data` without copying it.
+    PCM8, PCM16 and DSP ADPCM are supported.
+    
+    Returns the decoder, NULL if the file is broken or the encoding isn't supported.
+*/
+BCWAV_DECODER* bcwav_decoder_open(const uint8_t* data, const uint32_t size);
+
+/*
+    Frees the decoder, the data given to bcwav_decoder_open() stays as it is.
+    
+    Returns NULL.
+*/
+BCWAV_DECODER* bcwav_decoder_close(BCWAV_DECODER* dec);
+
+/*
+    Decodes up to `max_samples` per channel into `pcm` as interleaved 16-bit samples.
+    
+    Returns the amount of samples per channel written, 0 at the end.
+*/
+uint32_t bcwav_decode(BCWAV_DECODER* dec, int16_t* pcm, const uint32_t max_samples);
+
 static inline const BCWAV_HEADER bcwav_read_header_from_data(const uint8_t* data, const uint32_t size)
 {
     BCWAV_HEADER h = {0};
@@ -93,6 +93,24 @@ DAT_FILE* dat_parse_file(FU_FILE* file)
 }
 
 FU_FILE* dat_to_fu_file(DAT_FILE* dat, const uint32_t block_size, const uint8_t endian)
+{
+    FU_FILE* file = dat_header_to_fu_file(dat, endian);
+    
+    const uint64_t file_size = dat_get_file_size(dat, block_size);
+    fu_change_buf_size(file, file_size);
+    
+    /* Write file data */
+    for(uint32_t i = 0; i != dat->header.file_count; ++i)
+    {
+        DAT_FILE_ENTRY* entry = dat_get_entry_by_id(dat->entries, i);
+        fu_seek(file, entry->position, FU_SEEK_SET);
+        fu_write_data(file, entry->data, entry->size);
+    }
+    
+    return file;
+}
+
+FU_FILE* dat_header_to_fu_file(DAT_FILE* dat, const uint8_t endian)
 {
     FU_FILE* file = fu_alloc_file();
     fu_create_mem_file(file);
@@ -115,7 +133,6 @@ FU_FILE* dat_to_fu_file(DAT_FILE* dat, const uint32_t block_size, const uint8_t
     {
         DAT_FILE_ENTRY* entry = dat_get_entry_by_id(dat->entries, i);
         fu_write_u32(file, entry->position, endian);
-        fu_change_buf_size(file, entry->position);
     }
     
 	/* Write extensions */
@@ -152,18 +169,29 @@ FU_FILE* dat_to_fu_file(DAT_FILE* dat, const uint32_t block_size, const uint8_t
     FU_FILE* fht = dat_hash_to_fu_file(dat->hashtable, endian);
     fu_write_data(file, (uint8_t*)fht->buf, fht->size);
     fu_close(fht);
+    free(fht);
+    
+    return file;
+}
+
+const uint64_t dat_get_file_size(DAT_FILE* dat, const uint32_t block_size)
+{
+    uint64_t file_size = dat->header.hashtable_offset
+                         + 4*4
+                         + (cvec_size(dat->hashtable->bucket)*2)
+                         + (cvec_size(dat->hashtable->entries)*6);
     
-    /* Write file data */
     for(uint32_t i = 0; i != dat->header.file_count; ++i)
     {
         DAT_FILE_ENTRY* entry = dat_get_entry_by_id(dat->entries, i);
-        fu_seek(file, entry->position, FU_SEEK_SET);
-        fu_write_data(file, entry->data, entry->size);
+        
+        if((entry->position + entry->size) > file_size)
+        {
+            file_size = entry->position + entry->size;
+        }
     }
     
-    fu_add_to_buf_size(file, bound_calc_leftover(block_size, file->size));
-    
-    return file;
+    return file_size + bound_calc_leftover(block_size, file_size);
 }
 
 void dat_update(DAT_FILE* dat, const uint32_t block_size)
@@ -213,6 +241,24 @@ void dat_append_entry(CVEC entries,
                       const char* name,
                       const uint32_t size,
                       const uint8_t* data)
+{
+    uint8_t* copy = NULL;
+    
+    /* Entries without data are written from an RF_SOURCE */
+    if(data)
+    {
+        copy = (uint8_t*)calloc(1, size);
+        memcpy(copy, data, size);
+    }
+    
+    dat_append_entry_owned(entries, extension, name, size, copy);
+}
+
+void dat_append_entry_owned(CVEC entries,
+                            const char* extension,
+                            const char* name,
+                            const uint32_t size,
+                            uint8_t* data)
 {
     DAT_FILE_ENTRY entry = {0};
     
@@ -222,9 +268,7 @@ void dat_append_entry(CVEC entries,
     memcpy(&entry.extension[0], extension, ext_size);
     entry.name = su_create_string(name, name_size);
     entry.size = size;
-    
-    entry.data = (uint8_t*)calloc(1, size);
-    memcpy(entry.data, data, size);
+    entry.data = data;
     
     cvec_push_back(entries, &entry);
 }
@@ -3,6 +3,7 @@
 #include <stdint.h>
 
 #include <kwaslib/core/io/file_utils.h>
+#include <kwaslib/core/io/raw_file.h>
 #include <kwaslib/core/io/dir_list.h>
 #include <kwaslib/core/data/cvector.h>
 
@@ -61,14 +62,40 @@ struct DAT_FILE
 DAT_FILE* dat_parse_file(FU_FILE* file);
 FU_FILE* dat_to_fu_file(DAT_FILE* dat, const uint32_t block_size, const uint8_t endian);
 
+/*
+    Writes the header and all tables up to the end of the hashtable.
+    
+    Returns a memory file.
+*/
+FU_FILE* dat_header_to_fu_file(DAT_FILE* dat, const uint8_t endian);
+
+/*
+    Returns the size of the whole DAT file, padded to block_size.
+*/
+const uint64_t dat_get_file_size(DAT_FILE* dat, const uint32_t block_size);
+
 void dat_update(DAT_FILE* dat, const uint32_t block_size);
 
+/*
+    Appends an entry with a copy of `data`.
+    If `data` is NULL only the size is stored.
+*/
 void dat_append_entry(CVEC entries,
                       const char* extension,
                       const char* name,
                       const uint32_t size,
                       const uint8_t* data);
 
+/*
+    Same as dat_append_entry(), but the entry takes over `data`
+    instead of copying it. It's freed by dat_destroy().
+*/
+void dat_append_entry_owned(CVEC entries,
+                            const char* extension,
+                            const char* name,
+                            const uint32_t size,
+                            uint8_t* data);
+
 DAT_FILE* dat_alloc_dat();
 DAT_FILE* dat_destroy(DAT_FILE* dat);
 
@@ -0,0 +1,378 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+
+#include <kwaslib/core/io/type_readers.h>
+#include <kwaslib/core/io/type_writers.h>
+
+#include "dat_toc.h"
+
+static uint32_t dat_toc_read_u32(const uint8_t* data, const uint8_t endian)
+{
+    return endian == FU_BIG_ENDIAN ? tr_read_u32be(data) : tr_read_u32le(data);
+}
+
+static uint16_t dat_toc_read_u16(const uint8_t* data, const uint8_t endian)
+{
+    return endian == FU_BIG_ENDIAN ? tr_read_u16be(data) : tr_read_u16le(data);
+}
+
+static uint64_t dat_toc_max(const uint64_t a, const uint64_t b)
+{
+    return a > b ? a : b;
+}
+
+/*
+    Reads [0, end) of the file into toc->data if it isn't there yet.
+*/
+static uint8_t dat_toc_read_up_to(DAT_TOC* toc, uint64_t* data_size, const uint64_t end)
+{
+    if(end > toc->file->size)
+    {
+        return FU_ERROR;
+    }
+
+    if(end <= *data_size)
+    {
+        return FU_SUCCESS;
+    }
+
+    toc->data = (uint8_t*)realloc(toc->data, end);
+
+    if(rf_pread(toc->file, &toc->data[*data_size], end - *data_size, *data_size) != FU_SUCCESS)
+    {
+        return FU_ERROR;
+    }
+
+    *data_size = end;
+
+    return FU_SUCCESS;
+}
+
+static uint8_t dat_toc_parse(DAT_TOC* toc)
+{
+    uint64_t data_size = 0;
+
+    if(dat_toc_read_up_to(toc, &data_size, DAT_HEADER_SIZE) != FU_SUCCESS)
+    {
+        return FU_ERROR;
+    }
+
+    if(memcmp(toc->data, DAT_MAGIC, 4) != 0)
+    {
+        return FU_ERROR;
+    }
+
+    DAT_HEADER* h = &toc->header;
+    memcpy(&h->magic[0], toc->data, 4);
+    toc->endian = dat_check_endian(tr_read_u32le(&toc->data[4]));
+    h->file_count = dat_toc_read_u32(&toc->data[4], toc->endian);
+    h->positions_offset = dat_toc_read_u32(&toc->data[8], toc->endian);
+    h->extensions_offset = dat_toc_read_u32(&toc->data[12], toc->endian);
+    h->names_offset = dat_toc_read_u32(&toc->data[16], toc->endian);
+    h->sizes_offset = dat_toc_read_u32(&toc->data[20], toc->endian);
+    h->hashtable_offset = dat_toc_read_u32(&toc->data[24], toc->endian);
+    h->unk1C = dat_toc_read_u32(&toc->data[28], toc->endian);
+
+    const uint64_t count = h->file_count;
+
+    /* Fixed-size tables first, then what their contents point to */
+    uint64_t end = DAT_HEADER_SIZE;
+    end = dat_toc_max(end, (uint64_t)h->positions_offset + count*4);
+    end = dat_toc_max(end, (uint64_t)h->extensions_offset + count*4);
+    end = dat_toc_max(end, (uint64_t)h->sizes_offset + count*4);
+    end = dat_toc_max(end, (uint64_t)h->names_offset + 4);
+
+    if(h->hashtable_offset)
+    {
+        end = dat_toc_max(end, (uint64_t)h->hashtable_offset + DAT_HASH_HEADER_SIZE);
+    }
+
+    if(dat_toc_read_up_to(toc, &data_size, end) != FU_SUCCESS)
+    {
+        return FU_ERROR;
+    }
+
+    toc->entry_name_size = dat_toc_read_u32(&toc->data[h->names_offset], toc->endian);
+    end = dat_toc_max(end, (uint64_t)h->names_offset + 4 + count*toc->entry_name_size);
+
+    if(h->hashtable_offset)
+    {
+        const uint8_t* ht = &toc->data[h->hashtable_offset];
+        DAT_HASHTABLE_HEADER* hh = &toc->hash_header;
+        hh->prehash_shift = dat_toc_read_u32(&ht[0], toc->endian);
+        hh->bucket_offset = dat_toc_read_u32(&ht[4], toc->endian);
+        hh->hashes_offset = dat_toc_read_u32(&ht[8], toc->endian);
+        hh->indices_offset = dat_toc_read_u32(&ht[12], toc->endian);
+
+        /* Shift outside of this range can't come from the game, names are searched instead */
+        if((hh->prehash_shift >= 16) && (hh->prehash_shift <= 31))
+        {
+            toc->bucket_size = 1 << (31 - hh->prehash_shift);
+            end = dat_toc_max(end, (uint64_t)h->hashtable_offset + hh->bucket_offset + toc->bucket_size*2);
+            end = dat_toc_max(end, (uint64_t)h->hashtable_offset + hh->hashes_offset + count*4);
+            end = dat_toc_max(end, (uint64_t)h->hashtable_offset + hh->indices_offset + count*2);
+        }
+    }
+
+    if(dat_toc_read_up_to(toc, &data_size, end) != FU_SUCCESS)
+    {
+        return FU_ERROR;
+    }
+
+    /* Entries */
+    toc->entries = (DAT_TOC_ENTRY*)calloc(count + 1, sizeof(DAT_TOC_ENTRY));
+
+    for(uint32_t i = 0; i != count; ++i)
+    {
+        DAT_TOC_ENTRY* entry = &toc->entries[i];
+        entry->index = i;
+        entry->position = dat_toc_read_u32(&toc->data[h->positions_offset + i*4], toc->endian);
+        entry->size = dat_toc_read_u32(&toc->data[h->sizes_offset + i*4], toc->endian);
+        memcpy(&entry->extension[0], &toc->data[h->extensions_offset + i*4], 4);
+        entry->name = (const char*)&toc->data[h->names_offset + 4 + (uint64_t)i*toc->entry_name_size];
+    }
+
+    /* Hashtable */
+    if(toc->bucket_size)
+    {
+        const uint8_t* ht = &toc->data[h->hashtable_offset];
+        const DAT_HASHTABLE_HEADER* hh = &toc->hash_header;
+        toc->bucket = (uint16_t*)calloc(toc->bucket_size, sizeof(uint16_t));
+        toc->hashes = (uint32_t*)calloc(count + 1, sizeof(uint32_t));
+        toc->indices = (uint16_t*)calloc(count + 1, sizeof(uint16_t));
+
+        for(uint32_t i = 0; i != toc->bucket_size; ++i)
+        {
+            toc->bucket[i] = dat_toc_read_u16(&ht[hh->bucket_offset + i*2], toc->endian);
+        }
+
+        for(uint32_t i = 0; i != count; ++i)
+        {
+            toc->hashes[i] = dat_toc_read_u32(&ht[hh->hashes_offset + i*4], toc->endian);
+            toc->indices[i] = dat_toc_read_u16(&ht[hh->indices_offset + i*2], toc->endian);
+        }
+    }
+
+    return FU_SUCCESS;
+}
+
+static DAT_TOC* dat_open_toc_mode(const char* path, const uint8_t mode)
+{
+    RF_FILE* file = rf_open(path, mode);
+
+    if(file == NULL)
+    {
+        return NULL;
+    }
+
+    DAT_TOC* toc = (DAT_TOC*)calloc(1, sizeof(DAT_TOC));
+    toc->file = file;
+
+    if(dat_toc_parse(toc) != FU_SUCCESS)
+    {
+        toc = dat_close_toc(toc);
+    }
+
+    return toc;
+}
+
+DAT_TOC* dat_open_toc(const char* path)
+{
+    return dat_open_toc_mode(path, RF_READ);
+}
+
+DAT_TOC* dat_open_toc_rw(const char* path)
+{
+    return dat_open_toc_mode(path, RF_UPDATE);
+}
+
+DAT_TOC* dat_close_toc(DAT_TOC* toc)
+{
+    if(toc)
+    {
+        toc->file = rf_close(toc->file);
+        free(toc->entries);
+        free(toc->bucket);
+        free(toc->hashes);
+        free(toc->indices);
+        free(toc->data);
+        free(toc);
+    }
+
+    return NULL;
+}
+
+uint32_t dat_toc_name_len(DAT_TOC* toc, const DAT_TOC_ENTRY* entry)
+{
+    return strnlen(entry->name, toc->entry_name_size);
+}
+
+/* Names are case-insensitive, the hash is made from the lowercase one */
+static uint8_t dat_toc_name_matches(DAT_TOC* toc, const DAT_TOC_ENTRY* entry,
+                                    const char* name, const uint32_t name_len)
+{
+    if(dat_toc_name_len(toc, entry) != name_len)
+    {
+        return 0;
+    }
+
+    for(uint32_t i = 0; i != name_len; ++i)
+    {
+        if(tolower((uint8_t)entry->name[i]) != tolower((uint8_t)name[i]))
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+DAT_TOC_ENTRY* dat_find_entry(DAT_TOC* toc, const char* name)
+{
+    const uint32_t name_len = strlen(name);
+    const uint32_t count = toc->header.file_count;
+
+    if(toc->bucket_size == 0)
+    {
+        for(uint32_t i = 0; i != count; ++i)
+        {
+            if(dat_toc_name_matches(toc, &toc->entries[i], name, name_len))
+            {
+                return &toc->entries[i];
+            }
+        }
+
+        return NULL;
+    }
+
+    const uint32_t shift = toc->hash_header.prehash_shift;
+    const uint32_t hash = dat_hash_crc_from_name((const uint8_t*)name, name_len);
+    const uint32_t bucket_index = hash >> shift;
+
+    if(bucket_index >= toc->bucket_size)
+    {
+        return NULL;
+    }
+
+    const uint16_t first = toc->bucket[bucket_index];
+
+    if((first == DAT_HASH_NO_INDEX) || (first >= count))
+    {
+        return NULL;
+    }
+
+    /* Hashes are sorted by their bucket, the run for this one starts at `first` */
+    for(uint32_t i = first; (i != count) && ((toc->hashes[i] >> shift) == bucket_index); ++i)
+    {
+        const uint16_t file_index = toc->indices[i];
+
+        if((toc->hashes[i] == hash) && (file_index < count)
+           && dat_toc_name_matches(toc, &toc->entries[file_index], name, name_len))
+        {
+            return &toc->entries[file_index];
+        }
+    }
+
+    return NULL;
+}
+
+uint8_t dat_read_entry(DAT_TOC* toc, const DAT_TOC_ENTRY* entry, uint8_t* out)
+{
+    return rf_pread(toc->file, out, entry->size, entry->position);
+}
+
+uint8_t dat_copy_entry_to_fd(DAT_TOC* toc, const DAT_TOC_ENTRY* entry, const int fd)
+{
+    return rf_copy_to_fd(toc->file, entry->position, entry->size, fd);
+}
+
+uint64_t dat_toc_slot_end(DAT_TOC* toc, const DAT_TOC_ENTRY* entry)
+{
+    uint64_t end = toc->file->size;
+
+    for(uint32_t i = 0; i != toc->header.file_count; ++i)
+    {
+        const DAT_TOC_ENTRY* cur = &toc->entries[i];
+
+        /* Empty entries share the position with the next one, table order breaks the tie */
+        const uint8_t follows = (cur->position > entry->position)
+                                || ((cur->position == entry->position) && (cur->index > entry->index));
+
+        if(follows && (cur->position < end))
+        {
+            end = cur->position;
+        }
+    }
+
+    return end;
+}
+
+static uint8_t dat_toc_zero_func(void* user, uint8_t* out, const uint64_t offset, const uint64_t size)
+{
+    memset(out, 0, size);
+    return FU_SUCCESS;
+}
+
+uint8_t dat_toc_replace_entry(DAT_TOC* toc, DAT_TOC_ENTRY* entry, const RF_SOURCE* src)
+{
+    RF_FILE* rf = toc->file;
+    const uint64_t new_end = (uint64_t)entry->position + src->size;
+    const uint64_t old_end = (uint64_t)entry->position + entry->size;
+
+    if((rf->writeable == 0) || (src->size > UINT32_MAX) || (new_end > dat_toc_slot_end(toc, entry)))
+    {
+        return FU_ERROR;
+    }
+
+    if(rf_write_source(rf, entry->position, src) != FU_SUCCESS)
+    {
+        return FU_ERROR;
+    }
+
+    if(new_end < old_end)
+    {
+        const RF_SOURCE zeros = rf_source_func(dat_toc_zero_func, NULL, old_end - new_end);
+
+        if(rf_write_source(rf, new_end, &zeros) != FU_SUCCESS)
+        {
+            return FU_ERROR;
+        }
+    }
+
+    uint8_t size[4] = {0};
+
+    if(toc->endian == FU_BIG_ENDIAN)
+    {
+        tw_write_u32be(src->size, size);
+    }
+    else
+    {
+        tw_write_u32le(src->size, size);
+    }
+
+    if(rf_pwrite(rf, size, 4, toc->header.sizes_offset + entry->index*4) != FU_SUCCESS)
+    {
+        return FU_ERROR;
+    }
+
+    entry->size = src->size;
+
+    return FU_SUCCESS;
+}
+
+uint8_t dat_extract_entry(DAT_TOC* toc, const DAT_TOC_ENTRY* entry, const char* out_path)
+{
+    RF_FILE* out = rf_open(out_path, RF_WRITE);
+
+    if(out == NULL)
+    {
+        return FU_ERROR;
+    }
+
+    const uint8_t status = dat_copy_entry_to_fd(toc, entry, out->fd);
+    out = rf_close(out);
+
+    return status;
+}
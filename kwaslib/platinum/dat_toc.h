@@ -0,0 +1,127 @@
+#pragma once
+
+#include "dat.h"
+
+/*
+    Read-only view of a DAT on disk.
+    Only the header tables and the hashtable are read,
+    entry data is read on demand with positional I/O.
+*/
+
+/*
+    Defines
+*/
+#define DAT_HEADER_SIZE         (uint32_t)(0x20)
+#define DAT_HASH_HEADER_SIZE    (uint32_t)(0x10)
+#define DAT_HASH_NO_INDEX       (uint16_t)(0xFFFF)
+
+/*
+    Structures
+*/
+typedef struct DAT_TOC_ENTRY DAT_TOC_ENTRY;
+struct DAT_TOC_ENTRY
+{
+    uint32_t index;                 /* Position in the DAT tables */
+    uint32_t position;
+    uint32_t size;
+    uint8_t extension[4];
+    const char* name;               /* Points into the names section, not always terminated */
+};
+
+typedef struct DAT_TOC DAT_TOC;
+struct DAT_TOC
+{
+    RF_FILE* file;
+    uint8_t endian;
+    DAT_HEADER header;
+    uint32_t entry_name_size;
+    DAT_TOC_ENTRY* entries;         /* In the order of the DAT tables */
+
+    /* Sections of the hashtable, NULL if the DAT has none */
+    DAT_HASHTABLE_HEADER hash_header;
+    uint32_t bucket_size;
+    uint16_t* bucket;
+    uint32_t* hashes;
+    uint16_t* indices;
+
+    uint8_t* data;                  /* Everything up to the end of the hashtable */
+};
+
+/*
+    Functions
+*/
+
+/*
+    Opens the DAT at `path` and reads its tables.
+    The file stays open until dat_close_toc().
+
+    Returns a pointer to DAT_TOC; NULL on error.
+*/
+DAT_TOC* dat_open_toc(const char* path);
+
+/*
+    Same as dat_open_toc(), with the file open for dat_toc_replace_entry().
+
+    Returns a pointer to DAT_TOC; NULL on error.
+*/
+DAT_TOC* dat_open_toc_rw(const char* path);
+
+/*
+    Closes the file and frees the structure.
+
+    Returns NULL.
+*/
+DAT_TOC* dat_close_toc(DAT_TOC* toc);
+
+/*
+    Looks up `name` the way the game does: lowercased name goes through CRC32,
+    top bits of the hash pick a bucket, which points to a run of sorted hashes
+    paired with file indices. Names are compared in the end, so a collision
+    can't return the wrong file. DATs without a hashtable are searched linearly.
+
+    Returns a pointer to the entry; NULL if not found.
+*/
+DAT_TOC_ENTRY* dat_find_entry(DAT_TOC* toc, const char* name);
+
+/*
+    Reads the whole entry to `out`, which has to hold entry->size bytes.
+    Safe to call from multiple threads at once.
+
+    Returns FU_SUCCESS on success, FU_ERROR otherwise.
+*/
+uint8_t dat_read_entry(DAT_TOC* toc, const DAT_TOC_ENTRY* entry, uint8_t* out);
+
+/*
+    Appends the entry to the descriptor `fd` at its current position,
+    see rf_copy_to_fd().
+
+    Returns FU_SUCCESS on success, FU_ERROR otherwise.
+*/
+uint8_t dat_copy_entry_to_fd(DAT_TOC* toc, const DAT_TOC_ENTRY* entry, const int fd);
+
+/*
+    Returns the end of the space the entry can take without moving anything,
+    which is the start of whatever follows it or the end of the file.
+*/
+uint64_t dat_toc_slot_end(DAT_TOC* toc, const DAT_TOC_ENTRY* entry);
+
+/*
+    Overwrites the entry with `src` at its current position and updates its size.
+    New data has to fit up to dat_toc_slot_end(), nothing else gets moved.
+    Leftovers of the old data are zeroed like the rest of the padding.
+
+    Returns FU_SUCCESS on success, FU_ERROR if it doesn't fit or on I/O error.
+*/
+uint8_t dat_toc_replace_entry(DAT_TOC* toc, DAT_TOC_ENTRY* entry, const RF_SOURCE* src);
+
+/*
+    Writes the entry to a new file at `out_path`.
+
+    Returns FU_SUCCESS on success, FU_ERROR otherwise.
+*/
+uint8_t dat_extract_entry(DAT_TOC* toc, const DAT_TOC_ENTRY* entry, const char* out_path);
+
+/*
+    Returns the length of the entry name, without the padding.
+*/
+uint32_t dat_toc_name_len(DAT_TOC* toc, const DAT_TOC_ENTRY* entry);
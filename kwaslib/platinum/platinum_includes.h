@@ -2,5 +2,6 @@
 
 #include <kwaslib/platinum/dat.h>
 #include <kwaslib/platinum/dat_hashtable.h>
+#include <kwaslib/platinum/dat_toc.h>
 #include <kwaslib/platinum/wmb4.h>
 #include <kwaslib/platinum/wtb.h>
\ No newline at end of file
@@ -6,6 +6,7 @@
 #include <kwaslib/core/io/type_readers.h>
 #include <kwaslib/core/math/boundary.h>
 #include <kwaslib/core/data/image/dds.h>
+#include <kwaslib/core/data/image/gtf.h>
 
 WTB_FILE* wtb_parse_wta_wtp(FU_FILE* fwta, FU_FILE* fwtp)
 {
@@ -62,6 +63,7 @@ FU_FILE* wtb_header_to_fu_file(WTB_FILE* wtb)
     fu_check_buf_rem(fwta, wtb->header.sizes_offset);
     fu_check_buf_rem(fwta, wtb->header.flags_offset);
     fu_check_buf_rem(fwta, wtb->header.ids_offset);
+    fu_check_buf_rem(fwta, wtb->header.xpr_info_offset);
     
     for(uint32_t i = 0; i != cvec_size(wtb->entries); ++i)
     {
@@ -94,6 +96,19 @@ FU_FILE* wtb_header_to_fu_file(WTB_FILE* wtb)
             fu_seek(fwta, cur_pos, FU_SEEK_SET);
             fu_write_u32(fwta, entry->id, wtb->platform);
         }
+        
+        if(wtb->header.xpr_info_offset)
+        {
+            const uint64_t cur_pos = wtb->header.xpr_info_offset + (i*sizeof(D3DBaseTexture));
+            fu_seek(fwta, cur_pos, FU_SEEK_SET);
+            
+            const uint32_t* xb_dword = (const uint32_t*)&entry->x360;
+            
+            for(uint32_t j = 0; j != (sizeof(D3DBaseTexture)/sizeof(uint32_t)); ++j)
+            {
+                fu_write_u32(fwta, xb_dword[j], FU_BIG_ENDIAN);
+            }
+        }
     }
     
     fu_seek(fwta, 0, FU_SEEK_END);
@@ -125,6 +140,47 @@ FU_FILE* wtb_data_to_fu_file(WTB_FILE* wtb)
     return fwtp;
 }
 
+uint8_t wtb_header_to_rf(WTB_FILE* wtb, RF_FILE* out)
+{
+    FU_FILE* fwta = wtb_header_to_fu_file(wtb);
+    uint8_t status = rf_pwrite(out, (const uint8_t*)fwta->buf, fwta->size, 0);
+    fu_close(fwta);
+    free(fwta);
+    
+    return status;
+}
+
+uint8_t wtb_data_to_rf(WTB_FILE* wtb, RF_FILE* out, const RF_SOURCE* sources)
+{
+    uint8_t status = FU_SUCCESS;
+    uint64_t data_end = 0;
+    
+    for(uint32_t i = 0; (i != cvec_size(wtb->entries)) && (status == FU_SUCCESS); ++i)
+    {
+        WTB_ENTRY* entry = wtb_get_entry_by_id(wtb->entries, i);
+        
+        if(sources)
+        {
+            status = rf_write_source(out, entry->position, &sources[i]);
+        }
+        else
+        {
+            status = rf_pwrite(out, entry->data, entry->size, entry->position);
+        }
+        
+        data_end = entry->position + entry->size;
+    }
+    
+    /* Padding at the end is a hole */
+    if(status == FU_SUCCESS)
+    {
+        if(out->size > data_end) data_end = out->size;
+        status = rf_set_size(out, data_end + bound_calc_leftover(WTB_BLOCK_SIZE, data_end));
+    }
+    
+    return status;
+}
+
 void wtb_update(WTB_FILE* wtb, const uint8_t wtp)
 {
     if(wtb->platform == WTB_PLATFORM_LE)
@@ -159,10 +215,12 @@ void wtb_update(WTB_FILE* wtb, const uint8_t wtp)
     cur_pos += bound_calc_leftover(WTB_SECTION_ALIGNMENT, cur_pos);
     wtb->header.ids_offset = cur_pos;
     
-    if(wtb->platform == WTB_PLATFORM_BE)
+    cur_pos += wtb->header.tex_count*4;
+    cur_pos += bound_calc_leftover(WTB_SECTION_ALIGNMENT, cur_pos);
+    wtb->header.xpr_info_offset = 0;
+    
+    if((wtb->platform == WTB_PLATFORM_BE) && wtb->x360)
     {
-        cur_pos += wtb->header.tex_count*4;
-        cur_pos += bound_calc_leftover(WTB_SECTION_ALIGNMENT, cur_pos);
         wtb->header.xpr_info_offset = cur_pos;
         cur_pos += wtb->header.tex_count*sizeof(D3DBaseTexture);
     }
@@ -236,6 +294,7 @@ void wtb_read_header(FU_FILE* fwtb, WTB_FILE* wtb)
     wtb->header.flags_offset = fu_read_u32(fwtb, NULL, wtb->platform);
     wtb->header.ids_offset = fu_read_u32(fwtb, NULL, wtb->platform);
     wtb->header.xpr_info_offset = fu_read_u32(fwtb, NULL, wtb->platform);
+    wtb->x360 = (wtb->platform == WTB_PLATFORM_BE) && wtb->header.xpr_info_offset;
     
     cvec_resize(wtb->entries, wtb->header.tex_count);
     
@@ -310,8 +369,13 @@ void wtb_append_entry(CVEC entries,
     WTB_ENTRY entry = {0};
     entry.size = size;
     entry.id = id;
-    entry.data = (uint8_t*)calloc(1, size);
-    memcpy(entry.data, data, size);
+    
+    if(data)
+    {
+        entry.data = (uint8_t*)calloc(1, size);
+        memcpy(entry.data, data, size);
+    }
+    
     cvec_push_back(entries, &entry);
 }
 
@@ -320,22 +384,26 @@ WTB_ENTRY* wtb_get_entry_by_id(CVEC entries, const uint64_t id)
     return (WTB_ENTRY*)cvec_at(entries, id);
 }
 
-void wtb_set_entry_flags(WTB_ENTRY* entry, const uint8_t atlas)
+/*
+    Sets the flags that come from the DDS header.
+    Returns 1 if the rest has to be scanned for DXT1A blocks.
+*/
+static uint8_t wtb_set_header_flags(WTB_ENTRY* entry, const uint8_t* header, const uint8_t atlas)
 {
     /* Checks for non-DDS */
-    if((strncmp((const char*)&entry->data[0], "II*\0", 4) == 0)      /* TIFF */
-        || (strncmp((const char*)&entry->data[0], "MM\0*", 4) == 0)  /* Also TIFF */
-        || (strncmp((const char*)&entry->data[0], "‰PNG", 4) == 0)   /* PNG */
-        || (strncmp((const char*)&entry->data[6], "JFIF", 4) == 0))  /* JPEG */
+    if((strncmp((const char*)&header[0], "II*\0", 4) == 0)      /* TIFF */
+        || (strncmp((const char*)&header[0], "MM\0*", 4) == 0)  /* Also TIFF */
+        || (strncmp((const char*)&header[0], "‰PNG", 4) == 0)   /* PNG */
+        || (strncmp((const char*)&header[6], "JFIF", 4) == 0))  /* JPEG */
     {
         entry->flags.data.noncomplex = 1;
         entry->flags.data.always_set = 1;
         entry->flags.data.atlas = atlas;
-        return;
+        return 0;
     }
     
     DDS_FILE dds = {0};
-    dds_read_header(&dds, (const char*)&entry->data[0]);
+    dds_read_header(&dds, (const char*)&header[0]);
     
     entry->flags.data.noncomplex = dds.header.caps.data.complex ? 0 : 1;
     entry->flags.data.always_set = 1;
@@ -343,40 +411,155 @@ void wtb_set_entry_flags(WTB_ENTRY* entry, const uint8_t atlas)
     entry->flags.data.atlas = atlas;
     entry->flags.data.cubemap = dds.header.caps2.data.cubemap;
     
-    /*
-        Checking for DXT1A.
-    */
-    if(strncmp((const char*)&dds.header.pf.fourcc[0], "DXT1", 4) == 0)
+    return strncmp((const char*)&dds.header.pf.fourcc[0], "DXT1", 4) == 0;
+}
+
+/*
+    Checks whole DXT1 blocks for the 1-bit alpha.
+    Returns 1 if any block uses it.
+*/
+static uint8_t wtb_blocks_have_dxt1a(const uint8_t* blocks, const uint64_t size)
+{
+    for(uint64_t i = 0; (i + 8) <= size; i+=8)
     {
-        for(uint32_t i = 0x80; i < entry->size; i+=8)
+        const uint16_t c1 = tr_read_u16le((uint8_t*)&blocks[i]);
+        const uint16_t c2 = tr_read_u16le((uint8_t*)&blocks[i+2]);
+        const uint32_t px = tr_read_u32le((uint8_t*)&blocks[i+4]);
+        
+        /*
+            color1 <= color2
+            It's how we know it's a DXT1A texture
+        */
+        if(c1 <= c2)
         {
-            const uint16_t c1 = tr_read_u16le((uint8_t*)&entry->data[i]);
-            const uint16_t c2 = tr_read_u16le((uint8_t*)&entry->data[i+2]);
-            const uint32_t px = tr_read_u32le((uint8_t*)&entry->data[i+4]);
-            
             /*
-                color1 <= color2
-                It's how we know it's a DXT1A texture
+                Here we check if the colors in the
+                4x4 block are even using the transparency,
+                which is the value 3
             */
-            if(c1 <= c2)
+            for(uint8_t j = 0; j != 32; j+=2)
             {
-                /*
-                    Here we check if the colors in the
-                    4x4 block are even using the transparency,
-                    which is the value 3
-                */
-                for(uint8_t j = 0; j != 32; j+=2)
+                const uint8_t code = (px>>j)&0x3;
+                
+                /* Pixel is black (transparent) */
+                if(code == 3)
                 {
-                    const uint8_t code = (px>>j)&0x3;
-                    
-                    /* Pixel is black (transparent) */
-                    if(code == 3)
-                    {
-                        entry->flags.data.dxt1a = 1;
-                        return;
-                    }
+                    return 1;
                 }
             }
         }
     }
+    
+    return 0;
+}
+
+void wtb_set_entry_flags(WTB_ENTRY* entry, const uint8_t atlas)
+{
+    uint8_t header[DDS_FILE_HEADER_SIZE] = {0};
+    memcpy(header, entry->data, entry->size < sizeof(header) ? entry->size : sizeof(header));
+    
+    if(wtb_set_header_flags(entry, header, atlas) && (entry->size > sizeof(header)))
+    {
+        entry->flags.data.dxt1a = wtb_blocks_have_dxt1a(&entry->data[sizeof(header)],
+                                                        entry->size - sizeof(header));
+    }
+}
+
+uint8_t wtb_set_entry_flags_from_rf(WTB_ENTRY* entry, RF_FILE* rf, const uint8_t atlas)
+{
+    uint8_t header[DDS_FILE_HEADER_SIZE] = {0};
+    const uint64_t header_size = rf->size < sizeof(header) ? rf->size : sizeof(header);
+    
+    if(rf_pread(rf, header, header_size, 0) != FU_SUCCESS)
+    {
+        return FU_ERROR;
+    }
+    
+    if(wtb_set_header_flags(entry, header, atlas) == 0)
+    {
+        return FU_SUCCESS;
+    }
+    
+    /* DXT1 blocks are read in chunks, so the texture never has to fit in memory */
+    uint8_t* chunk = (uint8_t*)malloc(RF_CHUNK_SIZE);
+    uint8_t status = chunk ? FU_SUCCESS : FU_ERROR;
+    
+    for(uint64_t pos = sizeof(header); (pos < rf->size) && (status == FU_SUCCESS); pos += RF_CHUNK_SIZE)
+    {
+        const uint64_t left = rf->size - pos;
+        const uint64_t size = left < RF_CHUNK_SIZE ? left : RF_CHUNK_SIZE;
+        
+        status = rf_pread(rf, chunk, size, pos);
+        
+        if((status == FU_SUCCESS) && wtb_blocks_have_dxt1a(chunk, size))
+        {
+            entry->flags.data.dxt1a = 1;
+            break;
+        }
+    }
+    
+    free(chunk);
+    return status;
+}
+
+uint8_t wtb_entry_dds_to_x360(WTB_ENTRY* entry)
+{
+    D3DBaseTexture xpr = {0};
+    uint64_t tex_size = 0;
+    uint8_t* tex = x360_texture_from_dds(entry->data, entry->size, &xpr, &tex_size);
+    
+    if(tex == NULL)
+    {
+        return FU_ERROR;
+    }
+    
+    free(entry->data);
+    entry->data = tex;
+    entry->size = tex_size;
+    entry->x360 = xpr;
+    
+    return FU_SUCCESS;
+}
+
+uint8_t wtb_entry_dds_to_gtf(WTB_ENTRY* entry)
+{
+    uint64_t gtf_size = 0;
+    uint8_t* gtf = gtf_from_dds(entry->data, entry->size, &gtf_size);
+    
+    if(gtf == NULL)
+    {
+        return FU_ERROR;
+    }
+    
+    free(entry->data);
+    entry->data = gtf;
+    entry->size = gtf_size;
+    memset(&entry->x360, 0, sizeof(D3DBaseTexture));
+    
+    return FU_SUCCESS;
+}
+
+uint8_t wtb_entry_rgba_to_dds(WTB_ENTRY* entry, const uint8_t* rgba,
+                              const uint32_t width, const uint32_t height,
+                              const uint8_t format, const uint8_t quality,
+                              const uint32_t thread_count)
+{
+    uint64_t dds_size = 0;
+    uint8_t* dds = dds_encode_rgba(rgba, width, height, format, quality, 1, thread_count, &dds_size);
+    
+    if(dds == NULL)
+    {
+        return FU_ERROR;
+    }
+    
+    const uint8_t atlas = entry->flags.data.atlas;
+    
+    free(entry->data);
+    entry->data = dds;
+    entry->size = dds_size;
+    entry->flags.buf = 0;
+    memset(&entry->x360, 0, sizeof(D3DBaseTexture));
+    wtb_set_entry_flags(entry, atlas);
+    
+    return FU_SUCCESS;
 }
@@ -4,6 +4,7 @@
 
 #include <kwaslib/core/data/cvector.h>
 #include <kwaslib/core/io/file_utils.h>
+#include <kwaslib/core/io/raw_file.h>
 #include <kwaslib/core/crypto/crc32.h>
 #include <kwaslib/core/data/image/x360_texture.h>
 
@@ -86,6 +87,7 @@ typedef struct
     CVEC entries;
     
     uint8_t platform; /* 1 for PC, 2 for X360/PS3 */
+    uint8_t x360;     /* BE only, 1 for X360 textures with D3DBaseTexture info, 0 for PS3 GTF */
 } WTB_FILE;
 
 /*
@@ -98,6 +100,23 @@ WTB_FILE* wtb_parse_wtb(FU_FILE* fwtb);
 FU_FILE* wtb_header_to_fu_file(WTB_FILE* wtb);
 FU_FILE* wtb_data_to_fu_file(WTB_FILE* wtb);
 
+/*
+    Writes the header at the start of `out`.
+    For WTB call it before wtb_data_to_rf() on the same file.
+    
+    Returns FU_SUCCESS on success, FU_ERROR otherwise.
+*/
+uint8_t wtb_header_to_rf(WTB_FILE* wtb, RF_FILE* out);
+
+/*
+    Writes the texture data straight to `out` at positions from wtb_update().
+    Payload of entry `i` comes from `sources[i]`,
+    or from entry->data if `sources` is NULL.
+    
+    Returns FU_SUCCESS on success, FU_ERROR otherwise.
+*/
+uint8_t wtb_data_to_rf(WTB_FILE* wtb, RF_FILE* out, const RF_SOURCE* sources);
+
 /*
     Updates header offsets and positions of the image data.
 */
@@ -126,7 +145,8 @@ void wtb_read_header(FU_FILE* fwtb, WTB_FILE* wtb);
 void wtb_read_image_data(FU_FILE* fwtb, WTB_FILE* wtb);
 
 /*
-    Appends new entry
+    Appends new entry.
+    With `data` NULL only the size is kept, for writing from sources.
 */
 void wtb_append_entry(CVEC entries,
                       const uint32_t size,
@@ -147,4 +167,41 @@ WTB_ENTRY* wtb_get_entry_by_id(CVEC entries, const uint64_t id);
     it will set the closest flags that would be for
     a 2D RGB texture without mipmaps.
 */
-void wtb_set_entry_flags(WTB_ENTRY* entry, const uint8_t atlas);
\ No newline at end of file
+void wtb_set_entry_flags(WTB_ENTRY* entry, const uint8_t atlas);
+
+/*
+    Same as wtb_set_entry_flags(), but reads the texture from `rf`
+    in chunks instead of entry->data.
+    
+    Returns FU_SUCCESS on success, FU_ERROR otherwise.
+*/
+uint8_t wtb_set_entry_flags_from_rf(WTB_ENTRY* entry, RF_FILE* rf, const uint8_t atlas);
+
+/*
+    Replaces the DDS data of the entry with a tiled X360 texture
+    and writes its fetch constant to entry->x360.
+    Flags have to be set from the DDS before, see wtb_set_entry_flags().
+    
+    Returns FU_SUCCESS on success, FU_ERROR if the DDS can't be converted.
+*/
+uint8_t wtb_entry_dds_to_x360(WTB_ENTRY* entry);
+
+/*
+    Replaces the DDS data of the entry with a PS3 GTF texture.
+    Flags have to be set from the DDS before, see wtb_set_entry_flags().
+    
+    Returns FU_SUCCESS on success, FU_ERROR if the DDS can't be converted.
+*/
+uint8_t wtb_entry_dds_to_gtf(WTB_ENTRY* entry);
+
+/*
+    Replaces the data of the entry with a DDS encoded from `width`x`height` RGBA8 pixels,
+    with a full mip chain, see dds_encode_rgba(). Flags are set from the new DDS,
+    the atlas flag is kept.
+    
+    Returns FU_SUCCESS on success, FU_ERROR otherwise.
+*/
+uint8_t wtb_entry_rgba_to_dds(WTB_ENTRY* entry, const uint8_t* rgba,
+                              const uint32_t width, const uint32_t height,
+                              const uint8_t format, const uint8_t quality,
+                              const uint32_t thread_count);
@@ -1,13 +1,24 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <kwaslib/core/io/path_utils.h>
 #include <kwaslib/core/io/file_utils.h>
+#include <kwaslib/core/io/raw_file.h>
 #include <kwaslib/core/io/date_utils.h>
+#include <kwaslib/core/io/arg_parser.h>
 #include <kwaslib/core/data/text/sexml.h>
+#include <kwaslib/core/thread/thread_pool.h>
 
 #include <kwaslib/cri/archive/afs.h>
+#include <kwaslib/cri/archive/afs_parse.h>
+#include <kwaslib/cri/archive/afs_export.h>
+#include <kwaslib/cri/archive/afs_toc.h>
+#include <kwaslib/cri/compression/crilayla.h>
+#include <kwaslib/cri/audio/adx.h>
+
+#include "cri_audio_scan.h"
 
 /*
     Globals
@@ -16,12 +27,42 @@
 #define XML_AFS_NAME_SIZE       3
 
 uint8_t g_afs_counter = 0; 
+AP_DESC* g_arg_node = NULL;
+uint8_t g_flag_rekey = 0;
+CRI_ADX_KEY g_key = {0};
+CRI_ADX_KEY g_new_key = {0};
+uint8_t g_new_type = ADX_ENC_NONE;
+uint32_t g_threads = TP_THREADS_AUTO;
+uint8_t g_flag_scan = 0;
+char* g_scan_path = NULL;
+uint8_t g_flag_list = 0;
+char* g_extract_name = NULL;
+char* g_replace_name = NULL;
+char* g_replace_with = NULL;
+
+/* Entry marked for CRILAYLA compression when packing */
+typedef struct
+{
+    uint32_t id;
+    FU_FILE* file;
+    SU_STRING* name;
+    time_t timestamp;
+} AFS_TOOL_PENDING;
+
+/* Entry streamed from its file when writing */
+typedef struct
+{
+    uint32_t id;
+    const char* path;
+} AFS_TOOL_SOURCE;
 
 /*
 	Common
 */
+uint8_t afs_tool_parse_arguments(int argc, char** argv);
 void afs_tool_print_usage(char* program_name);
 void afs_tool_print_afs(AFS_FILE* afs);
+void afs_tool_entry_file_name(const char* metadata_name, const uint32_t id, char* out);
 
 /*
 	Unpacker
@@ -32,19 +73,94 @@ void afs_tool_afs_to_xml(AFS_FILE* afs, SEXML_ELEMENT* root, SU_STRING* work_dir
 /*
     Packer
 */
-AFS_FILE* afs_tool_xml_to_afs(SEXML_ELEMENT* afs_root);
+/*
+    Entries only get their sizes, except the ones marked for CRILAYLA.
+    `sources` gets an RF_SOURCE per id for afs_write_to_rf(), paths in it
+    point into the XML, so it has to outlive the writing.
+*/
+AFS_FILE* afs_tool_xml_to_afs(SEXML_ELEMENT* afs_root, RF_SOURCE** sources);
+
+/*
+    Table of contents only
+*/
+void afs_tool_toc(const char* path);
+void afs_tool_print_toc(AFS_TOC* toc);
+void afs_tool_extract_one(AFS_TOC* toc, const char* name);
+AFS_TOC_ENTRY* afs_tool_find_entry(AFS_TOC* toc, const char* name);
+void afs_tool_replace(const char* path, const char* name, const char* with);
+
+/*
+    Re-keying
+*/
+void afs_tool_rekey(const char* path);
+
+/*
+    Audio QA
+*/
+void afs_tool_scan(const char* afs_path, const char* report_path);
 
 /* 
 	Entry
 */
 int main(int argc, char** argv)
 {
+    /* Setting up arguments */
+    g_arg_node = ap_create();
+    ap_append_desc_str(g_arg_node, "0", "--key", "Current ADX key, keycode or start:mult:add");
+    ap_append_desc_str(g_arg_node, "0", "--new_key", "Re-key ADXs in place with this key, 0 decrypts");
+    ap_append_desc_uint(g_arg_node, 0, "--new_type", "ADX encryption type after re-keying, 0, 8 or 9");
+    ap_append_desc_str(g_arg_node, "", "--scan", "Measure levels of every entry into a .csv or .json report");
+    ap_append_desc_uint(g_arg_node, TP_THREADS_AUTO, "--threads", "Amount of threads for re-keying and scanning, 0 for all cores");
+    ap_append_desc_noval(g_arg_node, 0, "--list", "Only print the entries");
+    ap_append_desc_str(g_arg_node, "", "--extract", "Extract a single entry by its id or name");
+    ap_append_desc_str(g_arg_node, "", "--replace", "Replace a single entry by its id or name in place, needs --with");
+    ap_append_desc_str(g_arg_node, "", "--with", "File to replace the entry with");
+    
 	if(argc == 1)
 	{
 		afs_tool_print_usage(argv[0]);
 		return 0;
 	}
     
+    const uint8_t args_status = afs_tool_parse_arguments(argc, argv);
+    g_arg_node = ap_free(g_arg_node);
+    
+    if(args_status != FU_SUCCESS)
+    {
+        return 1;
+    }
+    
+    /* Re-keying works on the file as it is */
+    if(g_flag_rekey && pu_is_file(argv[1]))
+    {
+        afs_tool_rekey(argv[1]);
+        return 0;
+    }
+    
+    if(g_flag_scan && pu_is_file(argv[1]))
+    {
+        afs_tool_scan(argv[1], g_scan_path);
+        free(g_scan_path);
+        return 0;
+    }
+    
+    /* Only the entry, its table entry and metadata are written */
+    if(g_replace_name && pu_is_file(argv[1]))
+    {
+        afs_tool_replace(argv[1], g_replace_name, g_replace_with);
+        free(g_replace_name);
+        free(g_replace_with);
+        return 0;
+    }
+    
+    /* Only the table is read, the archive isn't loaded */
+    if((g_flag_list || g_extract_name) && pu_is_file(argv[1]))
+    {
+        afs_tool_toc(argv[1]);
+        free(g_extract_name);
+        return 0;
+    }
+    
 	/* It's a file so let's process it */
 	if(pu_is_file(argv[1]))
 	{
@@ -68,9 +184,9 @@ int main(int argc, char** argv)
                 return 0;
             }
             
-            /* Convert the AFS to FU_FILE* for saving */
-			AFS_FILE* afs = afs_tool_xml_to_afs(xml_root);
-            FU_FILE* fafs = afs_write_to_fu(afs, AFS_BLOCK_SIZE_DEFAULT);
+            /* Load the AFS entries described by the XML */
+            RF_SOURCE* sources = NULL;
+			AFS_FILE* afs = afs_tool_xml_to_afs(xml_root, &sources);
         
 			/* Remove XML extension */
 			su_remove(input_file_path->ext, 0, -1);
@@ -86,11 +202,17 @@ int main(int argc, char** argv)
         
             /* Saving the AFS archive to disk */
 			printf("\nAFS Path: %*s\n", afs_out_str->size, afs_out_str->ptr);
-            fu_to_file(afs_out_str->ptr, fafs, 1);
+            RF_FILE* fafs = rf_open(afs_out_str->ptr, RF_WRITE);
             
+            if((fafs == NULL) || (afs_write_to_rf(afs, fafs, AFS_BLOCK_SIZE_DEFAULT, sources) != FU_SUCCESS))
+            {
+                printf("Couldn't write the AFS file.\n");
+            }
+            
+            fafs = rf_close(fafs);
+            free(sources);
             afs = afs_free(afs);
-            fu_close(fafs);
-            free(fafs);
+            xml_root = sexml_destroy(xml_root);
             afs_out_str_ext = su_free(afs_out_str_ext);
             afs_out_str = su_free(afs_out_str);
 		}
@@ -135,25 +257,137 @@ void afs_tool_print_usage(char* program_name)
 	printf("Converts CRI Middleware's AFS archive to XML and vice versa.\n");;
 	printf("Usage:\n");
 	printf("\tTo unpack: %s <file.afs>\n", program_name);
+	printf("\tTo re-key ADXs: %s <file.afs> --key <key> --new_key <key> <options>\n", program_name);
+	printf("\tTo measure levels: %s <file.afs> --scan <report.csv/json> --key <key>\n", program_name);
+	printf("\tTo list: %s <file.afs> --list\n", program_name);
+	printf("\tTo extract one file: %s <file.afs> --extract <id/name>\n", program_name);
+	printf("\tTo replace one file: %s <file.afs> --replace <id/name> --with <file>\n", program_name);
 	printf("\tTo pack: %s <file.afs.xml>\n", program_name);
+    printf("\n");
+    printf("Options:\n");
+
+    for(uint32_t i = 0; i != ap_get_desc_count(g_arg_node); ++i)
+    {
+        AP_ARG_DESC* apd = ap_get_desc_by_id(g_arg_node, i);
+        printf("\t%24s\t%s\n", apd->name, apd->description);
+    }
+}
+
+uint8_t afs_tool_parse_arguments(int argc, char** argv)
+{
+    uint8_t status = FU_SUCCESS;
+    
+    if(ap_parse(g_arg_node, argc-2, &argv[2]) != AP_STAT_SUCCESS)
+    {
+        return status;
+    }
+
+    AP_ARG_VEC arg_key = ap_get_arg_vec_by_name(g_arg_node, "--key");
+    AP_ARG_VEC arg_new_key = ap_get_arg_vec_by_name(g_arg_node, "--new_key");
+    AP_ARG_VEC arg_new_type = ap_get_arg_vec_by_name(g_arg_node, "--new_type");
+    AP_ARG_VEC arg_scan = ap_get_arg_vec_by_name(g_arg_node, "--scan");
+    AP_ARG_VEC arg_threads = ap_get_arg_vec_by_name(g_arg_node, "--threads");
+    AP_ARG_VEC arg_list = ap_get_arg_vec_by_name(g_arg_node, "--list");
+    AP_ARG_VEC arg_extract = ap_get_arg_vec_by_name(g_arg_node, "--extract");
+    AP_ARG_VEC arg_replace = ap_get_arg_vec_by_name(g_arg_node, "--replace");
+    AP_ARG_VEC arg_with = ap_get_arg_vec_by_name(g_arg_node, "--with");
+    
+    if(arg_key)
+    {
+        if(cri_key_adx_from_str(AP_GET_ARG_STR(AP_ARG_FROM_VEC_BY_ID(arg_key, 0)), &g_key) == 0xFF)
+        {
+            printf("Key is neither a keycode nor start:mult:add.\n");
+            status = FU_ERROR;
+        }
+        
+        arg_key = ap_free_arg_vec(arg_key);
+    }
+    
+    if(arg_new_key)
+    {
+        /* Type follows the form of the key unless told otherwise */
+        g_new_type = cri_key_adx_from_str(AP_GET_ARG_STR(AP_ARG_FROM_VEC_BY_ID(arg_new_key, 0)), &g_new_key);
+        g_flag_rekey = (g_new_type != 0xFF);
+        
+        if(g_flag_rekey == 0)
+        {
+            printf("New key is neither a keycode nor start:mult:add.\n");
+            status = FU_ERROR;
+        }
+        
+        arg_new_key = ap_free_arg_vec(arg_new_key);
+    }
+    
+    if(arg_new_type)
+    {
+        g_new_type = AP_GET_ARG_UINT(AP_ARG_FROM_VEC_BY_ID(arg_new_type, 0));
+        arg_new_type = ap_free_arg_vec(arg_new_type);
+    }
+    
+    if(arg_scan)
+    {
+        g_flag_scan = 1;
+        g_scan_path = strdup(AP_GET_ARG_STR(AP_ARG_FROM_VEC_BY_ID(arg_scan, 0)));
+        arg_scan = ap_free_arg_vec(arg_scan);
+    }
+    
+    if(arg_threads)
+    {
+        g_threads = AP_GET_ARG_UINT(AP_ARG_FROM_VEC_BY_ID(arg_threads, 0));
+        arg_threads = ap_free_arg_vec(arg_threads);
+    }
+    
+    if(arg_list)
+    {
+        g_flag_list = 1;
+        arg_list = ap_free_arg_vec(arg_list);
+    }
+    
+    if(arg_extract)
+    {
+        /* Parser owns the value */
+        g_extract_name = strdup(AP_GET_ARG_STR(AP_ARG_FROM_VEC_BY_ID(arg_extract, 0)));
+        arg_extract = ap_free_arg_vec(arg_extract);
+    }
+    
+    if(arg_replace)
+    {
+        g_replace_name = strdup(AP_GET_ARG_STR(AP_ARG_FROM_VEC_BY_ID(arg_replace, 0)));
+        arg_replace = ap_free_arg_vec(arg_replace);
+    }
+    
+    if(arg_with)
+    {
+        g_replace_with = strdup(AP_GET_ARG_STR(AP_ARG_FROM_VEC_BY_ID(arg_with, 0)));
+        arg_with = ap_free_arg_vec(arg_with);
+    }
+    
+    /* Re-keying with a wrong old key would scramble every encrypted ADX */
+    if(status != FU_SUCCESS)
+    {
+        g_flag_rekey = 0;
+    }
+    
+    return status;
 }
 
 void afs_tool_print_afs(AFS_FILE* afs)
 {
     printf("### AFS ###\n");
-    for(uint32_t i = 0; i != AFS_MAX_FILES; ++i)
+    for(uint32_t i = 0; i != afs_get_count(afs); ++i)
     {
-        AFS_ENTRY* entry = afs_get_entry_by_id(afs, i);
+        AFS_ENTRY* entry = afs_get_entry_by_index(afs, i);
         
         if(entry->data)
         {
-            printf("[%05u]", i);
+            printf("[%05u]", entry->id);
             
             switch(entry->data_type)
             {
                 case AFS_DATA_ADX:  printf("[ADX] "); break;
                 case AFS_DATA_AHX:  printf("[AHX] "); break;
                 case AFS_DATA_AFS:  printf("[AFS] "); break;
+                case AFS_DATA_CRILAYLA: printf("[CRI] "); break;
                 default:            printf("[BIN] ");
             }
             
@@ -178,6 +412,32 @@ void afs_tool_print_afs(AFS_FILE* afs)
     printf("### AFS END ###\n");
 }
 
+/*
+    Names come from the archive. They're cut at the first NUL, can't leave
+    the output directory and fall back to the id when empty.
+    `out` has to hold AFS_ENTRY_METADATA_NAME_SIZE+1 bytes.
+*/
+void afs_tool_entry_file_name(const char* metadata_name, const uint32_t id, char* out)
+{
+    memcpy(out, metadata_name, AFS_ENTRY_METADATA_NAME_SIZE);
+    out[AFS_ENTRY_METADATA_NAME_SIZE] = '\0';
+    
+    for(char* c = out; *c; ++c)
+    {
+        if(((uint8_t)*c < 0x20) || strchr("/\\:*?\"<>|", *c)) *c = '_';
+    }
+    
+    if((strcmp(out, ".") == 0) || (strcmp(out, "..") == 0))
+    {
+        out[0] = '\0';
+    }
+    
+    if(out[0] == '\0')
+    {
+        sprintf(out, "%05u", id);
+    }
+}
+
 /*
 	Unpacker
 */
@@ -221,9 +481,9 @@ void afs_tool_afs_to_xml(AFS_FILE* afs, SEXML_ELEMENT* root, SU_STRING* work_dir
     /* Writing XML stuff */
     SEXML_ELEMENT* afs_node = sexml_append_element(root, XML_AFS_NAME);
     
-    for(uint32_t i = 0; i != AFS_MAX_FILES; ++i)
+    for(uint32_t i = 0; i != afs_get_count(afs); ++i)
     {
-        AFS_ENTRY* cur_entry = afs_get_entry_by_id(afs, i);
+        AFS_ENTRY* cur_entry = afs_get_entry_by_index(afs, i);
         
         if(cur_entry->data)
         {
@@ -233,12 +493,14 @@ void afs_tool_afs_to_xml(AFS_FILE* afs, SEXML_ELEMENT* root, SU_STRING* work_dir
             /* Use the name from metadata. Otherwise use the ID. */
             if(afs->has_metadata)
             {
-                su_insert_char(cur_file, -1, cur_entry->metadata.name, AFS_ENTRY_METADATA_NAME_SIZE);            
+                char name[AFS_ENTRY_METADATA_NAME_SIZE+1] = {0};
+                afs_tool_entry_file_name(cur_entry->metadata.name, cur_entry->id, name);
+                su_insert_char(cur_file, -1, name, strlen(name));
             }
             else
             {
                 char buf[6] = {0};
-                sprintf(buf, "%05u", i);
+                sprintf(buf, "%05u", cur_entry->id);
                 su_insert_char(cur_file, -1, buf, 5);     
                 
                 switch(cur_entry->data_type)
@@ -257,9 +519,28 @@ void afs_tool_afs_to_xml(AFS_FILE* afs, SEXML_ELEMENT* root, SU_STRING* work_dir
                 }
             }
             
-            sexml_append_attribute_uint(entry_xml, "id", i);
+            sexml_append_attribute_uint(entry_xml, "id", cur_entry->id);
             sexml_append_attribute(entry_xml, "path", cur_file->ptr);
-            fu_buffer_to_file(cur_file->ptr, (char*)cur_entry->data, cur_entry->size, 1);
+            
+            /* Compressed entries are saved decompressed and compressed again when packing */
+            uint64_t dec_size = 0;
+            uint8_t* dec_data = NULL;
+            
+            if(cur_entry->data_type == AFS_DATA_CRILAYLA)
+            {
+                dec_data = crilayla_decompress(cur_entry->data, cur_entry->size, &dec_size);
+            }
+            
+            if(dec_data)
+            {
+                sexml_append_attribute_uint(entry_xml, "crilayla", 1);
+                fu_buffer_to_file(cur_file->ptr, (char*)dec_data, dec_size, 1);
+                free(dec_data);
+            }
+            else
+            {
+                fu_buffer_to_file(cur_file->ptr, (char*)cur_entry->data, cur_entry->size, 1);
+            }
             
             /* Set the date for the file */
             if(afs->has_metadata)
@@ -281,9 +562,11 @@ void afs_tool_afs_to_xml(AFS_FILE* afs, SEXML_ELEMENT* root, SU_STRING* work_dir
 /*
 	Packer
 */
-AFS_FILE* afs_tool_xml_to_afs(SEXML_ELEMENT* afs_root)
+AFS_FILE* afs_tool_xml_to_afs(SEXML_ELEMENT* afs_root, RF_SOURCE** sources)
 {
     AFS_FILE* afs = afs_alloc();
+    CVEC pending = cvec_create(sizeof(AFS_TOOL_PENDING));
+    CVEC paths = cvec_create(sizeof(AFS_TOOL_SOURCE));
     
     afs->has_metadata = AFS_HAS_METADATA;
     const uint32_t entries_count = cvec_size(afs_root->elements);
@@ -297,6 +580,7 @@ AFS_FILE* afs_tool_xml_to_afs(SEXML_ELEMENT* afs_root)
         {
             SEXML_ATTRIBUTE* id_attr = sexml_get_attribute_by_name(entry_xml, "id");
             SEXML_ATTRIBUTE* file_path = sexml_get_attribute_by_name(entry_xml, "path");
+            SEXML_ATTRIBUTE* crilayla_attr = sexml_get_attribute_by_name(entry_xml, "crilayla");
             
             /* Only proceed if both values exist */
             if(id_attr && file_path)
@@ -306,22 +590,347 @@ AFS_FILE* afs_tool_xml_to_afs(SEXML_ELEMENT* afs_root)
                 /* We don't care for files that are over the max */
                 if(id < AFS_MAX_FILES)
                 {
-                    FU_FILE* f = fu_open(file_path->value->ptr, 1);
+                    const char* path = file_path->value->ptr;
                     
-                    if(f)
+                    if(pu_is_file(path))
                     {
-                        SU_STRING* name = pu_get_basename_char(file_path->value->ptr);
-                        const time_t timestamp = du_get_file_time(file_path->value->ptr);
-                        afs_set_entry_data(afs, id, (uint8_t*)f->buf, f->size, name->ptr, timestamp);
+                        SU_STRING* name = pu_get_basename_char(path);
+                        const time_t timestamp = du_get_file_time(path);
+                        
+                        /* Compressed together after all files are read */
+                        if(crilayla_attr && sexml_get_attribute_uint(crilayla_attr))
+                        {
+                            FU_FILE* f = fu_open(path, 1);
+                            
+                            if(f)
+                            {
+                                AFS_TOOL_PENDING p = {id, f, name, timestamp};
+                                cvec_push_back(pending, &p);
+                                continue;
+                            }
+                        }
+                        else
+                        {
+                            /* Streamed from the file when writing */
+                            AFS_TOOL_SOURCE src = {id, path};
+                            afs_set_entry_data(afs, id, NULL, fu_get_file_size(path), name->ptr, timestamp);
+                            cvec_push_back(paths, &src);
+                        }
                         
                         name = su_free(name);
-                        fu_close(f);
-                        free(f);
                     }
                 }
             }
         }
     }
+    
+    const uint32_t pending_count = cvec_size(pending);
+    
+    if(pending_count)
+    {
+        CRILAYLA_JOB* jobs = (CRILAYLA_JOB*)calloc(pending_count, sizeof(CRILAYLA_JOB));
+        
+        for(uint32_t i = 0; i != pending_count; ++i)
+        {
+            AFS_TOOL_PENDING* p = (AFS_TOOL_PENDING*)cvec_at(pending, i);
+            jobs[i].data = (const uint8_t*)p->file->buf;
+            jobs[i].size = p->file->size;
+        }
+        
+        crilayla_compress_batch(jobs, pending_count, CRILAYLA_EFFORT_DEFAULT, TP_THREADS_AUTO);
+        
+        for(uint32_t i = 0; i != pending_count; ++i)
+        {
+            AFS_TOOL_PENDING* p = (AFS_TOOL_PENDING*)cvec_at(pending, i);
+            
+            /* Data that didn't compress is stored as-is */
+            if(jobs[i].out)
+            {
+                afs_set_entry_data(afs, p->id, jobs[i].out, jobs[i].out_size, p->name->ptr, p->timestamp);
+                free(jobs[i].out);
+            }
+            else
+            {
+                afs_set_entry_data(afs, p->id, jobs[i].data, jobs[i].size, p->name->ptr, p->timestamp);
+            }
+            
+            p->name = su_free(p->name);
+            fu_close(p->file);
+            free(p->file);
+        }
+        
+        free(jobs);
+    }
+    
+    pending = cvec_destroy(pending);
+    
+    /* Compressed entries are the only ones in memory */
+    const uint32_t source_count = afs_get_count(afs) ? afs_get_last_entry_id(afs) + 1 : 1;
+    *sources = (RF_SOURCE*)calloc(source_count, sizeof(RF_SOURCE));
+    
+    for(uint32_t i = 0; i != cvec_size(paths); ++i)
+    {
+        const AFS_TOOL_SOURCE* src = (const AFS_TOOL_SOURCE*)cvec_at(paths, i);
+        AFS_ENTRY* entry = afs_get_entry_by_id(afs, src->id);
+        
+        if(entry && (entry->data == NULL))
+        {
+            (*sources)[src->id] = rf_source_path(src->path, 0, entry->size);
+        }
+    }
+    
+    for(uint32_t i = 0; i != afs_get_count(afs); ++i)
+    {
+        AFS_ENTRY* entry = afs_get_entry_by_index(afs, i);
+        
+        if(entry->data)
+        {
+            (*sources)[entry->id] = rf_source_buffer(entry->data, entry->size);
+        }
+    }
+    
+    paths = cvec_destroy(paths);
 
     return afs;
-}
\ No newline at end of file
+}
+
+/*
+    Re-keying
+*/
+void afs_tool_rekey(const char* path)
+{
+    RF_MAP* map = rf_map_rw(path);
+    
+    if(map == NULL)
+    {
+        printf("Could not open \"%s\" for writing.\n", path);
+        return;
+    }
+    
+    if(afs_check_if_valid(map->data, map->size) == AFS_GOOD)
+    {
+        const uint32_t rekeyed = afs_rekey_adx(map->data, map->size, g_key, g_new_key,
+                                               g_new_type, g_threads);
+        printf("Re-keyed %u ADX file(s).\n", rekeyed);
+    }
+    else if(adx_rekey(map->data, map->size, g_key, g_new_key, g_new_type))
+    {
+        printf("Re-keyed the ADX file.\n");
+    }
+    else
+    {
+        printf("File is not an AFS or ADX file, or the encryption type is unknown.\n");
+    }
+    
+    map = rf_unmap(map);
+}
+
+/*
+    Table of contents only
+*/
+void afs_tool_toc(const char* path)
+{
+    AFS_TOC* toc = afs_open_toc(path);
+    
+    if(toc == NULL)
+    {
+        printf("File is not a valid AFS file.\n");
+        return;
+    }
+    
+    if(g_flag_list)
+    {
+        afs_tool_print_toc(toc);
+    }
+    else
+    {
+        afs_tool_extract_one(toc, g_extract_name);
+    }
+    
+    toc = afs_close_toc(toc);
+}
+
+void afs_tool_print_toc(AFS_TOC* toc)
+{
+    printf("### AFS ###\n");
+    for(uint32_t i = 0; i != toc->count; ++i)
+    {
+        AFS_TOC_ENTRY* entry = &toc->entries[i];
+        
+        printf("[%05u] Offset: %08x | Size: %*u", entry->id, entry->offset, 10, entry->size);
+        
+        if(toc->has_metadata)
+        {
+            printf(" | ");
+            printf("%04d-%02d-%02d ", entry->metadata.year,
+                                      entry->metadata.month,
+                                      entry->metadata.day);
+            printf("%02d:%02d:%02d | ", entry->metadata.hour,
+                                        entry->metadata.minute,
+                                        entry->metadata.second);
+            printf("%.*s", AFS_ENTRY_METADATA_NAME_SIZE,
+                           entry->metadata.name);
+        }
+        
+        printf("\n");
+    }
+    printf("### AFS END ###\n");
+}
+
+AFS_TOC_ENTRY* afs_tool_find_entry(AFS_TOC* toc, const char* name)
+{
+    /* Names win over ids, "00001.bin" is a name too */
+    AFS_TOC_ENTRY* entry = afs_toc_find_by_name(toc, name);
+    
+    if(entry == NULL)
+    {
+        char* end = NULL;
+        const uint32_t id = strtoul(name, &end, 0);
+        
+        if((end != name) && (*end == '\0'))
+        {
+            entry = afs_toc_find_by_id(toc, id);
+        }
+    }
+    
+    return entry;
+}
+
+void afs_tool_extract_one(AFS_TOC* toc, const char* name)
+{
+    AFS_TOC_ENTRY* entry = afs_tool_find_entry(toc, name);
+    
+    if(entry == NULL)
+    {
+        printf("No entry \"%s\" in the archive.\n", name);
+        return;
+    }
+    
+    /* Saved to the working directory */
+    char out_path[AFS_ENTRY_METADATA_NAME_SIZE+1] = {0};
+    afs_tool_entry_file_name(entry->metadata.name, entry->id, out_path);
+    printf("Save Path: %s\n", out_path);
+    
+    RF_FILE* out = rf_open(out_path, RF_WRITE);
+    
+    if((out == NULL) || (afs_copy_entry_to_fd(toc, entry, out->fd) != FU_SUCCESS))
+    {
+        printf("Couldn't extract \"%s\".\n", name);
+    }
+    
+    out = rf_close(out);
+    
+    if(entry->timestamp)
+    {
+        du_set_file_time(out_path, entry->timestamp);
+    }
+}
+
+void afs_tool_replace(const char* path, const char* name, const char* with)
+{
+    if((with == NULL) || (pu_is_file(with) == 0))
+    {
+        printf("--with has to point to a file.\n");
+        return;
+    }
+    
+    AFS_TOC* toc = afs_open_toc_rw(path);
+    
+    if(toc == NULL)
+    {
+        printf("File is not a valid AFS file.\n");
+        return;
+    }
+    
+    AFS_TOC_ENTRY* entry = afs_tool_find_entry(toc, name);
+    
+    if(entry == NULL)
+    {
+        printf("No entry \"%s\" in the archive.\n", name);
+        toc = afs_close_toc(toc);
+        return;
+    }
+    
+    /* Name stays, the date follows the new file */
+    const RF_SOURCE src = rf_source_path(with, 0, fu_get_file_size(with));
+    
+    switch(afs_toc_replace_entry(toc, entry, &src, NULL, du_get_file_time(with)))
+    {
+        case AFS_REPLACE_IN_PLACE:
+            printf("Replaced [%05u] in place.\n", entry->id);
+            break;
+        case AFS_REPLACE_RELOCATED:
+            printf("Replaced [%05u], moved to %08x.\n", entry->id, entry->offset);
+            break;
+        default:
+            printf("Couldn't replace [%05u], the archive has to be repacked.\n", entry->id);
+    }
+    
+    toc = afs_close_toc(toc);
+}
+
+/*
+    Audio QA
+*/
+void afs_tool_scan(const char* afs_path, const char* report_path)
+{
+    RF_MAP* map = rf_map(afs_path);
+    
+    if((map == NULL) || (afs_check_if_valid(map->data, map->size) != AFS_GOOD))
+    {
+        printf("File is not a valid AFS file.\n");
+        map = rf_unmap(map);
+        return;
+    }
+    
+    const uint8_t* data = map->data;
+    const uint32_t size = map->size;
+    const uint32_t first_file_id = afs_find_first_file_index(data, size);
+    
+    if(first_file_id == AFS_ERROR)
+    {
+        printf("AFS has no files.\n");
+        map = rf_unmap(map);
+        return;
+    }
+    
+    const uint32_t file_count = afs_count_possible_files(first_file_id, data);
+    const uint32_t metadata_index = afs_find_metadata_index(first_file_id, file_count, data);
+    
+    /* Only the table is read, entries are decoded straight from the mapping */
+    CRI_SCAN_ENTRY* entries = (CRI_SCAN_ENTRY*)calloc(metadata_index - first_file_id + 1, sizeof(CRI_SCAN_ENTRY));
+    uint32_t count = 0;
+    
+    for(uint32_t i = first_file_id; i != metadata_index; ++i)
+    {
+        const uint32_t entry_pos = afs_id_to_entry_offset(i);
+        const uint32_t entry_offset = tr_read_u32le(&data[entry_pos]);
+        const uint32_t entry_size = tr_read_u32le(&data[entry_pos+4]);
+        
+        if(entry_offset && entry_size && (entry_offset < size) && (entry_size <= (size - entry_offset)))
+        {
+            entries[count].id = i;
+            entries[count].data = &data[entry_offset];
+            entries[count].size = entry_size;
+            entries[count].adx_key = g_key;
+            count += 1;
+        }
+    }
+    
+    cri_scan_entries(entries, count, g_threads);
+    
+    uint32_t measured = 0;
+    
+    for(uint32_t i = 0; i != count; ++i)
+    {
+        measured += (entries[i].status == CRI_SCAN_OK);
+    }
+    
+    if(cri_scan_write_report(report_path, afs_path, entries, count) == FU_SUCCESS)
+        printf("Measured %u of %u entries into %s.\n", measured, count, report_path);
+    else
+        printf("Couldn't write the report to %s.\n", report_path);
+    
+    free(entries);
+    map = rf_unmap(map);
+}
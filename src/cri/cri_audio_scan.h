@@ -0,0 +1,268 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <kwaslib/core/io/file_utils.h>
+#include <kwaslib/core/math/audio_meter.h>
+#include <kwaslib/core/thread/thread_pool.h>
+#include <kwaslib/cri/audio/awb.h>
+#include <kwaslib/cri/audio/adx.h>
+#include <kwaslib/cri/audio/hca.h>
+#include <kwaslib/nw4r/bcwav.h>
+
+/*
+    Audio QA scan shared by cri_awb_tool and cri_afs_tool.
+    Entries are decoded in chunks straight from the archive
+    and measured, nothing is written but the report.
+*/
+
+/*
+    Defines
+*/
+#define CRI_SCAN_CHUNK          (uint32_t)(4096)    /* Samples per channel */
+
+#define CRI_SCAN_OK             (uint8_t)(0)
+#define CRI_SCAN_UNSUPPORTED    (uint8_t)(1)        /* No decoder for the format */
+#define CRI_SCAN_BROKEN         (uint8_t)(2)        /* Decoder refused the data or stopped early */
+
+/*
+    Types
+*/
+typedef struct
+{
+    uint32_t id;
+    const uint8_t* data;
+    uint32_t size;          /* Most the entry can take */
+    CRI_ADX_KEY adx_key;    /* Used if the ADX is encrypted */
+    uint64_t hca_key;       /* Used if the HCA is keyed, mixed with the subkey */
+
+    /* Filled by cri_scan_entries() */
+    uint8_t type;           /* AWB_DATA_* */
+    uint8_t status;         /* CRI_SCAN_* */
+    uint8_t channel_count;
+    uint32_t sample_rate;
+    AM_RESULT result;
+} CRI_SCAN_ENTRY;
+
+/*
+    Scanning
+*/
+inline static void cri_scan_entry(CRI_SCAN_ENTRY* entry);
+inline static void cri_scan_entries(CRI_SCAN_ENTRY* entries, const uint32_t count, const uint32_t thread_count);
+
+/*
+    Report
+*/
+inline static uint8_t cri_scan_write_report(const char* path, const char* archive,
+                                            CRI_SCAN_ENTRY* entries, const uint32_t count);
+
+/*
+    Implementation
+*/
+
+/*
+    Scanning
+*/
+inline static void cri_scan_entry(CRI_SCAN_ENTRY* entry)
+{
+    const uint32_t size = awb_probe_data(entry->data, entry->size, &entry->type);
+    ADX_DECODER* adx = NULL;
+    HCA_DECODER* hca = NULL;
+    BCWAV_DECODER* bcwav = NULL;
+
+    switch(entry->type)
+    {
+        case AWB_DATA_ADX:
+            adx = adx_decoder_open(entry->data, size, entry->adx_key);
+            if(adx == NULL) break;
+            entry->channel_count = adx->channel_count;
+            entry->sample_rate = adx->sample_rate;
+            break;
+        case AWB_DATA_HCA:
+            hca = hca_decoder_open(entry->data, size, entry->hca_key);
+            if(hca == NULL) break;
+            entry->channel_count = hca->channel_count;
+            entry->sample_rate = hca->sample_rate;
+            break;
+        case AWB_DATA_BCWAV:
+            bcwav = bcwav_decoder_open(entry->data, size);
+            if(bcwav == NULL) break;
+            entry->channel_count = bcwav->channel_count;
+            entry->sample_rate = bcwav->sample_rate;
+            break;
+        default:
+            /* AHX has no decoder in kwaslib */
+            entry->status = CRI_SCAN_UNSUPPORTED;
+            return;
+    }
+
+    /* HCAs the decoder can't open, like VBR ones or v1.x with an ATH curve */
+    if((entry->type == AWB_DATA_HCA) && (hca == NULL))
+    {
+        entry->status = CRI_SCAN_UNSUPPORTED;
+        return;
+    }
+
+    AM_METER* meter = am_create(entry->channel_count, entry->sample_rate);
+
+    if(meter == NULL)
+    {
+        adx = adx_decoder_close(adx);
+        hca = hca_decoder_close(hca);
+        bcwav = bcwav_decoder_close(bcwav);
+        entry->status = CRI_SCAN_BROKEN;
+        return;
+    }
+
+    int16_t* pcm = (int16_t*)malloc(CRI_SCAN_CHUNK*entry->channel_count*sizeof(int16_t));
+    uint32_t decoded = 0;
+
+    do
+    {
+        if(adx) decoded = adx_decode(adx, pcm, CRI_SCAN_CHUNK);
+        else if(hca) decoded = hca_decode(hca, pcm, CRI_SCAN_CHUNK);
+        else decoded = bcwav_decode(bcwav, pcm, CRI_SCAN_CHUNK);
+        am_feed(meter, pcm, decoded);
+    }
+    while(decoded);
+
+    am_get_result(meter, &entry->result);
+    entry->status = (hca && hca->error) ? CRI_SCAN_BROKEN : CRI_SCAN_OK;
+
+    free(pcm);
+    meter = am_free(meter);
+    adx = adx_decoder_close(adx);
+    hca = hca_decoder_close(hca);
+    bcwav = bcwav_decoder_close(bcwav);
+}
+
+inline static void cri_scan_worker(void* user, const uint64_t index)
+{
+    CRI_SCAN_ENTRY* entries = (CRI_SCAN_ENTRY*)user;
+    cri_scan_entry(&entries[index]);
+}
+
+inline static void cri_scan_entries(CRI_SCAN_ENTRY* entries, const uint32_t count, const uint32_t thread_count)
+{
+    tp_parallel_for(count, thread_count, cri_scan_worker, entries);
+}
+
+/*
+    Report
+*/
+inline static const char* cri_scan_type_str(const uint8_t type)
+{
+    switch(type)
+    {
+        case AWB_DATA_ADX:   return "adx";
+        case AWB_DATA_HCA:   return "hca";
+        case AWB_DATA_BCWAV: return "bcwav";
+        case AWB_DATA_AHX:   return "ahx";
+        default:             return "bin";
+    }
+}
+
+inline static const char* cri_scan_status_str(const uint8_t status)
+{
+    switch(status)
+    {
+        case CRI_SCAN_OK:           return "ok";
+        case CRI_SCAN_UNSUPPORTED:  return "unsupported";
+        default:                    return "broken";
+    }
+}
+
+/* dB value, `inf` for silence */
+inline static void cri_scan_write_db(FILE* f, const double db, const char* inf)
+{
+    if(isinf(db))
+        fprintf(f, "%s", inf);
+    else
+        fprintf(f, "%.2f", db);
+}
+
+/*
+    Writes JSON if the path ends with .json, CSV otherwise.
+    Unmeasured values are empty in CSV and null in JSON, -inf dB is "-inf" and null.
+
+    Returns FU_SUCCESS or FU_ERROR.
+*/
+inline static uint8_t cri_scan_write_report(const char* path, const char* archive,
+                                            CRI_SCAN_ENTRY* entries, const uint32_t count)
+{
+    FILE* f = fopen(path, "w");
+
+    if(f == NULL)
+    {
+        return FU_ERROR;
+    }
+
+    const size_t path_len = strlen(path);
+    const uint8_t json = (path_len >= 5) && (strcmp(&path[path_len - 5], ".json") == 0);
+
+    if(json)
+    {
+        fprintf(f, "{\n    \"archive\": \"");
+
+        for(const char* c = archive; *c; ++c)
+        {
+            if((*c == '"') || (*c == '\\')) fputc('\\', f);
+            fputc(*c, f);
+        }
+
+        fprintf(f, "\",\n    \"entries\": [");
+    }
+    else
+    {
+        fprintf(f, "id,type,status,channels,sample_rate,samples,duration_s,"
+                   "peak_dbfs,rms_dbfs,integrated_lufs,dc_offset,clipped\n");
+    }
+
+    for(uint32_t i = 0; i != count; ++i)
+    {
+        const CRI_SCAN_ENTRY* e = &entries[i];
+        const AM_RESULT* r = &e->result;
+        const char* inf = json ? "null" : "-inf";
+
+        if(json)
+        {
+            fprintf(f, "%s\n        {\"id\": %u, \"type\": \"%s\", \"status\": \"%s\"",
+                    i ? "," : "", e->id, cri_scan_type_str(e->type), cri_scan_status_str(e->status));
+        }
+        else
+        {
+            fprintf(f, "%u,%s,%s", e->id, cri_scan_type_str(e->type), cri_scan_status_str(e->status));
+        }
+
+        if(e->status != CRI_SCAN_OK)
+        {
+            fprintf(f, json ? "}" : ",,,,,,,,,\n");
+            continue;
+        }
+
+        const double duration = (double)r->sample_count/e->sample_rate;
+
+        fprintf(f, json ? ", \"channels\": %u, \"sample_rate\": %u, \"samples\": %llu, \"duration_s\": %.3f, \"peak_dbfs\": "
+                        : ",%u,%u,%llu,%.3f,",
+                e->channel_count, e->sample_rate, (unsigned long long)r->sample_count, duration);
+        cri_scan_write_db(f, am_to_db(r->peak), inf);
+        fprintf(f, json ? ", \"rms_dbfs\": " : ",");
+        cri_scan_write_db(f, am_to_db(r->rms), inf);
+        fprintf(f, json ? ", \"integrated_lufs\": " : ",");
+        cri_scan_write_db(f, r->integrated, inf);
+        fprintf(f, json ? ", \"dc_offset\": %.6f, \"clipped\": %llu}" : ",%.6f,%llu\n",
+                r->dc_offset, (unsigned long long)r->clipped);
+    }
+
+    if(json)
+    {
+        fprintf(f, "\n    ]\n}\n");
+    }
+
+    fclose(f);
+
+    return FU_SUCCESS;
+}
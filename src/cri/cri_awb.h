@@ -19,6 +19,16 @@ inline static void cri_awb_afs2_to_xml(AWB_FILE* afs2, SEXML_ELEMENT* root, SU_S
 	Packing
 */
 inline static AWB_FILE* cri_awb_xml_to_afs2(SEXML_ELEMENT* awb_root);
+inline static void cri_awb_xml_to_header(SEXML_ELEMENT* awb_root, AWB_HEADER* header);
+
+inline static void cri_awb_xml_to_header(SEXML_ELEMENT* awb_root, AWB_HEADER* header)
+{
+    header->version = sexml_get_attribute_int_by_name(awb_root, "version");
+    header->offset_size = sexml_get_attribute_int_by_name(awb_root, "offset_size");
+    header->id_size = sexml_get_attribute_int_by_name(awb_root, "id_size");
+    header->alignment = sexml_get_attribute_int_by_name(awb_root, "alignment");
+    header->subkey = sexml_get_attribute_int_by_name(awb_root, "subkey");
+}
 
 /*
     Misc
@@ -120,12 +130,7 @@ inline static void cri_awb_afs2_to_xml(AWB_FILE* afs2, SEXML_ELEMENT* root, SU_S
 inline static AWB_FILE* cri_awb_xml_to_afs2(SEXML_ELEMENT* awb_root)
 {
     AWB_FILE* afs2 = awb_alloc();
-    
-    afs2->header.version = sexml_get_attribute_int_by_name(awb_root, "version");
-    afs2->header.offset_size = sexml_get_attribute_int_by_name(awb_root, "offset_size");
-    afs2->header.id_size = sexml_get_attribute_int_by_name(awb_root, "id_size");
-    afs2->header.alignment = sexml_get_attribute_int_by_name(awb_root, "alignment");
-    afs2->header.subkey = sexml_get_attribute_int_by_name(awb_root, "subkey");
+    cri_awb_xml_to_header(awb_root, &afs2->header);
     const uint32_t entries_count = cvec_size(awb_root->elements);
     
     for(uint32_t i = 0; i != entries_count; ++i)
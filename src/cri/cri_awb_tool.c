@@ -5,31 +5,99 @@
 
 #include <kwaslib/core/io/path_utils.h>
 #include <kwaslib/core/io/file_utils.h>
+#include <kwaslib/core/io/raw_file.h>
 #include <kwaslib/core/data/text/sexml.h>
+#include <kwaslib/core/io/arg_parser.h>
+#include <kwaslib/core/thread/thread_pool.h>
+#include <kwaslib/cri/audio/hca.h>
+#include <kwaslib/cri/audio/adx.h>
 
 /* Unpacking/packing stuff shared with cri_utf_tool */
 #include "cri_awb.h"
+#include "cri_audio_scan.h"
 
 /*
     Globals
 */
-uint8_t g_afs2_counter = 0; 
+AP_DESC* g_arg_node = NULL;
+uint8_t g_afs2_counter      = 0; 
+uint8_t g_flag_extract      = 0;
+uint32_t g_extract_id       = 0;
+uint8_t g_flag_rekey        = 0;
+uint64_t g_key              = 0;
+uint64_t g_new_key          = 0;
+uint8_t g_flag_new_subkey   = 0;
+uint16_t g_new_subkey       = 0;
+uint16_t g_new_type         = HCA_CIPH_NONE;
+uint8_t g_new_adx_type      = ADX_ENC_NONE;
+uint32_t g_threads          = TP_THREADS_AUTO;
+uint8_t g_flag_scan         = 0;
+char* g_scan_path           = NULL;
 
 /*
 	Common
 */
+void awb_tool_parse_arguments(int argc, char** argv);
 void awb_tool_print_usage(char* program_name);
 
+/*
+    Packing
+*/
+uint8_t awb_tool_write_awb(SEXML_ELEMENT* awb_root, const char* out_path);
+
+/*
+    Single entry
+*/
+void awb_tool_extract_id(PU_PATH* input_file_path, const char* awb_path, const uint32_t id);
+
+/*
+    Re-keying
+*/
+void awb_tool_rekey(const char* path);
+
+/*
+    Audio QA
+*/
+void awb_tool_scan(const char* awb_path, const char* report_path);
+
 /* 
 	Entry
 */
 int main(int argc, char** argv)
 {
+    /* Setting up arguments */
+    g_arg_node = ap_create();
+    ap_append_desc_uint(g_arg_node, 0, "--id", "Extract only the entry with this id");
+    ap_append_desc_str(g_arg_node, "0", "--key", "Current HCA/ADX keycode, decimal or 0x hex");
+    ap_append_desc_str(g_arg_node, "0", "--new_key", "Re-key HCAs and ADXs in place with this keycode, 0 decrypts");
+    ap_append_desc_uint(g_arg_node, 0, "--new_subkey", "Subkey to store in the AWB while re-keying");
+    ap_append_desc_uint(g_arg_node, 0, "--new_type", "HCA cipher type after re-keying, 0, 1 or 56");
+    ap_append_desc_uint(g_arg_node, 0, "--new_adx_type", "ADX encryption type after re-keying, 0 or 9");
+    ap_append_desc_str(g_arg_node, "", "--scan", "Measure levels of every entry into a .csv or .json report");
+    ap_append_desc_uint(g_arg_node, TP_THREADS_AUTO, "--threads", "Amount of threads for re-keying and scanning, 0 for all cores");
+    
 	if(argc == 1)
 	{
 		awb_tool_print_usage(&argv[0][0]);
 		return 0;
 	}
+    
+    awb_tool_parse_arguments(argc, argv);
+    g_arg_node = ap_free(g_arg_node);
+    
+    /* Re-keying works on the file as it is */
+    if(g_flag_rekey && pu_is_file(argv[1]))
+    {
+        awb_tool_rekey(argv[1]);
+        return 0;
+    }
+    
+    if(g_flag_scan && pu_is_file(argv[1]))
+    {
+        awb_tool_scan(argv[1], g_scan_path);
+        free(g_scan_path);
+        return 0;
+    }
 
 	/* It's a file so let's process it */
 	if(pu_is_file(argv[1]))
@@ -54,10 +122,6 @@ int main(int argc, char** argv)
                 return 0;
             }
             
-            /* Convert the AWB to SU_STRING* for saving */
-			AWB_FILE* afs2 = cri_awb_xml_to_afs2(xml_root);
-			SU_STRING* afs2_data = awb_to_data(afs2);
-
 			/* Remove XML extension */
 			su_remove(input_file_path->ext, 0, -1);
 			SU_STRING* awb_out_str = pu_path_to_string(input_file_path);
@@ -72,12 +136,20 @@ int main(int argc, char** argv)
 
             /* Saving the AFS2 archive to disk */
 			printf("\nAWB Path: %*s\n", awb_out_str->size, awb_out_str->ptr);
-            fu_buffer_to_file(awb_out_str->ptr, afs2_data->ptr, afs2_data->size, 1);
             
-            afs2 = awb_free(afs2);
-            afs2_data = su_free(afs2_data);
+            /* Payloads are streamed from their files */
+            if(awb_tool_write_awb(xml_root, awb_out_str->ptr) != FU_SUCCESS)
+            {
+                printf("Couldn't write the AWB file.\n");
+            }
+            
+            xml_root = sexml_destroy(xml_root);
             awb_out_str_ext = su_free(awb_out_str_ext);
             awb_out_str = su_free(awb_out_str);
+		}
+		else if(g_flag_extract) /* Only one waveform */
+		{
+            awb_tool_extract_id(input_file_path, argv[1], g_extract_id);
 		}
 		else /* Check if the file is a valid AFS2 file */
 		{
@@ -121,5 +193,293 @@ void awb_tool_print_usage(char* program_name)
 	printf("Converts CRIWARE AWB archive to XML and vice versa.\n");;
 	printf("Usage:\n");
 	printf("\tTo unpack: %s <file.awb>\n", program_name);
+	printf("\tTo extract one id: %s <file.awb> --id <id>\n", program_name);
+	printf("\tTo re-key HCAs/ADXs: %s <file.awb/hca/adx> --key <key> --new_key <key> <options>\n", program_name);
+	printf("\tTo measure levels: %s <file.awb> --scan <report.csv/json> --key <key>\n", program_name);
 	printf("\tTo pack: %s <file.xml>\n", program_name);
+    printf("\n");
+    printf("Options:\n");
+
+    for(uint32_t i = 0; i != ap_get_desc_count(g_arg_node); ++i)
+    {
+        AP_ARG_DESC* apd = ap_get_desc_by_id(g_arg_node, i);
+        printf("\t%24s\t%s\n", apd->name, apd->description);
+    }
+}
+
+void awb_tool_parse_arguments(int argc, char** argv)
+{
+    if(ap_parse(g_arg_node, argc-2, &argv[2]) != AP_STAT_SUCCESS)
+    {
+        return;
+    }
+
+    AP_ARG_VEC arg_id = ap_get_arg_vec_by_name(g_arg_node, "--id");
+    AP_ARG_VEC arg_key = ap_get_arg_vec_by_name(g_arg_node, "--key");
+    AP_ARG_VEC arg_new_key = ap_get_arg_vec_by_name(g_arg_node, "--new_key");
+    AP_ARG_VEC arg_new_subkey = ap_get_arg_vec_by_name(g_arg_node, "--new_subkey");
+    AP_ARG_VEC arg_new_type = ap_get_arg_vec_by_name(g_arg_node, "--new_type");
+    AP_ARG_VEC arg_new_adx_type = ap_get_arg_vec_by_name(g_arg_node, "--new_adx_type");
+    AP_ARG_VEC arg_scan = ap_get_arg_vec_by_name(g_arg_node, "--scan");
+    AP_ARG_VEC arg_threads = ap_get_arg_vec_by_name(g_arg_node, "--threads");
+    
+    if(arg_id)
+    {
+        g_flag_extract = 1;
+        g_extract_id = AP_GET_ARG_UINT(AP_ARG_FROM_VEC_BY_ID(arg_id, 0));
+        arg_id = ap_free_arg_vec(arg_id);
+    }
+    
+    if(arg_key)
+    {
+        g_key = strtoull(AP_GET_ARG_STR(AP_ARG_FROM_VEC_BY_ID(arg_key, 0)), NULL, 0);
+        arg_key = ap_free_arg_vec(arg_key);
+    }
+    
+    if(arg_new_key)
+    {
+        g_flag_rekey = 1;
+        g_new_key = strtoull(AP_GET_ARG_STR(AP_ARG_FROM_VEC_BY_ID(arg_new_key, 0)), NULL, 0);
+        arg_new_key = ap_free_arg_vec(arg_new_key);
+        
+        /* Keyless unless told otherwise */
+        g_new_type = g_new_key ? HCA_CIPH_KEYED : HCA_CIPH_NONE;
+        g_new_adx_type = g_new_key ? ADX_ENC_TYPE9 : ADX_ENC_NONE;
+    }
+    
+    if(arg_new_subkey)
+    {
+        g_flag_new_subkey = 1;
+        g_new_subkey = AP_GET_ARG_UINT(AP_ARG_FROM_VEC_BY_ID(arg_new_subkey, 0));
+        arg_new_subkey = ap_free_arg_vec(arg_new_subkey);
+    }
+    
+    if(arg_new_type)
+    {
+        g_new_type = AP_GET_ARG_UINT(AP_ARG_FROM_VEC_BY_ID(arg_new_type, 0));
+        arg_new_type = ap_free_arg_vec(arg_new_type);
+    }
+    
+    if(arg_new_adx_type)
+    {
+        g_new_adx_type = AP_GET_ARG_UINT(AP_ARG_FROM_VEC_BY_ID(arg_new_adx_type, 0));
+        arg_new_adx_type = ap_free_arg_vec(arg_new_adx_type);
+    }
+    
+    if(arg_scan)
+    {
+        g_flag_scan = 1;
+        g_scan_path = strdup(AP_GET_ARG_STR(AP_ARG_FROM_VEC_BY_ID(arg_scan, 0)));
+        arg_scan = ap_free_arg_vec(arg_scan);
+    }
+    
+    if(arg_threads)
+    {
+        g_threads = AP_GET_ARG_UINT(AP_ARG_FROM_VEC_BY_ID(arg_threads, 0));
+        arg_threads = ap_free_arg_vec(arg_threads);
+    }
+}
+
+
+/*
+    Packing
+*/
+uint8_t awb_tool_write_awb(SEXML_ELEMENT* awb_root, const char* out_path)
+{
+    AWB_FILE* afs2 = awb_alloc();
+    cri_awb_xml_to_header(awb_root, &afs2->header);
+    
+    const uint32_t elements_count = cvec_size(awb_root->elements);
+    RF_SOURCE* sources = (RF_SOURCE*)calloc(elements_count+1, sizeof(RF_SOURCE));
+    
+    for(uint32_t i = 0; i != elements_count; ++i)
+    {
+        SEXML_ELEMENT* entry_xml = sexml_get_element_by_id(awb_root, i);
+        
+        /* Same rules as cri_awb_xml_to_afs2() */
+        if(su_cmp_char(entry_xml->name->ptr, entry_xml->name->size, "entry", 5) == SU_STRINGS_MATCH)
+        {
+            SEXML_ATTRIBUTE* id_attr = sexml_get_attribute_by_name(entry_xml, "id");
+            SEXML_ATTRIBUTE* file_path = sexml_get_attribute_by_name(entry_xml, "path");
+            
+            if(id_attr && file_path)
+            {
+                const uint64_t size = fu_get_file_size(file_path->value->ptr);
+                
+                if(size != 0)
+                {
+                    const uint32_t id = sexml_get_attribute_uint(id_attr);
+                    sources[awb_get_file_count(afs2)] = rf_source_path(file_path->value->ptr, 0, size);
+                    awb_append_entry(afs2, id, NULL, size);
+                }
+            }
+        }
+    }
+    
+    RF_FILE* out = rf_open(out_path, RF_WRITE);
+    uint8_t status = FU_ERROR;
+    
+    if(out)
+    {
+        status = awb_write_to_rf(afs2, out, sources);
+        out = rf_close(out);
+    }
+    
+    free(sources);
+    afs2 = awb_free(afs2);
+    
+    return status;
+}
+
+/*
+    Single entry
+*/
+void awb_tool_extract_id(PU_PATH* input_file_path, const char* awb_path, const uint32_t id)
+{
+    RF_MAP* map = rf_map(awb_path);
+    AWB_INDEX* index = map ? awb_open_index(map->data, map->size) : NULL;
+    
+    if(index == NULL)
+    {
+        printf("File is not a valid AFS2 file.\n");
+        map = rf_unmap(map);
+        return;
+    }
+    
+    AWB_INDEX_ENTRY* entry = awb_index_find_by_id(index, id);
+    
+    const uint8_t* data = entry ? awb_index_get_data(index, entry) : NULL;
+    
+    if(entry == NULL)
+    {
+        printf("No entry with id %u.\n", id);
+    }
+    else if(data == NULL)
+    {
+        printf("Entry %u is empty or goes past the end of the file.\n", id);
+    }
+    else
+    {
+        SU_STRING* out_str = pu_path_to_string(input_file_path);
+        char buf[32] = {0};
+        const uint32_t buf_size = sprintf(buf, "_%05u", entry->id);
+        su_insert_char(out_str, -1, buf, buf_size);
+        
+        switch(entry->type)
+        {
+            case AWB_DATA_ADX:
+                su_insert_char(out_str, -1, ".adx", 4);
+                break;
+            case AWB_DATA_AHX:
+                su_insert_char(out_str, -1, ".ahx", 4);
+                break;
+            case AWB_DATA_HCA:
+                su_insert_char(out_str, -1, ".hca", 4);
+                break;
+            case AWB_DATA_BCWAV:
+                su_insert_char(out_str, -1, ".bcwav", 6);
+                break;
+            default:
+                su_insert_char(out_str, -1, ".bin", 4);
+        }
+        
+        printf("Save Path: %*s\n", out_str->size, out_str->ptr);
+        fu_buffer_to_file(out_str->ptr, (const char*)data, entry->size, 1);
+        out_str = su_free(out_str);
+    }
+    
+    index = awb_close_index(index);
+    map = rf_unmap(map);
+}
+
+/*
+    Re-keying
+*/
+void awb_tool_rekey(const char* path)
+{
+    RF_MAP* map = rf_map_rw(path);
+    
+    if(map == NULL)
+    {
+        printf("Could not open \"%s\" for writing.\n", path);
+        return;
+    }
+    
+    if((map->size >= AWB_HEADER_SIZE) && (memcmp(map->data, AWB_MAGIC, 4) == 0))
+    {
+        const uint16_t subkey = g_flag_new_subkey ? g_new_subkey : tr_read_u16le(&map->data[14]);
+        const uint32_t rekeyed = awb_rekey(map->data, map->size, g_key, g_new_key,
+                                           subkey, g_new_type, g_new_adx_type, g_threads);
+        printf("Re-keyed %u HCA/ADX file(s).\n", rekeyed);
+    }
+    else if(adx_check_if_valid(map->data, map->size) == ADX_TYPE_ADX)
+    {
+        const CRI_ADX_KEY old_key = cri_key_adx_type9(g_key, 0);
+        const CRI_ADX_KEY new_key = cri_key_adx_type9(g_new_key, 0);
+        
+        if(adx_rekey(map->data, map->size, old_key, new_key, g_new_adx_type))
+            printf("Re-keyed the ADX file.\n");
+        else
+            printf("Unknown ADX encryption type.\n");
+    }
+    else if(hca_rekey(map->data, map->size, g_key, g_new_key, g_new_type, g_threads))
+    {
+        printf("Re-keyed the HCA file.\n");
+    }
+    else
+    {
+        printf("File is not an AFS2, HCA or ADX file, or the cipher type can't be changed.\n");
+    }
+    
+    map = rf_unmap(map);
+}
+
+/*
+    Audio QA
+*/
+void awb_tool_scan(const char* awb_path, const char* report_path)
+{
+    RF_MAP* map = rf_map(awb_path);
+    AWB_INDEX* index = map ? awb_open_index(map->data, map->size) : NULL;
+    
+    if(index == NULL)
+    {
+        printf("File is not a valid AFS2 file.\n");
+        map = rf_unmap(map);
+        return;
+    }
+    
+    /* Keys are mixed with the subkey like when re-keying */
+    const CRI_ADX_KEY adx_key = cri_key_adx_type9(g_key, index->header.subkey);
+    const uint64_t hca_key = cri_key_scramble(g_key, index->header.subkey);
+    const uint32_t count = awb_index_get_file_count(index);
+    CRI_SCAN_ENTRY* entries = (CRI_SCAN_ENTRY*)calloc(count + 1, sizeof(CRI_SCAN_ENTRY));
+    
+    for(uint32_t i = 0; i != count; ++i)
+    {
+        const AWB_INDEX_ENTRY* entry = &index->entries[i];
+        entries[i].id = entry->id;
+        entries[i].data = &index->data[entry->offset];
+        entries[i].size = entry->size;
+        entries[i].adx_key = adx_key;
+        entries[i].hca_key = hca_key;
+    }
+    
+    cri_scan_entries(entries, count, g_threads);
+    
+    uint32_t measured = 0;
+    
+    for(uint32_t i = 0; i != count; ++i)
+    {
+        measured += (entries[i].status == CRI_SCAN_OK);
+    }
+    
+    if(cri_scan_write_report(report_path, awb_path, entries, count) == FU_SUCCESS)
+        printf("Measured %u of %u entries into %s.\n", measured, count, report_path);
+    else
+        printf("Couldn't write the report to %s.\n", report_path);
+    
+    free(entries);
+    index = awb_close_index(index);
+    map = rf_unmap(map);
 }
@@ -0,0 +1,207 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <kwaslib/core/io/path_utils.h>
+#include <kwaslib/core/io/file_utils.h>
+#include <kwaslib/core/io/arg_parser.h>
+#include <kwaslib/core/thread/thread_pool.h>
+
+#include <kwaslib/cri/archive/cpk.h>
+
+/*
+    Globals
+*/
+AP_DESC* g_arg_node = NULL;
+uint8_t g_flag_list         = 0;
+uint32_t g_threads          = TP_THREADS_AUTO;
+char* g_extract_path        = NULL;
+
+/*
+	Common
+*/
+void cpk_tool_parse_arguments(int argc, char** argv);
+
+void cpk_tool_print_usage(char* program_name);
+void cpk_tool_print_cpk(CPK_FILE* cpk);
+
+/*
+	Unpacker
+*/
+void cpk_tool_extract_one(CPK_FILE* cpk, const char* entry_path);
+void cpk_tool_extract_all(CPK_FILE* cpk, PU_PATH* input_file_path);
+
+/*
+	Entry
+*/
+int main(int argc, char** argv)
+{
+    /* Setting up arguments */
+    g_arg_node = ap_create();
+    ap_append_desc_noval(g_arg_node, 0, "--list", "Only print the entries");
+    ap_append_desc_str(g_arg_node, "", "--extract", "Extract a single entry by its path");
+    ap_append_desc_uint(g_arg_node, TP_THREADS_AUTO, "--threads", "Amount of threads for extraction, 0 for all cores");
+
+	if(argc == 1)
+	{
+		cpk_tool_print_usage(&argv[0][0]);
+		return 0;
+	}
+
+    cpk_tool_parse_arguments(argc, argv);
+    g_arg_node = ap_free(g_arg_node);
+
+	if(pu_is_file(argv[1]) == 0)
+	{
+        printf("\"%s\" is not a file.\n", argv[1]);
+        return 0;
+    }
+
+    CPK_FILE* cpk = cpk_open(argv[1]);
+
+    if(cpk == NULL)
+    {
+        printf("File is not a valid CPK archive.\n");
+        return 0;
+    }
+
+    PU_PATH* input_file_path = pu_split_path(argv[1], strlen(argv[1]));
+
+    if(g_flag_list)
+    {
+        cpk_tool_print_cpk(cpk);
+    }
+    else if(g_extract_path)
+    {
+        cpk_tool_extract_one(cpk, g_extract_path);
+    }
+    else
+    {
+        cpk_tool_extract_all(cpk, input_file_path);
+    }
+
+    input_file_path = pu_free_path(input_file_path);
+    cpk = cpk_close(cpk);
+    free(g_extract_path);
+
+	return 0;
+}
+
+/*
+	Common
+*/
+void cpk_tool_parse_arguments(int argc, char** argv)
+{
+    if(ap_parse(g_arg_node, argc-2, &argv[2]) != AP_STAT_SUCCESS)
+    {
+        return;
+    }
+
+    AP_ARG_VEC arg_list = ap_get_arg_vec_by_name(g_arg_node, "--list");
+    AP_ARG_VEC arg_extract = ap_get_arg_vec_by_name(g_arg_node, "--extract");
+    AP_ARG_VEC arg_threads = ap_get_arg_vec_by_name(g_arg_node, "--threads");
+
+    if(arg_list)
+    {
+        g_flag_list = 1;
+        arg_list = ap_free_arg_vec(arg_list);
+    }
+
+    if(arg_extract)
+    {
+        /* Parser owns the value */
+        g_extract_path = strdup(AP_GET_ARG_STR(AP_ARG_FROM_VEC_BY_ID(arg_extract, 0)));
+        arg_extract = ap_free_arg_vec(arg_extract);
+    }
+
+    if(arg_threads)
+    {
+        g_threads = AP_GET_ARG_UINT(AP_ARG_FROM_VEC_BY_ID(arg_threads, 0));
+        arg_threads = ap_free_arg_vec(arg_threads);
+    }
+}
+
+void cpk_tool_print_usage(char* program_name)
+{
+	printf("Extracts CRIWARE CPK archives.\n");
+	printf("Usage:\n");
+	printf("\tTo unpack: %s <file.cpk> <options>\n", program_name);
+    printf("\n");
+    printf("Options:\n");
+
+    for(uint32_t i = 0; i != ap_get_desc_count(g_arg_node); ++i)
+    {
+        AP_ARG_DESC* apd = ap_get_desc_by_id(g_arg_node, i);
+        printf("\t%24s\t%s\n", apd->name, apd->description);
+    }
+}
+
+void cpk_tool_print_cpk(CPK_FILE* cpk)
+{
+    const uint32_t count = cpk_get_entry_count(cpk);
+
+    printf("### CPK ###\n");
+    printf("Content offset: %llx\n", (unsigned long long)cpk->content_offset);
+    printf("Content size: %llu\n", (unsigned long long)cpk->content_size);
+    printf("Align: %u\n", cpk->align);
+    printf("Tables:%s%s%s%s\n", cpk->toc ? " TOC" : "", cpk->itoc ? " ITOC" : "",
+                                cpk->etoc ? " ETOC" : "", cpk->gtoc ? " GTOC" : "");
+    printf("Files: %u\n", count);
+
+    for(uint32_t i = 0; i != count; ++i)
+    {
+        CPK_ENTRY* entry = cpk_get_entry_by_index(cpk, i);
+        printf("\t[%5u] %*s | Offset %llx | Size %llu",
+               entry->id, entry->path->size, entry->path->ptr,
+               (unsigned long long)entry->offset, (unsigned long long)entry->size);
+
+        if(cpk_entry_is_compressed(entry))
+        {
+            printf(" | Extract size %llu", (unsigned long long)entry->extract_size);
+        }
+
+        printf("\n");
+    }
+}
+
+/*
+	Unpacker
+*/
+void cpk_tool_extract_one(CPK_FILE* cpk, const char* entry_path)
+{
+    CPK_ENTRY* entry = cpk_find_entry_by_path(cpk, entry_path);
+
+    if(entry == NULL)
+    {
+        printf("No entry \"%s\" in the archive.\n", entry_path);
+        return;
+    }
+
+    /* Saved to the working directory */
+    SU_STRING* out_str = pu_get_basename_char(entry->path->ptr);
+    printf("Save Path: %*s\n", out_str->size, out_str->ptr);
+
+    if(cpk_extract_entry(cpk, entry, out_str->ptr) != FU_SUCCESS)
+    {
+        printf("Couldn't extract \"%s\".\n", entry_path);
+    }
+
+    out_str = su_free(out_str);
+}
+
+void cpk_tool_extract_all(CPK_FILE* cpk, PU_PATH* input_file_path)
+{
+    /* Output folder is named after the archive */
+    su_remove(input_file_path->ext, 0, -1);
+    SU_STRING* out_dir = pu_path_to_string(input_file_path);
+
+    printf("Output folder: %*s\n", out_dir->size, out_dir->ptr);
+
+    const uint32_t failed = cpk_extract_all(cpk, out_dir->ptr, g_threads);
+
+    printf("Extracted %u out of %u files.\n",
+           cpk_get_entry_count(cpk) - failed, cpk_get_entry_count(cpk));
+
+    out_dir = su_free(out_dir);
+}
@@ -0,0 +1,84 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include <kwaslib/kwas_all.h>
+#include <kwaslib/core/thread/thread_pool.h>
+
+/*
+    Measures the HCA encoder throughput as seconds of audio
+    encoded per second of wall time, for 1, 2, 4, ... threads.
+*/
+
+static double bench_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+int main(int argc, char** argv)
+{
+    uint32_t seconds = 60;
+    uint32_t max_threads = tp_get_cpu_count();
+    
+    if(argc > 1) seconds = strtoul(argv[1], NULL, 10);
+    if(argc > 2) max_threads = strtoul(argv[2], NULL, 10);
+    
+    if((seconds == 0) || (max_threads == 0))
+    {
+        printf("Usage: %s [seconds=60] [max_threads=cpu_count]\n", argv[0]);
+        return 0;
+    }
+    
+    /* Stereo 48kHz, two tones and some noise */
+    const uint32_t sample_rate = 48000;
+    const uint32_t sample_count = seconds*sample_rate;
+    int16_t* pcm = (int16_t*)malloc(sample_count*2*sizeof(int16_t));
+    uint32_t seed = 1;
+    
+    for(uint32_t i = 0; i != sample_count; ++i)
+    {
+        seed = seed*1103515245 + 12345;
+        const float noise = (float)((seed >> 16) & 0x7FF) - 1024.0f;
+        pcm[i*2] = 12000.0f*sinf(i*0.0314f) + noise;
+        pcm[i*2 + 1] = 9000.0f*sinf(i*0.0921f) + noise;
+    }
+    
+    HCA_ENCODE_PARAMS params = {0};
+    params.sample_rate = sample_rate;
+    params.channel_count = 2;
+    
+    printf("%u s of stereo %u Hz audio\n", seconds, sample_rate);
+    printf("threads\twall_s\taudio_s_per_s\tspeedup\n");
+    
+    double base = 0.0;
+    
+    for(uint32_t threads = 1; threads <= max_threads; threads *= 2)
+    {
+        params.thread_count = threads;
+        
+        const double start = bench_now();
+        SU_STRING* hca = hca_encode(pcm, sample_count, &params);
+        const double wall = bench_now() - start;
+        
+        if(hca == NULL)
+        {
+            printf("Encoding failed\n");
+            break;
+        }
+        
+        su_free(hca);
+        
+        const double rate = seconds/wall;
+        if(threads == 1) base = rate;
+        
+        printf("%u\t%.3f\t%.2f\t%.2fx\n", threads, wall, rate, rate/base);
+    }
+    
+    free(pcm);
+    
+    return 0;
+}
@@ -8,10 +8,12 @@
 #include <kwaslib/core/data/text/sexml.h>
 #include <kwaslib/core/data/vl.h>
 #include <kwaslib/core/io/arg_parser.h>
+#include <kwaslib/core/io/raw_file.h>
 
 #include <kwaslib/cri/utf/utf.h>
 #include <kwaslib/cri/utf/utf_table.h>
 #include <kwaslib/cri/utf/utf_common.h>
+#include <kwaslib/cri/utf/utf_patch.h>
 
 /* ACB command unpacking/packing */
 #include "cri_acb_cmd.h"
@@ -33,6 +35,9 @@ uint8_t g_flag_verbose      = 0;
 uint8_t g_flag_overwrite    = 0;
 uint8_t g_xml_indent        = 4;
 uint8_t g_afs2_counter      = 0; 
+char** g_set_values         = NULL;
+uint32_t g_set_count        = 0;
+char* g_patch_path          = NULL;
 
 /*
 	Common
@@ -42,6 +47,12 @@ void utf_tool_parse_arguments(int argc, char** argv);
 void utf_tool_print_usage(char* program_name);
 void utf_tool_print_table(UTF_TABLE* utf);
 
+/*
+    In-place patching
+*/
+void utf_tool_patch(const char* utf_path);
+void utf_tool_patch_error(const uint32_t line, const char* text, const uint8_t status);
+
 /*
 	Unpacker
 */
@@ -63,6 +74,8 @@ int main(int argc, char** argv)
     ap_append_desc_noval(g_arg_node, 0, "--verbose", "Print everything regarding the ACB/XML");
     ap_append_desc_noval(g_arg_node, 0, "--force", "Force overwrite of the output");
     ap_append_desc_uint(g_arg_node, 4, "--xml_indent", "Indentation for the XML file");
+    ap_append_desc_str(g_arg_node, "", "--set", "Change a cell in place, \"Column[row]/...=value\"");
+    ap_append_desc_str(g_arg_node, "", "--patch", "Apply a file of \"path = value\" lines in place");
     
 	if(argc == 1)
 	{
@@ -73,6 +86,21 @@ int main(int argc, char** argv)
     utf_tool_parse_arguments(argc, argv);
     g_arg_node = ap_free(g_arg_node);
 
+    /* Patching doesn't convert anything */
+    if(g_set_count || g_patch_path)
+    {
+        utf_tool_patch(argv[1]);
+        
+        for(uint32_t i = 0; i != g_set_count; ++i)
+        {
+            free(g_set_values[i]);
+        }
+        
+        free(g_set_values);
+        free(g_patch_path);
+        return 0;
+    }
+
 	/* It's a file so let's process it */
 	if(pu_is_file(argv[1]))
 	{
@@ -244,6 +272,8 @@ void utf_tool_parse_arguments(int argc, char** argv)
     AP_ARG_VEC arg_verbose = ap_get_arg_vec_by_name(g_arg_node, "--verbose");
     AP_ARG_VEC arg_force = ap_get_arg_vec_by_name(g_arg_node, "--force");
     AP_ARG_VEC arg_xml_indent = ap_get_arg_vec_by_name(g_arg_node, "--xml_indent");
+    AP_ARG_VEC arg_set = ap_get_arg_vec_by_name(g_arg_node, "--set");
+    AP_ARG_VEC arg_patch = ap_get_arg_vec_by_name(g_arg_node, "--patch");
     
     if(arg_verbose)
     {
@@ -262,6 +292,25 @@ void utf_tool_parse_arguments(int argc, char** argv)
         g_xml_indent = AP_GET_ARG_UINT(AP_ARG_FROM_VEC_BY_ID(arg_xml_indent, 0));
         arg_xml_indent = ap_free_arg_vec(arg_xml_indent);
     }
+    
+    if(arg_set)
+    {
+        g_set_count = ap_get_arg_vec_count(arg_set);
+        g_set_values = (char**)calloc(g_set_count, sizeof(char*));
+        
+        for(uint32_t i = 0; i != g_set_count; ++i)
+        {
+            g_set_values[i] = strdup(AP_GET_ARG_STR(AP_ARG_FROM_VEC_BY_ID(arg_set, i)));
+        }
+        
+        arg_set = ap_free_arg_vec(arg_set);
+    }
+    
+    if(arg_patch)
+    {
+        g_patch_path = strdup(AP_GET_ARG_STR(AP_ARG_FROM_VEC_BY_ID(arg_patch, 0)));
+        arg_patch = ap_free_arg_vec(arg_patch);
+    }
 }
 
 void utf_tool_print_table(UTF_TABLE* utf)
@@ -334,6 +383,69 @@ void utf_tool_print_table(UTF_TABLE* utf)
     }
 }
 
+/*
+    In-place patching
+*/
+void utf_tool_patch(const char* utf_path)
+{
+    RF_MAP* map = rf_map_rw(utf_path);
+    
+    if(map == NULL)
+    {
+        printf("Could not open \"%s\" for writing.\n", utf_path);
+        return;
+    }
+    
+    uint32_t failed = 0;
+    
+    for(uint32_t i = 0; i != g_set_count; ++i)
+    {
+        char* eq = strchr(g_set_values[i], '=');
+        uint8_t status = UTF_PATCH_ERR_PATH;
+        
+        if(eq)
+        {
+            *eq = '\0';
+            status = utf_patch_set(map->data, map->size, g_set_values[i], eq + 1);
+        }
+        
+        if(status != UTF_PATCH_OK)
+        {
+            printf("--set %s: %s\n", g_set_values[i], utf_patch_status_str(status));
+            failed += 1;
+        }
+        else if(g_flag_verbose)
+        {
+            printf("Set %s to %s\n", g_set_values[i], eq + 1);
+        }
+    }
+    
+    if(g_patch_path)
+    {
+        const int32_t patch_failed = utf_patch_apply_file(map->data, map->size,
+                                                          g_patch_path, utf_tool_patch_error);
+        
+        if(patch_failed < 0)
+        {
+            printf("Could not read the patch file \"%s\".\n", g_patch_path);
+            failed += 1;
+        }
+        else
+        {
+            failed += patch_failed;
+        }
+    }
+    
+    map = rf_unmap(map);
+    
+    printf("Patched \"%s\", %u change(s) failed.\n", utf_path, failed);
+}
+
+void utf_tool_patch_error(const uint32_t line, const char* text, const uint8_t status)
+{
+    printf("%s:%u: %s: %s\n", g_patch_path, line, text, utf_patch_status_str(status));
+}
+
 /*
 	Unpacker
 */
@@ -0,0 +1,1189 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <kwaslib/core/io/path_utils.h>
+#include <kwaslib/core/io/file_utils.h>
+#include <kwaslib/core/io/raw_file.h>
+#include <kwaslib/core/io/type_readers.h>
+#include <kwaslib/core/io/arg_parser.h>
+#include <kwaslib/core/data/text/sexml.h>
+#include <kwaslib/core/thread/thread_pool.h>
+#include <kwaslib/ext/miniz.h>
+
+#include <kwaslib/cri/archive/afs.h>
+#include <kwaslib/cri/archive/afs_parse.h>
+#include <kwaslib/cri/audio/awb.h>
+#include <kwaslib/cri/audio/adx.h>
+#include <kwaslib/cri/utf/utf_load.h>
+#include <kwaslib/cri/utf/utf_common.h>
+
+#include <kwaslib/platinum/dat.h>
+#include <kwaslib/platinum/wtb.h>
+
+/*
+    Unpacks nested archives in one go.
+
+    The input is mapped once and every container inside of it is only a slice
+    of that mapping, nothing is copied or written out before it's a leaf.
+    Containers are queued on a thread pool as they're found, so siblings
+    and their contents are unpacked on all cores at once.
+
+    Node at path P keeps its entries in the directory "P_" and all the bytes
+    in between them (header, tables, padding) in "P.skel".
+    The manifest lists entries in the order of their offsets, so the original
+    can be rebuilt front to back by interleaving the skeleton with the entries.
+*/
+
+/*
+    Globals
+*/
+#define UNPACK_MANIFEST_NAME    (const char*)"manifest.xml"
+#define UNPACK_XML_ROOT         (const char*)"unpack"
+#define UNPACK_XML_CONTAINER    (const char*)"container"
+#define UNPACK_XML_FILE         (const char*)"file"
+
+#define UNPACK_MAX_DEPTH        (uint32_t)(16)
+#define UNPACK_NAME_SIZE        (uint32_t)(128)
+
+#define UNPACK_TYPE_FILE        (uint8_t)(0)
+#define UNPACK_TYPE_AFS         (uint8_t)(1)
+#define UNPACK_TYPE_AWB         (uint8_t)(2)
+#define UNPACK_TYPE_DAT         (uint8_t)(3)
+#define UNPACK_TYPE_WTB         (uint8_t)(4)
+#define UNPACK_TYPE_UTF         (uint8_t)(5)
+
+typedef struct UNPACK_NODE UNPACK_NODE;
+struct UNPACK_NODE
+{
+    char name[UNPACK_NAME_SIZE];
+    SU_STRING* path;                /* Relative to the output directory */
+    const uint8_t* data;            /* Inside the mapped input */
+    uint64_t offset;                /* In the parent */
+    uint64_t size;
+    uint32_t index;                 /* Position in the table of the parent */
+    uint32_t depth;
+    uint8_t type;                   /* UNPACK_TYPE_* */
+    uint8_t ref;                    /* Overlaps a previous entry, not used when rebuilding */
+    uint8_t has_skeleton;
+    uint8_t status;                 /* FU_SUCCESS once written */
+
+    uint32_t child_count;
+    UNPACK_NODE* children;          /* Sorted by offset */
+};
+
+AP_DESC* g_arg_node = NULL;
+uint32_t g_threads = TP_THREADS_AUTO;
+char* g_out_path = NULL;
+TP_POOL* g_pool = NULL;
+SU_STRING* g_out_dir = NULL;
+
+/*
+	Common
+*/
+void unpack_tool_parse_arguments(int argc, char** argv);
+void unpack_tool_print_usage(char* program_name);
+SU_STRING* unpack_tool_join(const char* dir, const char* name);
+
+/*
+    Detection
+*/
+uint8_t unpack_tool_get_type(const uint8_t* data, const uint64_t size);
+const char* unpack_tool_get_ext(const uint8_t type, const uint8_t* data, const uint64_t size);
+
+/*
+    Locating entries
+*/
+void unpack_tool_locate_afs(UNPACK_NODE* node, CVEC items);
+void unpack_tool_locate_awb(UNPACK_NODE* node, CVEC items);
+void unpack_tool_locate_dat(UNPACK_NODE* node, CVEC items);
+void unpack_tool_locate_wtb(UNPACK_NODE* node, CVEC items);
+void unpack_tool_locate_utf(UNPACK_NODE* node, CVEC items);
+
+/*
+	Unpacker
+*/
+void unpack_tool_unpack(const char* path);
+void unpack_tool_node_task(void* arg);
+void unpack_tool_file_task(void* arg);
+uint32_t unpack_tool_count_errors(UNPACK_NODE* node);
+void unpack_tool_node_to_xml(UNPACK_NODE* node, SEXML_ELEMENT* parent);
+void unpack_tool_free_node(UNPACK_NODE* node);
+
+/*
+    Rebuilding
+*/
+void unpack_tool_rebuild(const char* xml_path);
+uint8_t unpack_tool_emit(RF_FILE* out, const char* dir, SEXML_ELEMENT* container, const uint64_t base);
+
+/*
+	Entry
+*/
+int main(int argc, char** argv)
+{
+    /* Setting up arguments */
+    g_arg_node = ap_create();
+    ap_append_desc_uint(g_arg_node, TP_THREADS_AUTO, "--threads", "Amount of threads for unpacking, 0 for all cores");
+    ap_append_desc_str(g_arg_node, "", "--out", "Output directory when unpacking, output file when rebuilding");
+
+	if(argc == 1)
+	{
+		unpack_tool_print_usage(argv[0]);
+		return 0;
+	}
+
+    unpack_tool_parse_arguments(argc, argv);
+    g_arg_node = ap_free(g_arg_node);
+
+    if(pu_is_file(argv[1]) == 0)
+    {
+        printf("File doesn't exist.\n");
+        free(g_out_path);
+        return 0;
+    }
+
+    PU_PATH* input_path = pu_split_path(argv[1], strlen(argv[1]));
+
+    if(su_cmp_string_char(input_path->ext, "xml", 3) == SU_STRINGS_MATCH)
+    {
+        unpack_tool_rebuild(argv[1]);
+    }
+    else
+    {
+        unpack_tool_unpack(argv[1]);
+    }
+
+    input_path = pu_free_path(input_path);
+    free(g_out_path);
+
+	return 0;
+}
+
+/*
+	Common
+*/
+void unpack_tool_print_usage(char* program_name)
+{
+	printf("Unpacks nested AFS, AWB, DAT, WTB and @UTF archives into one directory tree.\n");
+	printf("Usage:\n");
+	printf("\tTo unpack: %s <file> <options>\n", program_name);
+	printf("\tTo rebuild: %s <dir/%s> <options>\n", program_name, UNPACK_MANIFEST_NAME);
+    printf("\n");
+    printf("Options:\n");
+
+    for(uint32_t i = 0; i != ap_get_desc_count(g_arg_node); ++i)
+    {
+        AP_ARG_DESC* apd = ap_get_desc_by_id(g_arg_node, i);
+        printf("\t%24s\t%s\n", apd->name, apd->description);
+    }
+}
+
+void unpack_tool_parse_arguments(int argc, char** argv)
+{
+    if(ap_parse(g_arg_node, argc-2, &argv[2]) != AP_STAT_SUCCESS)
+    {
+        return;
+    }
+
+    AP_ARG_VEC arg_threads = ap_get_arg_vec_by_name(g_arg_node, "--threads");
+    AP_ARG_VEC arg_out = ap_get_arg_vec_by_name(g_arg_node, "--out");
+
+    if(arg_threads)
+    {
+        g_threads = AP_GET_ARG_UINT(AP_ARG_FROM_VEC_BY_ID(arg_threads, 0));
+        arg_threads = ap_free_arg_vec(arg_threads);
+    }
+
+    if(arg_out)
+    {
+        /* Parser owns the value */
+        g_out_path = strdup(AP_GET_ARG_STR(AP_ARG_FROM_VEC_BY_ID(arg_out, 0)));
+        arg_out = ap_free_arg_vec(arg_out);
+    }
+}
+
+SU_STRING* unpack_tool_join(const char* dir, const char* name)
+{
+    SU_STRING* path = su_create_string(dir, strlen(dir));
+    su_insert_char(path, -1, "/", 1);
+    su_insert_char(path, -1, name, strlen(name));
+    return path;
+}
+
+/*
+    Detection
+*/
+uint8_t unpack_tool_get_type(const uint8_t* data, const uint64_t size)
+{
+    if(size < 32)
+    {
+        return UNPACK_TYPE_FILE;
+    }
+
+    if((size <= UINT32_MAX) && (afs_check_if_valid(data, size) == AFS_GOOD))
+    {
+        return UNPACK_TYPE_AFS;
+    }
+
+    if(memcmp(data, AWB_MAGIC, 4) == 0)
+    {
+        return UNPACK_TYPE_AWB;
+    }
+
+    if(memcmp(data, DAT_MAGIC, 4) == 0)
+    {
+        return UNPACK_TYPE_DAT;
+    }
+
+    if((memcmp(data, WTB_MAGIC_LE, 4) == 0) || (memcmp(data, WTB_MAGIC_BE, 4) == 0))
+    {
+        return UNPACK_TYPE_WTB;
+    }
+
+    if((memcmp(data, UTF_MAGIC, 4) == 0) && (size >= (8 + UTF_TABLE_HEADER_SIZE)))
+    {
+        return UNPACK_TYPE_UTF;
+    }
+
+    return UNPACK_TYPE_FILE;
+}
+
+const char* unpack_tool_get_ext(const uint8_t type, const uint8_t* data, const uint64_t size)
+{
+    switch(type)
+    {
+        case UNPACK_TYPE_AFS: return "afs";
+        case UNPACK_TYPE_AWB: return "awb";
+        case UNPACK_TYPE_DAT: return "dat";
+        case UNPACK_TYPE_WTB: return "wtb";
+        case UNPACK_TYPE_UTF: return "utf";
+    }
+
+    if(size < 8)
+    {
+        return "bin";
+    }
+
+    if(memcmp(data, "DDS ", 4) == 0) return "dds";
+    if(memcmp(data, "CWAV", 4) == 0) return "bcwav";
+    if(memcmp(data, "CRILAYLA", 8) == 0) return "bin";
+
+    /* Encrypted HCAs have the top bits of the magic set */
+    if(((data[0] & 0x7F) == 'H') && ((data[1] & 0x7F) == 'C') && ((data[2] & 0x7F) == 'A'))
+    {
+        return "hca";
+    }
+
+    /* ADX check reads the copyright string after the header */
+    if((size <= UINT32_MAX) && ((uint64_t)tr_read_u16be(&data[2]) + 4 <= size))
+    {
+        switch(adx_check_if_valid(data, size))
+        {
+            case ADX_TYPE_ADX: return "adx";
+            case ADX_TYPE_AHX: return "ahx";
+        }
+    }
+
+    return "bin";
+}
+
+/*
+    Locating entries
+
+    Every locator appends UNPACK_NODE with name, offset, size and index set.
+    Entries outside of the node are skipped, they end up in the skeleton.
+*/
+static void unpack_tool_add_item(CVEC items, UNPACK_NODE* node, const uint64_t offset, const uint64_t size,
+                                 const uint32_t index, const char* name, const uint32_t name_size)
+{
+    if((offset > node->size) || (size > (node->size - offset)))
+    {
+        return;
+    }
+
+    UNPACK_NODE item = {0};
+    item.offset = offset;
+    item.size = size;
+    item.index = index;
+
+    const uint32_t len = name_size < (UNPACK_NAME_SIZE-1) ? name_size : (UNPACK_NAME_SIZE-1);
+    memcpy(item.name, name, strnlen(name, len));
+
+    cvec_push_back(items, &item);
+}
+
+void unpack_tool_locate_afs(UNPACK_NODE* node, CVEC items)
+{
+    const uint8_t* data = node->data;
+    const uint32_t size = node->size;
+    const uint32_t first_file_id = afs_find_first_file_index(data, size);
+
+    if(first_file_id == AFS_ERROR)
+    {
+        return;
+    }
+
+    /* Table ends where the first file starts */
+    const uint32_t first_offset = tr_read_u32le(&data[afs_id_to_entry_offset(first_file_id)]);
+
+    if((first_offset > size) || (first_offset < (afs_id_to_entry_offset(first_file_id) + AFS_ENTRY_SIZE)))
+    {
+        return;
+    }
+
+    const uint32_t file_count = afs_count_possible_files(first_file_id, data);
+    const uint32_t metadata_index = afs_find_metadata_index(first_file_id, file_count, data);
+    const uint32_t metadata_entry = afs_id_to_entry_offset(metadata_index);
+
+    if((metadata_entry + AFS_ENTRY_SIZE) > size)
+    {
+        return;
+    }
+
+    const uint32_t metadata_pos = tr_read_u32le(&data[metadata_entry]);
+    const uint32_t metadata_size = tr_read_u32le(&data[metadata_entry+4]);
+    const uint8_t has_metadata = metadata_pos && metadata_size && ((uint64_t)metadata_pos + metadata_size <= size);
+    uint32_t metadata_it = 0;
+
+    for(uint32_t i = first_file_id; i != metadata_index; ++i)
+    {
+        const uint32_t entry_pos = afs_id_to_entry_offset(i);
+        const uint32_t entry_offset = tr_read_u32le(&data[entry_pos]);
+        const uint32_t entry_size = tr_read_u32le(&data[entry_pos+4]);
+
+        if((entry_offset == 0) || (entry_size == 0))
+        {
+            continue;
+        }
+
+        char name[UNPACK_NAME_SIZE] = {0};
+
+        if(has_metadata)
+        {
+            const uint32_t meta_offset = afs_id_to_metadata_offset(metadata_pos, metadata_size, metadata_it);
+
+            if((uint64_t)meta_offset + AFS_ENTRY_METADATA_SIZE <= size)
+            {
+                memcpy(name, &data[meta_offset], AFS_ENTRY_METADATA_NAME_SIZE);
+            }
+
+            metadata_it += 1;
+        }
+
+        /* No name, ids are used instead */
+        if(name[0] == '\0')
+        {
+            sprintf(name, "%05u", i);
+        }
+
+        unpack_tool_add_item(items, node, entry_offset, entry_size, i, name, AFS_ENTRY_METADATA_NAME_SIZE);
+    }
+}
+
+void unpack_tool_locate_awb(UNPACK_NODE* node, CVEC items)
+{
+    if(node->size > UINT32_MAX)
+    {
+        return;
+    }
+
+    AWB_INDEX* index = awb_open_index(node->data, node->size);
+
+    if(index == NULL)
+    {
+        return;
+    }
+
+    for(uint32_t i = 0; i != awb_index_get_file_count(index); ++i)
+    {
+        AWB_INDEX_ENTRY* entry = &index->entries[i];
+        char name[UNPACK_NAME_SIZE] = {0};
+
+        /* Exact size, so the padding after it goes to the skeleton */
+        awb_index_get_data(index, entry);
+        sprintf(name, "%05u", entry->id);
+
+        unpack_tool_add_item(items, node, entry->offset, entry->size, entry->index, name, UNPACK_NAME_SIZE);
+    }
+
+    index = awb_close_index(index);
+}
+
+static uint32_t unpack_tool_read_u32(const uint8_t* data, const uint8_t endian)
+{
+    return endian == FU_BIG_ENDIAN ? tr_read_u32be(data) : tr_read_u32le(data);
+}
+
+void unpack_tool_locate_dat(UNPACK_NODE* node, CVEC items)
+{
+    const uint8_t* data = node->data;
+    const uint64_t size = node->size;
+    const uint8_t endian = dat_check_endian(tr_read_u32le(&data[4]));
+
+    const uint64_t file_count = unpack_tool_read_u32(&data[4], endian);
+    const uint64_t positions_offset = unpack_tool_read_u32(&data[8], endian);
+    const uint64_t names_offset = unpack_tool_read_u32(&data[16], endian);
+    const uint64_t sizes_offset = unpack_tool_read_u32(&data[20], endian);
+
+    if(((positions_offset + file_count*4) > size)
+       || ((sizes_offset + file_count*4) > size)
+       || ((names_offset + 4) > size))
+    {
+        return;
+    }
+
+    /* Names are fixed-length, the length is the first value of the section */
+    const uint64_t name_size = unpack_tool_read_u32(&data[names_offset], endian);
+
+    if((names_offset + 4 + name_size*file_count) > size)
+    {
+        return;
+    }
+
+    for(uint32_t i = 0; i != file_count; ++i)
+    {
+        const uint32_t position = unpack_tool_read_u32(&data[positions_offset + i*4], endian);
+        const uint32_t file_size = unpack_tool_read_u32(&data[sizes_offset + i*4], endian);
+        const char* name = (const char*)&data[names_offset + 4 + name_size*i];
+        char id_name[UNPACK_NAME_SIZE] = {0};
+
+        if((name_size == 0) || (name[0] == '\0'))
+        {
+            sprintf(id_name, "%05u", i);
+            name = id_name;
+        }
+
+        unpack_tool_add_item(items, node, position, file_size, i, name, name_size ? name_size : UNPACK_NAME_SIZE);
+    }
+}
+
+void unpack_tool_locate_wtb(UNPACK_NODE* node, CVEC items)
+{
+    const uint8_t* data = node->data;
+    const uint64_t size = node->size;
+    const uint8_t endian = (memcmp(data, WTB_MAGIC_BE, 4) == 0) ? FU_BIG_ENDIAN : FU_LITTLE_ENDIAN;
+
+    const uint64_t tex_count = unpack_tool_read_u32(&data[8], endian);
+    const uint64_t positions_offset = unpack_tool_read_u32(&data[12], endian);
+    const uint64_t sizes_offset = unpack_tool_read_u32(&data[16], endian);
+
+    if(((positions_offset + tex_count*4) > size) || ((sizes_offset + tex_count*4) > size))
+    {
+        return;
+    }
+
+    for(uint32_t i = 0; i != tex_count; ++i)
+    {
+        char name[UNPACK_NAME_SIZE] = {0};
+        sprintf(name, "%05u", i);
+
+        unpack_tool_add_item(items, node,
+                             unpack_tool_read_u32(&data[positions_offset + i*4], endian),
+                             unpack_tool_read_u32(&data[sizes_offset + i*4], endian),
+                             i, name, UNPACK_NAME_SIZE);
+    }
+}
+
+/* Only VL data that is a known container is split out, the rest stays in the skeleton */
+static void unpack_tool_add_vl(CVEC items, UNPACK_NODE* node, const UTF_TABLE_HEADER* th, const uint32_t table_size,
+                               const UTF_RECORD* record, const uint32_t index, const char* name)
+{
+    const uint64_t offset = (uint64_t)th->data_offset + record->vl.offset;
+
+    if((record->vl.size == 0) || ((offset + record->vl.size) > table_size))
+    {
+        return;
+    }
+
+    /* Offsets in the table are relative to the end of the @UTF header */
+    const uint64_t abs_offset = 8 + offset;
+
+    if(unpack_tool_get_type(&node->data[abs_offset], record->vl.size) != UNPACK_TYPE_FILE)
+    {
+        unpack_tool_add_item(items, node, abs_offset, record->vl.size, index, name, UNPACK_NAME_SIZE);
+    }
+}
+
+void unpack_tool_locate_utf(UNPACK_NODE* node, CVEC items)
+{
+    const uint8_t* data = node->data;
+    const uint64_t table_size = tr_read_u32be(&data[4]);
+
+    if((table_size + 8) > node->size)
+    {
+        return;
+    }
+
+    const uint8_t* th_ptr = &data[8];
+    const UTF_TABLE_HEADER th = utf_read_table_header(th_ptr);
+
+    if((th.rows_offset > table_size)
+       || (th.string_table_offset > table_size)
+       || (th.data_offset > table_size)
+       || (((uint64_t)th.rows_offset + (uint64_t)th.rows_width*th.rows_count) > table_size))
+    {
+        return;
+    }
+
+    const char* strtbl_ptr = (const char*)&th_ptr[th.string_table_offset];
+    const uint64_t strtbl_size = table_size - th.string_table_offset;
+    CVEC schema = utf_read_schema(&th_ptr[UTF_TABLE_HEADER_SIZE], th.columns_count);
+    uint32_t rows_iter_offset = 0;
+    uint32_t index = 0;
+
+    for(uint32_t i = 0; i != th.columns_count; ++i)
+    {
+        UTF_SCHEMA_ENTRY* se = (UTF_SCHEMA_ENTRY*)cvec_at(schema, i);
+        char column_name[UNPACK_NAME_SIZE] = {0};
+
+        if(se->desc.name && (se->name_offset < strtbl_size))
+        {
+            const uint64_t max_len = strtbl_size - se->name_offset;
+            const uint64_t len = strnlen(&strtbl_ptr[se->name_offset], max_len);
+            memcpy(column_name, &strtbl_ptr[se->name_offset], len < 64 ? len : 64);
+        }
+
+        if(se->desc.type == UTF_COLUMN_TYPE_VLDATA)
+        {
+            /* Same data for all rows */
+            if(se->desc.schema)
+            {
+                unpack_tool_add_vl(items, node, &th, table_size, &se->record, index++, column_name);
+            }
+
+            if(se->desc.row)
+            {
+                for(uint32_t j = 0; j != th.rows_count; ++j)
+                {
+                    const uint8_t* row_ptr = &th_ptr[th.rows_offset + th.rows_width*j + rows_iter_offset];
+                    const UTF_RECORD record = utf_read_record_by_type(row_ptr, se->desc.type);
+                    char name[UNPACK_NAME_SIZE] = {0};
+
+                    snprintf(name, UNPACK_NAME_SIZE, "%.64s_%05u", column_name, j);
+                    unpack_tool_add_vl(items, node, &th, table_size, &record, index++, name);
+                }
+            }
+        }
+
+        if(se->desc.row)
+        {
+            rows_iter_offset += utf_get_type_size(se->desc.type);
+        }
+    }
+
+    cvec_destroy(schema);
+}
+
+/*
+	Unpacker
+*/
+static int unpack_tool_cmp_offset(const void* a, const void* b)
+{
+    const UNPACK_NODE* na = (const UNPACK_NODE*)a;
+    const UNPACK_NODE* nb = (const UNPACK_NODE*)b;
+
+    if(na->offset != nb->offset) return na->offset < nb->offset ? -1 : 1;
+    if(na->index != nb->index) return na->index < nb->index ? -1 : 1;
+    return 0;
+}
+
+static int unpack_tool_cmp_name(const void* a, const void* b)
+{
+    const UNPACK_NODE* na = *(const UNPACK_NODE**)a;
+    const UNPACK_NODE* nb = *(const UNPACK_NODE**)b;
+    const int cmp = strcmp(na->name, nb->name);
+
+    if(cmp) return cmp;
+    return na->index < nb->index ? -1 : (na->index > nb->index);
+}
+
+static uint8_t unpack_tool_name_taken(UNPACK_NODE* node, UNPACK_NODE* self, const char* name)
+{
+    for(uint32_t i = 0; i != node->child_count; ++i)
+    {
+        if((&node->children[i] != self) && (strcmp(node->children[i].name, name) == 0))
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/* Makes the names safe to use as file names and unique in the directory */
+static void unpack_tool_fix_names(UNPACK_NODE* node)
+{
+    for(uint32_t i = 0; i != node->child_count; ++i)
+    {
+        UNPACK_NODE* child = &node->children[i];
+
+        for(char* c = child->name; *c; ++c)
+        {
+            if(((uint8_t)*c < 0x20) || strchr("/\\:*?\"<>|", *c)) *c = '_';
+        }
+
+        if((strcmp(child->name, ".") == 0) || (strcmp(child->name, "..") == 0))
+        {
+            child->name[0] = '\0';
+        }
+
+        if(child->name[0] == '\0')
+        {
+            sprintf(child->name, "%05u", child->index);
+        }
+
+        /* Names from tables without a proper extension */
+        if(strchr(child->name, '.') == NULL)
+        {
+            const char* ext = unpack_tool_get_ext(child->type, child->data, child->size);
+            const size_t len = strlen(child->name);
+            snprintf(&child->name[len], UNPACK_NAME_SIZE - len, ".%s", ext);
+        }
+    }
+
+    UNPACK_NODE** sorted = (UNPACK_NODE**)calloc(node->child_count, sizeof(UNPACK_NODE*));
+
+    for(uint32_t i = 0; i != node->child_count; ++i)
+    {
+        sorted[i] = &node->children[i];
+    }
+
+    qsort(sorted, node->child_count, sizeof(UNPACK_NODE*), unpack_tool_cmp_name);
+
+    /* First one keeps the name, the rest get their index in front */
+    uint32_t first = 0;
+
+    for(uint32_t i = 1; i < node->child_count; ++i)
+    {
+        if(strcmp(sorted[i]->name, sorted[first]->name) != 0)
+        {
+            first = i;
+            continue;
+        }
+
+        /* Prefixed names can be cut or match another entry, so they're checked again */
+        char buf[UNPACK_NAME_SIZE] = {0};
+        const char* ext = strrchr(sorted[i]->name, '.');
+        uint32_t n = 0;
+
+        do
+        {
+            const int len = n ? snprintf(buf, UNPACK_NAME_SIZE, "%05u_%u_%s", sorted[i]->index, n, sorted[i]->name)
+                              : snprintf(buf, UNPACK_NAME_SIZE, "%05u_%s", sorted[i]->index, sorted[i]->name);
+
+            /* Too long, the index and extension are enough */
+            if((len < 0) || (len >= (int)UNPACK_NAME_SIZE))
+            {
+                snprintf(buf, UNPACK_NAME_SIZE, "%05u_%u%.16s", sorted[i]->index, n, ext ? ext : "");
+            }
+
+            n += 1;
+        }
+        while(unpack_tool_name_taken(node, sorted[i], buf));
+
+        memcpy(sorted[i]->name, buf, UNPACK_NAME_SIZE);
+    }
+
+    free(sorted);
+}
+
+static uint8_t unpack_tool_write_skeleton(UNPACK_NODE* node)
+{
+    uint64_t gap_size = 0;
+    uint64_t pos = 0;
+
+    for(uint32_t i = 0; i != node->child_count; ++i)
+    {
+        const UNPACK_NODE* child = &node->children[i];
+        if(child->ref) continue;
+        gap_size += child->offset - pos;
+        pos = child->offset + child->size;
+    }
+
+    gap_size += node->size - pos;
+
+    if(gap_size == 0)
+    {
+        return FU_SUCCESS;
+    }
+
+    SU_STRING* path = unpack_tool_join(g_out_dir->ptr, node->path->ptr);
+    su_insert_char(path, -1, ".skel", 5);
+    RF_FILE* skel = rf_open(path->ptr, RF_WRITE);
+    path = su_free(path);
+
+    if(skel == NULL)
+    {
+        return FU_ERROR;
+    }
+
+    uint8_t status = FU_SUCCESS;
+    uint64_t skel_pos = 0;
+    pos = 0;
+
+    for(uint32_t i = 0; i <= node->child_count; ++i)
+    {
+        const UNPACK_NODE* child = (i != node->child_count) ? &node->children[i] : NULL;
+        if(child && child->ref) continue;
+
+        const uint64_t end = child ? child->offset : node->size;
+
+        if(end != pos)
+        {
+            status |= rf_pwrite(skel, &node->data[pos], end - pos, skel_pos);
+            skel_pos += end - pos;
+        }
+
+        if(child) pos = child->offset + child->size;
+    }
+
+    skel = rf_close(skel);
+    node->has_skeleton = 1;
+
+    return status;
+}
+
+void unpack_tool_node_task(void* arg)
+{
+    UNPACK_NODE* node = (UNPACK_NODE*)arg;
+    CVEC items = cvec_create(sizeof(UNPACK_NODE));
+
+    switch(node->type)
+    {
+        case UNPACK_TYPE_AFS: unpack_tool_locate_afs(node, items); break;
+        case UNPACK_TYPE_AWB: unpack_tool_locate_awb(node, items); break;
+        case UNPACK_TYPE_DAT: unpack_tool_locate_dat(node, items); break;
+        case UNPACK_TYPE_WTB: unpack_tool_locate_wtb(node, items); break;
+        case UNPACK_TYPE_UTF: unpack_tool_locate_utf(node, items); break;
+    }
+
+    node->child_count = cvec_size(items);
+    node->children = (UNPACK_NODE*)calloc(node->child_count, sizeof(UNPACK_NODE));
+
+    for(uint32_t i = 0; i != node->child_count; ++i)
+    {
+        memcpy(&node->children[i], cvec_at(items, i), sizeof(UNPACK_NODE));
+    }
+
+    cvec_destroy(items);
+    qsort(node->children, node->child_count, sizeof(UNPACK_NODE), unpack_tool_cmp_offset);
+
+    /* Entries sharing data with a previous one are only there for convenience */
+    uint64_t end = 0;
+
+    for(uint32_t i = 0; i != node->child_count; ++i)
+    {
+        UNPACK_NODE* child = &node->children[i];
+        child->data = &node->data[child->offset];
+        child->depth = node->depth + 1;
+        child->ref = child->offset < end;
+
+        if(child->ref == 0)
+        {
+            end = child->offset + child->size;
+        }
+
+        if((child->ref == 0) && (child->depth < UNPACK_MAX_DEPTH) && (child->size < node->size))
+        {
+            child->type = unpack_tool_get_type(child->data, child->size);
+        }
+    }
+
+    unpack_tool_fix_names(node);
+
+    SU_STRING* dir = unpack_tool_join(g_out_dir->ptr, node->path->ptr);
+    su_insert_char(dir, -1, "_", 1);
+    pu_create_dir_char(dir->ptr);
+    dir = su_free(dir);
+
+    node->status = unpack_tool_write_skeleton(node);
+
+    for(uint32_t i = 0; i != node->child_count; ++i)
+    {
+        UNPACK_NODE* child = &node->children[i];
+        child->path = su_copy(node->path);
+        su_insert_char(child->path, -1, "_/", 2);
+        su_insert_char(child->path, -1, child->name, strlen(child->name));
+
+        tp_push(g_pool, child->type == UNPACK_TYPE_FILE ? unpack_tool_file_task : unpack_tool_node_task, child);
+    }
+}
+
+void unpack_tool_file_task(void* arg)
+{
+    UNPACK_NODE* node = (UNPACK_NODE*)arg;
+    SU_STRING* path = unpack_tool_join(g_out_dir->ptr, node->path->ptr);
+    RF_FILE* f = rf_open(path->ptr, RF_WRITE);
+
+    node->status = FU_ERROR;
+
+    if(f)
+    {
+        node->status = node->size ? rf_pwrite(f, node->data, node->size, 0) : FU_SUCCESS;
+        f = rf_close(f);
+    }
+
+    if(node->status != FU_SUCCESS)
+    {
+        printf("Couldn't write %s\n", path->ptr);
+    }
+
+    path = su_free(path);
+}
+
+uint32_t unpack_tool_count_errors(UNPACK_NODE* node)
+{
+    uint32_t errors = node->status != FU_SUCCESS;
+
+    for(uint32_t i = 0; i != node->child_count; ++i)
+    {
+        errors += unpack_tool_count_errors(&node->children[i]);
+    }
+
+    return errors;
+}
+
+void unpack_tool_node_to_xml(UNPACK_NODE* node, SEXML_ELEMENT* parent)
+{
+    const uint8_t is_file = node->type == UNPACK_TYPE_FILE;
+    SEXML_ELEMENT* xml = sexml_append_element(parent, is_file ? UNPACK_XML_FILE : UNPACK_XML_CONTAINER);
+
+    sexml_append_attribute(xml, "path", node->path->ptr);
+
+    if(is_file == 0)
+    {
+        sexml_append_attribute(xml, "type", unpack_tool_get_ext(node->type, NULL, 0));
+    }
+
+    sexml_append_attribute_uint(xml, "offset", node->offset);
+    sexml_append_attribute_uint(xml, "size", node->size);
+
+    if(node->has_skeleton)
+    {
+        SU_STRING* skel = su_copy(node->path);
+        su_insert_char(skel, -1, ".skel", 5);
+        sexml_append_attribute(xml, "skeleton", skel->ptr);
+        skel = su_free(skel);
+    }
+
+    if(node->ref)
+    {
+        sexml_append_attribute_uint(xml, "ref", 1);
+    }
+
+    for(uint32_t i = 0; i != node->child_count; ++i)
+    {
+        unpack_tool_node_to_xml(&node->children[i], xml);
+    }
+}
+
+void unpack_tool_free_node(UNPACK_NODE* node)
+{
+    for(uint32_t i = 0; i != node->child_count; ++i)
+    {
+        unpack_tool_free_node(&node->children[i]);
+    }
+
+    free(node->children);
+    node->path = su_free(node->path);
+}
+
+void unpack_tool_unpack(const char* path)
+{
+    RF_MAP* map = rf_map(path);
+
+    if(map == NULL)
+    {
+        printf("Couldn't open the file.\n");
+        return;
+    }
+
+    UNPACK_NODE root = {0};
+    root.data = map->data;
+    root.size = map->size;
+    root.type = unpack_tool_get_type(map->data, map->size);
+
+    if(root.type == UNPACK_TYPE_FILE)
+    {
+        printf("File is not a supported archive.\n");
+        map = rf_unmap(map);
+        return;
+    }
+
+    SU_STRING* name = pu_get_basename_char(path);
+    memcpy(root.name, name->ptr, name->size < UNPACK_NAME_SIZE ? name->size : UNPACK_NAME_SIZE-1);
+    root.path = su_copy(name);
+    name = su_free(name);
+
+    /* <file>_unpack next to the input unless told otherwise */
+    if(g_out_path)
+    {
+        g_out_dir = su_create_string(g_out_path, strlen(g_out_path));
+    }
+    else
+    {
+        g_out_dir = su_create_string(path, strlen(path));
+        su_insert_char(g_out_dir, -1, "_unpack", 7);
+    }
+
+    pu_create_dir_char(g_out_dir->ptr);
+    printf("Output: %s\n", g_out_dir->ptr);
+
+    /* Containers queue their own entries, waiting once covers the whole tree */
+    g_pool = tp_create(g_threads);
+
+    if(g_pool == NULL)
+    {
+        printf("Couldn't start the worker threads.\n");
+        unpack_tool_free_node(&root);
+        g_out_dir = su_free(g_out_dir);
+        map = rf_unmap(map);
+        return;
+    }
+
+    tp_push(g_pool, unpack_tool_node_task, &root);
+
+    const uint32_t crc = mz_crc32(MZ_CRC32_INIT, map->data, map->size);
+
+    tp_wait(g_pool);
+    g_pool = tp_destroy(g_pool);
+
+    const uint32_t errors = unpack_tool_count_errors(&root);
+
+    if(errors)
+    {
+        printf("%u files couldn't be written, no manifest was saved.\n", errors);
+    }
+    else
+    {
+        SEXML_ELEMENT* xml_root = sexml_create_root("root");
+        SEXML_ELEMENT* unpack_xml = sexml_append_element(xml_root, UNPACK_XML_ROOT);
+        char crc_str[9] = {0};
+        sprintf(crc_str, "%08x", crc);
+
+        sexml_append_attribute(unpack_xml, "name", root.name);
+        sexml_append_attribute_uint(unpack_xml, "size", root.size);
+        sexml_append_attribute(unpack_xml, "crc32", crc_str);
+        unpack_tool_node_to_xml(&root, unpack_xml);
+
+        SU_STRING* xml_path = unpack_tool_join(g_out_dir->ptr, UNPACK_MANIFEST_NAME);
+
+        unpack_xml->parent = NULL; /* Root isn't saved */
+        sexml_save_to_file_formatted(xml_path->ptr, unpack_xml, 4);
+        unpack_xml->parent = xml_root;
+
+        printf("Manifest: %s\n", xml_path->ptr);
+
+        xml_path = su_free(xml_path);
+        xml_root = sexml_destroy(xml_root);
+    }
+
+    unpack_tool_free_node(&root);
+    g_out_dir = su_free(g_out_dir);
+    map = rf_unmap(map);
+}
+
+/*
+    Rebuilding
+*/
+
+/* NULL if the element doesn't have it */
+static SEXML_ATTRIBUTE* unpack_tool_get_attribute(SEXML_ELEMENT* element, const char* name)
+{
+    for(uint32_t i = 0; i != cvec_size(element->attributes); ++i)
+    {
+        SEXML_ATTRIBUTE* attrib = sexml_get_attribute_by_id(element, i);
+
+        if(su_cmp_string_char(attrib->name, name, strlen(name)) == SU_STRINGS_MATCH)
+        {
+            return attrib;
+        }
+    }
+
+    return NULL;
+}
+
+static uint64_t unpack_tool_get_uint(SEXML_ELEMENT* element, const char* name)
+{
+    SEXML_ATTRIBUTE* attrib = unpack_tool_get_attribute(element, name);
+    return attrib ? sexml_get_attribute_uint(attrib) : 0;
+}
+
+static uint8_t unpack_tool_emit_skeleton(RF_FILE* out, const char* skel_path, const uint64_t skel_pos,
+                                         const uint64_t offset, const uint64_t size)
+{
+    if(skel_path == NULL)
+    {
+        return FU_ERROR;
+    }
+
+    const RF_SOURCE src = rf_source_path(skel_path, skel_pos, size);
+    return rf_write_source(out, offset, &src);
+}
+
+uint8_t unpack_tool_emit(RF_FILE* out, const char* dir, SEXML_ELEMENT* container, const uint64_t base)
+{
+    const uint64_t size = unpack_tool_get_uint(container, "size");
+    SEXML_ATTRIBUTE* skel_attr = unpack_tool_get_attribute(container, "skeleton");
+    SU_STRING* skel_path = skel_attr ? unpack_tool_join(dir, skel_attr->value->ptr) : NULL;
+    const char* skel = skel_path ? skel_path->ptr : NULL;
+
+    uint8_t status = FU_SUCCESS;
+    uint64_t pos = 0;
+    uint64_t skel_pos = 0;
+
+    for(uint32_t i = 0; (i != cvec_size(container->elements)) && (status == FU_SUCCESS); ++i)
+    {
+        SEXML_ELEMENT* child = sexml_get_element_by_id(container, i);
+        SEXML_ATTRIBUTE* ref_attr = unpack_tool_get_attribute(child, "ref");
+
+        if(ref_attr && sexml_get_attribute_uint(ref_attr))
+        {
+            continue;
+        }
+
+        const uint64_t child_offset = unpack_tool_get_uint(child, "offset");
+        const uint64_t child_size = unpack_tool_get_uint(child, "size");
+        SEXML_ATTRIBUTE* path_attr = unpack_tool_get_attribute(child, "path");
+
+        if((path_attr == NULL) || (child_offset < pos) || ((child_offset + child_size) > size))
+        {
+            printf("Manifest is broken at %s\n", path_attr ? path_attr->value->ptr : "?");
+            status = FU_ERROR;
+            break;
+        }
+
+        /* Header, tables and padding up to the entry */
+        if(child_offset != pos)
+        {
+            status = unpack_tool_emit_skeleton(out, skel, skel_pos, base + pos, child_offset - pos);
+            skel_pos += child_offset - pos;
+        }
+
+        if(status != FU_SUCCESS)
+        {
+            break;
+        }
+
+        if(su_cmp_string_char(child->name, UNPACK_XML_CONTAINER, strlen(UNPACK_XML_CONTAINER)) == SU_STRINGS_MATCH)
+        {
+            status = unpack_tool_emit(out, dir, child, base + child_offset);
+        }
+        else
+        {
+            SU_STRING* path = unpack_tool_join(dir, path_attr->value->ptr);
+
+            /* Rebuilding is byte-exact, the layout can't move */
+            if(fu_get_file_size(path->ptr) != child_size)
+            {
+                printf("%s doesn't have its original size of %llu bytes.\n",
+                       path->ptr, (unsigned long long)child_size);
+                status = FU_ERROR;
+            }
+            else if(child_size)
+            {
+                const RF_SOURCE src = rf_source_path(path->ptr, 0, child_size);
+                status = rf_write_source(out, base + child_offset, &src);
+            }
+
+            path = su_free(path);
+        }
+
+        pos = child_offset + child_size;
+    }
+
+    if((status == FU_SUCCESS) && (pos != size))
+    {
+        status = unpack_tool_emit_skeleton(out, skel, skel_pos, base + pos, size - pos);
+        skel_pos += size - pos;
+    }
+
+    if((status == FU_SUCCESS) && skel && (fu_get_file_size(skel) != skel_pos))
+    {
+        printf("%s doesn't match the manifest.\n", skel);
+        status = FU_ERROR;
+    }
+
+    skel_path = su_free(skel_path);
+
+    return status;
+}
+
+void unpack_tool_rebuild(const char* xml_path)
+{
+    SEXML_ELEMENT* xml_root = sexml_load_from_file(xml_path);
+
+    if(xml_root == NULL)
+    {
+        printf("Could not load the XML document.\n");
+        return;
+    }
+
+    if((su_cmp_string_char(xml_root->name, UNPACK_XML_ROOT, strlen(UNPACK_XML_ROOT)) != SU_STRINGS_MATCH)
+       || (cvec_size(xml_root->elements) == 0))
+    {
+        printf("Root node is not %s.\n", UNPACK_XML_ROOT);
+        xml_root = sexml_destroy(xml_root);
+        return;
+    }
+
+    /* Paths in the manifest are relative to it */
+    SU_STRING* dir = pu_get_parent_dir_char(xml_path);
+
+    if(dir->size == 0)
+    {
+        su_insert_char(dir, -1, ".", 1);
+    }
+
+    SEXML_ATTRIBUTE* name_attr = unpack_tool_get_attribute(xml_root, "name");
+    SEXML_ATTRIBUTE* crc_attr = unpack_tool_get_attribute(xml_root, "crc32");
+
+    if((name_attr == NULL) || (crc_attr == NULL))
+    {
+        printf("Manifest has no name or crc32.\n");
+        dir = su_free(dir);
+        xml_root = sexml_destroy(xml_root);
+        return;
+    }
+
+    SU_STRING* out_path = g_out_path ? su_create_string(g_out_path, strlen(g_out_path))
+                                     : unpack_tool_join(dir->ptr, name_attr->value->ptr);
+    const uint64_t size = unpack_tool_get_uint(xml_root, "size");
+    const uint32_t crc = strtoul(crc_attr->value->ptr, NULL, 16);
+
+    printf("Output: %s\n", out_path->ptr);
+
+    RF_FILE* out = rf_open(out_path->ptr, RF_WRITE);
+    uint8_t status = FU_ERROR;
+
+    if(out)
+    {
+        status = unpack_tool_emit(out, dir->ptr, sexml_get_element_by_id(xml_root, 0), 0);
+        out = rf_close(out);
+    }
+
+    if(status != FU_SUCCESS)
+    {
+        printf("Couldn't rebuild the file.\n");
+    }
+    else
+    {
+        RF_MAP* map = rf_map(out_path->ptr);
+
+        if(map && (map->size == size) && (mz_crc32(MZ_CRC32_INIT, map->data, map->size) == crc))
+        {
+            printf("Rebuilt %llu bytes, CRC32 %08x matches.\n", (unsigned long long)size, crc);
+        }
+        else
+        {
+            printf("Rebuilt file doesn't match the original.\n");
+        }
+
+        map = rf_unmap(map);
+    }
+
+    out_path = su_free(out_path);
+    dir = su_free(dir);
+    xml_root = sexml_destroy(xml_root);
+}
@@ -1,13 +1,20 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
+#include <time.h>
 
 #include <kwaslib/core/io/arg_parser.h>
 #include <kwaslib/core/io/path_utils.h>
 #include <kwaslib/core/io/file_utils.h>
+#include <kwaslib/core/io/raw_file.h>
 #include <kwaslib/core/cpu/endianness.h>
+#include <kwaslib/core/math/boundary.h>
 #include <kwaslib/core/data/text/sexml.h>
+#include <kwaslib/core/thread/thread_pool.h>
 #include <kwaslib/platinum/dat.h>
+#include <kwaslib/platinum/dat_toc.h>
+#include <kwaslib/ext/miniz.h>
 
 /*
     Arguments
@@ -19,28 +26,144 @@ uint8_t dat_tool_endian = FU_HOST_ENDIAN;
 uint8_t flag_skip_ext_check = 0;
 
 uint32_t val_block_size = DAT_DEFAULT_BLOCK_SIZE;
+uint32_t val_threads = TP_THREADS_AUTO;
+char* val_extract_name = NULL;
 
-void dat_tool_parse_arguments(int argc, char** argv);
+/*
+    Inputs come first, everything from the first option on is parsed.
+    Returns the index of the first option.
+*/
+int dat_tool_parse_arguments(int argc, char** argv);
 
 /*
     Common
 */
 void dat_tool_print_usage(char* program_name);
-void dat_tool_print_dat(DAT_FILE* dat);
+void dat_tool_print_dat(DAT_TOC* toc);
+
+/*
+    Entry names come from the archive and are saved as they are,
+    so they can't point outside of the output directory.
+
+    Returns 1 if `name` is a plain file name, 0 otherwise.
+*/
+uint8_t dat_tool_name_is_safe(const char* name, const uint32_t name_len);
 
 /* 
     Unpacker
 */
-DAT_FILE* dat_tool_parse_file(const char* path);
-void dat_tool_extract(DAT_FILE* dat, SU_STRING* out_dir_path);
-void dat_tool_write_info(DAT_FILE* dat, SU_STRING* out_path);
+/*
+    Next to the name, every file gets its position, size and crc32 in the DAT,
+    which lets the packer patch it in place later on.
+    `block_size` is only known after packing, 0 leaves it out.
+*/
+void dat_tool_write_info(DAT_TOC* toc, SU_STRING* out_path,
+                         const uint32_t* crcs, const uint32_t block_size);
+
+/*
+    Copies `size` bytes from `in` at `offset` to the start of `out`
+    and computes their CRC32. With `out` set to NULL it only hashes.
+
+    Returns FU_SUCCESS on success, FU_ERROR otherwise.
+*/
+uint8_t dat_tool_copy_range(RF_FILE* in, const uint64_t offset, const uint64_t size,
+                            RF_FILE* out, uint32_t* crc);
+
+/*
+    Single entries, only the tables are read
+*/
+uint8_t dat_tool_match_pattern(const char* pattern, const char* name, const uint32_t name_len);
+void dat_tool_extract_by_name(const char* path, const char* pattern);
+uint8_t dat_tool_extract_entry(DAT_TOC* toc, DAT_TOC_ENTRY* entry);
 
 /* 
     Packer
 */
+typedef struct DAT_TOOL_RECORD DAT_TOOL_RECORD;
+struct DAT_TOOL_RECORD
+{
+    uint32_t position;              /* As written to kwasinfo.xml */
+    uint32_t size;
+    uint32_t crc32;
+    uint8_t known;                  /* All three were there */
+};
+
 uint8_t dat_tool_check_kwasinfo(const char* dir_path);
-DAT_FILE* dat_tool_from_kwasinfo(const char* input_dir);
-DAT_FILE* dat_tool_from_folder(const char* input_dir);
+/*
+    Entries only get their sizes.
+    Full paths to their files are appended to `paths` (SU_STRING*)
+    and streamed into the DAT by dat_tool_write_dat().
+    kwasinfo.xml layout of each file goes to `records` (DAT_TOOL_RECORD),
+    `block_size` is 0 if it wasn't there.
+*/
+DAT_FILE* dat_tool_from_kwasinfo(const char* input_dir, CVEC paths, CVEC records, uint32_t* block_size);
+DAT_FILE* dat_tool_from_folder(const char* input_dir, CVEC paths);
+
+/*
+    Batch
+    
+    Every input is a job. Jobs go through the same stages together,
+    and every stage queues tasks of all jobs on one pool. Entries are
+    tasks of their own, so small and huge archives share the cores evenly.
+*/
+typedef struct DAT_TOOL_JOB DAT_TOOL_JOB;
+typedef struct DAT_TOOL_TASK DAT_TOOL_TASK;
+
+struct DAT_TOOL_TASK
+{
+    DAT_TOOL_JOB* job;
+    uint32_t index;
+};
+
+struct DAT_TOOL_JOB
+{
+    const char* input;
+    SU_STRING* output;              /* Directory when unpacking, DAT when packing */
+    uint8_t is_pack;
+    uint8_t status;
+    const char* note;               /* What was done, printed at the end */
+    
+    uint32_t file_count;
+    uint32_t* crcs;
+    uint8_t* entry_status;
+    DAT_TOOL_TASK* tasks;
+    
+    uint32_t files_done;            /* Written to disk, for the summary */
+    uint64_t bytes_done;
+    
+    /* Unpacking */
+    DAT_TOC* toc;
+    
+    /* Packing */
+    DAT_FILE* dat;
+    CVEC paths;
+    CVEC records;
+    uint8_t has_kwasinfo;
+    uint32_t info_block_size;
+    uint8_t rebuild;
+    RF_FILE* out;
+};
+
+/*
+    Appends inputs from argv up to `first_option` to `inputs` (char*).
+    `@file` is replaced with paths listed in the file, one per line.
+*/
+void dat_tool_collect_inputs(int first_option, char** argv, CVEC inputs);
+void dat_tool_run_batch(CVEC inputs);
+
+void dat_tool_job_prepare(void* arg);
+void dat_tool_job_entry(void* arg);
+void dat_tool_job_layout(void* arg);
+void dat_tool_job_write(void* arg);
+void dat_tool_job_finish(DAT_TOOL_JOB* job);
+
+/*
+    Writes only the files that changed since kwasinfo.xml into the existing DAT.
+    Doesn't touch the DAT if the layout would have to change.
+
+    Returns FU_SUCCESS if the DAT is up to date, FU_ERROR if it needs a rebuild.
+*/
+uint8_t dat_tool_patch_dat(DAT_TOOL_JOB* job);
 
 /*
     Entry point
@@ -53,6 +176,8 @@ int main(int argc, char** argv)
     ap_append_desc_noval(g_arg_node, 0, "--be", "Pack the DAT as Big Endian (X360/PS3/WiiU)");
     ap_append_desc_noval(g_arg_node, 0, "--skip_ext_check", "Don't get a file type from directory suffix");
     ap_append_desc_uint(g_arg_node, DAT_DEFAULT_BLOCK_SIZE, "--block_size", "Block size to be used in the resulting DAT");
+    ap_append_desc_uint(g_arg_node, TP_THREADS_AUTO, "--threads", "Amount of threads for unpacking and packing, 0 for all cores");
+    ap_append_desc_str(g_arg_node, "", "--extract", "Extract entries by name, * and ? work as wildcards");
 
     if(argc < 2)
     {
@@ -60,89 +185,38 @@ int main(int argc, char** argv)
         return 0;
     }
 
-    dat_tool_parse_arguments(argc, argv);
+    const int first_option = dat_tool_parse_arguments(argc, argv);
     g_arg_node = ap_free(g_arg_node);
     
-    /* It's a file so let's process a DAT file */
-    if(pu_is_file(argv[1]))
+    CVEC inputs = cvec_create(sizeof(char*));
+    dat_tool_collect_inputs(first_option, argv, inputs);
+    
+    if(val_extract_name)
     {
-        DAT_FILE* dat = dat_tool_parse_file(argv[1]);
-        
-        if(dat == NULL)
-        {
-            printf("Couldn't process the DAT file.\n");
-        }
-        else
+        for(uint32_t i = 0; i != cvec_size(inputs); ++i)
         {
-            dat_tool_print_dat(dat);
-            
-            PU_PATH* dat_path = pu_split_path(argv[1], strlen(argv[1]));
-            
-            /* I love hacking my own code */
-            su_insert_char(dat_path->name, -1, "_", 1);
-            su_insert_char(dat_path->name, -1, dat_path->ext->ptr, 3);
-            su_remove(dat_path->ext, 0, -1);
-            dat_path->type = PU_PATH_TYPE_DIR;
+            const char* input = *(char**)cvec_at(inputs, i);
             
-            SU_STRING* path_str = pu_path_to_string(dat_path);
-            printf("Dir path: %s\n", path_str->ptr);
-            
-            dat_tool_extract(dat, path_str);
-            
-            printf("\nUnpacking done without issues (I hope)\n");
-        }
-    }
-    else if(pu_is_dir(argv[1])) /* It's a directory so let's create a DAT file */
-    {
-        DAT_FILE* dat = NULL;
-        
-        if(dat_tool_check_kwasinfo(argv[1]))
-        {
-            printf("Loading kwasinfo.xml\n");
-            dat = dat_tool_from_kwasinfo(argv[1]);
-        }
-        else
-        {
-            printf("Couldn't find kwasinfo.xml.\nDAT file might not work properly.\n");
-            dat = dat_tool_from_folder(argv[1]);
-        }
-        
-        printf("Preparing the file. This might take a moment.\n");
-        
-        dat_update(dat, val_block_size);
-        
-        FU_FILE* fdat = dat_to_fu_file(dat, val_block_size, dat_tool_endian);
-        SU_STRING* output_str = su_create_string(argv[1], strlen(argv[1]));
-
-        /* converting the suffix in the folder name to the 3-letter extension */
-        if(flag_skip_ext_check)
-        {
-            su_insert_char(output_str, -1, ".dat", 4);
-        }
-        else
-        {
-            if(output_str->ptr[output_str->size-4] == '_')
+            if(pu_is_file(input))
             {
-                output_str->ptr[output_str->size-4] = '.';
+                dat_tool_extract_by_name(input, val_extract_name);
             }
         }
         
-        /* Saving to the file and overwriting */
-        fu_to_file(output_str->ptr, fdat, 1);
-        
-        /* Cleanup */
-        su_free(output_str);
-        fu_close(fdat);
-        free(fdat);
-        dat_destroy(dat);
-        
-        printf("\nPacking done without issues (I hope)\n");
+        free(val_extract_name);
+    }
+    else
+    {
+        dat_tool_run_batch(inputs);
     }
-    else /* Everything failed oops */
+    
+    for(uint32_t i = 0; i != cvec_size(inputs); ++i)
     {
-        printf("Couldn't do anything.\n");
+        free(*(char**)cvec_at(inputs, i));
     }
     
+    inputs = cvec_destroy(inputs);
+    
     return 0;
 }
 
@@ -150,16 +224,25 @@ int main(int argc, char** argv)
     Common
 */
 
-void dat_tool_parse_arguments(int argc, char** argv)
+int dat_tool_parse_arguments(int argc, char** argv)
 {
-    if(ap_parse(g_arg_node, argc-2, &argv[2]) != AP_STAT_SUCCESS)
+    int first_option = 1;
+    
+    while((first_option != argc) && (strncmp(argv[first_option], "--", 2) != 0))
     {
-        return;
+        first_option += 1;
+    }
+    
+    if(ap_parse(g_arg_node, argc-first_option, &argv[first_option]) != AP_STAT_SUCCESS)
+    {
+        return first_option;
     }
 
     AP_ARG_VEC arg_be  = ap_get_arg_vec_by_name(g_arg_node, "--be");
     AP_ARG_VEC arg_ext = ap_get_arg_vec_by_name(g_arg_node, "--skip_ext_check");
     AP_ARG_VEC arg_block_size = ap_get_arg_vec_by_name(g_arg_node, "--block_size");
+    AP_ARG_VEC arg_threads = ap_get_arg_vec_by_name(g_arg_node, "--threads");
+    AP_ARG_VEC arg_extract = ap_get_arg_vec_by_name(g_arg_node, "--extract");
     
     if(arg_be)
     {
@@ -178,16 +261,31 @@ void dat_tool_parse_arguments(int argc, char** argv)
         val_block_size = AP_GET_ARG_UINT(ap_get_arg_from_vec_by_id(arg_block_size, 0));
         arg_block_size = ap_free_arg_vec(arg_block_size);
     }
+    
+    if(arg_threads)
+    {
+        val_threads = AP_GET_ARG_UINT(ap_get_arg_from_vec_by_id(arg_threads, 0));
+        arg_threads = ap_free_arg_vec(arg_threads);
+    }
+    
+    if(arg_extract)
+    {
+        val_extract_name = strdup(AP_GET_ARG_STR(ap_get_arg_from_vec_by_id(arg_extract, 0)));
+        arg_extract = ap_free_arg_vec(arg_extract);
+    }
+    
+    return first_option;
 }
 
 void dat_tool_print_usage(char* program_name)
 {
     printf("Usage:\n");
-    printf("\tTo unpack:\t\t%s <dat file>\n", program_name);
-    printf("\tTo pack:\t\t%s <directory> <options>\n", program_name);
+    printf("\tTo unpack:\t\t%s <dat files>\n", program_name);
+    printf("\tTo pack:\t\t%s <directories> <options>\n", program_name);
+    printf("\tTo extract by name:\t%s <dat files> --extract <name/pattern>\n", program_name);
+    printf("\tInputs can be mixed and read from a list with @<file>, one path per line.\n");
     printf("\n");
     printf("Options:\n");
-    printf("\tPacking:\n");
     
     for(uint32_t i = 0; i != ap_get_desc_count(g_arg_node); ++i)
     {
@@ -196,16 +294,17 @@ void dat_tool_print_usage(char* program_name)
     }
 }
 
-void dat_tool_print_dat(DAT_FILE* dat)
+void dat_tool_print_dat(DAT_TOC* toc)
 {    
-    printf("File count: %u\n", dat->header.file_count);
-    printf("Positions offset: 0x%x\n", dat->header.positions_offset);
-    printf("Extensions offset: 0x%x\n", dat->header.extensions_offset);
-    printf("Names offset: 0x%x\n", dat->header.names_offset);
-    printf("Sizes offset: 0x%x\n", dat->header.sizes_offset);
-    printf("Hashtable offset: 0x%x\n", dat->header.hashtable_offset);
+    printf("DAT file is in %s Endian\n", toc->endian == FU_LITTLE_ENDIAN ? "Little" : "Big");
+    printf("File count: %u\n", toc->header.file_count);
+    printf("Positions offset: 0x%x\n", toc->header.positions_offset);
+    printf("Extensions offset: 0x%x\n", toc->header.extensions_offset);
+    printf("Names offset: 0x%x\n", toc->header.names_offset);
+    printf("Sizes offset: 0x%x\n", toc->header.sizes_offset);
+    printf("Hashtable offset: 0x%x\n", toc->header.hashtable_offset);
     printf("\n");
-    printf("Entry name size: %u\n", dat->entry_name_size);
+    printf("Entry name size: %u\n", toc->entry_name_size);
     printf("\n");
 
     /*
@@ -222,59 +321,205 @@ void dat_tool_print_dat(DAT_FILE* dat)
     */
 }
 
+uint8_t dat_tool_name_is_safe(const char* name, const uint32_t name_len)
+{
+    if((name_len == 0)
+       || ((name_len == 1) && (name[0] == '.'))
+       || ((name_len == 2) && (name[0] == '.') && (name[1] == '.')))
+    {
+        return 0;
+    }
+
+    /* Separators and drive letters */
+    for(uint32_t i = 0; i != name_len; ++i)
+    {
+        if((name[i] == '/') || (name[i] == '\\') || (name[i] == ':'))
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
 /*
     Unpacker
 */
-DAT_FILE* dat_tool_parse_file(const char* path)
+void dat_tool_write_info(DAT_TOC* toc, SU_STRING* out_path,
+                         const uint32_t* crcs, const uint32_t block_size)
 {
-    FU_FILE fdat = {0};
-    fu_open_file(path, 1, &fdat);
-    DAT_FILE* dat = dat_parse_file(&fdat);
-    fu_close(&fdat);
-    return dat;
+    SEXML_ELEMENT* root = sexml_create_root("PlatinumDAT");
+    SU_STRING* name = su_create_string("", 0);
+    char crc_str[9] = {0};
+    
+    if(block_size)
+    {
+        sexml_append_attribute_uint(root, "block_size", block_size);
+    }
+    
+    for(uint32_t i = 0; i != toc->header.file_count; ++i)
+    {
+        SEXML_ELEMENT* xml_entry = sexml_append_element(root, "file");
+        DAT_TOC_ENTRY* dat_entry = &toc->entries[i];
+        su_remove(name, 0, -1);
+        su_insert_char(name, 0, dat_entry->name, dat_toc_name_len(toc, dat_entry));
+        sprintf(crc_str, "%08x", crcs[i]);
+        
+        sexml_append_attribute(xml_entry, "path", name->ptr);
+        sexml_append_attribute_uint(xml_entry, "position", dat_entry->position);
+        sexml_append_attribute_uint(xml_entry, "size", dat_entry->size);
+        sexml_append_attribute(xml_entry, "crc32", crc_str);
+    }
+    
+    sexml_save_to_file_formatted(out_path->ptr, root, 4);
+    root = sexml_destroy(root);
+    name = su_free(name);
 }
 
-void dat_tool_extract(DAT_FILE* dat, SU_STRING* out_dir_path)
+uint8_t dat_tool_copy_range(RF_FILE* in, const uint64_t offset, const uint64_t size,
+                            RF_FILE* out, uint32_t* crc)
 {
-    pu_create_dir_char(out_dir_path->ptr);
+    const uint64_t chunk_size = (size < RF_CHUNK_SIZE) ? size : RF_CHUNK_SIZE;
+    uint8_t* chunk = (uint8_t*)malloc(chunk_size + 1);
+    uint8_t status = FU_SUCCESS;
+    *crc = MZ_CRC32_INIT;
     
-    for(uint32_t i = 0; i != cvec_size(dat->entries); ++i)
+    for(uint64_t done = 0; (done < size) && (status == FU_SUCCESS); done += chunk_size)
     {
-        DAT_FILE_ENTRY* entry = dat_get_entry_by_id(dat->entries, i);
+        const uint64_t left = size - done;
+        const uint64_t req = (left < chunk_size) ? left : chunk_size;
         
-        SU_STRING* str_temp = su_copy(out_dir_path);
-        su_insert_char(str_temp, -1, "/", 1);
-        su_insert_char(str_temp, -1, entry->name->ptr, entry->name->size);
+        status = rf_pread(in, chunk, req, offset + done);
         
-        FILE* cur_file = fopen(str_temp->ptr, "wb");
-        fwrite(entry->data, entry->size, 1, cur_file);
-        fclose(cur_file);
-        
-        str_temp = su_free(str_temp);
+        if(status == FU_SUCCESS)
+        {
+            *crc = mz_crc32(*crc, chunk, req);
+            
+            if(out)
+            {
+                status = rf_pwrite(out, chunk, req, done);
+            }
+        }
     }
     
-    SU_STRING* xml_path = su_copy(out_dir_path);
-    su_insert_char(xml_path, -1, "/", 1);
-    su_insert_char(xml_path, -1, "kwasinfo.xml", 12);
+    free(chunk);
     
-    dat_tool_write_info(dat, xml_path);
+    return status;
+}
 
-    xml_path = su_free(xml_path);
+/*
+    Single entries
+*/
+uint8_t dat_tool_match_pattern(const char* pattern, const char* name, const uint32_t name_len)
+{
+    /* Position after the last `*` to go back to on a mismatch */
+    const char* star = NULL;
+    uint32_t star_pos = 0;
+    uint32_t pos = 0;
+    
+    while(pos != name_len)
+    {
+        if(*pattern == '*')
+        {
+            star = ++pattern;
+            star_pos = pos;
+        }
+        else if((*pattern == '?') || ((*pattern != '\0') && (tolower((uint8_t)*pattern) == tolower((uint8_t)name[pos]))))
+        {
+            ++pattern;
+            ++pos;
+        }
+        else if(star)
+        {
+            pattern = star;
+            pos = ++star_pos;
+        }
+        else
+        {
+            return 0;
+        }
+    }
+    
+    while(*pattern == '*')
+    {
+        ++pattern;
+    }
+    
+    return *pattern == '\0';
 }
 
-void dat_tool_write_info(DAT_FILE* dat, SU_STRING* out_path)
+void dat_tool_extract_by_name(const char* path, const char* pattern)
 {
-    SEXML_ELEMENT* root = sexml_create_root("PlatinumDAT");
+    DAT_TOC* toc = dat_open_toc(path);
     
-    for(uint32_t i = 0; i != cvec_size(dat->entries); ++i)
+    if(toc == NULL)
     {
-        SEXML_ELEMENT* xml_entry = sexml_append_element(root, "file");
-        DAT_FILE_ENTRY* dat_entry = dat_get_entry_by_id(dat->entries, i);
-        sexml_append_attribute(xml_entry, "path", dat_entry->name->ptr);
+        printf("Couldn't process the DAT file.\n");
+        return;
     }
     
-    sexml_save_to_file_formatted(out_path->ptr, root, 4);
-    root = sexml_destroy(root);
+    uint32_t extracted = 0;
+    
+    if(strpbrk(pattern, "*?") == NULL)
+    {
+        /* Plain name goes through the hashtable */
+        DAT_TOC_ENTRY* entry = dat_find_entry(toc, pattern);
+        
+        if(entry)
+        {
+            extracted += dat_tool_extract_entry(toc, entry) == FU_SUCCESS;
+        }
+    }
+    else
+    {
+        for(uint32_t i = 0; i != toc->header.file_count; ++i)
+        {
+            DAT_TOC_ENTRY* entry = &toc->entries[i];
+            
+            if(dat_tool_match_pattern(pattern, entry->name, dat_toc_name_len(toc, entry)))
+            {
+                extracted += dat_tool_extract_entry(toc, entry) == FU_SUCCESS;
+            }
+        }
+    }
+    
+    if(extracted)
+    {
+        printf("Extracted %u file(s).\n", extracted);
+    }
+    else
+    {
+        printf("No entry \"%s\" in the archive.\n", pattern);
+    }
+    
+    toc = dat_close_toc(toc);
+}
+
+uint8_t dat_tool_extract_entry(DAT_TOC* toc, DAT_TOC_ENTRY* entry)
+{
+    /* Saved to the working directory */
+    const uint32_t name_len = dat_toc_name_len(toc, entry);
+    
+    if(dat_tool_name_is_safe(entry->name, name_len) == 0)
+    {
+        printf("Skipping \"%.*s\", it's not a plain file name.\n", name_len, entry->name);
+        return FU_ERROR;
+    }
+    
+    char* out_path = (char*)calloc(name_len+1, 1);
+    memcpy(out_path, entry->name, name_len);
+    printf("Save Path: %s\n", out_path);
+    
+    const uint8_t status = dat_extract_entry(toc, entry, out_path);
+    
+    if(status != FU_SUCCESS)
+    {
+        printf("Couldn't extract \"%s\".\n", out_path);
+    }
+    
+    free(out_path);
+    
+    return status;
 }
 
 /*
@@ -290,7 +535,22 @@ uint8_t dat_tool_check_kwasinfo(const char* dir_path)
     return is_xml;
 }
 
-DAT_FILE* dat_tool_from_kwasinfo(const char* input_dir)
+static SEXML_ATTRIBUTE* dat_tool_get_attribute(SEXML_ELEMENT* element, const char* name)
+{
+    for(uint32_t i = 0; i != cvec_size(element->attributes); ++i)
+    {
+        SEXML_ATTRIBUTE* attrib = sexml_get_attribute_by_id(element, i);
+        
+        if(su_cmp_string_char(attrib->name, name, strlen(name)) == SU_STRINGS_MATCH)
+        {
+            return attrib;
+        }
+    }
+    
+    return NULL;
+}
+
+DAT_FILE* dat_tool_from_kwasinfo(const char* input_dir, CVEC paths, CVEC records, uint32_t* block_size)
 {
     SU_STRING* dir = su_create_string(input_dir, strlen(input_dir));
     DAT_FILE* dat = dat_alloc_dat();
@@ -304,7 +564,9 @@ DAT_FILE* dat_tool_from_kwasinfo(const char* input_dir)
     if(su_cmp_string_char(root->name, "PlatinumDAT", 11) == 0)
     {
         const uint64_t file_count = sexml_get_child_count(root, "file");
-        printf("File count: %llu\n", file_count);
+        
+        SEXML_ATTRIBUTE* block_size_attr = dat_tool_get_attribute(root, "block_size");
+        *block_size = block_size_attr ? sexml_get_attribute_uint(block_size_attr) : 0;
         
         for(uint32_t i = 0; i != file_count; ++i)
         {
@@ -315,16 +577,30 @@ DAT_FILE* dat_tool_from_kwasinfo(const char* input_dir)
             su_insert_string(filestr, -1, path->value);
             PU_PATH* filepath = pu_split_path(filestr->ptr, filestr->size);
             
-            FU_FILE file_data = {0};
-            fu_open_file(filestr->ptr, 1, &file_data);
+            const uint64_t file_size = fu_get_file_size(filestr->ptr);
            
             dat_append_entry(dat->entries,
                              filepath->ext->ptr, path->value->ptr,
-                             file_data.size, (uint8_t*)file_data.buf);
+                             file_size, NULL);
             
+            cvec_push_back(paths, &filestr);
             pu_free_path(filepath);
-            fu_close(&file_data);
-            su_free(filestr);
+            
+            /* Missing from kwasinfo.xml written by older versions */
+            SEXML_ATTRIBUTE* position = dat_tool_get_attribute(file, "position");
+            SEXML_ATTRIBUTE* size = dat_tool_get_attribute(file, "size");
+            SEXML_ATTRIBUTE* crc32 = dat_tool_get_attribute(file, "crc32");
+            DAT_TOOL_RECORD record = {0};
+            
+            if(position && size && crc32)
+            {
+                record.position = sexml_get_attribute_uint(position);
+                record.size = sexml_get_attribute_uint(size);
+                record.crc32 = strtoul(crc32->value->ptr, NULL, 16);
+                record.known = 1;
+            }
+            
+            cvec_push_back(records, &record);
         }
     }
     
@@ -334,7 +610,7 @@ DAT_FILE* dat_tool_from_kwasinfo(const char* input_dir)
     return dat;
 }
 
-DAT_FILE* dat_tool_from_folder(const char* input_dir)
+DAT_FILE* dat_tool_from_folder(const char* input_dir, CVEC paths)
 {
     DAT_FILE* dat = dat_alloc_dat();
     
@@ -351,23 +627,557 @@ DAT_FILE* dat_tool_from_folder(const char* input_dir)
             su_insert_char(file_dir_path, -1, "/", 1);
             su_insert_char(file_dir_path, -1, file_name->ptr, file_name->size);
 
-            /* Loading the file */
-            FU_FILE file_data = {0};
-            fu_open_file(file_dir_path->ptr, 1, &file_data);
+            /* Append new entry, data is streamed when writing */
+            const uint64_t file_size = fu_get_file_size(file_dir_path->ptr);
             
-            /* Append new entry */
             dat_append_entry(dat->entries,
                              dirlist.entries[i].path->ext->ptr, file_name->ptr,
-                             file_data.size, (uint8_t*)file_data.buf);
+                             file_size, NULL);
+            
+            cvec_push_back(paths, &file_dir_path);
             
             /* Cleanup */
-            fu_close(&file_data);
             su_free(file_name);
-            su_free(file_dir_path);
         }
     }
     
     dl_free_list(&dirlist);
     
     return dat;
-}
\ No newline at end of file
+}
+
+uint8_t dat_tool_patch_dat(DAT_TOOL_JOB* job)
+{
+    DAT_FILE* dat = job->dat;
+    const uint32_t file_count = job->file_count;
+    
+    for(uint32_t i = 0; i != file_count; ++i)
+    {
+        if(((DAT_TOOL_RECORD*)cvec_at(job->records, i))->known == 0)
+        {
+            job->note = "rebuilt, kwasinfo.xml had no layout of the DAT";
+            return FU_ERROR;
+        }
+    }
+    
+    if(job->info_block_size && (job->info_block_size != val_block_size))
+    {
+        job->note = "rebuilt, block size changed";
+        return FU_ERROR;
+    }
+    
+    DAT_TOC* toc = dat_open_toc_rw(job->output->ptr);
+    
+    if(toc == NULL)
+    {
+        job->note = "rebuilt, there was no DAT to patch";
+        return FU_ERROR;
+    }
+    
+    uint8_t endian = dat_tool_endian;
+    
+    if(endian == FU_HOST_ENDIAN)
+    {
+        endian = ed_is_BE() ? FU_BIG_ENDIAN : FU_LITTLE_ENDIAN;
+    }
+    
+    if((toc->endian != endian) || (toc->header.file_count != file_count))
+    {
+        job->note = "rebuilt, endianness or the file list changed";
+        toc = dat_close_toc(toc);
+        return FU_ERROR;
+    }
+    
+    /* Unpacking doesn't record the block size, so the DAT itself has to be laid out with it */
+    uint8_t aligned = (bound_calc_leftover(val_block_size, toc->file->size) == 0);
+    
+    for(uint32_t i = 0; (i != file_count) && aligned; ++i)
+    {
+        aligned = (bound_calc_leftover(val_block_size, toc->entries[i].position) == 0);
+    }
+    
+    if(aligned == 0)
+    {
+        job->note = "rebuilt, block size changed";
+        toc = dat_close_toc(toc);
+        return FU_ERROR;
+    }
+    
+    /* Every change has to fit before anything is written */
+    for(uint32_t i = 0; i != file_count; ++i)
+    {
+        DAT_FILE_ENTRY* entry = dat_get_entry_by_id(dat->entries, i);
+        DAT_TOOL_RECORD* record = (DAT_TOOL_RECORD*)cvec_at(job->records, i);
+        DAT_TOC_ENTRY* toc_entry = &toc->entries[i];
+        
+        /* DAT has to be the one kwasinfo.xml describes */
+        if((su_cmp_char(entry->name->ptr, entry->name->size,
+                        toc_entry->name, dat_toc_name_len(toc, toc_entry)) != SU_STRINGS_MATCH)
+           || (memcmp(entry->extension, toc_entry->extension, 4) != 0)
+           || (toc_entry->position != record->position)
+           || (toc_entry->size != record->size))
+        {
+            job->note = "rebuilt, DAT didn't match kwasinfo.xml";
+            toc = dat_close_toc(toc);
+            return FU_ERROR;
+        }
+        
+        if((entry->size == record->size) && (job->crcs[i] == record->crc32))
+        {
+            continue;
+        }
+        
+        if(((uint64_t)toc_entry->position + entry->size) > dat_toc_slot_end(toc, toc_entry))
+        {
+            job->note = "rebuilt, a file outgrew its place";
+            toc = dat_close_toc(toc);
+            return FU_ERROR;
+        }
+    }
+    
+    uint8_t status = FU_SUCCESS;
+    
+    for(uint32_t i = 0; (i != file_count) && (status == FU_SUCCESS); ++i)
+    {
+        DAT_FILE_ENTRY* entry = dat_get_entry_by_id(dat->entries, i);
+        DAT_TOOL_RECORD* record = (DAT_TOOL_RECORD*)cvec_at(job->records, i);
+        
+        if((entry->size != record->size) || (job->crcs[i] != record->crc32))
+        {
+            SU_STRING* path = *(SU_STRING**)cvec_at(job->paths, i);
+            const RF_SOURCE src = rf_source_path(path->ptr, 0, entry->size);
+            status = dat_toc_replace_entry(toc, &toc->entries[i], &src);
+            
+            job->files_done += 1;
+            job->bytes_done += entry->size;
+        }
+    }
+    
+    toc = dat_close_toc(toc);
+    
+    if(status != FU_SUCCESS)
+    {
+        job->note = "rebuilt, patching failed";
+        job->files_done = 0;
+        job->bytes_done = 0;
+        return FU_ERROR;
+    }
+    
+    job->note = "patched in place";
+    
+    return FU_SUCCESS;
+}
+
+/*
+    Batch
+*/
+static double dat_tool_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+static void dat_tool_push_input(CVEC inputs, const char* path, uint64_t len)
+{
+    /* Trailing slashes would end up in the DAT name */
+    while((len > 1) && ((path[len-1] == '/') || (path[len-1] == '\\')))
+    {
+        len -= 1;
+    }
+    
+    if(len)
+    {
+        char* input = (char*)calloc(len + 1, 1);
+        memcpy(input, path, len);
+        cvec_push_back(inputs, &input);
+    }
+}
+
+void dat_tool_collect_inputs(int first_option, char** argv, CVEC inputs)
+{
+    for(int i = 1; i != first_option; ++i)
+    {
+        if(argv[i][0] != '@')
+        {
+            dat_tool_push_input(inputs, argv[i], strlen(argv[i]));
+            continue;
+        }
+        
+        FILE* list = fopen(&argv[i][1], "rb");
+        
+        if(list == NULL)
+        {
+            printf("Couldn't open the list %s\n", &argv[i][1]);
+            continue;
+        }
+        
+        char line[4096];
+        
+        while(fgets(line, sizeof(line), list))
+        {
+            dat_tool_push_input(inputs, line, strcspn(line, "\r\n"));
+        }
+        
+        fclose(list);
+    }
+}
+
+void dat_tool_run_batch(CVEC inputs)
+{
+    TP_POOL* pool = tp_create(val_threads);
+    
+    if(pool == NULL)
+    {
+        printf("Couldn't start the worker threads.\n");
+        return;
+    }
+    
+    const uint32_t job_count = cvec_size(inputs);
+    DAT_TOOL_JOB* jobs = (DAT_TOOL_JOB*)calloc(job_count + 1, sizeof(DAT_TOOL_JOB));
+    const double start = dat_tool_now();
+    
+    /* Tables, file lists and kwasinfo.xml */
+    for(uint32_t i = 0; i != job_count; ++i)
+    {
+        jobs[i].input = *(char**)cvec_at(inputs, i);
+        tp_push(pool, dat_tool_job_prepare, &jobs[i]);
+    }
+    
+    tp_wait(pool);
+    
+    /* Lone DAT gets its header printed like before */
+    if((job_count == 1) && jobs[0].toc)
+    {
+        dat_tool_print_dat(jobs[0].toc);
+    }
+    
+    /* Extracting entries, hashing files to pack */
+    for(uint32_t i = 0; i != job_count; ++i)
+    {
+        DAT_TOOL_JOB* job = &jobs[i];
+        
+        if((job->status == FU_SUCCESS) && ((job->is_pack == 0) || job->has_kwasinfo))
+        {
+            for(uint32_t j = 0; j != job->file_count; ++j)
+            {
+                tp_push(pool, dat_tool_job_entry, &job->tasks[j]);
+            }
+        }
+    }
+    
+    tp_wait(pool);
+    
+    /* Patching in place or laying out the new DAT */
+    for(uint32_t i = 0; i != job_count; ++i)
+    {
+        if(jobs[i].is_pack && (jobs[i].status == FU_SUCCESS))
+        {
+            tp_push(pool, dat_tool_job_layout, &jobs[i]);
+        }
+    }
+    
+    tp_wait(pool);
+    
+    /* Writing rebuilt DATs */
+    for(uint32_t i = 0; i != job_count; ++i)
+    {
+        DAT_TOOL_JOB* job = &jobs[i];
+        
+        if(job->rebuild && (job->status == FU_SUCCESS))
+        {
+            for(uint32_t j = 0; j != job->file_count; ++j)
+            {
+                tp_push(pool, dat_tool_job_write, &job->tasks[j]);
+            }
+        }
+    }
+    
+    tp_wait(pool);
+    pool = tp_destroy(pool);
+    
+    uint32_t files = 0;
+    uint32_t failed = 0;
+    uint64_t bytes = 0;
+    
+    for(uint32_t i = 0; i != job_count; ++i)
+    {
+        dat_tool_job_finish(&jobs[i]);
+        files += jobs[i].files_done;
+        bytes += jobs[i].bytes_done;
+        failed += (jobs[i].status != FU_SUCCESS);
+    }
+    
+    const double seconds = dat_tool_now() - start;
+    const double mb = bytes/(1024.0*1024.0);
+    
+    printf("\n%u archive(s), %u failed\n", job_count, failed);
+    printf("%u files, %.2f MB in %.3fs", files, mb, seconds);
+    
+    if(seconds > 0)
+    {
+        printf(" (%.0f files/s, %.2f MB/s)", files/seconds, mb/seconds);
+    }
+    
+    printf("\n");
+    
+    free(jobs);
+}
+
+void dat_tool_job_prepare(void* arg)
+{
+    DAT_TOOL_JOB* job = (DAT_TOOL_JOB*)arg;
+    job->status = FU_ERROR;
+    
+    if(pu_is_file(job->input))
+    {
+        job->toc = dat_open_toc(job->input);
+        
+        if(job->toc == NULL)
+        {
+            job->note = "not a DAT file";
+            return;
+        }
+        
+        job->file_count = job->toc->header.file_count;
+        
+        /* file.dat -> file_dat */
+        PU_PATH* dat_path = pu_split_path(job->input, strlen(job->input));
+        su_insert_char(dat_path->name, -1, "_", 1);
+        su_insert_char(dat_path->name, -1, dat_path->ext->ptr, 3);
+        su_remove(dat_path->ext, 0, -1);
+        dat_path->type = PU_PATH_TYPE_DIR;
+        job->output = pu_path_to_string(dat_path);
+        pu_free_path(dat_path);
+        
+        pu_create_dir_char(job->output->ptr);
+    }
+    else if(pu_is_dir(job->input))
+    {
+        job->is_pack = 1;
+        job->paths = cvec_create(sizeof(SU_STRING*));
+        job->records = cvec_create(sizeof(DAT_TOOL_RECORD));
+        job->has_kwasinfo = dat_tool_check_kwasinfo(job->input);
+        
+        if(job->has_kwasinfo)
+        {
+            job->dat = dat_tool_from_kwasinfo(job->input, job->paths, job->records, &job->info_block_size);
+        }
+        else
+        {
+            job->dat = dat_tool_from_folder(job->input, job->paths);
+        }
+        
+        job->file_count = cvec_size(job->dat->entries);
+        job->output = su_create_string(job->input, strlen(job->input));
+        
+        /* converting the suffix in the folder name to the 3-letter extension */
+        if(flag_skip_ext_check)
+        {
+            su_insert_char(job->output, -1, ".dat", 4);
+        }
+        else if((job->output->size >= 4) && (job->output->ptr[job->output->size-4] == '_'))
+        {
+            job->output->ptr[job->output->size-4] = '.';
+        }
+    }
+    else
+    {
+        job->note = "not a file or a directory";
+        return;
+    }
+    
+    job->crcs = (uint32_t*)calloc(job->file_count + 1, sizeof(uint32_t));
+    job->entry_status = (uint8_t*)calloc(job->file_count + 1, 1);
+    job->tasks = (DAT_TOOL_TASK*)calloc(job->file_count + 1, sizeof(DAT_TOOL_TASK));
+    
+    for(uint32_t i = 0; i != job->file_count; ++i)
+    {
+        job->tasks[i].job = job;
+        job->tasks[i].index = i;
+    }
+    
+    job->status = FU_SUCCESS;
+}
+
+void dat_tool_job_entry(void* arg)
+{
+    DAT_TOOL_TASK* task = (DAT_TOOL_TASK*)arg;
+    DAT_TOOL_JOB* job = task->job;
+    uint8_t status = FU_ERROR;
+    
+    if(job->is_pack)
+    {
+        SU_STRING* path = *(SU_STRING**)cvec_at(job->paths, task->index);
+        RF_FILE* in = rf_open(path->ptr, RF_READ);
+        
+        if(in)
+        {
+            status = dat_tool_copy_range(in, 0, in->size, NULL, &job->crcs[task->index]);
+            in = rf_close(in);
+        }
+    }
+    else
+    {
+        DAT_TOC_ENTRY* entry = &job->toc->entries[task->index];
+        const uint32_t name_len = dat_toc_name_len(job->toc, entry);
+
+        if(dat_tool_name_is_safe(entry->name, name_len) == 0)
+        {
+            job->entry_status[task->index] = FU_ERROR;
+            return;
+        }
+
+        SU_STRING* out_path = su_copy(job->output);
+        su_insert_char(out_path, -1, "/", 1);
+        su_insert_char(out_path, -1, entry->name, name_len);
+        
+        RF_FILE* out = rf_open(out_path->ptr, RF_WRITE);
+        
+        if(out)
+        {
+            status = dat_tool_copy_range(job->toc->file, entry->position, entry->size,
+                                         out, &job->crcs[task->index]);
+            out = rf_close(out);
+        }
+        
+        out_path = su_free(out_path);
+    }
+    
+    job->entry_status[task->index] = status;
+}
+
+void dat_tool_job_layout(void* arg)
+{
+    DAT_TOOL_JOB* job = (DAT_TOOL_JOB*)arg;
+    
+    for(uint32_t i = 0; i != job->file_count; ++i)
+    {
+        if(job->has_kwasinfo && (job->entry_status[i] != FU_SUCCESS))
+        {
+            job->note = "couldn't read the files";
+            job->status = FU_ERROR;
+            return;
+        }
+    }
+    
+    /* Files unchanged since kwasinfo.xml don't have to be written again */
+    if(job->has_kwasinfo && (dat_tool_patch_dat(job) == FU_SUCCESS))
+    {
+        return;
+    }
+    
+    if(job->has_kwasinfo == 0)
+    {
+        job->note = "built without kwasinfo.xml, DAT file might not work properly";
+    }
+    
+    job->rebuild = 1;
+    dat_update(job->dat, val_block_size);
+    job->out = rf_open(job->output->ptr, RF_WRITE);
+    
+    if(job->out == NULL)
+    {
+        job->status = FU_ERROR;
+        return;
+    }
+    
+    FU_FILE* header = dat_header_to_fu_file(job->dat, dat_tool_endian);
+    job->status = rf_pwrite(job->out, (const uint8_t*)header->buf, header->size, 0);
+    fu_close(header);
+    free(header);
+    
+    if(job->status == FU_SUCCESS)
+    {
+        /* Padding at the end is a hole */
+        job->status = rf_set_size(job->out, dat_get_file_size(job->dat, val_block_size));
+    }
+}
+
+void dat_tool_job_write(void* arg)
+{
+    DAT_TOOL_TASK* task = (DAT_TOOL_TASK*)arg;
+    DAT_TOOL_JOB* job = task->job;
+    DAT_FILE_ENTRY* entry = dat_get_entry_by_id(job->dat->entries, task->index);
+    SU_STRING* path = *(SU_STRING**)cvec_at(job->paths, task->index);
+    
+    const RF_SOURCE src = rf_source_path(path->ptr, 0, entry->size);
+    job->entry_status[task->index] = rf_write_source(job->out, entry->position, &src);
+}
+
+void dat_tool_job_finish(DAT_TOOL_JOB* job)
+{
+    if(job->status == FU_SUCCESS)
+    {
+        /* Entries only report back through their status */
+        const uint8_t wrote_entries = (job->is_pack == 0) || job->rebuild;
+        
+        for(uint32_t i = 0; (i != job->file_count) && wrote_entries; ++i)
+        {
+            if(job->entry_status[i] != FU_SUCCESS)
+            {
+                job->status = FU_ERROR;
+                job->note = "couldn't write some of the files";
+                break;
+            }
+            
+            const uint32_t size = job->is_pack ? dat_get_entry_by_id(job->dat->entries, i)->size
+                                               : job->toc->entries[i].size;
+            job->files_done += 1;
+            job->bytes_done += size;
+        }
+    }
+    
+    job->out = rf_close(job->out);
+    
+    /* kwasinfo.xml follows whatever ended up in the DAT */
+    if((job->status == FU_SUCCESS) && ((job->is_pack == 0) || job->has_kwasinfo))
+    {
+        DAT_TOC* toc = job->is_pack ? dat_open_toc(job->output->ptr) : job->toc;
+        SU_STRING* xml_path = job->is_pack ? su_create_string(job->input, strlen(job->input))
+                                           : su_copy(job->output);
+        su_insert_char(xml_path, -1, "/", 1);
+        su_insert_char(xml_path, -1, "kwasinfo.xml", 12);
+        
+        if(toc)
+        {
+            dat_tool_write_info(toc, xml_path, job->crcs, job->is_pack ? val_block_size : 0);
+        }
+        
+        if(job->is_pack)
+        {
+            toc = dat_close_toc(toc);
+        }
+        
+        xml_path = su_free(xml_path);
+    }
+    
+    printf("%s -> %s: %s%s%s\n", job->input,
+                                 job->output ? job->output->ptr : "-",
+                                 job->status == FU_SUCCESS ? (job->is_pack ? "packed" : "unpacked") : "failed",
+                                 job->note ? ", " : "",
+                                 job->note ? job->note : "");
+    
+    /* Cleanup */
+    if(job->is_pack && job->dat)
+    {
+        for(uint32_t i = 0; i != cvec_size(job->paths); ++i)
+        {
+            su_free(*(SU_STRING**)cvec_at(job->paths, i));
+        }
+        
+        job->paths = cvec_destroy(job->paths);
+        job->records = cvec_destroy(job->records);
+        job->dat = dat_destroy(job->dat);
+    }
+    
+    if(job->output)
+    {
+        job->output = su_free(job->output);
+    }
+    
+    job->toc = dat_close_toc(job->toc);
+    free(job->crcs);
+    free(job->entry_status);
+    free(job->tasks);
+}
@@ -1,16 +1,27 @@
 #include <stdio.h>
 #include <stdint.h>
+#include <time.h>
 
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include <kwaslib/ext/stb_image_write.h>
 
+#define STB_IMAGE_IMPLEMENTATION
+#define STBI_ONLY_PNG
+#define STBI_ONLY_TGA
+#define STBI_ONLY_JPEG
+#define STBI_ONLY_BMP
+#include <kwaslib/ext/stb_image.h>
+
 #include <kwaslib/core/io/file_utils.h>
+#include <kwaslib/core/io/raw_file.h>
 #include <kwaslib/core/io/arg_parser.h>
 #include <kwaslib/core/io/path_utils.h>
 #include <kwaslib/core/io/dir_list.h>
 #include <kwaslib/core/data/text/sexml.h>
 #include <kwaslib/core/data/image/image.h>
 #include <kwaslib/core/data/image/gtf.h>
+#include <kwaslib/core/data/image/s3tc.h>
+#include <kwaslib/core/thread/thread_pool.h>
 #include <kwaslib/platinum/wtb.h>
 
 /*
@@ -23,14 +34,37 @@ void wtb_tool_parse_arguments(int argc, char** argv);
 
 /* Unpacking */
 void wtb_tool_to_dir(const char* dir_path, WTB_FILE* wtb);
+uint8_t* wtb_tool_console_to_dds(WTB_FILE* wtb, WTB_ENTRY* entry, uint64_t* dds_size);
+IMAGE* wtb_tool_console_to_image(WTB_FILE* wtb, WTB_ENTRY* entry);
 SU_STRING* wtb_tool_ext_by_data(const uint8_t* data);
 
 /* Packing */
 SEXML_ELEMENT* wtb_tool_check_kwasinfo(const char* dir_path);
-WTB_FILE* wtb_tool_kwasinfo_to_wtb(const char* dir_path, SEXML_ELEMENT* xml);
-WTB_FILE* wtb_tool_dir_to_wtb(const char* dir_path);
-void wtb_tool_to_wtb(SU_STRING* wtb_path_str, WTB_FILE* wtb);
-void wtb_tool_to_wta_wtp(SU_STRING* wta_path_str, WTB_FILE* wtb);
+SEXML_ATTRIBUTE* wtb_tool_get_attribute(SEXML_ELEMENT* element, const char* name);
+uint8_t wtb_tool_kwasinfo_target(SEXML_ELEMENT* xml);
+void wtb_tool_to_console(WTB_FILE* wtb, const uint8_t target);
+uint8_t wtb_tool_encode_format(const char* name);
+void wtb_tool_encode_images(WTB_FILE* wtb);
+/*
+    With `paths` set, entries keep only their sizes and flags,
+    full paths to their files are appended to it (SU_STRING*).
+*/
+WTB_FILE* wtb_tool_kwasinfo_to_wtb(const char* dir_path, SEXML_ELEMENT* xml, CVEC paths);
+WTB_FILE* wtb_tool_dir_to_wtb(const char* dir_path, CVEC paths);
+void wtb_tool_append_file(WTB_FILE* wtb, SU_STRING* path, const uint32_t id, const uint8_t atlas, CVEC paths);
+RF_SOURCE* wtb_tool_paths_to_sources(WTB_FILE* wtb, CVEC paths);
+void wtb_tool_to_wtb(SU_STRING* wtb_path_str, WTB_FILE* wtb, const RF_SOURCE* sources);
+void wtb_tool_to_wta_wtp(SU_STRING* wta_path_str, WTB_FILE* wtb, const RF_SOURCE* sources);
+
+/*
+    Defines
+*/
+#define WTB_TOOL_TARGET_PC      (uint8_t)(0)
+#define WTB_TOOL_TARGET_X360    (uint8_t)(1)
+#define WTB_TOOL_TARGET_PS3     (uint8_t)(2)
+
+#define WTB_TOOL_ENCODE_NONE    (uint8_t)(0)
+#define WTB_TOOL_ENCODE_AUTO    (uint8_t)(0xFF)    /* DXT1 for opaque images, DXT5 otherwise */
 
 /*
     Globals
@@ -43,6 +77,16 @@ AP_DESC* g_arg_node = NULL;
 uint8_t flag_skip_ext_check = 0;
 uint8_t flag_wtb = 0;
 uint8_t flag_wta = 0;
+uint8_t flag_png = 0;
+uint8_t flag_x360 = 0;
+uint8_t flag_ps3 = 0;
+uint8_t flag_hq = 0;
+
+/*
+    Values
+*/
+uint8_t val_encode = WTB_TOOL_ENCODE_NONE;
+uint32_t val_threads = TP_THREADS_AUTO;
 
 /*
     Entry point
@@ -55,6 +99,12 @@ int main(int argc, char** argv)
     ap_append_desc_noval(g_arg_node, 0, "--skip_ext_check", "Don't get a file type from directory suffix");
     ap_append_desc_noval(g_arg_node, 1, "--wtb", "Force the creation of standalone WTB file (default)");
     ap_append_desc_noval(g_arg_node, 0, "--wta", "Force the creation of WTA and WTP files");
+    ap_append_desc_noval(g_arg_node, 0, "--x360", "Convert DDS files to tiled X360 textures");
+    ap_append_desc_noval(g_arg_node, 0, "--ps3", "Convert DDS files to PS3 GTF textures");
+    ap_append_desc_noval(g_arg_node, 0, "--png", "Convert X360/PS3 DXT textures to PNG instead of DDS");
+    ap_append_desc_str(g_arg_node, "", "--encode", "Encode PNG/TGA/JPG/BMP files to DDS with mipmaps: auto, bc1, bc2, bc3, bc4, bc5");
+    ap_append_desc_noval(g_arg_node, 0, "--hq", "Slower, higher quality --encode (cluster fit)");
+    ap_append_desc_uint(g_arg_node, TP_THREADS_AUTO, "--threads", "Amount of threads for --encode, 0 for all cores");
     
     /* No arguments, print usage */
     if(argc == 1)
@@ -73,18 +123,42 @@ int main(int argc, char** argv)
         /* Looking for kwasinfo.xml */
         SEXML_ELEMENT* wtb_xml = wtb_tool_check_kwasinfo(argv[1]);
         WTB_FILE* wtb_file = NULL; 
+        uint8_t target = WTB_TOOL_TARGET_PC;
         
         if(wtb_xml) /* XML exists and is valid */
         {
             printf("kwasinfo.xml found\n");
-            wtb_file = wtb_tool_kwasinfo_to_wtb(argv[1], wtb_xml);
+            target = wtb_tool_kwasinfo_target(wtb_xml);
         }
         else
         {
             printf("Could not find valid kwasinfo.xml\n"
                    "Repacked file might not work properly.\n");
-                   
-            wtb_file = wtb_tool_dir_to_wtb(argv[1]);
+        }
+        
+        /* Console textures, from flags or the platform the WTB was unpacked from */
+        if(flag_x360) target = WTB_TOOL_TARGET_X360;
+        if(flag_ps3) target = WTB_TOOL_TARGET_PS3;
+        
+        /* Textures stay in memory only when they get converted, the rest is streamed */
+        CVEC paths = NULL;
+        
+        if((val_encode == WTB_TOOL_ENCODE_NONE) && (target == WTB_TOOL_TARGET_PC))
+        {
+            paths = cvec_create(sizeof(SU_STRING*));
+        }
+        
+        wtb_file = wtb_xml ? wtb_tool_kwasinfo_to_wtb(argv[1], wtb_xml, paths)
+                           : wtb_tool_dir_to_wtb(argv[1], paths);
+        
+        if(val_encode != WTB_TOOL_ENCODE_NONE)
+        {
+            wtb_tool_encode_images(wtb_file);
+        }
+        
+        if(target != WTB_TOOL_TARGET_PC)
+        {
+            wtb_tool_to_console(wtb_file, target);
         }
         
         /*
@@ -98,7 +172,7 @@ int main(int argc, char** argv)
         /* Checking flags */
         if(flag_skip_ext_check == 0) /* Get the extension */
         {
-            if(argv[1][arg1_len-4] == '_')
+            if((arg1_len >= 4) && (argv[1][arg1_len-4] == '_'))
             {
                 argv[1][arg1_len-4] = '.';
             }
@@ -151,13 +225,26 @@ int main(int argc, char** argv)
         SU_STRING* dir_path_str = pu_path_to_string(dir_path);
         printf("Output file: %*s\n", dir_path_str->size, dir_path_str->ptr);
         
+        RF_SOURCE* sources = paths ? wtb_tool_paths_to_sources(wtb_file, paths) : NULL;
+        
         if(is_wta) /* Export the WTA+WTP */
         {
-            wtb_tool_to_wta_wtp(dir_path_str, wtb_file);
+            wtb_tool_to_wta_wtp(dir_path_str, wtb_file, sources);
         }
         else /* Export the WTB */
         {
-            wtb_tool_to_wtb(dir_path_str, wtb_file);
+            wtb_tool_to_wtb(dir_path_str, wtb_file, sources);
+        }
+        
+        if(paths)
+        {
+            for(uint32_t i = 0; i != cvec_size(paths); ++i)
+            {
+                su_free(*(SU_STRING**)cvec_at(paths, i));
+            }
+            
+            paths = cvec_destroy(paths);
+            free(sources);
         }
         
         dir_path = pu_free_path(dir_path);
@@ -255,7 +342,6 @@ void wtb_tool_print_usage(const char* exe_name)
 	printf("\tTo pack:\t%s <directory with DDS files/kwasinfo.xml> <options>\n", exe_name);
 	printf("\n");
 	printf("Options:\n");
-	printf("\tPacking:\n");
     
     for(uint32_t i = 0; i != ap_get_desc_count(g_arg_node); ++i)
     {
@@ -266,6 +352,10 @@ void wtb_tool_print_usage(const char* exe_name)
 	printf("\n");
 	printf("DDS filenames in the unpacked directory are the texture IDs in decimal.\n");
 	printf("Only change them if you know what you are doing.\n");
+	printf("X360/PS3 DXT textures are unpacked to DDS with their mipmaps,\n");
+	printf("other formats are converted to PNG.\n");
+	printf("With --encode, images are compressed to DDS before packing,\n");
+	printf("so they can also go through --x360/--ps3.\n");
 }
 
 void wtb_tool_parse_arguments(int argc, char** argv)
@@ -278,6 +368,12 @@ void wtb_tool_parse_arguments(int argc, char** argv)
     AP_ARG_VEC arg_ext = ap_get_arg_vec_by_name(g_arg_node, "--skip_ext_check");
     AP_ARG_VEC arg_wtb = ap_get_arg_vec_by_name(g_arg_node, "--wtb");
     AP_ARG_VEC arg_wta = ap_get_arg_vec_by_name(g_arg_node, "--wta");
+    AP_ARG_VEC arg_png = ap_get_arg_vec_by_name(g_arg_node, "--png");
+    AP_ARG_VEC arg_x360 = ap_get_arg_vec_by_name(g_arg_node, "--x360");
+    AP_ARG_VEC arg_ps3 = ap_get_arg_vec_by_name(g_arg_node, "--ps3");
+    AP_ARG_VEC arg_encode = ap_get_arg_vec_by_name(g_arg_node, "--encode");
+    AP_ARG_VEC arg_hq = ap_get_arg_vec_by_name(g_arg_node, "--hq");
+    AP_ARG_VEC arg_threads = ap_get_arg_vec_by_name(g_arg_node, "--threads");
 
 	if(arg_ext)
 	{
@@ -298,6 +394,51 @@ void wtb_tool_parse_arguments(int argc, char** argv)
         flag_wta = 1;
         arg_wta = ap_free_arg_vec(arg_wta);
     }
+    
+    if(arg_png)
+    {
+        flag_png = 1;
+        arg_png = ap_free_arg_vec(arg_png);
+    }
+    
+    if(arg_x360)
+    {
+        flag_x360 = 1;
+        flag_ps3 = 0;
+        arg_x360 = ap_free_arg_vec(arg_x360);
+    }
+    
+    if(arg_ps3)
+    {
+        flag_x360 = 0;
+        flag_ps3 = 1;
+        arg_ps3 = ap_free_arg_vec(arg_ps3);
+    }
+    
+    if(arg_encode)
+    {
+        const char* name = AP_GET_ARG_STR(ap_get_arg_from_vec_by_id(arg_encode, 0));
+        val_encode = wtb_tool_encode_format(name);
+        
+        if(val_encode == WTB_TOOL_ENCODE_NONE)
+        {
+            printf("Unknown --encode format `%s`, images are packed as they are\n", name);
+        }
+        
+        arg_encode = ap_free_arg_vec(arg_encode);
+    }
+    
+    if(arg_hq)
+    {
+        flag_hq = 1;
+        arg_hq = ap_free_arg_vec(arg_hq);
+    }
+    
+    if(arg_threads)
+    {
+        val_threads = AP_GET_ARG_UINT(ap_get_arg_from_vec_by_id(arg_threads, 0));
+        arg_threads = ap_free_arg_vec(arg_threads);
+    }
 }
 
 
@@ -315,6 +456,11 @@ void wtb_tool_to_dir(const char* dir_path, WTB_FILE* wtb)
     su_insert_char(kwasinfo_xml, -1, "/kwasinfo.xml", 13);
     SEXML_ELEMENT* xml = sexml_create_root("PlatinumWTB");
     
+    if(wtb->platform == WTB_PLATFORM_BE)
+    {
+        sexml_append_attribute(xml, "platform", wtb->x360 ? "x360" : "ps3");
+    }
+    
     for(uint32_t i = 0; i != wtb->header.tex_count; ++i)
     {
         WTB_ENTRY* entry = wtb_get_entry_by_id(wtb->entries, i);
@@ -327,41 +473,44 @@ void wtb_tool_to_dir(const char* dir_path, WTB_FILE* wtb)
         SU_STRING* full_file_name = su_copy(out_str);
         su_insert_char(full_file_name, -1, "/", 1);
         
-        /* Convert any X360/PS3 texture to PNG */
+        /*
+            X360/PS3 DXT textures are rewritten as DDS,
+            anything else gets decoded to PNG.
+        */
         if(wtb->platform == WTB_PLATFORM_BE)
         {
-			IMAGE* img = NULL;
-
-			if(wtb->header.xpr_info_offset) /* X360 */
-			{
-				img = x360_texture_to_image(entry->x360, &entry->data[0], entry->size);
-			}
-			else /* PS3 */
-			{
-                FU_FILE temp_file = {0};
-                fu_create_mem_file(&temp_file);
-                fu_write_data(&temp_file, entry->data, entry->size);
-                fu_seek(&temp_file, 0, FU_SEEK_SET);
+            uint64_t dds_size = 0;
+            uint8_t* dds_data = flag_png ? NULL : wtb_tool_console_to_dds(wtb, entry, &dds_size);
+            
+            if(dds_data)
+            {
+                su_insert_char(file_name, -1, ".dds", 4);
+                su_insert_string(full_file_name, -1, file_name);
                 
-				GTF_FILE gtf = gtf_read_file(&temp_file);
-				img = gtf_to_image(&gtf);
+                FILE* fout = fopen(full_file_name->ptr, "wb");
+                fwrite(dds_data, dds_size, 1, fout);
+                fclose(fout);
                 
-                fu_close(&temp_file);
-			}
-            
-            uint64_t img_size = 0;
-            uint8_t* img_data = img_to_raw_data(img, &img_size);
-            
-            su_insert_char(file_name, -1, ".png", 4);
-            su_insert_string(full_file_name, -1, file_name);
-            
-			stbi_write_png(full_file_name->ptr,
-                           img->width, img->height,
-                           img->bpp, img_data,
-                           img->width*img->bpp);
-            
-            free(img_data);
-			img_free_image(img);
+                free(dds_data);
+            }
+            else
+            {
+                IMAGE* img = wtb_tool_console_to_image(wtb, entry);
+                
+                uint64_t img_size = 0;
+                uint8_t* img_data = img_to_raw_data(img, &img_size);
+                
+                su_insert_char(file_name, -1, ".png", 4);
+                su_insert_string(full_file_name, -1, file_name);
+                
+                stbi_write_png(full_file_name->ptr,
+                               img->width, img->height,
+                               img->bpp, img_data,
+                               img->width*img->bpp);
+                
+                free(img_data);
+                img_free_image(img);
+            }
         }
         else
         {
@@ -400,6 +549,56 @@ void wtb_tool_to_dir(const char* dir_path, WTB_FILE* wtb)
     xml = sexml_destroy(xml);
 }
 
+uint8_t* wtb_tool_console_to_dds(WTB_FILE* wtb, WTB_ENTRY* entry, uint64_t* dds_size)
+{
+    uint8_t* dds_data = NULL;
+    
+    if(wtb->header.xpr_info_offset) /* X360 */
+    {
+        dds_data = x360_texture_to_dds(entry->x360, &entry->data[0], entry->size, dds_size);
+    }
+    else /* PS3 */
+    {
+        FU_FILE temp_file = {0};
+        fu_create_mem_file(&temp_file);
+        fu_write_data(&temp_file, entry->data, entry->size);
+        fu_seek(&temp_file, 0, FU_SEEK_SET);
+        
+        GTF_FILE gtf = gtf_read_file(&temp_file);
+        dds_data = gtf_to_dds(&gtf, dds_size);
+        
+        gtf_free(&gtf);
+        fu_close(&temp_file);
+    }
+    
+    return dds_data;
+}
+
+IMAGE* wtb_tool_console_to_image(WTB_FILE* wtb, WTB_ENTRY* entry)
+{
+    IMAGE* img = NULL;
+    
+    if(wtb->header.xpr_info_offset) /* X360 */
+    {
+        img = x360_texture_to_image(entry->x360, &entry->data[0], entry->size);
+    }
+    else /* PS3 */
+    {
+        FU_FILE temp_file = {0};
+        fu_create_mem_file(&temp_file);
+        fu_write_data(&temp_file, entry->data, entry->size);
+        fu_seek(&temp_file, 0, FU_SEEK_SET);
+        
+        GTF_FILE gtf = gtf_read_file(&temp_file);
+        img = gtf_to_image(&gtf);
+        
+        gtf_free(&gtf);
+        fu_close(&temp_file);
+    }
+    
+    return img;
+}
+
 SU_STRING* wtb_tool_ext_by_data(const uint8_t* data)
 {
     SU_STRING* ext = NULL;
@@ -454,7 +653,155 @@ SEXML_ELEMENT* wtb_tool_check_kwasinfo(const char* dir_path)
     return root;
 }
 
-WTB_FILE* wtb_tool_kwasinfo_to_wtb(const char* dir_path, SEXML_ELEMENT* xml)
+SEXML_ATTRIBUTE* wtb_tool_get_attribute(SEXML_ELEMENT* element, const char* name)
+{
+    for(uint32_t i = 0; i != cvec_size(element->attributes); ++i)
+    {
+        SEXML_ATTRIBUTE* attrib = sexml_get_attribute_by_id(element, i);
+        
+        if(su_cmp_string_char(attrib->name, name, strlen(name)) == SU_STRINGS_MATCH)
+        {
+            return attrib;
+        }
+    }
+    
+    return NULL;
+}
+
+uint8_t wtb_tool_kwasinfo_target(SEXML_ELEMENT* xml)
+{
+    SEXML_ATTRIBUTE* platform = wtb_tool_get_attribute(xml, "platform");
+    
+    if(platform)
+    {
+        if(su_cmp_string_char(platform->value, "x360", 4) == SU_STRINGS_MATCH)
+        {
+            return WTB_TOOL_TARGET_X360;
+        }
+        
+        if(su_cmp_string_char(platform->value, "ps3", 3) == SU_STRINGS_MATCH)
+        {
+            return WTB_TOOL_TARGET_PS3;
+        }
+    }
+    
+    return WTB_TOOL_TARGET_PC;
+}
+
+void wtb_tool_to_console(WTB_FILE* wtb, const uint8_t target)
+{
+    wtb->platform = WTB_PLATFORM_BE;
+    wtb->x360 = (target == WTB_TOOL_TARGET_X360);
+    
+    printf("Converting textures for %s\n", wtb->x360 ? "X360" : "PS3");
+    
+    for(uint32_t i = 0; i != cvec_size(wtb->entries); ++i)
+    {
+        WTB_ENTRY* entry = wtb_get_entry_by_id(wtb->entries, i);
+        const uint8_t status = wtb->x360 ? wtb_entry_dds_to_x360(entry)
+                                         : wtb_entry_dds_to_gtf(entry);
+        
+        if(status != FU_SUCCESS)
+        {
+            printf("Texture %u is not a supported DDS, left as it is\n", entry->id);
+        }
+    }
+}
+
+uint8_t wtb_tool_encode_format(const char* name)
+{
+    if(strcmp(name, "auto") == 0) return WTB_TOOL_ENCODE_AUTO;
+    if((strcmp(name, "bc1") == 0) || (strcmp(name, "dxt1") == 0)) return S3TC_FORMAT_DXT1;
+    if((strcmp(name, "bc2") == 0) || (strcmp(name, "dxt3") == 0)) return S3TC_FORMAT_DXT3;
+    if((strcmp(name, "bc3") == 0) || (strcmp(name, "dxt5") == 0)) return S3TC_FORMAT_DXT5;
+    if(strcmp(name, "bc4") == 0) return S3TC_FORMAT_BC4;
+    if(strcmp(name, "bc5") == 0) return S3TC_FORMAT_BC5;
+    return WTB_TOOL_ENCODE_NONE;
+}
+
+static double wtb_tool_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+void wtb_tool_encode_images(WTB_FILE* wtb)
+{
+    const uint8_t quality = flag_hq ? S3TC_QUALITY_HIGH : S3TC_QUALITY_FAST;
+    uint32_t encoded = 0;
+    double mpix = 0.0;
+    const double start = wtb_tool_now();
+    
+    for(uint32_t i = 0; i != cvec_size(wtb->entries); ++i)
+    {
+        WTB_ENTRY* entry = wtb_get_entry_by_id(wtb->entries, i);
+        
+        if((entry->size >= 4) && (strncmp((const char*)&entry->data[0], "DDS ", 4) == 0))
+        {
+            continue;
+        }
+        
+        int width = 0;
+        int height = 0;
+        int channels = 0;
+        uint8_t* rgba = stbi_load_from_memory(entry->data, entry->size, &width, &height, &channels, 4);
+        
+        if(rgba == NULL)
+        {
+            printf("Texture %u is not a supported image, left as it is\n", entry->id);
+            continue;
+        }
+        
+        uint8_t format = val_encode;
+        
+        if(format == WTB_TOOL_ENCODE_AUTO)
+        {
+            format = S3TC_FORMAT_DXT1;
+            
+            for(uint64_t p = 0; p != (uint64_t)width*height; ++p)
+            {
+                if(rgba[p*4 + 3] != 0xFF)
+                {
+                    format = S3TC_FORMAT_DXT5;
+                    break;
+                }
+            }
+        }
+        
+        if(wtb_entry_rgba_to_dds(entry, rgba, width, height, format, quality, val_threads) == FU_SUCCESS)
+        {
+            /* Every level of the chain counts */
+            for(uint32_t w = width, h = height; ; w = w > 1 ? w/2 : 1, h = h > 1 ? h/2 : 1)
+            {
+                mpix += (double)w*h/1e6;
+                if((w == 1) && (h == 1)) break;
+            }
+            
+            encoded += 1;
+        }
+        else
+        {
+            printf("Couldn't encode texture %u\n", entry->id);
+        }
+        
+        stbi_image_free(rgba);
+    }
+    
+    const double seconds = wtb_tool_now() - start;
+    printf("Encoded %u texture(s), %.2f MPix in %.3fs", encoded, mpix, seconds);
+    
+    if(seconds > 0.0)
+    {
+        printf(" (%.2f MPix/s)", mpix/seconds);
+    }
+    
+    printf("\n");
+    
+    wtb_update(wtb, 0);
+}
+
+WTB_FILE* wtb_tool_kwasinfo_to_wtb(const char* dir_path, SEXML_ELEMENT* xml, CVEC paths)
 {
     SU_STRING* dir_str = su_create_string(dir_path, strlen(dir_path));
     WTB_FILE* wtb = wtb_alloc_wtb();
@@ -465,8 +812,8 @@ WTB_FILE* wtb_tool_kwasinfo_to_wtb(const char* dir_path, SEXML_ELEMENT* xml)
     for(uint32_t i = 0; i != file_count; ++i)
     {
         SEXML_ELEMENT* file = sexml_get_element_by_id(xml, i);
-        SEXML_ATTRIBUTE* path = sexml_get_attribute_by_name(file, "path");
-        SEXML_ATTRIBUTE* atlas_attr = sexml_get_attribute_by_name(file, "atlas");
+        SEXML_ATTRIBUTE* path = wtb_tool_get_attribute(file, "path");
+        SEXML_ATTRIBUTE* atlas_attr = wtb_tool_get_attribute(file, "atlas");
         const uint8_t atlas_value = atlas_attr ? sexml_get_attribute_bool(atlas_attr) : 0;
         
         if(path == NULL)
@@ -481,21 +828,14 @@ WTB_FILE* wtb_tool_kwasinfo_to_wtb(const char* dir_path, SEXML_ELEMENT* xml)
         sscanf(file_path->name->ptr, "%u", &entry_id);
         file_path = pu_free_path(file_path);
         
-        /* Reading the file contents */
+        /* Appending new entry to WTB file */
         SU_STRING* file_path_str = su_copy(dir_str);
         su_insert_char(file_path_str, -1, "/", 1);
         su_insert_string(file_path_str, -1, path->value);
         
-        FU_FILE file_data = {0};
-        fu_open_file(file_path_str->ptr, 1, &file_data);
-        
-        /* Appending new entry to WTB file */
-        wtb_append_entry(wtb->entries, file_data.size, entry_id, (uint8_t*)file_data.buf);
-        WTB_ENTRY* new_entry = wtb_get_entry_by_id(wtb->entries, i);
-        wtb_set_entry_flags(new_entry, atlas_value);
+        wtb_tool_append_file(wtb, file_path_str, entry_id, atlas_value, paths);
         
         /* Cleanup */
-        fu_close(&file_data);
         file_path_str = su_free(file_path_str);
     }
     
@@ -505,7 +845,7 @@ WTB_FILE* wtb_tool_kwasinfo_to_wtb(const char* dir_path, SEXML_ELEMENT* xml)
     return wtb;
 }
 
-WTB_FILE* wtb_tool_dir_to_wtb(const char* dir_path)
+WTB_FILE* wtb_tool_dir_to_wtb(const char* dir_path, CVEC paths)
 {
     SU_STRING* dir_str = su_create_string(dir_path, strlen(dir_path));
     WTB_FILE* wtb = wtb_alloc_wtb();
@@ -513,7 +853,6 @@ WTB_FILE* wtb_tool_dir_to_wtb(const char* dir_path)
     DL_DIR_LIST dirlist = {0};
     dl_parse_directory(dir_path, &dirlist);
     
-    uint32_t dds_it = 0;
     for(uint32_t i = 0; i != dirlist.size; ++i)
     {
         if(dirlist.entries[i].type == DL_TYPE_FILE)
@@ -524,20 +863,11 @@ WTB_FILE* wtb_tool_dir_to_wtb(const char* dir_path)
             uint32_t entry_id = 0;
             sscanf(dirlist.entries[i].path->name->ptr, "%u", &entry_id);
             
-            /* Reading the file contents */
-            FU_FILE file_data = {0};
-            fu_open_file(file_path_str->ptr, 1, &file_data);
-            
             /* Appending new entry to WTB file */
-            wtb_append_entry(wtb->entries, file_data.size, entry_id, (uint8_t*)file_data.buf);
-            WTB_ENTRY* new_entry = wtb_get_entry_by_id(wtb->entries, dds_it);
-            wtb_set_entry_flags(new_entry, 0);
+            wtb_tool_append_file(wtb, file_path_str, entry_id, 0, paths);
             
             /* Cleanup */
-            fu_close(&file_data);
             file_path_str = su_free(file_path_str);
-            
-            dds_it += 1;
         }
     }
     
@@ -547,34 +877,90 @@ WTB_FILE* wtb_tool_dir_to_wtb(const char* dir_path)
     return wtb;
 }
 
-void wtb_tool_to_wtb(SU_STRING* wtb_path_str, WTB_FILE* wtb)
+/*
+    Without `paths` the file is loaded into the entry.
+    With it only the size and flags are read, the path is kept for streaming.
+*/
+void wtb_tool_append_file(WTB_FILE* wtb, SU_STRING* path, const uint32_t id, const uint8_t atlas, CVEC paths)
 {
-    wtb_update(wtb, 0);
+    if(paths == NULL)
+    {
+        FU_FILE file_data = {0};
+        fu_open_file(path->ptr, 1, &file_data);
+        
+        wtb_append_entry(wtb->entries, file_data.size, id, (uint8_t*)file_data.buf);
+        wtb_set_entry_flags(wtb_get_entry_by_id(wtb->entries, cvec_size(wtb->entries) - 1), atlas);
+        
+        fu_close(&file_data);
+        return;
+    }
+    
+    RF_FILE* rf = rf_open(path->ptr, RF_READ);
+    
+    wtb_append_entry(wtb->entries, rf ? rf->size : 0, id, NULL);
+    WTB_ENTRY* new_entry = wtb_get_entry_by_id(wtb->entries, cvec_size(wtb->entries) - 1);
+    
+    if((rf == NULL) || (wtb_set_entry_flags_from_rf(new_entry, rf, atlas) != FU_SUCCESS))
+    {
+        printf("Couldn't read %s\n", path->ptr);
+    }
+    
+    SU_STRING* path_copy = su_copy(path);
+    cvec_push_back(paths, &path_copy);
+    
+    rf = rf_close(rf);
+}
+
+RF_SOURCE* wtb_tool_paths_to_sources(WTB_FILE* wtb, CVEC paths)
+{
+    const uint32_t count = cvec_size(wtb->entries);
+    RF_SOURCE* sources = (RF_SOURCE*)calloc(count + 1, sizeof(RF_SOURCE));
+    
+    for(uint32_t i = 0; i != count; ++i)
+    {
+        SU_STRING* path = *(SU_STRING**)cvec_at(paths, i);
+        sources[i] = rf_source_path(path->ptr, 0, wtb_get_entry_by_id(wtb->entries, i)->size);
+    }
     
-    FU_FILE* fuwta = wtb_header_to_fu_file(wtb);
-    FU_FILE* fuwtp = wtb_data_to_fu_file(wtb);
+    return sources;
+}
+
+void wtb_tool_to_wtb(SU_STRING* wtb_path_str, WTB_FILE* wtb, const RF_SOURCE* sources)
+{
+    wtb_update(wtb, 0);
     
-    fu_seek(fuwtp, 0, FU_SEEK_SET);
-    fu_write_data(fuwtp, (const uint8_t*)&fuwta->buf[0], fuwta->size);
+    RF_FILE* fwtb = rf_open(wtb_path_str->ptr, RF_WRITE);
     
-    fu_to_file(wtb_path_str->ptr, fuwtp, 1);
+    if((fwtb == NULL)
+       || (wtb_header_to_rf(wtb, fwtb) != FU_SUCCESS)
+       || (wtb_data_to_rf(wtb, fwtb, sources) != FU_SUCCESS))
+    {
+        printf("Couldn't write %s\n", wtb_path_str->ptr);
+    }
     
-    fu_close(fuwta);
-    fu_close(fuwtp);
+    fwtb = rf_close(fwtb);
 }
 
-void wtb_tool_to_wta_wtp(SU_STRING* wta_path_str, WTB_FILE* wtb)
+void wtb_tool_to_wta_wtp(SU_STRING* wta_path_str, WTB_FILE* wtb, const RF_SOURCE* sources)
 {
     wtb_update(wtb, 1);
     
-    FU_FILE* fuwta = wtb_header_to_fu_file(wtb);
-    FU_FILE* fuwtp = wtb_data_to_fu_file(wtb);
+    RF_FILE* fwta = rf_open(wta_path_str->ptr, RF_WRITE);
     
-    fu_to_file(wta_path_str->ptr, fuwta, 1);
+    if((fwta == NULL) || (wtb_header_to_rf(wtb, fwta) != FU_SUCCESS))
+    {
+        printf("Couldn't write %s\n", wta_path_str->ptr);
+    }
+    
+    fwta = rf_close(fwta);
     
     wta_path_str->ptr[wta_path_str->size-1] = 'p';
-    fu_to_file(wta_path_str->ptr, fuwtp, 1);
+    RF_FILE* fwtp = rf_open(wta_path_str->ptr, RF_WRITE);
+    
+    if((fwtp == NULL) || (wtb_data_to_rf(wtb, fwtp, sources) != FU_SUCCESS))
+    {
+        printf("Couldn't write %s\n", wta_path_str->ptr);
+    }
     
-    fu_close(fuwta);
-    fu_close(fuwtp);
+    fwtp = rf_close(fwtp);
 }
\ No newline at end of file
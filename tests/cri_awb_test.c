@@ -0,0 +1,57 @@
+/*
+    Checks the u16 -> u32 offset switch of awb_update().
+    Data ending at 65530 is padded to 65536 by alignment 32,
+    so the file size field doesn't fit in u16 anymore.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <kwaslib/core/io/type_readers.h>
+#include <kwaslib/core/io/string_utils.h>
+#include <kwaslib/cri/audio/awb.h>
+
+int main()
+{
+    AWB_FILE* awb = awb_alloc();
+    AWB_HEADER* h = &awb->header;
+    h->version = 2;
+    h->offset_size = 2;
+    h->id_size = 2;
+    h->alignment = 32;
+    
+    /* Header takes 22 bytes, data starts at 32 */
+    uint8_t* data = (uint8_t*)calloc(1, 65530 - 32);
+    awb_append_entry(awb, 0, data, 65530 - 32);
+    free(data);
+    
+    SU_STRING* awb_data = awb_to_data(awb);
+    
+    int failed = 0;
+    
+    if(h->offset_size != 4)
+    {
+        printf("Offset size is %u, expected 4\n", h->offset_size);
+        failed = 1;
+    }
+    
+    if(awb_data->size != 65536)
+    {
+        printf("AWB size is %u, expected 65536\n", (uint32_t)awb_data->size);
+        failed = 1;
+    }
+    
+    const uint8_t* ptr = (const uint8_t*)&awb_data->ptr[0];
+    const uint32_t file_size = tr_read_u32le(&ptr[16 + 2 + 4]);
+    
+    if((ptr[5] != 4) || (file_size != 65536))
+    {
+        printf("Written offset size %u and file size %u, expected 4 and 65536\n", ptr[5], file_size);
+        failed = 1;
+    }
+    
+    su_free(awb_data);
+    awb_free(awb);
+    
+    return failed;
+}